@@ -0,0 +1,120 @@
+/*!
+ * \file bench.h
+ * \brief timing harness for the benchmark programs
+ *
+ * \date 19 Oct 26
+ *
+ * BENCH(name, ops, code) runs code in batches for at least
+ * bench_time seconds.  The batch size is doubled until a batch takes
+ * at least 20 microseconds, so that reading the clock doesn't affect
+ * the result, and the time per operation is recorded for each batch.
+ * One line is printed per test with tab separated fields: the name,
+ * the mean time per operation and the 50th, 90th and 99th percentile
+ * of the batch times per operation (all in ns), and the number of
+ * times the code was run.  Lines starting with '#' are comments, so
+ * the output of two runs can be compared with standard tools.
+ *
+ * Code inside BENCH should not use break or continue.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#ifndef __BENCH_INCLUDED__
+#define __BENCH_INCLUDED__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MAXSAMP 4096		/* batch times kept per test */
+
+static double bench_time = 0.2;		/* seconds per test */
+static double bench_samp[BENCH_MAXSAMP];
+
+/* Current time in nanoseconds */
+static double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Print the header line */
+static void bench_header(char *prog)
+{
+  printf("# %s\n# %-22s\t%10s\t%10s\t%10s\t%10s\t%s\n", prog,
+	 "test", "ns/op", "p50", "p90", "p99", "runs");
+}
+
+/* Print the results for one test */
+static void bench_report(char *name, double ops, long iter, double total,
+			 int nsamp)
+{
+  int n = nsamp < BENCH_MAXSAMP ? nsamp : BENCH_MAXSAMP;
+
+  qsort(bench_samp, n, sizeof(double), bench_cmp);
+  printf("%-24s\t%10.1f\t%10.1f\t%10.1f\t%10.1f\t%ld\n", name,
+	 total / (iter * ops), bench_samp[(n - 1) * 50 / 100],
+	 bench_samp[(n - 1) * 90 / 100], bench_samp[(n - 1) * 99 / 100],
+	 iter);
+  fflush(stdout);
+}
+
+#define BENCH(name, ops, ...) {					\
+  long iter_ = 0, batch_ = 1, i_;					\
+  int nsamp_ = 0;							\
+  double start_ = bench_now(), t0_, t1_, total_ = 0;			\
+  do {									\
+    t0_ = bench_now();							\
+    for (i_ = 0; i_ < batch_; ++i_) { __VA_ARGS__; }			\
+    t1_ = bench_now();							\
+    if (t1_ - t0_ < 20000) batch_ *= 2;					\
+    else {								\
+      bench_samp[nsamp_++ % BENCH_MAXSAMP] =				\
+	(t1_ - t0_) / (batch_ * (double) (ops));			\
+      total_ += t1_ - t0_;						\
+      iter_ += batch_;							\
+    }									\
+  } while (t1_ - start_ < bench_time * 1e9 || nsamp_ == 0);		\
+  bench_report(name, ops, iter_, total_, nsamp_);			\
+}
+
+#endif /* __BENCH_INCLUDED__ */
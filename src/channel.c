@@ -43,13 +43,19 @@
 #include <string.h>
 #include "channel.h"
 #include "hook.h"
+#include "profile.h"
+#include "lut.h"
 
 /* Local function declarations */
 int chn_filter(CHANNEL *cp);
 
-/* Allocate space for write hooks */
+/* Allocate space for read and write hooks */
+DECL_HOOKLIST(chn_read_hooks, 4);
 DECL_HOOKLIST(chn_write_hooks, 4);
 
+static int chn_nlut = 0;		/* channels mapped through tables */
+static int chn_nstage = 0;		/* channels with processing stages */
+
 /*
  * Main channel I/O routines
  *
@@ -71,6 +77,8 @@ int chn_init()
     int i, j, k;
     FILTER *filtp;
 
+    char name[PROF_NAMELEN];
+
     /* Go through and initialize each driver */
     for (offset = dev = 0; dev < chn_ndev; ++dev) {
 	(dp->driver) (Init, dp, chn_chantbl + offset);
@@ -78,6 +86,21 @@ int chn_init()
 	++dp;
     }
 
+    /* Name the profiler stages for each device (see profile.c) */
+    for (dev = 0; dev < PROF_MAXDEV; ++dev) {
+	name[0] = '\0';
+	if (dev < chn_ndev)
+	    snprintf(name, sizeof(name), " read %d %s", dev,
+		     chn_devtbl[dev].name);
+	prof_setname(PROF_DEVREAD(dev), name);
+	if (dev < chn_ndev)
+	    snprintf(name, sizeof(name), " write %d %s", dev,
+		     chn_devtbl[dev].name);
+	prof_setname(PROF_DEVWRITE(dev), name);
+    }
+    chn_read_hooks->prof = PROF_RHOOKS;
+    chn_write_hooks->prof = PROF_HOOKS;
+
     /*
      * Initialize channel filters; make the chn_filters list of channels that
      * get filtered and set initial values for the filters
@@ -99,6 +122,12 @@ int chn_init()
     }
     chn_filters[j] = -1;	/* mark end of list */
 
+    /* Group the channels that have lookup tables (see lut.c) */
+    chn_nlut = lut_chn_init();
+
+    /* Compile the processing stages (see chnstage.c) */
+    chn_nstage = chn_stage_init();
+
     /* Return the number of devices installed */
     return chn_ndev;
 }
@@ -109,24 +138,53 @@ int chn_read()
     DEVICE *dp = chn_devtbl;
     int chni, offset = 0;
     int *filtchns;
+    PROF_BEGIN(t_read);
 
     /* Read data from hardware */
     for (chni = 0; chni < chn_ndev; ++chni) {
+	PROF_BEGIN(t_dev);
+
 	/* Call device driver to perform read/conversion */
 	(*dp->driver) (Read, dp, chn_chantbl + offset);
+	PROF_END(PROF_DEVREAD(chni), t_dev);
 
 	/* Update the offset into the channel table */
 	offset += dp->size;
 	++dp;
     }
 
+    /* Pick up values written by other processes (see chnshm.c) */
+    if (chn_shm_enable) chn_shm_import();
+
     /* Do any desired channel filtering */
-    filtchns = chn_filters;
-    while (*filtchns != -1) {	/* end of filter list indicated by -1 */
-	chn_filter((chn_chantbl + *filtchns));
-	filtchns++;
+    if (chn_filters[0] != -1) {
+	PROF_BEGIN(t_filt);
+	filtchns = chn_filters;
+	while (*filtchns != -1) {	/* end of filter list indicated by -1 */
+	    chn_filter((chn_chantbl + *filtchns));
+	    filtchns++;
+	}
+	PROF_END(PROF_FILTER, t_filt);
     }
 
+    /* Map channels through their lookup tables */
+    if (chn_nlut > 0) {
+	PROF_BEGIN(t_lut);
+	lut_chn_apply();
+	PROF_END(PROF_LUT, t_lut);
+    }
+
+    /* Clamps, deadbands, rate limits and derivatives */
+    if (chn_nstage > 0) {
+	PROF_BEGIN(t_stage);
+	chn_stage_run(0);
+	PROF_END(PROF_STAGES, t_stage);
+    }
+
+    /* Call hooks (used by state-space blocks; see ssblock.c) */
+    hook_execute(chn_read_hooks);
+
+    PROF_END(PROF_READ, t_read);
     return 0;
 }
 
@@ -183,10 +241,17 @@ int chn_write()
 {
     DEVICE *dp = chn_devtbl;
     int chni, status, offset = 0;
+    PROF_BEGIN(t_write);
+
+    /* Stages on outputs (-onwrite), before the data is written */
+    if (chn_nstage > 0) chn_stage_run(1);
 
     for (chni = 0; chni < chn_ndev; ++chni) {
+	PROF_BEGIN(t_dev);
+
 	/* Write raw data to hardware */
 	status = (*dp->driver) (Write, dp, chn_chantbl + offset);
+	PROF_END(PROF_DEVWRITE(chni), t_dev);
 
 	offset += dp->size;
 	++dp;
@@ -195,6 +260,10 @@ int chn_write()
     /* Call hooks (used to capture data; see capture.c and adcap.c) */
     hook_execute(chn_write_hooks);
 
+    /* Publish a frame to other processes (see chnshm.c) */
+    if (chn_shm_enable) chn_shm_publish();
+
+    PROF_END(PROF_WRITE, t_write);
     return status;
 }
 
@@ -49,6 +49,7 @@
 #include <stdio.h>			/* for FILE declaration */
 
 #define CHN_MAXDEV 64			/* max number of channels allowed */
+#define CHN_MAXCHN 256			/* size of the channel table */
  
 /*!
  * \enum chn_driver_action 
@@ -122,6 +123,38 @@ struct chn_filter_entry {
 };
 typedef struct chn_filter_entry FILTER;
 
+/*!
+ * \struct chn_lut_entry
+ * \brief channel lookup table
+ *
+ * The data on a channel can be mapped through a lookup table (see
+ * lut.h) and sent to the same or another channel.
+ */
+struct chn_lut_entry {
+  struct lut *lut;		/* table */
+  int in_chn;			/* second input of a 2-D table (or -1) */
+  int out_chn;			/* output channel number */
+};
+typedef struct chn_lut_entry CHN_LUT;
+
+/*!
+ * \struct chn_stage_entry
+ * \brief channel processing stages
+ *
+ * A channel can be passed through a list of simple stages (clamp,
+ * deadband, rate limit, derivative), in chn_read() or, for outputs,
+ * in chn_write() before the data is written.  See chnstage.c.
+ */
+#define CHN_MAXSTAGE 8			/* stages per channel */
+enum chn_stage_op { ChnClamp, ChnDeadband, ChnRateLimit, ChnDeriv };
+struct chn_stage_entry {
+  int nstage;
+  struct { enum chn_stage_op op; double a, b; } stage[CHN_MAXSTAGE];
+  int out_chn;			/* output channel number */
+  int onwrite;			/* run in chn_write instead of chn_read */
+};
+typedef struct chn_stage_entry CHN_STAGE;
+
 /* Channel types */
 enum channel_type {
     Double, 	         		/* double precision float */
@@ -148,6 +181,9 @@ struct chn_channel_entry {
   unsigned dumpf;			/* dump data to disk? */
   FILTER *filter;	 /* data needed for possible filtering of the channel */
   void *dev_sp;
+  int stale;				/* data is old (device not responding) */
+  CHN_LUT *lut;				/* lookup table for the channel */
+  CHN_STAGE *stages;			/* processing stages */
 };
 typedef struct chn_channel_entry CHANNEL;
 
@@ -198,9 +234,48 @@ int chn_capture_dump(char *filename), chn_capture_dump_cb(long);
 int chn_capture(void);
 unsigned chn_capture_size(unsigned size);
 
+/* Device driver plugins (chnplugin.c) */
+#define CHN_PLUGIN_PREFIX "plugin:"	/* driver name prefix for plugins */
+#define CHN_PLUGIN_REGISTER "chn_plugin_register"
+int chn_plugin_register(DEV_LOOKUP *);	/* defined by the plugin */
+int chn_load_plugin(char *name);
+
+/* Configuration cache (chncache.c) */
+#include <stdint.h>
+#include <stddef.h>
+extern int chn_cache_enable;		/* use cache files (-1: environment) */
+uint64_t chn_cache_hash(char *buf, size_t len);
+void chn_cache_reset(int record);
+int chn_cache_record(DEVICE *dp, CHANNEL *cp);
+int chn_cache_depend(char *file);
+int chn_cache_save(char *file, uint64_t hash);
+int chn_cache_load(char *file, uint64_t hash);
+
+/* Shared memory export of the channel table (chnshm.c) */
+typedef struct chn_shm CHN_SHM;
+#define CHN_SHM_BUSY ((uint64_t) -1)	/* chn_shm_read got no frame */
+extern int chn_shm_enable;		/* channel table is exported */
+int chn_shm_export(char *name);
+void chn_shm_unexport(void);
+void chn_shm_publish(void);
+void chn_shm_import(void);
+CHN_SHM *chn_shm_attach(char *name, int writer);
+void chn_shm_detach(CHN_SHM *sp);
+int chn_shm_nchan(CHN_SHM *sp);
+int chn_shm_device(CHN_SHM *sp, char *name, int *size);
+uint64_t chn_shm_read(CHN_SHM *sp, double *data, int *stale, int n);
+int chn_shm_write(CHN_SHM *sp, int chan, double value);
+
+/* Channel processing stages (chnstage.c) */
+int chn_stage_add(CHANNEL *cp, char *flag, char *value);
+void chn_stage_clear(int chan);
+int chn_stage_init(void);
+void chn_stage_run(int onwrite);
+
 #define chn_data(i)     chn_chantbl[i].data.d
 #define chn_bits(i)     chn_chantbl[i].data.s
 #define chn_raw(i)	chn_chantbl[i].raw
+#define chn_stale(i)	chn_chantbl[i].stale
 
 /* Define the default drivers in the library */
 int virtual_driver(DEV_ACTION, ...);
@@ -0,0 +1,161 @@
+/*!
+ * \file chnbench.c
+ * \brief timing tests for the channel configuration parser
+ *
+ * \date 19 Oct 26
+ *
+ * This program generates large configuration files and times the
+ * pieces of chn_config(): getting tokens from the file (using both
+ * the stdio and the memory based lexer), parsing the standard flags
+ * and reading a complete configuration.  The channel tables hold at
+ * most CHN_MAXDEV devices, so the full chn_config() test uses a file
+ * that fills the tables; the tokenizer tests use ndev devices (1000
+ * by default).  The full configuration is timed with and without the
+ * configuration cache.
+ *
+ * Usage: chnbench [ndev]
+ *
+ * Results are printed in the format described in bench.h: one line
+ * per test with the mean ns/op, the 50th, 90th and 99th percentile of
+ * the times for each run and the number of runs, separated by tabs.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "channel.h"
+#include "display.h"
+#include "bench.h"
+
+int chn_parse_option(DEVICE *, CHANNEL *, char *, int *,
+  double *, unsigned *, FILTER **, int);
+
+/* Write a configuration file with ndev virtual devices */
+static int write_config(char *file, int ndev, int nchan)
+{
+  FILE *fp;
+  int i, j;
+
+  if ((fp = fopen(file, "w")) == NULL) { perror(file); return -1; }
+  fprintf(fp, "# chnbench - generated configuration file\n");
+  for (i = 0; i < ndev; ++i) {
+    fprintf(fp, "device: virtual %d 0x%x -offset=%d -scale = 2.5;"
+	    "\t# device %d\n", nchan, i, i % 7, i);
+    for (j = 0; j < nchan; ++j)
+      fprintf(fp, "\tchannel: %d -scale=%d.5 -offset = -1 %s;\n", j, j,
+	      j % 2 ? "-nodump" : "");
+  }
+  fclose(fp);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char file[32] = "/tmp/chnbenchXXXXXX", buf[41];
+  int ndev = argc > 1 ? atoi(argv[1]) : 1000;
+  int fd, line, ntok = 0, ch, i, offset;
+  unsigned dumpf;
+  double scale;
+  FILTER *filtp;
+  DEVICE dev;
+  CHN_LEX *lp;
+  FILE *fp;
+  static char *flags[] = {
+    "-offset=3", "-scale=2.5", "-nodump", "-debug=0", "-index=0x10"
+  };
+
+  if ((fd = mkstemp(file)) < 0) { perror("chnbench"); exit(1); }
+  close(fd);
+  if (write_config(file, ndev, 4) < 0) exit(1);
+
+  /* Count the tokens in the file so we can report time per token */
+  lp = chn_lex_open(file);
+  do {
+    ch = chn_lex_gettok(lp, buf, 40, " \t\n;", &line);
+    if (*buf != '\0') ++ntok;
+  } while (ch != EOF);
+  chn_lex_close(lp);
+  bench_header("chnbench");
+  printf("# %d devices, %d tokens\n", ndev, ntok);
+
+  /* Tokenize the file using stdio */
+  BENCH("chn_gettok", ntok, {
+    fp = fopen(file, "r");
+    while (chn_gettok(fp, buf, 40, " \t\n;", &line) != EOF);
+    fclose(fp);
+  });
+
+  /* Tokenize the file using the memory based lexer */
+  BENCH("chn_lex_gettok", ntok, {
+    lp = chn_lex_open(file);
+    while (chn_lex_gettok(lp, buf, 40, " \t\n;", &line) != EOF);
+    chn_lex_close(lp);
+  });
+
+  /* Look up the standard flags */
+  chn_flag_type = Device;
+  BENCH("chn_parse_option", 5, {
+    for (i = 0; i < 5; ++i)
+      chn_parse_option(&dev, chn_chantbl, flags[i], &offset, &scale, &dumpf,
+		       &filtp, 0);
+  });
+
+  /* Read a complete configuration that fills the device table */
+  if (write_config(file, CHN_MAXDEV, CHN_MAXCHN / CHN_MAXDEV) < 0) exit(1);
+  chn_cache_enable = 0;
+  BENCH("chn_config", 1, {
+    if (chn_config(file) < 0) exit(1);
+    chn_close();
+  });
+  printf("# %d devices, %d channels configured\n", chn_ndev, chn_nchan);
+
+  /* Same thing, but restoring the tables from the cache */
+  chn_cache_enable = 1;
+  BENCH("chn_config-cached", 1, {
+    if (chn_config(file) < 0) exit(1);
+    chn_close();
+  });
+
+  unlink(file);
+  strcat(file, ".cache");
+  unlink(file);
+  return 0;
+}
@@ -0,0 +1,440 @@
+/*!
+ * \file chncache.c
+ * \brief compiled cache of the channel configuration
+ *
+ * \date 19 Oct 26
+ *
+ * Reading a configuration file with chn_config() requires parsing
+ * the file and setting up each device.  To speed up restarts,
+ * chn_config() saves the resolved device and channel tables in a binary
+ * cache file (the name of the configuration file with ".cache"
+ * appended).  The cache is keyed on a hash of the configuration file,
+ * so if the file has not changed the tables are restored by mapping
+ * the cache into memory.  The cache is only used if chn_cache_enable
+ * is set, or (if it is left at -1) SPARROW_CHN_CACHE is in the
+ * environment, since it writes a file next to the configuration.
+ *
+ * The driver specific part of a channel (dev_sp) is private to the
+ * driver, so it cannot be saved.  Instead, the cache records the
+ * driver specific flags and replays them (after NewChannels) when the
+ * cache is loaded.  Files that the configuration depends on (such as
+ * lookup table files) are recorded with their size and
+ * modification time and checked when the cache is loaded.
+ *
+ * Channel filters are not cached: a configuration that uses them (only
+ * possible when built with OLD_MATLABV4) is always read from the file.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "channel.h"
+#include "display.h"
+#include "lut.h"
+
+int chn_parse_option(DEVICE *, CHANNEL *, char *, int *,
+  double *, unsigned *, FILTER **, int);
+extern DEV_LOOKUP chn_devlut[];
+extern int chn_dev_debug, chn_chn_debug;
+
+int chn_cache_enable = -1;		/* -1: set from SPARROW_CHN_CACHE */
+
+#define CHN_CACHE_MAGIC 0x4e484353	/* "SCHN" */
+#define CHN_CACHE_VERSION 2
+#define CHN_CACHE_FLAGLEN 48		/* room for "-" flag "=" value */
+#define CHN_CACHE_PATHLEN 256
+
+/*
+ * Cache file layout.  All records have fixed size and are multiples
+ * of 8 bytes, so that everything in the mapped file is aligned.
+ */
+struct chn_cache_header {
+  int32_t magic, version;
+  uint64_t hash;			/* hash of configuration file */
+  int32_t ndev, nchan;			/* number of devices, channels */
+  int32_t nflag, ndep;			/* driver flags, dependencies */
+  uint64_t size;			/* total size of the file */
+};
+
+struct chn_cache_device {
+  char name[CHNDEVLEN+1];		/* driver name */
+  char devname[CHNDEVLEN+1];		/* device path */
+  char pad[2];
+  int32_t size, address, index;
+};
+
+struct chn_cache_channel {
+  int32_t devid, chnid, offset, type;
+  double scale;
+  uint32_t dumpf, pad;
+};
+
+struct chn_cache_flag {
+  int32_t devid, chan;			/* channel is -1 for device flags */
+  char text[CHN_CACHE_FLAGLEN];		/* flag as given to parse_option */
+};
+
+struct chn_cache_dep {
+  char path[CHN_CACHE_PATHLEN];
+  int64_t size, mtime;
+};
+
+/* Driver flags and dependencies recorded while parsing */
+static struct chn_cache_flag *chn_cache_flags = NULL;
+static struct chn_cache_dep *chn_cache_deps = NULL;
+static int chn_cache_nflag = 0, chn_cache_ndep = 0;
+static int chn_cache_recording = 0;
+
+/*!
+ * \fn uint64_t chn_cache_hash(char *buf, size_t len)
+ * \brief compute the hash of a configuration file (64 bit FNV-1a)
+ * \ingroup channel
+ */
+uint64_t chn_cache_hash(char *buf, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  while (len-- > 0) { h ^= (unsigned char) *buf++; h *= 1099511628211ULL; }
+  return h;
+}
+
+/*!
+ * \fn void chn_cache_reset(int record)
+ * \brief clear the list of recorded flags and dependencies
+ * \ingroup channel
+ *
+ * Called by chn_config() before parsing a file.  If record is
+ * nonzero, calls to chn_cache_record() and chn_cache_depend() are
+ * saved until the next call to chn_cache_reset().
+ */
+void chn_cache_reset(int record)
+{
+  free(chn_cache_flags); chn_cache_flags = NULL; chn_cache_nflag = 0;
+  free(chn_cache_deps); chn_cache_deps = NULL; chn_cache_ndep = 0;
+  chn_cache_recording = record;
+}
+
+/*!
+ * \fn int chn_cache_record(DEVICE *dp, CHANNEL *cp)
+ * \brief record a driver specific flag for replay from the cache
+ * \ingroup channel
+ *
+ * Called by chn_parse_option() after a driver specific flag (or the
+ * debug flag) has been handled, using
+ * the flag stored in chn_flag_name and chn_flag_value.  Device flags
+ * (chn_flag_type == Device) are replayed before NewChannels, channel
+ * flags after it.
+ */
+int chn_cache_record(DEVICE *dp, CHANNEL *cp)
+{
+  struct chn_cache_flag *fp;
+
+  if (!chn_cache_recording) return 0;
+  if ((fp = (struct chn_cache_flag *) realloc(chn_cache_flags,
+	 (chn_cache_nflag + 1) * sizeof(struct chn_cache_flag))) == NULL) {
+    chn_cache_recording = 0;		/* can't cache this configuration */
+    return -1;
+  }
+  chn_cache_flags = fp;
+  fp += chn_cache_nflag++;
+
+  memset(fp, 0, sizeof(struct chn_cache_flag));
+  fp->devid = dp - chn_devtbl;
+  fp->chan = chn_flag_type == Channel ? cp - chn_chantbl : -1;
+  if (snprintf(fp->text, CHN_CACHE_FLAGLEN, *chn_flag_value ? "-%s=%s" : "-%s",
+	       chn_flag_name, chn_flag_value) >= CHN_CACHE_FLAGLEN) {
+    chn_cache_recording = 0;		/* flag doesn't fit */
+    return -1;
+  }
+  return 0;
+}
+
+/*!
+ * \fn int chn_cache_depend(char *file)
+ * \brief add a file to the list of files the configuration depends on
+ * \ingroup channel
+ */
+int chn_cache_depend(char *file)
+{
+  struct chn_cache_dep *dp;
+  struct stat st;
+
+  if (!chn_cache_recording) return 0;
+  if (stat(file, &st) < 0 || strlen(file) >= CHN_CACHE_PATHLEN ||
+      (dp = (struct chn_cache_dep *) realloc(chn_cache_deps,
+	 (chn_cache_ndep + 1) * sizeof(struct chn_cache_dep))) == NULL) {
+    chn_cache_recording = 0;
+    return -1;
+  }
+  chn_cache_deps = dp;
+  dp += chn_cache_ndep++;
+
+  memset(dp, 0, sizeof(struct chn_cache_dep));
+  strcpy(dp->path, file);
+  dp->size = st.st_size;
+  dp->mtime = st.st_mtime;
+  return 0;
+}
+
+/*!
+ * \fn int chn_cache_save(char *file, uint64_t hash)
+ * \brief save the current channel configuration in a cache file
+ * \ingroup channel
+ *
+ * The file is written under a temporary name and then renamed, so
+ * that a partially written cache is never used.  Returns 0 on
+ * success, -1 on error or if any channel has a filter.
+ */
+int chn_cache_save(char *file, uint64_t hash)
+{
+  struct chn_cache_header hdr;
+  struct chn_cache_device dev;
+  struct chn_cache_channel chn;
+  char tmpfile[CHN_CACHE_PATHLEN + 8];
+  int i;
+  FILE *fp;
+
+  if (!chn_cache_recording) return -1;
+  for (i = 0; i < chn_nchan; ++i)
+    if (chn_chantbl[i].filter != NULL) return -1;
+  if (strlen(file) >= CHN_CACHE_PATHLEN) return -1;
+  sprintf(tmpfile, "%s.tmp", file);
+  if ((fp = fopen(tmpfile, "w")) == NULL) return -1;
+
+  /* Header */
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CHN_CACHE_MAGIC;
+  hdr.version = CHN_CACHE_VERSION;
+  hdr.hash = hash;
+  hdr.ndev = chn_ndev;
+  hdr.nchan = chn_nchan;
+  hdr.nflag = chn_cache_nflag;
+  hdr.ndep = chn_cache_ndep;
+  hdr.size = sizeof(hdr) + hdr.ndev * sizeof(dev) + hdr.nchan * sizeof(chn) +
+    hdr.nflag * sizeof(struct chn_cache_flag) +
+    hdr.ndep * sizeof(struct chn_cache_dep);
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+
+  /* Devices */
+  for (i = 0; i < chn_ndev; ++i) {
+    memset(&dev, 0, sizeof(dev));
+    strcpy(dev.name, chn_devtbl[i].name);
+    strcpy(dev.devname, chn_devtbl[i].devname);
+    dev.size = chn_devtbl[i].size;
+    dev.address = chn_devtbl[i].address;
+    dev.index = chn_devtbl[i].index;
+    fwrite(&dev, sizeof(dev), 1, fp);
+  }
+
+  /* Channels */
+  for (i = 0; i < chn_nchan; ++i) {
+    memset(&chn, 0, sizeof(chn));
+    chn.devid = chn_chantbl[i].devid;
+    chn.chnid = chn_chantbl[i].chnid;
+    chn.offset = chn_chantbl[i].offset;
+    chn.type = chn_chantbl[i].type;
+    chn.scale = chn_chantbl[i].scale;
+    chn.dumpf = chn_chantbl[i].dumpf;
+    fwrite(&chn, sizeof(chn), 1, fp);
+  }
+
+  /* Driver flags and dependencies */
+  fwrite(chn_cache_flags, sizeof(struct chn_cache_flag), chn_cache_nflag, fp);
+  fwrite(chn_cache_deps, sizeof(struct chn_cache_dep), chn_cache_ndep, fp);
+
+  if (fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) < 0) {
+    fclose(fp);
+    unlink(tmpfile);
+    return -1;
+  }
+  fclose(fp);
+  return rename(tmpfile, file);
+}
+
+/*!
+ * \fn int chn_cache_load(char *file, uint64_t hash)
+ * \brief restore the channel configuration from a cache file
+ * \ingroup channel
+ *
+ * Checks that the cache matches the given hash, that all of the
+ * drivers are available and that none of the files the configuration
+ * depends on have changed.  If so, the device and channel tables are
+ * restored, each driver is given its NewChannels call and the driver
+ * flags are replayed.  Returns the number of devices or -1 if the
+ * cache can't be used, in which case chn_config() reads the
+ * configuration file instead.  If a driver's NewChannels fails, the
+ * devices already set up are closed and the tables left empty.
+ */
+int chn_cache_load(char *file, uint64_t hash)
+{
+  struct chn_cache_header *hdr;
+  struct chn_cache_device *dev;
+  struct chn_cache_channel *chn;
+  struct chn_cache_flag *flag;
+  struct chn_cache_dep *dep;
+  double scale;
+  int (*drivers[CHN_MAXDEV])(DEV_ACTION, ...);
+  int fd, i, j, d, c, offset;
+  unsigned dumpf;
+  FILTER *fltp;
+  struct stat st;
+  size_t mapsize;
+  void *map;
+
+  if ((fd = open(file, O_RDONLY)) < 0) return -1;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*hdr) ||
+      (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		  fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  mapsize = st.st_size;
+
+  /* Check the header */
+  hdr = (struct chn_cache_header *) map;
+  if (hdr->magic != CHN_CACHE_MAGIC || hdr->version != CHN_CACHE_VERSION ||
+      hdr->hash != hash || hdr->size != (uint64_t) mapsize ||
+      hdr->ndev < 0 || hdr->ndev > CHN_MAXDEV ||
+      hdr->nchan < 0 || hdr->nchan > CHN_MAXCHN ||
+      hdr->nflag < 0 || hdr->ndep < 0 ||
+      hdr->size != sizeof(*hdr) + hdr->ndev * sizeof(*dev) +
+      hdr->nchan * sizeof(*chn) + hdr->nflag * sizeof(*flag) +
+      hdr->ndep * sizeof(*dep))
+    goto reject;
+
+  dev = (struct chn_cache_device *) (hdr + 1);
+  chn = (struct chn_cache_channel *) (dev + hdr->ndev);
+  flag = (struct chn_cache_flag *) (chn + hdr->nchan);
+  dep = (struct chn_cache_dep *) (flag + hdr->nflag);
+
+  /* Make sure the dependencies haven't changed */
+  for (i = 0; i < hdr->ndep; ++i) {
+    dep[i].path[CHN_CACHE_PATHLEN-1] = '\0';
+    if (stat(dep[i].path, &st) < 0 || st.st_size != dep[i].size ||
+	st.st_mtime != dep[i].mtime) goto reject;
+  }
+
+  /* Look up the drivers and check the table structure */
+  for (d = 0, c = 0; d < hdr->ndev; c += dev[d++].size) {
+    dev[d].name[CHNDEVLEN] = dev[d].devname[CHNDEVLEN] = '\0';
+    for (i = 0; chn_devlut[i].name != NULL; ++i)
+      if (strcmp(chn_devlut[i].name, dev[d].name) == 0) break;
+    if (chn_devlut[i].name == NULL && chn_load_plugin(dev[d].name) < 0)
+      goto reject;
+    if ((drivers[d] = chn_devlut[i].driver) == NULL || dev[d].size < 0)
+      goto reject;
+  }
+  if (c != hdr->nchan) goto reject;
+  for (i = 0; i < hdr->nchan; ++i)
+    if (chn[i].devid < 0 || chn[i].devid >= hdr->ndev) goto reject;
+  for (i = 0; i < hdr->nflag; ++i) {
+    flag[i].text[CHN_CACHE_FLAGLEN-1] = '\0';
+    if (flag[i].devid < 0 || flag[i].devid >= hdr->ndev ||
+	flag[i].chan >= hdr->nchan) goto reject;
+  }
+
+  /* Now build the tables, one device at a time (same order as chn_config) */
+  chn_ndev = chn_nchan = 0;
+  for (d = 0, j = 0; d < hdr->ndev; ++d) {
+    DEVICE *dp = chn_devtbl + d;
+    CHANNEL *cp = chn_chantbl + chn_nchan;
+
+    dp->driver = drivers[d];
+    dp->size = dev[d].size;
+    dp->address = dev[d].address;
+    dp->index = dev[d].index;
+    strcpy(dp->devname, dev[d].devname);
+    strcpy(dp->name, dev[d].name);
+    chn_dev_debug = 0;
+
+    /* Device flags */
+    chn_flag_type = Device;
+    for (; j < hdr->nflag && flag[j].devid == d && flag[j].chan < 0; ++j)
+      chn_parse_option(dp, cp, flag[j].text, &offset, &scale, &dumpf,
+		       &fltp, 0);
+
+    /* Channels */
+    for (i = chn_nchan; i < chn_nchan + dp->size; ++i) {
+      chn_chantbl[i].devid = chn[i].devid;
+      chn_chantbl[i].chnid = chn[i].chnid;
+      chn_chantbl[i].offset = chn[i].offset;
+      chn_chantbl[i].type = (enum channel_type) chn[i].type;
+      chn_chantbl[i].scale = chn[i].scale;
+      chn_chantbl[i].dumpf = chn[i].dumpf;
+      chn_chantbl[i].filter = NULL;
+      lut_chn_clear(i);
+      chn_stage_clear(i);
+    }
+    if ((*dp->driver) (NewChannels, dp, cp) == -1) {
+      /* Something changed since the cache was made: undo the devices
+	 set up so far, so that chn_config() starts from empty tables */
+      fprintf(stderr, "chn_cache_load: NewChannels failed for %s\n",
+	      dp->name);
+      chn_close();
+      for (i = 0; i < chn_nchan + dp->size; ++i) {
+	lut_chn_clear(i);
+	chn_stage_clear(i);
+      }
+      chn_ndev = chn_nchan = 0;
+      goto reject;
+    }
+    chn_nchan += dp->size;
+    chn_ndev++;
+
+    /* Channel flags */
+    chn_flag_type = Channel;
+    chn_chn_debug = chn_dev_debug;
+    for (; j < hdr->nflag && flag[j].devid == d; ++j) {
+      cp = chn_chantbl + (flag[j].chan < 0 ? 0 : flag[j].chan);
+      chn_parse_option(dp, cp, flag[j].text, &cp->offset, &cp->scale,
+		       &cp->dumpf, &fltp, 0);
+    }
+  }
+  munmap(map, mapsize);
+  return chn_ndev;
+
+ reject:
+  munmap(map, mapsize);
+  return -1;
+}
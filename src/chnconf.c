@@ -42,8 +42,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "channel.h"
 #include "display.h"
+#include "lut.h"
 
 #ifdef OLD_MATLABV4
 #include "matlab.h"
@@ -52,7 +54,6 @@
 /* Function declarations */
 int chn_parse_option(DEVICE *, CHANNEL *, char *, int *, 
   double *, unsigned *, FILTER **, int);
-int chn_gettok(FILE *, char *, int, char *, int *);
 
 extern DEV_LOOKUP chn_devlut[];	/* device lookup table */
 
@@ -66,7 +67,7 @@ extern DEV_LOOKUP chn_devlut[];	/* device lookup table */
  */
 
 /* Global variables */
-#define MAXCHN 256
+#define MAXCHN CHN_MAXCHN
 #define FLEN 40			/* max string length allowed for flags,
 				 * including preceeding - and possibly an =
 				 * sign and flag value */
@@ -84,6 +85,10 @@ enum flags {
     MFILTER,			/* filter, specified in matlab format */
     FILTOUT,			/* channel to output filter to */
     DEBUG,			/* turn on debugging information */
+    LUT_FILE,			/* lookup table, from a matlab file */
+    LUT_IN,			/* second input of a 2-D lookup table */
+    LUT_OUT,			/* channel to output lookup table to */
+    STAGE,			/* processing stages (chnstage.c) */
 };
 
 /* table for parsing channel configuration file flags */
@@ -93,12 +98,55 @@ static struct {
 } chn_flags[] = {
     {"index", INDEX}, {"offset", OFFSET}, {"scale", SCALE},
     {"nodump", NODUMP}, {"filter", MFILTER}, {"filtout", FILTOUT},
-    {"debug", DEBUG},
+    {"debug", DEBUG}, {"lut", LUT_FILE}, {"lutin", LUT_IN},
+    {"lutout", LUT_OUT}, {"clamp", STAGE}, {"deadband", STAGE},
+    {"ratelimit", STAGE}, {"deriv", STAGE}, {"stageout", STAGE},
+    {"onwrite", STAGE},
     {"tableend", TABLEEND}
 };
 
+/*
+ * Hash table for the flag names.  The table is built the first time a
+ * flag is looked up, by searching for a hash seed that puts each flag
+ * in its own slot.  A lookup is then a single hash and strcmp.
+ */
+#define CHN_FLAGHASH 64			/* slots in flag hash (power of 2) */
+static signed char chn_flag_hash[CHN_FLAGHASH];
+static unsigned chn_flag_seed = 0;
+
+static unsigned chn_flag_hashfn(const char *s, unsigned seed)
+{
+    unsigned h = 2166136261u ^ seed;
+    while (*s) { h ^= (unsigned char) *s++; h *= 16777619u; }
+    return (h ^ (h >> 15)) & (CHN_FLAGHASH - 1);
+}
+
+static int chn_flag_lookup(char *name)
+{
+    int i;
+    unsigned h;
+
+    if (chn_flag_seed == 0) {
+	/* Find a seed that gives a collision free table */
+	for (chn_flag_seed = 1; ; ++chn_flag_seed) {
+	    memset(chn_flag_hash, -1, sizeof(chn_flag_hash));
+	    for (i = 0; chn_flags[i].number != TABLEEND; ++i) {
+		h = chn_flag_hashfn(chn_flags[i].name, chn_flag_seed);
+		if (chn_flag_hash[h] >= 0) break;
+		chn_flag_hash[h] = i;
+	    }
+	    if (chn_flags[i].number == TABLEEND) break;
+	}
+    }
+
+    i = chn_flag_hash[chn_flag_hashfn(name, chn_flag_seed)];
+    if (i >= 0 && strcmp(name, chn_flags[i].name) == 0)
+	return chn_flags[i].number;
+    return TABLEEND;
+}
+
 char chn_flag_name[20];
-char chn_flag_value[20];
+char chn_flag_value[FLEN + 1];
 CHN_FLAG_TYPE chn_flag_type;
 
 int chn_dev_debug = 0;		/* turn on device debugging info */
@@ -110,10 +158,11 @@ int chn_chn_debug = 0;		/* turn on channel debugging info */
  */
 int chn_config(char *file)
 {
-    FILE *fp;
+    CHN_LEX *lp;
     int line = 1, status, i;
     char buf[FLEN + 1], delims[5] = " \t\n;";
-    char ch;
+    char path[PATH_MAX + 1];		/* driver name or plugin path */
+    int ch;
     int num, address, offset;
     unsigned dumpf;
     double scale;
@@ -121,13 +170,31 @@ int chn_config(char *file)
     int errorflag = 0;
     FILTER *filtp;
     char tempbuf[100];
+    char *cachefile = NULL;
+    uint64_t hash = 0;
 
     /* Open up the configuration file */
-    if ((fp = fopen(file, "r")) == NULL) {
+    if ((lp = chn_lex_open(file)) == NULL) {
 	perror("chn_config");
 	fprintf(stderr, "chn_config: trouble opening file %s\n", file);
 	return -1;
     }
+
+    /* See if we have a compiled version of this file (if asked for) */
+    if (chn_cache_enable < 0)
+	chn_cache_enable = getenv("SPARROW_CHN_CACHE") != NULL;
+    if (chn_cache_enable &&
+	(cachefile = (char *) malloc(strlen(file) + 7)) != NULL) {
+	sprintf(cachefile, "%s.cache", file);
+	hash = chn_cache_hash(lp->buf, lp->size);
+	if (chn_cache_load(cachefile, hash) >= 0) {
+	    chn_lex_close(lp);
+	    free(cachefile);
+	    chn_init();
+	    return 1;
+	}
+    }
+    chn_cache_reset(cachefile != NULL);
     /* initialize */
     chn_ndev = 0;
     chn_nchan = 0;
@@ -138,11 +205,20 @@ int chn_config(char *file)
 
     /* main loop searches for occurences of "device:" or "channel:" */
     do {
-	ch = chn_gettok(fp, buf, FLEN, delims, &line);
+	ch = chn_lex_gettok(lp, buf, FLEN, delims, &line);
 
 	if (strcmp(buf, "device:") == 0) {
 	    /* get the required device parameters */
-	    chn_gettok(fp, buf, FLEN, delims, &line);	/* look for device */
+	    chn_lex_gettok(lp, path, sizeof(path), delims, &line);	/* look for device */
+	    if (strlen(path) > CHNDEVLEN) {
+		fprintf(stderr, "%s too long (%s), skipping device. (line %d)\n",
+			strncmp(path, CHN_PLUGIN_PREFIX, strlen(CHN_PLUGIN_PREFIX)) == 0 ?
+			"Plugin path" : "Device name", path, line);
+		chn_flag_type = Unknown;
+		errorflag++;
+		continue;
+	    }
+	    strcpy(buf, path);
 
 #	    ifdef DEBUG
 	    /* Look for the driver name in the lookup table */
@@ -155,6 +231,16 @@ int chn_config(char *file)
 		if (strcmp(chn_devlut[i].name, buf) == 0)
 		    break;
 
+	    /* Load the driver if it is a plugin */
+	    if (chn_devlut[i].name == NULL &&
+		strncmp(buf, CHN_PLUGIN_PREFIX, strlen(CHN_PLUGIN_PREFIX)) == 0
+		&& chn_load_plugin(buf) < 0) {
+		fprintf(stderr, "Can't load driver \"%s\", skipping. (line %d)\n", buf, line);
+		chn_flag_type = Unknown;
+		errorflag++;
+		continue;
+	    }
+
 	    if (chn_devlut[i].name == NULL) {
 		if (strcmp(buf,"end")==0) {
 	            /* artifical end of file */
@@ -167,7 +253,7 @@ int chn_config(char *file)
 		errorflag++;
 		continue;
 	    }
-	    chn_gettok(fp, buf, FLEN, delims, &line);	/* look for no. of
+	    chn_lex_gettok(lp, buf, FLEN, delims, &line);	/* look for no. of
 							 * channels */
 	    if (sscanf(buf, "%d", &num) != 1) {
 		fprintf(stderr, "Bad size parameter, skipping device. (line %d)\n", line);
@@ -175,7 +261,7 @@ int chn_config(char *file)
 		errorflag++;
 		continue;
 	    }
-	    ch = chn_gettok(fp, buf, FLEN, delims, &line);	/* look for address */
+	    ch = chn_lex_gettok(lp, buf, FLEN, delims, &line);	/* look for address */
 	    if (sscanf(buf, "0x%x", &address) == 1 ||
 		sscanf(buf, "0X%x", &address) == 1) {
 	      chn_devtbl[chn_ndev].address = address;
@@ -194,6 +280,14 @@ int chn_config(char *file)
 		    continue;
 	    }
 
+	    /* make sure there is room for the device and its channels */
+	    if (chn_ndev >= CHN_MAXDEV || num < 0 || chn_nchan + num > MAXCHN) {
+		fprintf(stderr, "Too many devices or channels, skipping device. (line %d)\n", line);
+		chn_flag_type = Unknown;
+		errorflag++;
+		continue;
+	    }
+
 	    /* store the device driver information */
 	    /* Note: address, devname stored during parsing */
 	    chn_devtbl[chn_ndev].driver = chn_devlut[i].driver;
@@ -212,8 +306,9 @@ int chn_config(char *file)
 					 * device */
 	    status = 1;
 	    chn_dev_debug = 0;		/* debugging off by default */
-	    while (ch != ';') {
-		ch = chn_gettok(fp, buf, FLEN, delims, &line);
+	    while (ch != ';' && ch != EOF) {
+		ch = chn_lex_gettok(lp, buf, FLEN, delims, &line);
+		if (*buf == '\0') continue;
 		status = chn_parse_option(chn_devtbl + chn_ndev, chn_chantbl + chn_nchan, buf, &offset, &scale, &dumpf, &filtp, line);
 		if (status == -1) {	/* if an error occurs skip device */
 		    fprintf(stderr, "Device option error (%s), skipping device. (line %d)\n", buf, line);
@@ -238,6 +333,8 @@ int chn_config(char *file)
 		chn_chantbl[chn_nchan].scale = scale;
 		chn_chantbl[chn_nchan].dumpf = dumpf;
 		chn_chantbl[chn_nchan].filter = filtp;
+		lut_chn_clear(chn_nchan);
+		chn_stage_clear(chn_nchan);
 		chn_nchan++;	/* add this channel */
 	    }
 	    /* let the device driver setup its special channel entries */
@@ -260,7 +357,7 @@ int chn_config(char *file)
 		continue;
 	    }
 	    /* get channel number; check its validity */
-	    chn_gettok(fp, buf, FLEN, delims, &line);
+	    chn_lex_gettok(lp, buf, FLEN, delims, &line);
 	    if (sscanf(buf, "%d", &num) != 1) {
 		fprintf(stderr, "Bad channel number, skipping channel. (line %d)\n", line);
 		errorflag++;
@@ -278,8 +375,9 @@ int chn_config(char *file)
 	    chn_flag_type = Channel;	/* so parsing functions know it's a
 					 * channel */
 	    chn_chn_debug = chn_dev_debug; /* inherit debugging status */
-	    while (ch != ';') {
-		ch = chn_gettok(fp, buf, FLEN, delims, &line);
+	    while (ch != ';' && ch != EOF) {
+		ch = chn_lex_gettok(lp, buf, FLEN, delims, &line);
+		if (*buf == '\0') continue;
 		status = chn_parse_option(chn_devtbl + chn_ndev - 1, chnp, buf, &chnp->offset, &chnp->scale, &chnp->dumpf, &filtp, line);
 		if (status == -1) {	/* stop the parsing */
 		    fprintf(stderr, "Channel option error (%s), skipping it. (line %d)\n", buf, line);
@@ -295,12 +393,19 @@ int chn_config(char *file)
 	    fprintf(stderr, "chn_config: Ignoring unknown text (%s) in config file, line %d\n", buf, line);
 	    errorflag++;
 	}
-	if (feof(fp))
+	if (ch == EOF || chn_lex_eof(lp))
 	    break;
     } while (1);		/* end of configuration file parsing loop */
 
 
-    fclose(fp);			/* close the file */
+    chn_lex_close(lp);		/* close the file */
+
+    /* Save the tables if everything went OK */
+    if (cachefile != NULL) {
+	if (!errorflag) chn_cache_save(cachefile, hash);
+	free(cachefile);
+    }
+    chn_cache_reset(0);
 
     if (errorflag) {
 	strcpy(tempbuf, "chnconf(): An error occured during channel configuration. Continue(y/n)? ");
@@ -363,29 +468,27 @@ int chn_parse_option(
     double doubletemp;
     struct matlab_entry *amat, *bmat;
     FILTER *filtp;
+    char lutfile[FLEN + 1], *lutname;
 
     if (*buf != '-')
 	return status;
 
     /* copy flag name & value into the global flag holders */
     buf++;
-    for (i = 0; buf[i] != '\0' && buf[i] != '='; i++)
+    for (i = 0; buf[i] != '\0' && buf[i] != '=' && i < 19; i++)
 	chn_flag_name[i] = buf[i];
     chn_flag_name[i] = '\0';
+    while (buf[i] != '\0' && buf[i] != '=') ++i;
     if (buf[i] == '=') {
 	buf = buf + i + 1;
-	for (i = 0; buf[i] != '\0'; i++)
+	for (i = 0; buf[i] != '\0' && i < FLEN; i++)
 	    chn_flag_value[i] = buf[i];
 	chn_flag_value[i] = '\0';
     } else
 	*chn_flag_value = '\0';
-    /* lookup flag number in flag table */
-    for (i = 0; chn_flags[i].number != 0; i++) {
-	if (strcmp(chn_flag_name, chn_flags[i].name) == 0)
-	    break;
-    }
 
-    switch (chn_flags[i].number) {
+    /* lookup flag number in flag table */
+    switch (chn_flag_lookup(chn_flag_name)) {
     case TABLEEND:		/* flag not supported by channel.c */
 	if (chn_flag_type == Unknown) {
 	    fprintf(stderr, "No device for \"%s\", skipping. (line %d)\n", chn_flag_name, line);
@@ -393,11 +496,13 @@ int chn_parse_option(
 	}
 	/* Non-standard flag, let the device driver handle it */
 	status = (*dp->driver) (HandleFlag, dp, cp);
+	if (status == 1) chn_cache_record(dp, cp);
 	break;
 
     case DEBUG:		/* Turn on debuggings */
 	if (chn_flag_type == Device) chn_dev_debug = atoi(chn_flag_value);
 	if (chn_flag_type == Channel) chn_chn_debug = atoi(chn_flag_value);
+	chn_cache_record(dp, cp);
 	status = 1;
 	break;
 
@@ -594,6 +699,68 @@ int chn_parse_option(
 	status = 1;
 	break;
 
+    case LUT_FILE:		/* map the channel through a lookup table */
+	if (chn_flag_type != Channel) {
+	    fprintf(stderr, "\"lut\" is a channel flag only. (line %d)\n", line);
+	    break;
+	}
+	if (cp->lut == NULL) {
+	    if ((cp->lut = (CHN_LUT *) malloc(sizeof(CHN_LUT))) == NULL) {
+		fprintf(stderr, "Could not allocate memory for lookup table. (line %d)\n", line);
+		break;
+	    }
+	    cp->lut->in_chn = -1;
+	    cp->lut->out_chn = cp - chn_chantbl;
+	} else
+	    lut_free(cp->lut->lut);
+
+	/* value is file[:name]; keep chn_flag_value intact for the cache */
+	strcpy(lutfile, chn_flag_value);
+	if ((lutname = strchr(lutfile, ':')) != NULL) *lutname++ = '\0';
+	if ((cp->lut->lut = lut_open(lutfile, lutname)) == NULL) {
+	    fprintf(stderr, "Couldn't load lookup table from \"%s\". (line %d)\n", chn_flag_value, line);
+	    break;
+	}
+	chn_cache_depend(lutfile);
+	chn_cache_record(dp, cp);
+	status = 1;
+	break;
+
+    case LUT_IN:
+    case LUT_OUT:
+	if (chn_flag_type != Channel) {
+	    fprintf(stderr, "\"%s\" is a channel flag only. (line %d)\n", chn_flag_name, line);
+	    break;
+	}
+	if (cp->lut == NULL) {
+	    fprintf(stderr, "No lookup table has been defined for \"%s\" flag. (line %d)\n", chn_flag_name, line);
+	    break;
+	}
+	if (sscanf(chn_flag_value, "%d", &inttemp) != 1 || inttemp < 0) {
+	    fprintf(stderr, "Bad channel number for \"%s\". (line %d)\n", chn_flag_name, line);
+	    break;
+	}
+	if (strcmp(chn_flag_name, "lutin") == 0)
+	    cp->lut->in_chn = inttemp;
+	else
+	    cp->lut->out_chn = inttemp;
+	chn_cache_record(dp, cp);
+	status = 1;
+	break;
+
+    case STAGE:			/* clamp, deadband, ratelimit, ... */
+	if (chn_flag_type != Channel) {
+	    fprintf(stderr, "\"%s\" is a channel flag only. (line %d)\n", chn_flag_name, line);
+	    break;
+	}
+	if (chn_stage_add(cp, chn_flag_name, chn_flag_value) < 0) {
+	    fprintf(stderr, "Bad \"%s\" flag. (line %d)\n", chn_flag_name, line);
+	    break;
+	}
+	chn_cache_record(dp, cp);
+	status = 1;
+	break;
+
     }
     return status;
 }
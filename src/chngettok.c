@@ -44,62 +44,217 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "display.h"
 
 /*
  * Parser for configuration file; gets strings separated by _delimiters, from
  * input stream _fp.  _line keeps track of newline characters. A maximum of
  * _length characters is returned in _string.
+ *
+ * Spaces and tabs are allowed on either side of the equal sign in a
+ * flag, so "-scale = 2" is returned as "-scale=2".  The return value
+ * is the delimiter that ended the token (';' and newlines are consumed,
+ * other delimiters are left in the stream), EOF at the end of the
+ * file or -1 if the token overflowed the string.
+ *
+ * This version reads from a stdio stream.  chn_config() uses the
+ * chn_lex_* functions below, which work on the whole file in memory.
  */
 int chn_gettok(FILE * fp, char *string, int length, char *delimiters, int *line)
 {
-  int i = 0;
-  int flag = 0;
-  char ch;
-
-  while(string[i] != '\0')
-    string[i++] = ' ';
-  i = 0;
-
-  /* ignore preceeding whitespace */
-  do {
-    ch = fgetc(fp);
-    if (ch == '#') {	/* ignore stuff from # to end of line
-			 * (comments) */
-      while (ch != '\n' && !feof(fp))
-	ch = fgetc(fp);
-    }
+  int i = 0, ch;
+
+  /* ignore preceeding whitespace and comments (# to end of line) */
+  while ((ch = getc(fp)) != EOF) {
+    if (ch == '#')
+      while ((ch = getc(fp)) != EOF && ch != '\n');
     if (ch == '\n')
       ++(*line);
-  } while (ch == ' ' || ch == '\t' || ch == '\n');
-  
+    else if (ch != ' ' && ch != '\t')
+      break;
+  }
+
   while (i < length - 1) {
-    if (ch == '\n')
-      ++(*line);
-    if (strchr(delimiters, (int) ch) != NULL || feof(fp)) {
-      if (strchr(string, '=') != NULL) flag = 1;
-      while (ch == ' ' || ch == '\t') /* allow spaces or tabs between */
-	ch = fgetc(fp);               /* flag and equal sign as well as */
-      if (ch == '=')                  /* equal sign and flag value */
-	flag = 1;
-      else if ((flag) && (((ch >= '0') && (ch <= '9')) || (ch == '.')))
+    if (ch == EOF) break;
+    if (ch == '#') {			/* comment ends the token */
+      while ((ch = getc(fp)) != EOF && ch != '\n');
+      if (ch == '\n') ++(*line);
+      break;
+    }
+    if (strchr(delimiters, ch) != NULL) {
+      int delim = ch;
+
+      /* allow spaces or tabs between flag and equal sign as well as */
+      /* equal sign and flag value */
+      while (ch == ' ' || ch == '\t') ch = getc(fp);
+      if (ch == '=') {
+	string[i++] = ch;
+	ch = getc(fp);
 	continue;
-      else {
-	flag = 0;
-	if (!feof(fp) && ch != '\n' && ch != ';')
-	  ungetc(ch,fp);
-	string[i] = '\0';
-	return ch;
       }
-    }
-    if (ch == '#') {	/* ignore stuff from # to end of line
-			 * (comments) */
-      while (ch != '\n' && !feof(fp))
-	ch = fgetc(fp);
+      if (i > 0 && string[i-1] == '=' && ch != EOF && ch != '\n' && ch != ';' &&
+	  ch != '#')
+	continue;			/* value follows the equal sign */
+
+      if (ch == '\n') ++(*line);
+      if (ch == '\n' || ch == ';' || ch == EOF)
+	delim = ch;			/* consume end of line or option list */
+      else if (!(delim == ' ' || delim == '\t'))
+	break;				/* non-blank delimiter */
+      else
+	ungetc(ch, fp);
+      string[i] = '\0';
+      return delim;
     }
     string[i++] = ch;
-    ch = fgetc(fp);
+    ch = getc(fp);
+  }
+  string[i] = '\0';
+  if (ch == EOF) return EOF;
+  return (i < length - 1) ? '\n' : -1;	/* comment or overflow */
+}
+
+/*
+ * Memory based lexer for configuration files
+ *
+ * chn_lex_open		map a configuration file into memory
+ * chn_lex_gettok	get the next token (same rules as chn_gettok)
+ * chn_lex_close	release the file
+ *
+ * The whole file is mapped into memory, so getting a token is just a
+ * scan through a buffer.  Delimiters are looked up in a table that is
+ * rebuilt only when a different delimiter string is passed in.
+ */
+
+CHN_LEX *chn_lex_open(char *file)
+{
+  CHN_LEX *lp;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(file, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) < 0 || (lp = (CHN_LEX *) calloc(1, sizeof(CHN_LEX))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    /* Regular file: map it */
+    lp->size = st.st_size;
+    lp->buf = (char *) mmap(NULL, lp->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (lp->buf == MAP_FAILED) { close(fd); free(lp); return NULL; }
+    lp->mapped = 1;
+
+  } else {
+    /* Pipe, terminal or empty file: read it into a buffer */
+    size_t alloc = 4096;
+    ssize_t n;
+    char *tmp;
+
+    if ((lp->buf = (char *) malloc(alloc)) == NULL) { close(fd); free(lp); return NULL; }
+    while ((n = read(fd, lp->buf + lp->size, alloc - lp->size)) > 0) {
+      lp->size += n;
+      if (lp->size == alloc) {
+	if ((tmp = (char *) realloc(lp->buf, alloc *= 2)) == NULL) break;
+	lp->buf = tmp;
+      }
+    }
+  }
+  close(fd);
+
+  lp->p = lp->buf;
+  lp->end = lp->buf + lp->size;
+  return lp;
+}
+
+void chn_lex_close(CHN_LEX *lp)
+{
+  if (lp == NULL) return;
+  if (lp->mapped)
+    munmap(lp->buf, lp->size);
+  else
+    free(lp->buf);
+  free(lp);
+}
+
+int chn_lex_gettok(CHN_LEX *lp, char *string, int length, char *delimiters,
+		   int *line)
+{
+  register char *p = lp->p, *end = lp->end;
+  register int i = 0;
+  int delim;
+
+  /* Update the delimiter table if the delimiters have changed */
+  if (delimiters != lp->delimiters) {
+    memset(lp->isdelim, 0, sizeof(lp->isdelim));
+    for (lp->delimiters = delimiters; *delimiters; ++delimiters)
+      lp->isdelim[(unsigned char) *delimiters] = 1;
+  }
+
+  /* ignore preceeding whitespace and comments (# to end of line) */
+  for (; p < end; ++p) {
+    if (*p == '#')
+      while (p < end - 1 && p[1] != '\n') ++p;
+    else if (*p == '\n')
+      ++(*line);
+    else if (*p != ' ' && *p != '\t' && *p != '\r')
+      break;
+  }
+
+  while (i < length - 1) {
+    if (p >= end) break;
+    if (*p == '#') {			/* comment ends the token */
+      while (p < end && *p != '\n') ++p;
+      if (p < end) { ++(*line); ++p; }
+      string[i] = '\0';
+      lp->p = p;
+      return '\n';
+    }
+    if (lp->isdelim[(unsigned char) *p]) {
+      char *q = p;
+
+      /* allow spaces or tabs between flag and equal sign as well as */
+      /* equal sign and flag value */
+      while (q < end && (*q == ' ' || *q == '\t')) ++q;
+      if (q < end && *q == '=') {
+	string[i++] = '=';
+	p = q + 1;
+	continue;
+      }
+      if (i > 0 && string[i-1] == '=' && q < end && *q != '\n' && *q != ';' &&
+	  *q != '#') {
+	p = q;				/* value follows the equal sign */
+	continue;
+      }
+
+      delim = (unsigned char) *p;
+      if (q >= end) {
+	delim = EOF;
+	p = q;
+      } else if (*q == '\n' || *q == ';') {
+	if (*q == '\n') ++(*line);
+	delim = *q;			/* consume end of line or option list */
+	p = q + 1;
+      } else
+	p = q;				/* leave next token in the buffer */
+
+      string[i] = '\0';
+      lp->p = p;
+      return delim;
+    }
+    string[i++] = *p++;
   }
   string[i] = '\0';
-  return -1;			/* overflow */
+  lp->p = p;
+  return (p >= end) ? EOF : -1;	/* end of file or overflow */
+}
+
+/* Check for end of file on a lexer */
+int chn_lex_eof(CHN_LEX *lp)
+{
+  return lp->p >= lp->end;
 }
@@ -0,0 +1,134 @@
+/*!
+ * \file chnplugin.c
+ * \brief load device drivers from shared objects
+ *
+ * \date 19 Oct 26
+ *
+ * Device drivers can be loaded at run time by giving the name of a
+ * shared object in the configuration file:
+ *
+ *   device: plugin:libmyadc.so 16 0x300;
+ *
+ * The shared object is opened with dlopen() and must define the
+ * registration function chn_plugin_register(), which fills in the
+ * driver function in the DEV_LOOKUP structure that it is passed:
+ *
+ *   int chn_plugin_register(DEV_LOOKUP *lp)
+ *   {
+ *     lp->driver = myadc_driver;
+ *     return 0;
+ *   }
+ *
+ * The driver is then added to the driver lookup table using the full
+ * name ("plugin:libmyadc.so"), so the object is only loaded once.
+ * Drivers that use the channel library globals (chn_flag_name, etc)
+ * need the program to be linked with -rdynamic.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "channel.h"
+
+extern DEV_LOOKUP chn_devlut[];
+
+/*!
+ * \fn int chn_load_plugin(char *name)
+ * \brief load a device driver plugin and add it to the driver table
+ * \ingroup channel
+ *
+ * The name should have the form "plugin:file", where file is passed
+ * to dlopen() (so it can either be a path or the name of a library
+ * in the library search path).  The whole name is stored in the
+ * device table, so it can't be longer than CHNDEVLEN.  Returns the
+ * offset of the driver in chn_devlut, or -1 on error.
+ */
+int chn_load_plugin(char *name)
+{
+  int (*regfcn)(DEV_LOOKUP *);
+  DEV_LOOKUP entry;
+  void *handle;
+  char *path;
+  int i;
+
+  /* See if this plugin is already loaded */
+  for (i = 0; chn_devlut[i].name != NULL; ++i)
+    if (strcmp(chn_devlut[i].name, name) == 0) return i;
+
+  if (strncmp(name, CHN_PLUGIN_PREFIX, strlen(CHN_PLUGIN_PREFIX)) != 0)
+    return -1;
+  path = name + strlen(CHN_PLUGIN_PREFIX);
+  if (strlen(name) > CHNDEVLEN) {
+    fprintf(stderr, "chn_load_plugin: plugin path too long: %s\n", path);
+    return -1;
+  }
+
+  /* Open the shared object and find the registration function */
+  if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+    fprintf(stderr, "chn_load_plugin: %s\n", dlerror());
+    return -1;
+  }
+  *(void **) (&regfcn) = dlsym(handle, CHN_PLUGIN_REGISTER);
+  if (regfcn == NULL) {
+    fprintf(stderr, "chn_load_plugin: %s: no %s function\n", path,
+	    CHN_PLUGIN_REGISTER);
+    dlclose(handle);
+    return -1;
+  }
+
+  /* Let the plugin fill in the driver */
+  entry.name = name;
+  entry.driver = NULL;
+  if ((*regfcn)(&entry) < 0 || entry.driver == NULL) {
+    fprintf(stderr, "chn_load_plugin: %s: registration failed\n", path);
+    dlclose(handle);
+    return -1;
+  }
+
+  /* Add the driver under the name used in the configuration file */
+  if ((entry.name = strdup(name)) == NULL ||
+      (i = chn_add_driver(entry.name, entry.driver)) < 0) {
+    fprintf(stderr, "chn_load_plugin: %s: can't add driver\n", path);
+    free(entry.name);
+    dlclose(handle);
+    return -1;
+  }
+  return i;
+}
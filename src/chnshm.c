@@ -0,0 +1,410 @@
+/*!
+ * \file chnshm.c
+ * \brief export the channel table to other processes in shared memory
+ *
+ * \date 19 Oct 26
+ *
+ * The process that runs the servo loop can export its channel table
+ * in a POSIX shared memory segment with chn_shm_export().  Every call
+ * to chn_write() then publishes a frame holding the current data for
+ * all channels.  Other processes (a logger, a display or a supervisory
+ * controller) attach to the segment with chn_shm_attach() and read
+ * frames with chn_shm_read(), without sockets and without disturbing
+ * the servo loop.
+ *
+ * Frames are protected by a sequence lock: the servo loop makes the
+ * sequence number odd while it copies the data in and even again when
+ * it is done, and readers retry if the number changed while they were
+ * copying.  The servo loop never waits for a reader, and a reader
+ * gives up after CHN_SHM_RETRIES tries (if the exporting process died
+ * in the middle of a frame, for instance).
+ *
+ * Processes that attach as writers can also set the channels of
+ * virtual devices with chn_shm_write().  Each channel has an input slot
+ * with a generation count; chn_read() copies a value into the channel
+ * table whenever the count has changed since the last read.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "channel.h"
+
+#define CHN_SHM_MAGIC 0x53484d43	/* "CMHS" */
+#define CHN_SHM_VERSION 1
+#define CHN_SHM_RETRIES 1000		/* tries for a complete frame */
+
+/* Segment header; the magic number is stored last when exporting */
+struct chn_shm_header {
+  uint32_t magic, version;
+  int32_t ndev, nchan;
+  uint64_t seq;				/* frame sequence lock */
+  uint64_t frame;			/* number of frames published */
+};
+
+/* Device information, so that clients can find channels by name */
+struct chn_shm_device {
+  char name[CHNDEVLEN+1];
+  int32_t offset, size;			/* first channel and count */
+  int32_t writable;			/* channels accept chn_shm_write */
+};
+
+/* Input slot for one channel */
+struct chn_shm_input {
+  uint64_t gen;				/* incremented on each write */
+  uint64_t value;			/* bits of a double */
+};
+
+/*
+ * Attached segment.  The header is followed by ndev devices, then the
+ * frame (nchan doubles and nchan stale flags) and then nchan input
+ * slots.
+ */
+struct chn_shm {
+  struct chn_shm_header *hdr;
+  struct chn_shm_device *dev;
+  double *data;
+  int32_t *stale;
+  struct chn_shm_input *in;
+  size_t size;
+  int writer;
+  uint64_t *gen;			/* last input seen (exporter only) */
+};
+
+static CHN_SHM chn_shm_local;		/* exported segment */
+static char chn_shm_name[64];
+int chn_shm_enable = 0;			/* set when exported */
+
+/*
+ * Size of a segment.  If base is not NULL, also set the addresses of
+ * the parts of the segment in sp.
+ */
+static size_t chn_shm_layout(CHN_SHM *sp, char *base, int ndev, int nchan)
+{
+  size_t dev, data, stale, in, size;
+
+  dev = sizeof(struct chn_shm_header);
+  data = (dev + ndev * sizeof(struct chn_shm_device) + 7) & ~(size_t) 7;
+  stale = data + nchan * sizeof(double);
+  in = (stale + nchan * sizeof(int32_t) + 7) & ~(size_t) 7;
+  size = in + nchan * sizeof(struct chn_shm_input);
+
+  if (base != NULL) {
+    sp->hdr = (struct chn_shm_header *) base;
+    sp->dev = (struct chn_shm_device *) (base + dev);
+    sp->data = (double *) (base + data);
+    sp->stale = (int32_t *) (base + stale);
+    sp->in = (struct chn_shm_input *) (base + in);
+  }
+  return size;
+}
+
+/*!
+ * \fn int chn_shm_export(char *name)
+ * \brief export the channel table in a shared memory segment
+ * \ingroup channel
+ *
+ * Creates (or replaces) the POSIX shared memory segment name, which
+ * should start with a slash, and starts publishing frames from
+ * chn_write().  Call this after chn_config(); the segment describes
+ * the channel table as it is when chn_shm_export() is called.
+ * Returns 0 on success or -1 on error.
+ */
+int chn_shm_export(char *name)
+{
+  int fd, i, offset;
+  size_t size;
+  char *base;
+  uint64_t *gen;
+
+  chn_shm_unexport();
+
+  size = chn_shm_layout(&chn_shm_local, NULL, chn_ndev, chn_nchan);
+  if ((gen = (uint64_t *) calloc(chn_nchan + 1, sizeof(uint64_t))) == NULL)
+    return -1;
+
+  shm_unlink(name);
+  if ((fd = shm_open(name, O_CREAT | O_RDWR, 0660)) < 0) {
+    perror(name);
+    free(gen);
+    return -1;
+  }
+  if (ftruncate(fd, size) < 0 ||
+      (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+      == MAP_FAILED) {
+    perror(name);
+    close(fd);
+    shm_unlink(name);
+    free(gen);
+    return -1;
+  }
+  close(fd);
+
+  chn_shm_layout(&chn_shm_local, base, chn_ndev, chn_nchan);
+  chn_shm_local.size = size;
+  chn_shm_local.writer = 1;
+  chn_shm_local.gen = gen;
+
+  /* Fill in the device table; the new segment is already zero */
+  for (offset = i = 0; i < chn_ndev; ++i) {
+    struct chn_shm_device *dp = chn_shm_local.dev + i;
+    strcpy(dp->name, chn_devtbl[i].name);
+    dp->offset = offset;
+    dp->size = chn_devtbl[i].size;
+    dp->writable = chn_devtbl[i].driver == virtual_driver;
+    offset += chn_devtbl[i].size;
+  }
+  chn_shm_local.hdr->version = CHN_SHM_VERSION;
+  chn_shm_local.hdr->ndev = chn_ndev;
+  chn_shm_local.hdr->nchan = chn_nchan;
+  __atomic_store_n(&chn_shm_local.hdr->magic, CHN_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  strncpy(chn_shm_name, name, sizeof(chn_shm_name) - 1);
+  chn_shm_enable = 1;
+  chn_shm_publish();
+  return 0;
+}
+
+/*!
+ * \fn void chn_shm_unexport(void)
+ * \brief stop exporting the channel table and remove the segment
+ * \ingroup channel
+ */
+void chn_shm_unexport(void)
+{
+  if (!chn_shm_enable) return;
+  chn_shm_enable = 0;
+  munmap(chn_shm_local.hdr, chn_shm_local.size);
+  shm_unlink(chn_shm_name);
+  free(chn_shm_local.gen);
+  memset(&chn_shm_local, 0, sizeof(chn_shm_local));
+}
+
+/* Publish the current channel data (called from chn_write) */
+void chn_shm_publish(void)
+{
+  struct chn_shm_header *hp = chn_shm_local.hdr;
+  CHANNEL *cp = chn_chantbl;
+  int i, n = hp->nchan;
+
+  __atomic_store_n(&hp->seq, hp->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (i = 0; i < n; ++i, ++cp) {
+    chn_shm_local.data[i] = cp->type == Short ? cp->data.s : cp->data.d;
+    chn_shm_local.stale[i] = cp->stale;
+  }
+  __atomic_store_n(&hp->frame, hp->frame + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&hp->seq, hp->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy values written by other processes (called from chn_read) */
+void chn_shm_import(void)
+{
+  struct chn_shm_device *dp = chn_shm_local.dev;
+  int i, j, n = chn_shm_local.hdr->ndev;
+  uint64_t gen, bits;
+
+  for (i = 0; i < n; ++i, ++dp) {
+    if (!dp->writable) continue;
+    for (j = dp->offset; j < dp->offset + dp->size; ++j) {
+      gen = __atomic_load_n(&chn_shm_local.in[j].gen, __ATOMIC_ACQUIRE);
+      if (gen == chn_shm_local.gen[j]) continue;
+      bits = __atomic_load_n(&chn_shm_local.in[j].value, __ATOMIC_RELAXED);
+      memcpy(&chn_chantbl[j].data.d, &bits, sizeof(double));
+      chn_shm_local.gen[j] = gen;
+    }
+  }
+}
+
+/*!
+ * \fn CHN_SHM *chn_shm_attach(char *name, int writer)
+ * \brief attach to a channel table exported by another process
+ * \ingroup channel
+ *
+ * The segment is mapped read only unless writer is nonzero.  Returns
+ * NULL if the segment doesn't exist or isn't a channel table.
+ */
+CHN_SHM *chn_shm_attach(char *name, int writer)
+{
+  CHN_SHM *sp;
+  struct stat st;
+  char *base;
+  int fd;
+
+  if ((fd = shm_open(name, writer ? O_RDWR : O_RDONLY, 0)) < 0) {
+    perror(name);
+    return NULL;
+  }
+  base = fstat(fd, &st) < 0 || st.st_size < sizeof(struct chn_shm_header) ?
+    MAP_FAILED : mmap(NULL, st.st_size, writer ? PROT_READ | PROT_WRITE :
+		      PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "chn_shm_attach: can't map %s\n", name);
+    return NULL;
+  }
+
+  if ((sp = (CHN_SHM *) calloc(1, sizeof(CHN_SHM))) == NULL) {
+    munmap(base, st.st_size);
+    return NULL;
+  }
+  sp->hdr = (struct chn_shm_header *) base;
+  if (__atomic_load_n(&sp->hdr->magic, __ATOMIC_ACQUIRE) != CHN_SHM_MAGIC ||
+      sp->hdr->version != CHN_SHM_VERSION ||
+      chn_shm_layout(sp, base, sp->hdr->ndev, sp->hdr->nchan) > st.st_size) {
+    fprintf(stderr, "chn_shm_attach: %s is not a channel table\n", name);
+    munmap(base, st.st_size);
+    free(sp);
+    return NULL;
+  }
+  sp->size = st.st_size;
+  sp->writer = writer;
+  return sp;
+}
+
+/*!
+ * \fn void chn_shm_detach(CHN_SHM *sp)
+ * \brief detach from an exported channel table
+ * \ingroup channel
+ */
+void chn_shm_detach(CHN_SHM *sp)
+{
+  if (sp == NULL) return;
+  munmap(sp->hdr, sp->size);
+  free(sp);
+}
+
+/*!
+ * \fn int chn_shm_nchan(CHN_SHM *sp)
+ * \brief number of channels in an exported channel table
+ * \ingroup channel
+ */
+int chn_shm_nchan(CHN_SHM *sp) { return sp->hdr->nchan; }
+
+/*!
+ * \fn int chn_shm_device(CHN_SHM *sp, char *name, int *size)
+ * \brief find the first channel of a device in an exported table
+ * \ingroup channel
+ *
+ * Returns the channel number of the first channel of the first device
+ * with the given driver name and stores the number of channels in
+ * size (if not NULL), or returns -1 if there is no such device.
+ */
+int chn_shm_device(CHN_SHM *sp, char *name, int *size)
+{
+  int i;
+
+  for (i = 0; i < sp->hdr->ndev; ++i)
+    if (strcmp(sp->dev[i].name, name) == 0) {
+      if (size != NULL) *size = sp->dev[i].size;
+      return sp->dev[i].offset;
+    }
+  return -1;
+}
+
+/*!
+ * \fn uint64_t chn_shm_read(CHN_SHM *sp, double *data, int *stale, int n)
+ * \brief copy the latest frame from an exported channel table
+ * \ingroup channel
+ *
+ * Copies the data (and, if stale is not NULL, the stale flags) for
+ * the first n channels.  The copy is always of a single, complete
+ * frame.  Returns the number of the frame, which can be used to tell
+ * if a new frame has been published since the last call.  If no
+ * complete frame could be copied after CHN_SHM_RETRIES tries, returns
+ * CHN_SHM_BUSY; the data is then not valid and all of the stale flags
+ * are set.
+ */
+uint64_t chn_shm_read(CHN_SHM *sp, double *data, int *stale, int n)
+{
+  struct chn_shm_header *hp = sp->hdr;
+  uint64_t seq, frame;
+  int i, try;
+
+  if (n > hp->nchan) n = hp->nchan;
+  for (try = 0; try < CHN_SHM_RETRIES; ++try) {
+    seq = __atomic_load_n(&hp->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {			/* frame being written */
+      sched_yield();
+      continue;
+    }
+
+    memcpy(data, sp->data, n * sizeof(double));
+    if (stale != NULL)
+      for (i = 0; i < n; ++i) stale[i] = sp->stale[i];
+    frame = __atomic_load_n(&hp->frame, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&hp->seq, __ATOMIC_RELAXED) == seq) return frame;
+  }
+
+  if (stale != NULL)
+    for (i = 0; i < n; ++i) stale[i] = 1;
+  return CHN_SHM_BUSY;
+}
+
+/*!
+ * \fn int chn_shm_write(CHN_SHM *sp, int chan, double value)
+ * \brief set a channel of a virtual device in an exported table
+ * \ingroup channel
+ *
+ * The value is copied into the channel table at the next chn_read()
+ * in the exporting process.  Returns -1 if the table was not attached
+ * as a writer or the channel doesn't belong to a virtual device.
+ */
+int chn_shm_write(CHN_SHM *sp, int chan, double value)
+{
+  int i;
+  uint64_t bits;
+
+  if (!sp->writer || chan < 0 || chan >= sp->hdr->nchan) return -1;
+  for (i = 0; i < sp->hdr->ndev; ++i)
+    if (chan < sp->dev[i].offset + sp->dev[i].size) break;
+  if (i == sp->hdr->ndev || !sp->dev[i].writable) return -1;
+
+  memcpy(&bits, &value, sizeof(double));
+  __atomic_store_n(&sp->in[chan].value, bits, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sp->in[chan].gen, 1, __ATOMIC_RELEASE);
+  return 0;
+}
@@ -0,0 +1,366 @@
+/*!
+ * \file chnstage.c
+ * \brief clamp, deadband, rate limit and derivative stages on channels
+ *
+ * \date 19 Oct 26
+ *
+ * Each channel can be given a list of processing stages in the
+ * channel configuration file, applied in the order they are given:
+ *
+ *   -clamp=lo:hi		limit the value to [lo, hi]
+ *   -deadband=w or lo:hi	zero inside [lo, hi] (or [-w, w]), and
+ *				shifted by the edge of the band outside
+ *   -ratelimit=r or fall:rise	limit the change in one cycle
+ *   -deriv or -deriv=k		k times the change since the last cycle
+ *
+ * The result goes back to the channel, or to another channel given
+ * with -stageout.  The stages run in chn_read(), after the filters
+ * and lookup tables, or with -onwrite at the start of chn_write(), so
+ * that outputs set by the servo routine are limited before they are
+ * written to the hardware.
+ *
+ * chn_stage_init() (called by chn_init) compiles the stages of all of
+ * the channels into a program for each of chn_read() and chn_write().
+ * Channels with the same list of stages are put next to each other
+ * in a work vector, and the program is a list of blocks, each running
+ * one kind of stage over a contiguous part of the work vector with
+ * its parameters in matching arrays.  Each block is a simple loop
+ * without branches that the compiler can vectorize.  A cycle copies
+ * the channel data into the work vector, runs the blocks and copies
+ * the results out.
+ *
+ * The rate limit and derivative start from the first value seen after
+ * chn_init(), so they don't jump on the first cycle.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.h"
+
+/* A stage run over part of the work vector */
+struct chn_stage_block {
+  enum chn_stage_op op;
+  int start, n;				/* part of the work vector */
+  double *a, *b, *s;			/* parameters and state */
+};
+
+/* Stages for chn_read() (0) and chn_write() (1) */
+static struct chn_stage_prog {
+  int nchan, nblock;
+  int *in, *out;			/* channels for the work vector */
+  double *w;				/* work vector */
+  struct chn_stage_block *block;
+  void *arena;				/* everything above, allocated once */
+  int prime;				/* first cycle after chn_init */
+} chn_stage_prog[2];
+
+/* Parse "x" or "x:y" into *a and *b */
+static int chn_stage_pair(char *value, double *a, double *b)
+{
+  switch (sscanf(value, "%lf:%lf", a, b)) {
+  case 1: *b = *a; return 1;
+  case 2: return 2;
+  default: return 0;
+  }
+}
+
+/*!
+ * \fn int chn_stage_add(CHANNEL *cp, char *flag, char *value)
+ * \brief add a stage to a channel (called by chn_parse_option)
+ * \ingroup channel
+ *
+ * flag is the flag name without the - and value its value.  Returns 1
+ * if the flag was handled and -1 on error.
+ */
+int chn_stage_add(CHANNEL *cp, char *flag, char *value)
+{
+  CHN_STAGE *sp;
+  double a, b;
+  int n;
+
+  if ((sp = cp->stages) == NULL) {
+    if ((sp = cp->stages = (CHN_STAGE *) calloc(1, sizeof(CHN_STAGE)))
+	== NULL) {
+      fprintf(stderr, "chn_stage_add: out of memory\n");
+      return -1;
+    }
+    sp->out_chn = cp - chn_chantbl;
+  }
+
+  if (strcmp(flag, "stageout") == 0) {
+    if (sscanf(value, "%d", &sp->out_chn) != 1 || sp->out_chn < 0) {
+      fprintf(stderr, "chn_stage_add: bad channel \"%s\"\n", value);
+      return -1;
+    }
+    return 1;
+  }
+  if (strcmp(flag, "onwrite") == 0) {
+    sp->onwrite = 1;
+    return 1;
+  }
+
+  if (sp->nstage >= CHN_MAXSTAGE) {
+    fprintf(stderr, "chn_stage_add: more than %d stages\n", CHN_MAXSTAGE);
+    return -1;
+  }
+  n = chn_stage_pair(value, &a, &b);
+  if (strcmp(flag, "clamp") == 0 && n == 2 && a <= b) {
+    sp->stage[sp->nstage].op = ChnClamp;
+  } else if (strcmp(flag, "deadband") == 0 && n == 1 && a >= 0) {
+    sp->stage[sp->nstage].op = ChnDeadband;
+    a = -a;
+  } else if (strcmp(flag, "deadband") == 0 && n == 2 && a <= b) {
+    sp->stage[sp->nstage].op = ChnDeadband;
+  } else if (strcmp(flag, "ratelimit") == 0 && n > 0 && a >= 0 && b >= 0) {
+    sp->stage[sp->nstage].op = ChnRateLimit;
+  } else if (strcmp(flag, "deriv") == 0 && (n == 1 || *value == '\0')) {
+    sp->stage[sp->nstage].op = ChnDeriv;
+    if (n == 0) a = 1;
+    b = 0;
+  } else {
+    fprintf(stderr, "chn_stage_add: bad value \"%s\" for \"%s\"\n",
+	    value, flag);
+    return -1;
+  }
+  sp->stage[sp->nstage].a = a;
+  sp->stage[sp->nstage].b = b;
+  ++sp->nstage;
+  return 1;
+}
+
+/*!
+ * \fn void chn_stage_clear(int chan)
+ * \brief remove the stages from a channel
+ * \ingroup channel
+ *
+ * Called when the channel table is (re)built.
+ */
+void chn_stage_clear(int chan)
+{
+  free(chn_chantbl[chan].stages);
+  chn_chantbl[chan].stages = NULL;
+}
+
+/* Compare the lists of stages (not the parameters) on two channels */
+static int chn_stage_cmp(int c1, int c2)
+{
+  CHN_STAGE *s1 = chn_chantbl[c1].stages, *s2 = chn_chantbl[c2].stages;
+  int k;
+
+  if (s1->nstage != s2->nstage) return s1->nstage - s2->nstage;
+  for (k = 0; k < s1->nstage; ++k)
+    if (s1->stage[k].op != s2->stage[k].op)
+      return (int) s1->stage[k].op - (int) s2->stage[k].op;
+  return 0;
+}
+
+/* qsort() order: by list of stages, then by channel */
+static int chn_stage_sort(const void *p1, const void *p2)
+{
+  int c1 = *(const int *) p1, c2 = *(const int *) p2;
+  int cmp = chn_stage_cmp(c1, c2);
+  return cmp != 0 ? cmp : c1 - c2;
+}
+
+/* End of the group of channels with the same stages as chans[i] */
+static int chn_stage_group(int *chans, int i, int n)
+{
+  int j;
+
+  for (j = i + 1; j < n && chn_stage_cmp(chans[i], chans[j]) == 0; ++j);
+  return j;
+}
+
+/* Build the program for one phase from the sorted list of channels */
+static int chn_stage_compile(struct chn_stage_prog *pp, int *chans, int n)
+{
+  struct chn_stage_block *bp;
+  CHN_STAGE *sp;
+  double *param;
+  int i, j, k, c, nblock = 0, nparam = 0;
+  char *mem;
+
+  for (i = 0; i < n; i = j) {
+    j = chn_stage_group(chans, i, n);
+    nblock += chn_chantbl[chans[i]].stages->nstage;
+    nparam += (j - i) * chn_chantbl[chans[i]].stages->nstage;
+  }
+
+  /* One allocation: blocks, parameters and state, work vector, channels */
+  mem = malloc(nblock * sizeof(struct chn_stage_block) +
+	       (3 * nparam + n) * sizeof(double) + 2 * n * sizeof(int));
+  if (mem == NULL) {
+    fprintf(stderr, "chn_stage_init: out of memory\n");
+    return -1;
+  }
+  pp->arena = mem;
+  pp->block = (struct chn_stage_block *) mem;
+  param = (double *) (pp->block + nblock);
+  pp->w = param + 3 * nparam;
+  pp->in = (int *) (pp->w + n);
+  pp->out = pp->in + n;
+  pp->nchan = n;
+  pp->nblock = nblock;
+  pp->prime = 1;
+
+  for (i = 0; i < n; ++i) {
+    pp->in[i] = chans[i];
+    pp->out[i] = chn_chantbl[chans[i]].stages->out_chn;
+  }
+
+  /* A block for each stage of each group */
+  bp = pp->block;
+  for (i = 0; i < n; i = j) {
+    j = chn_stage_group(chans, i, n);
+    for (k = 0; k < chn_chantbl[chans[i]].stages->nstage; ++k, ++bp) {
+      bp->op = chn_chantbl[chans[i]].stages->stage[k].op;
+      bp->start = i;
+      bp->n = j - i;
+      bp->a = param;
+      bp->b = param + bp->n;
+      bp->s = param + 2 * bp->n;
+      param += 3 * bp->n;
+      for (c = 0; c < bp->n; ++c) {
+	sp = chn_chantbl[chans[i + c]].stages;
+	bp->a[c] = sp->stage[k].a;
+	bp->b[c] = sp->stage[k].b;
+	bp->s[c] = 0;
+      }
+    }
+  }
+  return 0;
+}
+
+/*!
+ * \fn int chn_stage_init(void)
+ * \brief compile the stages on all channels
+ * \ingroup channel
+ *
+ * Called by chn_init().  Returns the number of channels with stages.
+ */
+int chn_stage_init(void)
+{
+  int chans[2][CHN_MAXCHN], n[2] = {0, 0};
+  CHN_STAGE *sp;
+  int i, w;
+
+  for (w = 0; w < 2; ++w) {
+    free(chn_stage_prog[w].arena);
+    memset(chn_stage_prog + w, 0, sizeof(struct chn_stage_prog));
+  }
+
+  for (i = 0; i < chn_nchan; ++i) {
+    if ((sp = chn_chantbl[i].stages) == NULL) continue;
+    if (sp->out_chn >= chn_nchan) {
+      fprintf(stderr, "chn_stage_init: channel %d: bad output channel %d\n",
+	      i, sp->out_chn);
+      continue;
+    }
+    w = sp->onwrite != 0;
+    chans[w][n[w]++] = i;
+  }
+
+  for (w = 0; w < 2; ++w) {
+    if (n[w] == 0) continue;
+    qsort(chans[w], n[w], sizeof(int), chn_stage_sort);
+    if (chn_stage_compile(chn_stage_prog + w, chans[w], n[w]) < 0)
+      n[w] = 0;
+  }
+  return n[0] + n[1];
+}
+
+/*!
+ * \fn void chn_stage_run(int onwrite)
+ * \brief run the stages (called by chn_read and chn_write)
+ * \ingroup channel
+ */
+void chn_stage_run(int onwrite)
+{
+  struct chn_stage_prog *pp = chn_stage_prog + (onwrite != 0);
+  struct chn_stage_block *bp;
+  double *x, *a, *b, *s, v;
+  int i, n;
+
+  if (pp->nchan == 0) return;
+  for (i = 0; i < pp->nchan; ++i) pp->w[i] = chn_data(pp->in[i]);
+
+  for (bp = pp->block; bp < pp->block + pp->nblock; ++bp) {
+    x = pp->w + bp->start;
+    a = bp->a; b = bp->b; s = bp->s;
+    n = bp->n;
+    switch (bp->op) {
+    case ChnClamp:
+      for (i = 0; i < n; ++i) {
+	v = x[i] > a[i] ? x[i] : a[i];
+	x[i] = v < b[i] ? v : b[i];
+      }
+      break;
+
+    case ChnDeadband:
+      for (i = 0; i < n; ++i) {
+	v = x[i];
+	x[i] = (v > b[i] ? v - b[i] : 0) + (v < a[i] ? v - a[i] : 0);
+      }
+      break;
+
+    case ChnRateLimit:
+      if (pp->prime) memcpy(s, x, n * sizeof(double));
+      for (i = 0; i < n; ++i) {
+	v = x[i] - s[i];
+	v = v > -a[i] ? v : -a[i];
+	v = v < b[i] ? v : b[i];
+	x[i] = s[i] = s[i] + v;
+      }
+      break;
+
+    case ChnDeriv:
+      if (pp->prime) memcpy(s, x, n * sizeof(double));
+      for (i = 0; i < n; ++i) {
+	v = x[i];
+	x[i] = a[i] * (v - s[i]);
+	s[i] = v;
+      }
+      break;
+    }
+  }
+  pp->prime = 0;
+
+  for (i = 0; i < pp->nchan; ++i) chn_data(pp->out[i]) = pp->w[i];
+}
@@ -46,6 +46,7 @@
 #include "keymap.h"
 #include "channel.h"
 #include "servo.h"
+#include "profile.h"
 // #include "vscope.h"
 #include "fcn_gen.h"
 
@@ -86,6 +87,8 @@ int main(int argc, char **argv)
   dd_bindkey(K_F3, channel_dump_button);
   dd_bindkey(K_F4, channel_init_button);
   dd_bindkey('r', dd_redraw);
+  dd_bindkey('p', prof_display_cb);
+  dd_bindkey('t', prof_trace_cb);
   dd_usetbl(chnmenu);		/* start off on the main menu */
   dd_loop();			/* start the display manager */
   dd_close();			/* close up the screen */
@@ -0,0 +1,454 @@
+/*!
+ * \file corebench.c
+ * \brief timing tests for the servo loop hot paths
+ *
+ * \date 19 Oct 26
+ *
+ * Times the routines that run every servo cycle or that move a lot of
+ * data: chn_read()/chn_write() on tables of virtual and function
+ * generator devices, channel filters of several orders, processing
+ * stages, data capture and dumps, hook lists, dd_update() on a large
+ * display table, the matrix routines (mat_mult() with each kernel over
+ * a range of sizes, and state-space updates done with separate
+ * operations, fused and as a state-space block), mat_load(),
+ * mat_find(), lookup tables and debug messages.  Output is in the
+ * format described in bench.h.  dd_update() is timed with values that
+ * haven't changed, which is the common case; the time to write to the
+ * terminal is not included.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "channel.h"
+#include "display.h"
+#include "hook.h"
+#include "matrix.h"
+#include "ssblock.h"
+#include "lut.h"
+#include "dbglib.h"
+#include "bench.h"
+
+extern int chn_filter(CHANNEL *cp);
+
+static char devfile[] = "/tmp/corebenchXXXXXX.dev";
+static char datfile[] = "/tmp/corebenchXXXXXX.dat";
+static char matfile[] = "/tmp/corebenchXXXXXX.mat";
+
+/* Configure nvirt virtual devices with nvchan channels and nfcn
+   function generators with 4; returns the number of channels */
+static int config(int nvirt, int nvchan, int nfcn)
+{
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen(devfile, "w")) == NULL) { perror(devfile); exit(1); }
+  for (i = 0; i < nvirt; ++i)
+    fprintf(fp, "device: virtual %d 0x%x -scale=2.5;\n", nvchan, i);
+  for (i = 0; i < nfcn; ++i)
+    fprintf(fp, "device: function-gen 4 0x%x;\n", i);
+  fclose(fp);
+
+  chn_close();
+  if (chn_config(devfile) < 0) {
+    fprintf(stderr, "corebench: configuration failed\n");
+    exit(1);
+  }
+  unlink(devfile);
+  return chn_nchan;
+}
+
+/* Give the first nchan channels a filter of the given order */
+static void set_filters(int nchan, int order)
+{
+  static FILTER filt[CHN_MAXCHN];
+  static double a[CHN_MAXCHN][64], b[CHN_MAXCHN][64];
+  static double x[CHN_MAXCHN][64], y[CHN_MAXCHN][64];
+  int i, k;
+
+  for (i = 0; i < nchan; ++i) {
+    filt[i].a = a[i]; filt[i].b = b[i];
+    filt[i].x = x[i]; filt[i].y = y[i];
+    filt[i].na = filt[i].nb = order;
+    filt[i].xi = filt[i].yi = 0;
+    filt[i].out_chn = i;
+    for (k = 0; k < order; ++k) {
+      b[i][k] = 1.0 / order;
+      a[i][k] = k == 0 ? -0.5 : 0.01;
+      x[i][k] = y[i][k] = 0;
+    }
+    chn_chantbl[i].filter = filt + i;
+  }
+}
+
+static int nilhook(void) { return 0; }
+DECL_HOOKLIST(bench_hooks, 16);
+
+/* Write a MATLAB v4 file with nmat n x n matrices */
+static void write_mat(char *file, int nmat, int n)
+{
+  int32_t hdr[5] = {0, 0, 0, 0, 2};
+  double *data = calloc(n * n, sizeof(double));
+  char name[8];
+  FILE *fp = fopen(file, "wb");
+  int i;
+
+  hdr[1] = hdr[2] = n;
+  for (i = 0; i < nmat; ++i) {
+    snprintf(name, sizeof(name), "m%d", i);
+    hdr[4] = strlen(name) + 1;
+    fwrite(hdr, sizeof(hdr), 1, fp);
+    fwrite(name, hdr[4], 1, fp);
+    fwrite(data, sizeof(double), n * n, fp);
+  }
+  fclose(fp);
+  free(data);
+}
+
+/* Square and matrix-vector products with each multiply kernel */
+static void bench_mult(int n)
+{
+  static char *kname[] = {"", " c", " sse2", " avx2"};
+  MATRIX *a = mat_init(n, n), *b = mat_init(n, n), *c = mat_init(n, n);
+  MATRIX *x = mat_init(n, 1), *y = mat_init(n, 1);
+  char name[32];
+  int k;
+
+  for (k = 0; k < n * n; ++k) a->real[k] = b->real[k] = k % 7 - 3;
+  for (k = 0; k < 4; ++k) {
+    mat_mult_kernel = k;
+    snprintf(name, sizeof(name), "mat_mult %dx%d%s", n, n, kname[k]);
+    BENCH(name, 1, mat_mult(c, a, b));
+  }
+  mat_mult_kernel = MAT_KERNEL_AUTO;
+  snprintf(name, sizeof(name), "mat_mult %dx%d*%dx1", n, n, n);
+  BENCH(name, 1, mat_mult(y, a, x));
+  snprintf(name, sizeof(name), "mat_mult %dx%d in place", n, n);
+  BENCH(name, 1, mat_mult(b, a, b));
+  mat_free(a); mat_free(b); mat_free(c); mat_free(x); mat_free(y);
+}
+
+/* State-space and observer updates with n states and n/4 inputs and
+   outputs, as separate operations and fused */
+static void bench_statespace(int n)
+{
+  int p = n < 4 ? 1 : n / 4;
+  MATRIX *A = mat_init(n, n), *B = mat_init(n, p), *C = mat_init(p, n);
+  MATRIX *L = mat_init(n, p), *x = mat_init(n, 1), *u = mat_init(p, 1);
+  MATRIX *y = mat_init(p, 1), *t1 = mat_init(n, 1), *t2 = mat_init(n, 1);
+  MATRIX *r = mat_init(p, 1);
+  SS_BLOCK *sp;
+  char name[32];
+  int k;
+
+  for (k = 0; k < n * n; ++k) A->real[k] = (k % 7 - 3) * 0.01;
+  for (k = 0; k < n * p; ++k) B->real[k] = C->real[k] = L->real[k] = 0.1;
+
+  snprintf(name, sizeof(name), "statespace %d separate", n);
+  BENCH(name, 1, {
+    mat_mult(t1, A, x); mat_mult(t2, B, u); mat_add(x, t1, t2);
+  });
+  snprintf(name, sizeof(name), "statespace %d fused", n);
+  BENCH(name, 1, mat_statespace(x, A, x, B, u));
+  snprintf(name, sizeof(name), "observer %d separate", n);
+  BENCH(name, 1, {
+    mat_mult(r, C, x); mat_subtract(r, y, r); mat_mult(t1, L, r);
+    mat_mult(t2, A, x); mat_add(t1, t1, t2); mat_mult(t2, B, u);
+    mat_add(x, t1, t2);
+  });
+  snprintf(name, sizeof(name), "observer %d fused", n);
+  BENCH(name, 1, mat_observer(x, A, B, L, C, u, y));
+
+  /* The same system as a state-space block (with D = 0) */
+  mat_set_name(A, "A"); mat_set_name(B, "B"); mat_set_name(C, "C");
+  A->next = B; B->next = C; C->next = NULL;
+  sp = ss_create(A, "A", "B", "C", NULL, NULL);
+  A->next = B->next = NULL;
+  snprintf(name, sizeof(name), "ss_step %d", n);
+  BENCH(name, 1, ss_step(sp, u->real, y->real));
+  ss_free(sp);
+
+  mat_free(A); mat_free(B); mat_free(C); mat_free(L); mat_free(x);
+  mat_free(u); mat_free(y); mat_free(t1); mat_free(t2); mat_free(r);
+}
+
+/* Lookup tables with 64 breakpoints (16 x 16 for 2-D), one point at
+   a time and in blocks of 256 */
+static void bench_lut(void)
+{
+  MATRIX *bx = mat_init(64, 1), *bn = mat_init(64, 1), *v = mat_init(64, 1);
+  MATRIX *b16 = mat_init(16, 1), *v2 = mat_init(16, 16);
+  double x[256], y[256], z[256];
+  LUT *tables[3];
+  static char *names[3] = {"uniform", "non-uniform", "2-D"};
+  char name[48];
+  int i, k;
+
+  for (k = 0; k < 64; ++k) {
+    bx->real[k] = k * 0.5;
+    bn->real[k] = k * 0.5 + (k % 3) * 0.1;
+    v->real[k] = (k % 5) * 0.3;
+  }
+  for (k = 0; k < 16; ++k) b16->real[k] = k * 2;
+  for (k = 0; k < 256; ++k) {
+    v2->real[k] = (k % 7) * 0.2;
+    x[k] = (k * 37 % 256) * 0.125;
+    y[k] = (k * 11 % 256) * 0.125;
+  }
+  tables[0] = lut_create(bx, NULL, v);
+  tables[1] = lut_create(bn, NULL, v);
+  tables[2] = lut_create(b16, b16, v2);
+
+  for (i = 0; i < 3; ++i) {
+    snprintf(name, sizeof(name), "lut_eval %s", names[i]);
+    BENCH(name, 256, for (k = 0; k < 256; ++k)
+	  z[k] = lut_eval(tables[i], x[k], y[k]));
+    snprintf(name, sizeof(name), "lut_eval_n %s", names[i]);
+    BENCH(name, 256, lut_eval_n(tables[i], 256, x, y, z));
+    lut_free(tables[i]);
+  }
+  mat_free(bx); mat_free(bn); mat_free(v); mat_free(b16); mat_free(v2);
+}
+
+/* Debug messages: turned off, from a module not in the list, printed
+   to a log file directly and copied for the background thread.  For
+   the last, each run logs fewer messages than a ring holds and then
+   waits (untimed) for the writer to empty it. */
+static void bench_dbg(void)
+{
+  double t0, t1, total = 0;
+  int k = 0, n;
+
+  dbg_outf = 0;
+  dbg_openlog("/dev/null", "w");
+  BENCH("dbg_info off", 1, dbg_info("value %d of %s: %g", k, "x", 1.5));
+  dbg_flag = 1;
+  BENCH("dbg_info not listed", 1, dbg_info("value %d of %s: %g", k, "x", 1.5));
+  dbg_add_module("corebench.c");
+  BENCH("dbg_info direct", 1, dbg_info("value %d of %s: %g", k, "x", 1.5));
+
+  dbg_async_start();
+  for (n = 0; n < 40; ++n) {
+    t0 = bench_now();
+    for (k = 0; k < 200; ++k) dbg_info("value %d of %s: %g", k, "x", 1.5);
+    t1 = bench_now();
+    bench_samp[n] = (t1 - t0) / 200;
+    total += t1 - t0;
+    usleep(30000);
+  }
+  bench_report("dbg_info background", 200, n, total, n);
+  dbg_async_stop();
+
+  dbg_delete_module("corebench.c");
+  dbg_flag = 0;
+  dbg_closelog();
+}
+
+static void bench_matrix(int n)
+{
+  MATRIX *a = mat_init(n, n), *b = mat_init(n, n), *c = mat_init(n, n);
+  MAT_FACTOR *f;
+  char name[32];
+  int i, j;
+
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < n; ++j) {
+      mat_element_set(a, i, j, i == j ? n : 1.0 / (1 + i + j));
+      mat_element_set(b, i, j, i - j);
+    }
+
+  snprintf(name, sizeof(name), "mat_add %dx%d", n, n);
+  BENCH(name, 1, mat_add(c, a, b));
+  snprintf(name, sizeof(name), "mat_transpose %dx%d", n, n);
+  BENCH(name, 1, mat_transpose(c, a));
+
+  snprintf(name, sizeof(name), "mat_inverse %dx%d", n, n);
+  BENCH(name, 1, mat_inverse(c, a));
+  snprintf(name, sizeof(name), "mat_det %dx%d", n, n);
+  BENCH(name, 1, mat_det_f(a));
+  snprintf(name, sizeof(name), "mat_solve %dx%d", n, n);
+  BENCH(name, 1, mat_solve(c, a, b));
+
+  /* Solving with a saved factor */
+  f = mat_factor_init(n);
+  snprintf(name, sizeof(name), "mat_lu %dx%d", n, n);
+  BENCH(name, 1, mat_lu(f, a));
+  snprintf(name, sizeof(name), "mat_chol %dx%d", n, n);
+  BENCH(name, 1, mat_chol(f, a));
+  snprintf(name, sizeof(name), "mat_factor_solve %dx%d", n, n);
+  BENCH(name, 1, mat_factor_solve(c, f, b));
+  mat_factor_free(f);
+
+  mat_free(a); mat_free(b); mat_free(c);
+}
+
+int main(int argc, char **argv)
+{
+  static int ndevs[] = {1, 4, 16}, orders[] = {2, 8, 32};
+  static int nfilt[] = {1, 16, 64}, nhooks[] = {1, 4, 16};
+  static int sizes[] = {4, 16, 64};
+  static int msizes[] = {2, 3, 4, 6, 8, 12, 16, 32, 64, 128, 256};
+  static int nstates[] = {4, 16, 64, 256, 512};
+  char name[32];
+  DD_IDENT *tbl;
+  double *values, *current;
+  int i, j, n, nchan, fd;
+
+  if ((fd = mkstemps(devfile, 4)) < 0 || close(fd) < 0 ||
+      (fd = mkstemps(datfile, 4)) < 0 || close(fd) < 0 ||
+      (fd = mkstemps(matfile, 4)) < 0 || close(fd) < 0) {
+    perror("corebench");
+    return 1;
+  }
+  if (argc > 1) bench_time = atof(argv[1]);
+  bench_header("corebench");
+  chn_cache_enable = 0;
+
+  /* Read and write cycles */
+  for (i = 0; i < 3; ++i) {
+    config(ndevs[i], 8, ndevs[i]);
+    snprintf(name, sizeof(name), "chn_read %d+%d", ndevs[i], ndevs[i]);
+    BENCH(name, 1, chn_read());
+    snprintf(name, sizeof(name), "chn_write %d+%d", ndevs[i], ndevs[i]);
+    BENCH(name, 1, chn_write());
+  }
+
+  /* Channel filters; time per filtered channel */
+  config(1, 64, 0);
+  for (i = 0; i < 3; ++i)
+    for (j = 0; j < 3; ++j) {
+      set_filters(nfilt[j], orders[i]);
+      snprintf(name, sizeof(name), "chn_filter o%d x%d", orders[i], nfilt[j]);
+      BENCH(name, nfilt[j], for (n = 0; n < nfilt[j]; ++n)
+	    chn_filter(chn_chantbl + n));
+    }
+  for (n = 0; n < 64; ++n) chn_chantbl[n].filter = NULL;
+
+  /* Processing stages on 64 channels; the same three stages on every
+     channel, then one of four different lists on each */
+  for (i = 0; i < 2; ++i) {
+    static char *flags[4] = {"clamp", "deadband", "ratelimit", "deriv"};
+    static char *values[4] = {"-1:1", "0.1", "0.5", "100"};
+
+    for (n = 0; n < 64; ++n) {
+      chn_stage_clear(n);
+      for (j = 0; j < 3; ++j) {
+	int k = i == 0 ? j : (n + j) % 4;
+	chn_stage_add(chn_chantbl + n, flags[k], values[k]);
+      }
+    }
+    chn_stage_init();
+    BENCH(i == 0 ? "chn_stage 64 same" : "chn_stage 64 mixed", 64,
+	  chn_stage_run(0));
+  }
+  for (n = 0; n < 64; ++n) chn_stage_clear(n);
+  chn_stage_init();
+
+  /* Hook lists */
+  for (i = 0; i < 3; ++i) {
+    hook_clear(bench_hooks);
+    for (j = 0; j < nhooks[i]; ++j) hook_add(bench_hooks, nilhook);
+    snprintf(name, sizeof(name), "hook_execute %d", nhooks[i]);
+    BENCH(name, 1, hook_execute(bench_hooks));
+  }
+
+  /* Data capture (time per channel stored) and dump (per value) */
+  nchan = config(8, 8, 0);
+  chn_capture_on();
+  BENCH("chn_capture", nchan, {
+    if (!chn_capture_flag) chn_capture_on();
+    chn_capture();
+  });
+  chn_capture_on();
+  while (chn_capture_flag) chn_capture();
+  n = chn_capture_offset;
+  BENCH("chn_capture_dump", n, chn_capture_dump(datfile));
+  unlink(datfile);
+  chn_capture_off();
+  chn_close();
+
+  /* Display update with 1000 unchanged double entries */
+  n = 1000;
+  tbl = calloc(n + 1, sizeof(DD_IDENT));
+  values = calloc(n, sizeof(double));
+  current = calloc(n, sizeof(double));
+  for (i = 0; i < n; ++i) {
+    tbl[i].row = 1 + i % 20;
+    tbl[i].col = 1 + 10 * (i / 20 % 8);
+    tbl[i].value = values + i;
+    tbl[i].function = dd_double;
+    tbl[i].format = "%8.3f";
+    tbl[i].current = (char *) (current + i);
+    tbl[i].type = Data;
+    tbl[i].length = -1;
+    tbl[i].initialized = 1;
+  }
+  ddtbl = tbl;
+  BENCH("dd_update 1000", n, dd_update());
+  ddtbl = NULL;
+  free(tbl); free(values); free(current);
+
+  /* Matrix operations */
+  for (i = 0; i < sizeof(msizes) / sizeof(int); ++i) bench_mult(msizes[i]);
+  for (i = 0; i < 5; ++i) bench_statespace(nstates[i]);
+  for (i = 0; i < 3; ++i) bench_matrix(sizes[i]);
+
+  /* Loading a MATLAB file with 16 matrices */
+  for (i = 0; i < 3; ++i) {
+    write_mat(matfile, 16, sizes[i]);
+    snprintf(name, sizeof(name), "mat_load 16x%dx%d", sizes[i], sizes[i]);
+    BENCH(name, 1, mat_list_free(mat_load(matfile)));
+  }
+  write_mat(matfile, 1, 512);
+  BENCH("mat_load 1x512x512", 1, mat_list_free(mat_load(matfile)));
+
+  /* Looking up a name in a file with 1000 matrices */
+  write_mat(matfile, 1000, 1);
+  {
+    MATRIX *list = mat_load(matfile);
+    BENCH("mat_find 1000", 1, mat_find(list, "m999"));
+    mat_list_free(list);
+  }
+  unlink(matfile);
+
+  bench_lut();
+  bench_dbg();
+
+  return 0;
+}
@@ -54,14 +54,36 @@ extern "C"
 
 enum dbg_type {DBG_INFO=0x01, DBG_WARN=0x02, DBG_ERROR=0x04, DBG_PANIC=0x08};
 
+/*
+ * Each call site keeps a static record of its file and line, whether
+ * its module is in the debug list (looked up again only when the list
+ * changes) and, for background logging, its parsed format.
+ */
+struct dbg_site {
+  enum dbg_type type;
+  const char *module;			/* file name */
+  int line;
+  int gen;				/* module list version of lookup */
+  int active;				/* module is in the list */
+  void *format;				/* parsed format (debug.c) */
+};
+
+#define _dbg_site_log(type, ...) do { \
+  static struct dbg_site _dbg_site = {type, __FILE__, __LINE__, -1, 0, NULL}; \
+  if (dbg_flag) _dbg_log(&_dbg_site, __VA_ARGS__); \
+} while (0)
+
 /* Define dbg_printf to give us the file name and line of the message */
-#define dbg_info(...) _dbg_printf(DBG_INFO, __FILE__, __LINE__, __VA_ARGS__);
-#define dbg_warn(...) _dbg_printf(DBG_WARN, __FILE__, __LINE__, __VA_ARGS__);
-#define dbg_error(...) _dbg_printf(DBG_ERROR, __FILE__, __LINE__, __VA_ARGS__);
-#define dbg_panic(...) _dbg_printf(DBG_PANIC, __FILE__, __LINE__, __VA_ARGS__);
+#define dbg_info(...) _dbg_site_log(DBG_INFO, __VA_ARGS__)
+#define dbg_warn(...) _dbg_site_log(DBG_WARN, __VA_ARGS__)
+#define dbg_error(...) _dbg_site_log(DBG_ERROR, __VA_ARGS__)
+#define dbg_panic(...) _dbg_site_log(DBG_PANIC, __VA_ARGS__)
 
 /* Debug routines */
 void _dbg_printf(enum dbg_type, char *file, int line, char *fmt, ...);
+void _dbg_log(struct dbg_site *, const char *fmt, ...);
+int dbg_async_start(void);
+int dbg_async_stop(void);
 int dbg_openlog(char *, char *);
 int dbg_closelog();
 int dbg_flushlog();
@@ -77,6 +99,7 @@ extern int dbg_flag;			/* print debug information? */
 extern int dbg_all;			/* debug all modules? */
 extern int dbg_outf;			/* print debugging output (+ mask) */
 extern int dbg_logf;			/* log debugging output (+ mask) */
+extern int dbg_async;			/* log from a background thread? */
 extern FILE *dbg_infofile;		/* file for informational output */
 extern FILE *dbg_warnfile;		/* file for warning output */
 extern FILE *dbg_errorfile;		/* file for error output */
@@ -0,0 +1,195 @@
+/*!
+ * \file dbgtst.c
+ * \brief test debug messages
+ *
+ * \date 19 Oct 26
+ *
+ * Logs messages to a file, printed directly and then from the
+ * background thread, and compares them with the same formats run
+ * through snprintf(), including formats that have to be formatted by
+ * the caller.  Checks that adding and deleting modules is seen by call
+ * sites that have already looked up their module, that messages from
+ * several threads all arrive, and that every message is either logged
+ * or counted as dropped.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "dbglib.h"
+
+#define TST_NAME "dbgtst"
+#include "tstutil.h"
+
+#define NTHREAD 4
+#define NMSG 100
+
+static char logfile[] = "/tmp/dbgtstXXXXXX.log";
+static char expect[64][400];
+static int nexpect;
+
+/* Log one message of each kind, saving what it should look like */
+#define LOG(...) do { \
+  dbg_info(__VA_ARGS__); \
+  snprintf(expect[nexpect++], sizeof(expect[0]), __VA_ARGS__); \
+} while (0)
+
+static void log_formats(void)
+{
+  char *null = NULL, big[300];
+  int x = 7;
+  static char *fmts[] = {"first %s", "second %s"};
+  int i;
+
+  memset(big, 'y', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+
+  nexpect = 0;
+  LOG("plain message");
+  LOG("ints %d %5u %-4x| %hd %hhu %c", -12, 34u, 0xbeef, (short) -5,
+      (unsigned char) 200, 'q');
+  LOG("longs %ld %lld %lu %zu %jd %td", -1234567890123L, -5LL, 99UL,
+      (size_t) 42, (intmax_t) -7, (ptrdiff_t) 3);
+  LOG("doubles %f %.3e %10.4g %a", 3.25, -1e-7, 2.0 / 3, 0.5);
+  LOG("strings [%s] [%8s] [%-6.2s] %s", "abc", "right", "left", "and %d");
+  LOG("pointer %p percent 100%%", (void *) &x);
+  LOG("width %*d precision %.*f", 6, 42, 2, 3.14159);	/* caller formats */
+  LOG("count %d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9);
+  LOG("%s", big);
+  for (i = 0; i < 2; ++i)
+    LOG(fmts[i], i == 0 ? "1" : "2");		/* format changes */
+  dbg_info("null %s", null);
+  strcpy(expect[nexpect++], "null (null)");
+}
+
+/* Check the messages in the log file against the expected ones */
+static int check_log(int nmsg, char *when)
+{
+  char line[2000], *s;
+  int n = 0, bad = 0;
+  FILE *fp;
+
+  if ((fp = fopen(logfile, "r")) == NULL) return -1;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strncmp(line, "====", 4) == 0 || strstr(line, "new logfile") != NULL)
+      continue;
+    if ((s = strchr(line, '@')) == NULL || (s = strstr(s, ": ")) == NULL) {
+      ++bad;
+      continue;
+    }
+    s[strlen(s) - 1] = '\0';
+    /* Long strings are cut off when logged in the background */
+    if (n < nmsg && strcmp(s + 2, expect[n]) != 0 &&
+	(strlen(s + 2) < 150 ||
+	 strncmp(s + 2, expect[n], strlen(s + 2)) != 0)) {
+      fprintf(stderr, "dbgtst: %s: got '%s', want '%s'\n", when, s + 2,
+	      expect[n]);
+      ++bad;
+    }
+    ++n;
+  }
+  fclose(fp);
+  if (n != nmsg) {
+    fprintf(stderr, "dbgtst: %s: %d messages, want %d\n", when, n, nmsg);
+    ++bad;
+  }
+  if (bad) status = 1;
+  return n;
+}
+
+static int count_lines(char *pattern)
+{
+  char line[2000];
+  int n = 0;
+  FILE *fp = fopen(logfile, "r");
+
+  if (fp == NULL) return -1;
+  while (fgets(line, sizeof(line), fp) != NULL)
+    if (strstr(line, pattern) != NULL) ++n;
+  fclose(fp);
+  return n;
+}
+
+static void *logger(void *arg)
+{
+  int i;
+
+  for (i = 0; i < NMSG; ++i)
+    dbg_warn("thread %ld message %d", (long) arg, i);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t thread[NTHREAD];
+  char line[64];
+  int i, dropped;
+
+  tst_tmpfile(logfile, 4);
+  dbg_flag = 1;
+  dbg_outf = 0;
+  check(dbg_openlog(logfile, "w") == 0, "can't open log");
+
+  /* Module list: messages only appear while the module is in the list */
+  for (i = 0; i < 4; ++i) {
+    if (i == 1) dbg_add_module("dbg*.c");
+    if (i == 2) dbg_delete_module("dbg*.c");
+    if (i == 3) dbg_add_module("dbgtst.c");
+    dbg_info("module %d", i);
+  }
+  dbg_flushlog();
+  check(count_lines("module 1") == 1 && count_lines("module 3") == 1 &&
+	count_lines("module 0") == 0 && count_lines("module 2") == 0,
+	"module list changes not seen");
+
+  /* Printed directly, then from the background thread */
+  dbg_closelog();
+  dbg_openlog(logfile, "w");
+  log_formats();
+  dbg_flushlog();
+  check_log(nexpect, "direct");
+
+  dbg_closelog();
+  dbg_openlog(logfile, "w");
+  check(dbg_async_start() == 0, "can't start background logging");
+  fprintf(stderr, "dbgtst: expect 1 error message:\n");
+  check(dbg_async_start() < 0, "background logging started twice");
+  log_formats();
+  check(dbg_async_stop() == 0, "messages dropped");
+  check(dbg_async_stop() < 0, "background logging stopped twice");
+  check_log(nexpect, "background");
+
+  /* Several threads */
+  dbg_closelog();
+  dbg_openlog(logfile, "w");
+  dbg_async_start();
+  for (i = 0; i < NTHREAD; ++i)
+    pthread_create(thread + i, NULL, logger, (void *) (long) i);
+  for (i = 0; i < NTHREAD; ++i) pthread_join(thread[i], NULL);
+  check(dbg_async_stop() == 0, "messages dropped (threads)");
+  for (i = 0; i < NTHREAD; ++i) {
+    sprintf(line, "thread %d message ", i);
+    check(count_lines(line) == NMSG, "messages from a thread missing");
+  }
+  check(count_lines("thread 2 message 99") == 1, "last message missing");
+
+  /* A burst bigger than the ring: everything is logged or counted */
+  dbg_closelog();
+  dbg_openlog(logfile, "w");
+  dbg_async_start();
+  for (i = 0; i < 5000; ++i) dbg_info("burst %d", i);
+  dropped = dbg_async_stop();
+  check(count_lines("burst ") + dropped == 5000, "burst messages lost");
+  check(dropped == 0 || count_lines("messages dropped") > 0,
+	"drops not reported");
+
+  dbg_closelog();
+  unlink(logfile);
+  return status;
+}
@@ -0,0 +1,165 @@
+/*!
+ * \file ddindex.c
+ * \brief hash index of variable names in display tables
+ *
+ * \date 19 Oct 26
+ *
+ * The load, save and rebind functions look up display entries by
+ * their variable name.  For large tables a linear search using
+ * strcmp() for every name that is read gets expensive, so we keep a
+ * small cache of hash indices, one per display table.  The index for
+ * a table is built the first time that it is needed and thrown away
+ * whenever the table is (re)installed using dd_usetbl().
+ *
+ * \ingroup display
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "display.h"
+
+#define DD_MAXINDEX 8			/* number of tables we keep indices for */
+
+/* Index for a single display table (open addressing, linear probing) */
+struct dd_index {
+  DD_IDENT *tbl;			/* table that is indexed (or NULL) */
+  unsigned size;			/* number of slots (power of 2) */
+  int *slot;				/* entry offset + 1; 0 if empty */
+  unsigned long age;			/* last use, for replacement */
+};
+
+static struct dd_index dd_indextbl[DD_MAXINDEX];
+static unsigned long dd_index_clock = 0;
+
+/* Hash function for variable names (FNV-1a) */
+static unsigned dd_index_hash(const char *s)
+{
+  unsigned h = 2166136261u;
+  while (*s) { h ^= (unsigned char) *s++; h *= 16777619u; }
+  return h;
+}
+
+/* Build the index for a table in the given cache slot */
+static int dd_index_build(struct dd_index *ip, DD_IDENT *tbl)
+{
+  int entry, nentries;
+  unsigned size, h;
+
+  /* Size the table so that it is never more than half full */
+  for (nentries = 0; tbl[nentries].value != NULL; ++nentries);
+  for (size = 16; size < 2 * (unsigned) nentries; size <<= 1);
+
+  free(ip->slot);
+  ip->tbl = NULL;
+  if ((ip->slot = (int *) calloc(size, sizeof(int))) == NULL) return -1;
+  ip->size = size;
+
+  /* Insert entries in order; the first entry with a given name wins */
+  for (entry = 0; entry < nentries; ++entry) {
+    if (tbl[entry].varname[0] == '\0') continue;
+    for (h = dd_index_hash(tbl[entry].varname) & (size - 1); ip->slot[h];
+	 h = (h + 1) & (size - 1))
+      if (strcmp(tbl[ip->slot[h] - 1].varname, tbl[entry].varname) == 0)
+	break;
+    if (ip->slot[h] == 0) ip->slot[h] = entry + 1;
+  }
+
+  ip->tbl = tbl;
+  return 0;
+}
+
+/*!
+ * \fn int dd_lookup_tbl(char *name, DD_IDENT *tbl)
+ * \brief find the offset of a named entry in a display table
+ * \ingroup display
+ *
+ * Returns the offset of the first entry in the table whose variable
+ * name matches name, or -1 if there is no such entry.  Entries
+ * without a variable name are never matched.
+ */
+int dd_lookup_tbl(char *name, DD_IDENT *tbl)
+{
+  struct dd_index *ip, *oldest = dd_indextbl;
+  unsigned h;
+  int i;
+
+  if (tbl == NULL || name == NULL || *name == '\0') return -1;
+
+  /* Find the index for this table, or the slot to build it in */
+  for (ip = NULL, i = 0; i < DD_MAXINDEX; ++i) {
+    if (dd_indextbl[i].tbl == tbl) { ip = dd_indextbl + i; break; }
+    if (dd_indextbl[i].age < oldest->age) oldest = dd_indextbl + i;
+  }
+  if (ip == NULL) {
+    if (dd_index_build(ip = oldest, tbl) < 0) {
+      /* Out of memory; fall back to a linear search */
+      for (i = 0; tbl[i].value != NULL; ++i)
+	if (strcmp(tbl[i].varname, name) == 0) return i;
+      return -1;
+    }
+  }
+  ip->age = ++dd_index_clock;
+
+  for (h = dd_index_hash(name) & (ip->size - 1); ip->slot[h];
+       h = (h + 1) & (ip->size - 1))
+    if (strcmp(tbl[ip->slot[h] - 1].varname, name) == 0)
+      return ip->slot[h] - 1;
+
+  return -1;
+}
+
+/*!
+ * \fn void dd_index_clear(DD_IDENT *tbl)
+ * \brief discard the variable name index for a table
+ * \ingroup display
+ *
+ * This function should be called if the variable names in a table
+ * are changed.  It is called automatically by dd_usetbl().  If tbl
+ * is NULL, all indices are discarded.
+ */
+void dd_index_clear(DD_IDENT *tbl)
+{
+  int i;
+
+  for (i = 0; i < DD_MAXINDEX; ++i) {
+    if (tbl != NULL && dd_indextbl[i].tbl != tbl) continue;
+    free(dd_indextbl[i].slot);
+    dd_indextbl[i].slot = NULL;
+    dd_indextbl[i].tbl = NULL;
+    dd_indextbl[i].age = 0;
+  }
+}
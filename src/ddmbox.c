@@ -0,0 +1,256 @@
+/*!
+ * \file ddmbox.c
+ * \brief mailbox for passing display writes to the servo thread
+ *
+ * \date 19 Oct 26
+ *
+ * When the user enters a new value on the display, the display
+ * manager normally stores it directly into the variable that the
+ * entry points to.  If the variable is being used by the servo loop
+ * in another thread, the servo loop can see a double or a string that
+ * is only partly written.  Entries that have the mailbox flag set
+ * (see dd_setmbox_tbl()) instead post the new value to a queue, and
+ * the servo thread copies the values into place at the start of its
+ * next cycle, between runs of the servo routine.
+ *
+ * The queue is a bounded, lock-free ring.  Any thread may post to it
+ * and the servo thread is the only consumer.  Each slot has a sequence
+ * number that tells producers when the slot is free and the consumer
+ * when it is full, so neither side ever waits for the other.
+ *
+ * Functions can be posted as well as values, for operations such as
+ * chn_zero() that must not run at the same time as the servo loop.
+ *
+ * \ingroup display
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "display.h"
+
+#define DD_MBOX_SIZE 256		/* number of slots (power of 2) */
+
+struct dd_mbox_slot {
+  unsigned long seq;			/* slot sequence number */
+  void *dst;				/* where to store the data */
+  int (*fcn)(long);			/* or function to call */
+  long arg;
+  size_t len;
+  char data[DD_MBOX_DATALEN];
+};
+
+static struct dd_mbox_slot dd_mbox[DD_MBOX_SIZE];
+static unsigned long dd_mbox_head = 0;	/* next slot to apply */
+static unsigned long dd_mbox_tail = 0;	/* next slot to fill */
+static pthread_once_t dd_mbox_once = PTHREAD_ONCE_INIT;
+
+int dd_mbox_enable = 0;			/* set when a consumer is running */
+
+static void dd_mbox_init(void)
+{
+  unsigned long i;
+  for (i = 0; i < DD_MBOX_SIZE; ++i) dd_mbox[i].seq = i;
+}
+
+/* Claim a slot for writing; returns NULL if the queue is full */
+static struct dd_mbox_slot *dd_mbox_claim(unsigned long *posp)
+{
+  struct dd_mbox_slot *sp;
+  unsigned long pos, seq;
+  long diff;
+
+  pthread_once(&dd_mbox_once, dd_mbox_init);
+  pos = __atomic_load_n(&dd_mbox_tail, __ATOMIC_RELAXED);
+  for (;;) {
+    sp = dd_mbox + (pos & (DD_MBOX_SIZE - 1));
+    seq = __atomic_load_n(&sp->seq, __ATOMIC_ACQUIRE);
+    diff = (long) (seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&dd_mbox_tail, &pos, pos + 1, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	break;
+    } else if (diff < 0)
+      return NULL;			/* full */
+    else
+      pos = __atomic_load_n(&dd_mbox_tail, __ATOMIC_RELAXED);
+  }
+  *posp = pos;
+  return sp;
+}
+
+/*!
+ * \fn int dd_mbox_post(void *dst, void *src, size_t len)
+ * \brief queue a write of len bytes from src to dst
+ * \ingroup display
+ *
+ * The data is copied when it is posted.  Returns 0 on success or -1
+ * if the data is too long or the queue is full.
+ */
+int dd_mbox_post(void *dst, void *src, size_t len)
+{
+  struct dd_mbox_slot *sp;
+  unsigned long pos;
+
+  if (len > DD_MBOX_DATALEN || (sp = dd_mbox_claim(&pos)) == NULL)
+    return -1;
+  sp->dst = dst;
+  sp->fcn = NULL;
+  sp->len = len;
+  memcpy(sp->data, src, len);
+  __atomic_store_n(&sp->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*!
+ * \fn int dd_mbox_call(int (*fcn)(long), long arg)
+ * \brief queue a function to be called from the servo thread
+ * \ingroup display
+ */
+int dd_mbox_call(int (*fcn)(long), long arg)
+{
+  struct dd_mbox_slot *sp;
+  unsigned long pos;
+
+  if ((sp = dd_mbox_claim(&pos)) == NULL) return -1;
+  sp->dst = NULL;
+  sp->fcn = fcn;
+  sp->arg = arg;
+  __atomic_store_n(&sp->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*!
+ * \fn int dd_mbox_apply(int max)
+ * \brief apply queued writes (called from the servo thread)
+ * \ingroup display
+ *
+ * Applies at most max entries, so that the time taken is bounded, and
+ * returns the number applied.  Entries are applied in the order in
+ * which they were posted.
+ */
+int dd_mbox_apply(int max)
+{
+  struct dd_mbox_slot *sp;
+  unsigned long pos = dd_mbox_head;
+  int n;
+
+  pthread_once(&dd_mbox_once, dd_mbox_init);
+  for (n = 0; n < max; ++n, ++pos) {
+    sp = dd_mbox + (pos & (DD_MBOX_SIZE - 1));
+    if (__atomic_load_n(&sp->seq, __ATOMIC_ACQUIRE) != pos + 1) break;
+
+    if (sp->fcn != NULL) (*sp->fcn)(sp->arg);
+    else memcpy(sp->dst, sp->data, sp->len);
+    __atomic_store_n(&sp->seq, pos + DD_MBOX_SIZE, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&dd_mbox_head, pos, __ATOMIC_RELEASE);
+  return n;
+}
+
+/*!
+ * \fn int dd_mbox_sync(void)
+ * \brief wait until everything posted so far has been applied
+ * \ingroup display
+ *
+ * Gives up after about a second (for example if the servo loop has
+ * stopped) and returns -1 in that case.
+ */
+int dd_mbox_sync(void)
+{
+  unsigned long tail = __atomic_load_n(&dd_mbox_tail, __ATOMIC_ACQUIRE);
+  int i;
+
+  for (i = 0; i < 10000; ++i) {
+    if ((long) (__atomic_load_n(&dd_mbox_head, __ATOMIC_ACQUIRE) - tail) >= 0)
+      return 0;
+    usleep(100);
+  }
+  return -1;
+}
+
+/*!
+ * \fn int dd_store(DD_IDENT *dd, void *src, size_t len)
+ * \brief store a new value for a display entry
+ * \ingroup display
+ *
+ * Used by display managers to store values that have been entered or
+ * loaded.  If the entry has the mailbox flag set and a consumer is
+ * running, the value is posted to the mailbox; otherwise it is copied
+ * directly.  If the mailbox is full (loading a large table, for
+ * instance), waits for the servo to apply what is queued and tries
+ * again.  Returns -1 (after prompting the user) if the value still
+ * couldn't be posted.
+ */
+int dd_store(DD_IDENT *dd, void *src, size_t len)
+{
+  if (!dd->mailbox || !dd_mbox_enable) {
+    memcpy(dd->value, src, len);
+    return 0;
+  }
+  if (dd_mbox_post(dd->value, src, len) < 0 &&
+      (dd_mbox_sync() < 0 || dd_mbox_post(dd->value, src, len) < 0)) {
+    DD_PROMPT("update not applied (mailbox full)");
+    return -1;
+  }
+  return 0;
+}
+
+/*!
+ * \fn int dd_setmbox_tbl(int offset, int flag, DD_IDENT *tbl)
+ * \brief route writes to a display entry through the mailbox
+ * \ingroup display
+ *
+ * Sets (flag nonzero) or clears the mailbox flag for the entry at
+ * offset, or for every entry in the table if offset is -1.
+ */
+int dd_setmbox(int offset, int flag) {
+  return dd_setmbox_tbl(offset, flag, ddtbl);
+}
+int dd_setmbox_tbl(int offset, int flag, DD_IDENT *tbl)
+{
+  int i;
+
+  if (tbl == NULL) return -1;
+  if (offset >= 0) {
+    tbl[offset].mailbox = flag != 0;
+    return 0;
+  }
+  for (i = 0; tbl[i].value != NULL; ++i) tbl[i].mailbox = flag != 0;
+  return 0;
+}
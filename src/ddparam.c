@@ -0,0 +1,444 @@
+/*!
+ * \file ddparam.c
+ * \brief versioned parameter sets for display tables
+ *
+ * \date 19 Oct 26
+ *
+ * dd_load() applies values one at a time, directly into the variables
+ * used by the servo loop, so a servo routine running at the same time
+ * can see a partially loaded set of gains.  The functions in this
+ * file manage the saveable numeric entries of a display table as a
+ * parameter set:
+ *
+ *   dd_pset_create	create a parameter set for a display table
+ *   dd_pset_load	load and validate a file into a new version
+ *   dd_pset_apply	copy the current version into the variables
+ *   dd_pset_rollback	go back to a previous version
+ *   dd_pset_save	save the current version to a file
+ *
+ * A file is parsed into a shadow buffer and checked before it becomes
+ * a new version.  Versions are kept in a ring so that rolling back is
+ * just a matter of changing which version is current.  The servo
+ * routine calls dd_pset_apply() at the top of each cycle; this is the
+ * only place where the variables themselves are written, so the servo
+ * always sees a complete set.
+ *
+ * A version buffer must not be overwritten while the servo is copying
+ * it.  dd_pset_load() therefore waits (briefly) until the servo has
+ * applied the last change before it writes a new version; after that
+ * the servo isn't copying anything until the new version is published.
+ *
+ * Loading, rollback and saving should all be done from a single
+ * thread (normally the display thread).
+ *
+ * \ingroup display
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "display.h"
+
+/* Parameter set entry: one saveable variable in the table */
+struct dd_pset_entry {
+  char *name;				/* variable name */
+  void *value;				/* address of the variable */
+  int (*function)(DD_ACTION, int);	/* manager (determines type) */
+  int size;				/* size of the variable */
+  int offset;				/* offset into a version buffer */
+};
+
+struct dd_pset {
+  DD_IDENT *tbl;			/* display table */
+  int nentries;				/* number of managed entries */
+  struct dd_pset_entry *entry;		/* list of entries */
+  int *map;				/* table offset -> entry (or -1) */
+  int bufsize;				/* size of one version */
+  int nslots;				/* number of version buffers */
+  char *ring;				/* version buffers */
+  char *shadow;				/* buffer for loading files */
+  int latest;				/* most recent version */
+  int current;				/* version that should be in use */
+  int applied;				/* version copied to the variables */
+  int (*validate)(char *, void *);	/* optional validation function */
+};
+
+#define SLOT(ps, v)	((ps)->ring + ((v) % (ps)->nslots) * (ps)->bufsize)
+
+/* Figure out the size of a variable from its manager */
+static int dd_pset_size(int (*function)(DD_ACTION, int))
+{
+  if (function == dd_double) return sizeof(double);
+  if (function == dd_float) return sizeof(float);
+  if (function == dd_short) return sizeof(int);
+  if (function == dd_long) return sizeof(long);
+  if (function == dd_byte) return sizeof(char);
+  return 0;				/* not a supported type */
+}
+
+/* Convert a string to a value of the right type */
+static int dd_pset_scan(struct dd_pset_entry *ep, char *s, void *value)
+{
+  int itmp;
+
+  if (ep->function == dd_double) return sscanf(s, "%lf", (double *) value);
+  if (ep->function == dd_float) return sscanf(s, "%f", (float *) value);
+  if (ep->function == dd_short) return sscanf(s, "%d", (int *) value);
+  if (ep->function == dd_long) return sscanf(s, "%ld", (long *) value);
+  if (sscanf(s, "%d", &itmp) != 1) return 0;
+  *(char *) value = itmp;
+  return 1;
+}
+
+/* Print a value of the right type (exactly, so that it reloads) */
+static void dd_pset_print(FILE *fp, struct dd_pset_entry *ep, void *value)
+{
+  if (ep->function == dd_double)
+    fprintf(fp, "%s\t%.17g\n", ep->name, *(double *) value);
+  else if (ep->function == dd_float)
+    fprintf(fp, "%s\t%.9g\n", ep->name, *(float *) value);
+  else if (ep->function == dd_short)
+    fprintf(fp, "%s\t%d\n", ep->name, *(int *) value);
+  else if (ep->function == dd_long)
+    fprintf(fp, "%s\t%ld\n", ep->name, *(long *) value);
+  else
+    fprintf(fp, "%s\t%d\n", ep->name, *(char *) value);
+}
+
+/* Find an entry by name */
+static struct dd_pset_entry *dd_pset_find(DD_PSET *ps, char *name)
+{
+  int i = dd_lookup_tbl(name, ps->tbl);
+
+  if (i < 0 || ps->map[i] < 0) return NULL;
+  return ps->entry + ps->map[i];
+}
+
+/*!
+ * \fn DD_PSET *dd_pset_create(DD_IDENT *tbl, int depth)
+ * \brief create a parameter set for a display table
+ * \ingroup display
+ *
+ * Creates a parameter set containing all of the saveable numeric
+ * entries (double, float, short, long and byte) in tbl and keeps up
+ * to depth previous versions for rollback.  The current values of the
+ * variables become version 0.  Returns NULL on error.
+ */
+DD_PSET *dd_pset_create(DD_IDENT *tbl, int depth)
+{
+  DD_PSET *ps;
+  int i, n, size;
+
+  if (tbl == NULL || depth < 0) return NULL;
+  if ((ps = (DD_PSET *) calloc(1, sizeof(DD_PSET))) == NULL) return NULL;
+  ps->tbl = tbl;
+
+  /* Allocate space for the entries and the map from the table */
+  for (i = 0; tbl[i].value != NULL; ++i);
+  ps->entry = (struct dd_pset_entry *)
+    calloc(i + 1, sizeof(struct dd_pset_entry));
+  ps->map = (int *) calloc(i + 1, sizeof(int));
+  if (ps->entry == NULL || ps->map == NULL) {
+    dd_pset_free(ps);
+    return NULL;
+  }
+
+  /* Lay out the entries in a version buffer (8 byte aligned) */
+  for (i = n = 0; tbl[i].value != NULL; ++i) {
+    ps->map[i] = -1;
+    if (tbl[i].varname[0] == '\0') continue;
+    if ((size = dd_pset_size(tbl[i].function)) == 0) continue;
+
+    ps->map[i] = n;
+    ps->entry[n].name = tbl[i].varname;
+    ps->entry[n].value = tbl[i].value;
+    ps->entry[n].function = tbl[i].function;
+    ps->entry[n].size = size;
+    ps->entry[n].offset = ps->bufsize;
+    ps->bufsize += (size + 7) & ~7;
+    ++n;
+  }
+  ps->nentries = n;
+
+  /*
+   * Allocate the version ring: the latest version and depth previous
+   * ones.  The slot that a new version goes into may be the current
+   * one (after a rollback), but by then the servo has finished with
+   * it (see dd_pset_wait).
+   */
+  ps->nslots = depth + 1;
+  ps->ring = (char *) calloc(ps->nslots, ps->bufsize > 0 ? ps->bufsize : 1);
+  ps->shadow = (char *) calloc(1, ps->bufsize > 0 ? ps->bufsize : 1);
+  if (ps->ring == NULL || ps->shadow == NULL) {
+    dd_pset_free(ps);
+    return NULL;
+  }
+
+  /* Version 0 is the current contents of the variables */
+  for (i = 0; i < ps->nentries; ++i)
+    memcpy(SLOT(ps, 0) + ps->entry[i].offset, ps->entry[i].value,
+	   ps->entry[i].size);
+  ps->latest = ps->current = ps->applied = 0;
+
+  return ps;
+}
+
+/*!
+ * \fn void dd_pset_free(DD_PSET *ps)
+ * \brief free a parameter set
+ * \ingroup display
+ */
+void dd_pset_free(DD_PSET *ps)
+{
+  if (ps == NULL) return;
+  free(ps->entry);
+  free(ps->map);
+  free(ps->ring);
+  free(ps->shadow);
+  free(ps);
+}
+
+/*!
+ * \fn void dd_pset_validate(DD_PSET *ps, int (*fcn)(char *, void *))
+ * \brief set a validation function for a parameter set
+ * \ingroup display
+ *
+ * The validation function is called for each value that is read by
+ * dd_pset_load(), with the name of the variable and a pointer to the
+ * new value.  If it returns a negative number, the file is rejected.
+ */
+void dd_pset_validate(DD_PSET *ps, int (*fcn)(char *, void *))
+{
+  ps->validate = fcn;
+}
+
+/*
+ * Wait until the servo has applied the current version, so that it
+ * isn't (and won't start) copying a version buffer.  Gives up after
+ * DD_PSET_WAIT milliseconds.
+ */
+#define DD_PSET_WAIT 100
+static int dd_pset_wait(DD_PSET *ps)
+{
+  int i;
+
+  for (i = 0; i < DD_PSET_WAIT; ++i) {
+    if (__atomic_load_n(&ps->applied, __ATOMIC_ACQUIRE) == ps->current)
+      return 0;
+    usleep(1000);
+  }
+  return -1;
+}
+
+/* Skip the rest of a token that didn't fit; returns 1 if there was any */
+static int dd_pset_skip(FILE *fp)
+{
+  int c = getc(fp);
+
+  if (c == EOF) return 0;
+  ungetc(c, fp);
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return 0;
+  fscanf(fp, "%*[^ \t\r\n]");
+  return 1;
+}
+
+/*!
+ * \fn int dd_pset_load(DD_PSET *ps, char *filename)
+ * \brief load a file into a new version of a parameter set
+ * \ingroup display
+ *
+ * The file has the same format as the files used by dd_load().
+ * Variables that are not listed in the file keep their current
+ * values.  The file is read into a shadow buffer and, if all of the
+ * values are valid, published as a new version.  The values are
+ * copied to the variables the next time dd_pset_apply() is called.
+ * Entries whose name is too long to be in the table are skipped.
+ *
+ * Returns the new version number or -1 on error (in which case the
+ * current version is not changed).  It is an error to load a new
+ * version before dd_pset_apply() has picked up the last change.
+ */
+int dd_pset_load(DD_PSET *ps, char *filename)
+{
+  FILE *fp;
+  char name[sizeof(ps->tbl->varname)], value[256];
+  struct dd_pset_entry *ep;
+  int line = 0, status = 0, version;
+
+  if ((fp = fopen(filename, "r")) == NULL) return -1;
+
+  /* Start from the current version */
+  memcpy(ps->shadow, SLOT(ps, ps->current), ps->bufsize);
+
+  while (fscanf(fp, " %31s", name) == 1) {
+    ++line;
+    if (name[0] == '#') {		/* comment; skip rest of the line */
+      fscanf(fp, "%*[^\n]");
+      continue;
+    }
+    if (dd_pset_skip(fp)) {
+      fprintf(stderr, "dd_pset_load: name too long in %s (entry %d)\n",
+	      filename, line);
+      fscanf(fp, " %*s");		/* skip the value as well */
+      continue;
+    }
+    if (fscanf(fp, " %255s", value) != 1 || dd_pset_skip(fp)) {
+      fprintf(stderr, "dd_pset_load: bad entry %d in %s\n", line, filename);
+      status = -1;
+      break;
+    }
+
+    /* Ignore variables that aren't part of the set (as dd_load does) */
+    if ((ep = dd_pset_find(ps, name)) == NULL) continue;
+
+    if (dd_pset_scan(ep, value, ps->shadow + ep->offset) != 1 ||
+	(ps->validate != NULL &&
+	 (*ps->validate)(name, ps->shadow + ep->offset) < 0)) {
+      fprintf(stderr, "dd_pset_load: bad value for %s in %s (entry %d)\n",
+	      name, filename, line);
+      status = -1;
+      break;
+    }
+  }
+  fclose(fp);
+  if (status < 0) return -1;
+  if (dd_pset_wait(ps) < 0) {
+    fprintf(stderr, "dd_pset_load: version %d has not been applied\n",
+	    ps->current);
+    return -1;
+  }
+
+  /* Store the new version in the ring and make it current */
+  version = ps->latest + 1;
+  memcpy(SLOT(ps, version), ps->shadow, ps->bufsize);
+  ps->latest = version;
+  __atomic_store_n(&ps->current, version, __ATOMIC_RELEASE);
+
+  return version;
+}
+
+/*!
+ * \fn int dd_pset_apply(DD_PSET *ps)
+ * \brief copy the current version of a parameter set to its variables
+ * \ingroup display
+ *
+ * This function should be called at the start of each servo cycle.
+ * If the current version has changed since the last call, all of the
+ * variables are updated at once.  Returns 1 if the variables were
+ * changed and 0 otherwise.
+ */
+int dd_pset_apply(DD_PSET *ps)
+{
+  int i, version = __atomic_load_n(&ps->current, __ATOMIC_ACQUIRE);
+  char *buf;
+
+  if (version == ps->applied) return 0;
+
+  buf = SLOT(ps, version);
+  for (i = 0; i < ps->nentries; ++i)
+    memcpy(ps->entry[i].value, buf + ps->entry[i].offset, ps->entry[i].size);
+  __atomic_store_n(&ps->applied, version, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+/*!
+ * \fn int dd_pset_rollback(DD_PSET *ps, int steps)
+ * \brief make a previous version of a parameter set current
+ * \ingroup display
+ *
+ * Go back the given number of versions from the latest version (so
+ * that dd_pset_rollback(ps, 0) returns to the latest version).
+ * Returns the version that is now current, or -1 if that version is
+ * no longer available.
+ */
+int dd_pset_rollback(DD_PSET *ps, int steps)
+{
+  int version = ps->latest - steps;
+
+  if (steps < 0 || version < 0 || steps > ps->nslots - 1) return -1;
+  __atomic_store_n(&ps->current, version, __ATOMIC_RELEASE);
+  return version;
+}
+
+/*!
+ * \fn int dd_pset_version(DD_PSET *ps)
+ * \brief return the current version of a parameter set
+ * \ingroup display
+ */
+int dd_pset_version(DD_PSET *ps)
+{
+  return __atomic_load_n(&ps->current, __ATOMIC_ACQUIRE);
+}
+
+/*!
+ * \fn int dd_pset_save(DD_PSET *ps, char *filename)
+ * \brief save the current version of a parameter set
+ * \ingroup display
+ *
+ * The values are written to a temporary file which is renamed to
+ * filename once it is complete, so that a crash never leaves a
+ * partially written file behind.  The values are taken from the
+ * version buffer rather than the variables themselves, so this can be
+ * called while the servo is running.
+ */
+int dd_pset_save(DD_PSET *ps, char *filename)
+{
+  FILE *fp;
+  char *buf, tmpfile[FILENAME_MAX];
+  int i;
+
+  snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+  if ((fp = fopen(tmpfile, "w")) == NULL) return -1;
+
+  buf = SLOT(ps, dd_pset_version(ps));
+  for (i = 0; i < ps->nentries; ++i)
+    dd_pset_print(fp, ps->entry + i, buf + ps->entry[i].offset);
+
+  /* Make sure the data is on disk before replacing the old file */
+  if (fflush(fp) != 0 || fsync(fileno(fp)) < 0) {
+    fclose(fp);
+    unlink(tmpfile);
+    return -1;
+  }
+  if (fclose(fp) != 0 || rename(tmpfile, filename) < 0) {
+    unlink(tmpfile);
+    return -1;
+  }
+  return 1;
+}
@@ -48,8 +48,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "display.h"
 
+#define SAVELEN 80		/* length of dd_save_string (display.c) */
+
 /*!
  * \fn int dd_save(char *filename)
  * \brief save the display variables for the current table
@@ -59,6 +65,38 @@ int dd_save(char *filename)
   return dd_tbl_save(filename, ddtbl);
 }
 
+/*
+ * Format the value of a saveable entry.  The common types are
+ * formatted here, straight from the table, so that saving a table
+ * doesn't need to switch ddtbl (which the display may be using).
+ * Other managers look their entry up in ddtbl, so they can only be
+ * asked when tbl is the current table.  Returns -1 if the entry
+ * can't be saved.
+ */
+static int dd_save_value(DD_IDENT *tbl, int i, char *buf, int len)
+{
+  DD_IDENT *dd = tbl + i;
+
+  if (dd->function == dd_double)
+    snprintf(buf, len, "%lg", *(double *) dd->value);
+  else if (dd->function == dd_float)
+    snprintf(buf, len, "%g", *(float *) dd->value);
+  else if (dd->function == dd_short)
+    snprintf(buf, len, "%d", *(int *) dd->value);
+  else if (dd->function == dd_long)
+    snprintf(buf, len, "%ld", *(long *) dd->value);
+  else if (dd->function == dd_string)
+    snprintf(buf, len, "%s", (char *) dd->value);
+  else if (tbl == ddtbl) {
+    /* the manager function is responsible for formatting and storing
+       the number it wants to save in dd_save_string */
+    (*dd->function)(Save, i);
+    snprintf(buf, len, "%s", dd_save_string);
+  } else
+    return -1;
+  return 0;
+}
+
 /*!
  * \fn int dd_save_tbl(char *filename, DD_IDENT *tbl)
  * \brief save a specific table
@@ -66,9 +104,8 @@ int dd_save(char *filename)
 int dd_save_tbl(char *filename, DD_IDENT *tbl)
 {
   int i;
-  char tempbuf[256], response[10];
+  char tempbuf[256], response[10], tmpfile[FILENAME_MAX];
   FILE *fp;
-  DD_IDENT *tmptbl;
 
 #ifdef UNUSED
   struct ffblk file_search;
@@ -81,27 +118,33 @@ int dd_save_tbl(char *filename, DD_IDENT *tbl)
       return -1;
   }
 #endif
-  if((fp=fopen(filename,"w"))==NULL){
+  /* Write to a temporary file and then rename it, so that an
+     interrupted save doesn't destroy the old file */
+  snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", filename);
+  if((fp=fopen(tmpfile,"w"))==NULL){
     DD_PROMPT("Unable to open file.");
     return -1;
   }
 
-  tmptbl = ddtbl;		/* store current table */
-  ddtbl = tbl;			/* switch current table, to load values */
   /* Search thru table for variables to save; a saveable variable is
      indicated by a non-null varname */
-  for (i = 0; ddtbl[i].value != NULL; i++) {
-    if(*(ddtbl[i].varname) != '\0'){
-      /* the manager function is responsible for formatting and storing the
-	 number it wants to save in dd_save_string, max length 256 */
-      (*ddtbl[i].function)(Save, i); 
-      fprintf(fp,"%s\t%s\n",ddtbl[i].varname,dd_save_string);
+  for (i = 0; tbl[i].value != NULL; i++) {
+    if(*(tbl[i].varname) != '\0'){
+      if (dd_save_value(tbl, i, tempbuf, sizeof(tempbuf)) < 0) {
+	fprintf(stderr, "dd_save_tbl: can't save %s from a table that "
+		"isn't displayed\n", tbl[i].varname);
+	continue;
+      }
+      fprintf(fp,"%s\t%s\n",tbl[i].varname,tempbuf);
     }
   }
 
-  fclose(fp);
-  if(tmptbl != tbl)
-    ddtbl = tmptbl;		/* go back to current table */
+  if (fflush(fp) != 0 || fsync(fileno(fp)) < 0 || fclose(fp) != 0 ||
+      rename(tmpfile, filename) < 0) {
+    DD_PROMPT("Unable to write file.");
+    unlink(tmpfile);
+    return -1;
+  }
 
   return 1;
 }
@@ -114,47 +157,97 @@ int dd_load(char *filename){
   return dd_tbl_load(filename, ddtbl);
 }
 
+/*
+ * Get the next token from a memory buffer.  Tokens are separated by
+ * white space.  If comments is set (where a name is expected), comments
+ * run from '#' to the end of the line; values may contain '#'.  At most
+ * len-1 characters are copied into tok; the rest of the token is
+ * skipped.  Returns the full length of the token, which is len or more
+ * if it didn't fit, or -1 at end of buffer.
+ */
+static int dd_load_token(char **pp, char *end, char *tok, int len,
+			 int comments)
+{
+  char *p = *pp, *start;
+  int n;
+
+  /* Skip white space and comments */
+  while (p < end) {
+    if (*p == '#' && comments)
+      while (p < end && *p != '\n') ++p;
+    else if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+      ++p;
+    else
+      break;
+  }
+  if (p >= end) { *pp = p; return -1; }
+
+  /* Find the end of the token and copy out as much as fits */
+  for (start = p; p < end && *p != ' ' && *p != '\t' && *p != '\n' &&
+	 *p != '\r' && (*p != '#' || !comments); ++p);
+  n = (p - start < len) ? p - start : len - 1;
+  memcpy(tok, start, n);
+  tok[n] = '\0';
+
+  *pp = p;
+  return p - start;
+}
+
 /*!
  * \fn dd_tbl_load(char *filename, DD_IDENT *tbl)
  * \brief load saved display vars into a specific table
+ *
+ * The file is mapped into memory and parsed in a single pass.  Each
+ * variable name is looked up using the hash index for the table (see
+ * dd_lookup_tbl()), so the cost of loading grows linearly with the
+ * size of the file.  Names too long to be in the table are skipped,
+ * along with their values.  Returns -1 if the file can't be read or a
+ * value couldn't be stored (see dd_store()), otherwise 1.
  */
 int dd_tbl_load(char *filename, DD_IDENT *tbl){
-  int line=0, i;
-  FILE *fp;
-  char buf[256];
+  int fd, i, n, status = 1;
+  struct stat st;
+  char *buf, *p, *end;
+  char name[sizeof(tbl->varname)];
   DD_IDENT *tmptbl;
 
-  if ((fp = fopen(filename,"r"))==NULL) {
+  if ((fd = open(filename, O_RDONLY)) < 0) {
 #   ifdef UNUSED			/* don't print error msg here */
     perror("dd_load");
-    strcpy(buf,"dd_load: error opening inputfile: ");
-    strcat(buf, filename); 
-    DD_PROMPT(buf);
 #   endif
     return -1;
   }
+  if (fstat(fd, &st) < 0) { close(fd); return -1; }
+  if (st.st_size == 0) { close(fd); return 1; }
+
+  /* Map the entire file; we only need it for the duration of the load */
+  buf = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) return -1;
+  end = buf + st.st_size;
+  p = buf;
 
   tmptbl = ddtbl;		/* store current table */
   ddtbl = tbl;			/* switch current table, to load values */
-  while( (chn_gettok(fp, buf, 256, " \t\n", &line)) !=EOF){
-    /* see if this variable is defined in the _current_ display */
-    for (i = 0; tbl[i].value != NULL; ++i)
-      if(!strcmp(tbl[i].varname, buf)) /* found */
-	break;
-    chn_gettok(fp, buf, 256, " \t\n", &line);
-    if(tbl[i].value != NULL){	/* found the varname */
-      /* the manager function is responsible for using the string in dd_save_string
-	 to load its value */
-      strcpy(dd_save_string, buf);
-      (*ddtbl[i].function)(Load, i); 
+  while ((n = dd_load_token(&p, end, name, sizeof(name), 1)) >= 0) {
+    /* the manager function is responsible for using the string in
+       dd_save_string to load its value */
+    if (dd_load_token(&p, end, dd_save_string, SAVELEN, 0) < 0) break;
+    if (n >= (int) sizeof(name)) {
+      fprintf(stderr, "dd_load: name too long in %s (%.20s...)\n",
+	      filename, name);
+      continue;
     }
+
+    /* see if this variable is defined in the _current_ display */
+    if ((i = dd_lookup_tbl(name, tbl)) >= 0 &&
+	(*ddtbl[i].function)(Load, i) < 0)
+      status = -1;
   }
-  fclose(fp);
+  munmap(buf, st.st_size);
   
   if(tmptbl != tbl)
     ddtbl = tmptbl;		/* go back to current table */
 
-  return 1;
+  return status;
 }
-
-
@@ -71,7 +71,7 @@ int dd_double(DD_ACTION action, int id)
     
   case Input:
     if (DD_SCANF("Float: ", "%lf", &dtmp) == 1)
-      *value = dtmp;
+      dd_store(dd, &dtmp, sizeof(double));
     break;
     
   case Save:
@@ -79,8 +79,9 @@ int dd_double(DD_ACTION action, int id)
     break;
     
   case Load:
-    if(sscanf(dd_save_string, "%lf", &dtmp)==1)
-      *value = dtmp;
+    if(sscanf(dd_save_string, "%lf", &dtmp)==1 &&
+	dd_store(dd, &dtmp, sizeof(double)) < 0)
+      return -1;
     break;
     
   }
@@ -94,6 +95,7 @@ int dd_short(DD_ACTION action, int id)
   char ibuf[12];
 
   int *value = (int *)dd->value, *current = (int *)dd->current;
+  int itmp;
   
   switch (action) {
   case Update:
@@ -111,7 +113,8 @@ int dd_short(DD_ACTION action, int id)
     break;
     
   case Input:
-    DD_SCANF("Integer: ", "%d", value);
+    if (DD_SCANF("Integer: ", "%d", &itmp) == 1)
+      dd_store(dd, &itmp, sizeof(int));
     break;
     
   case Save:
@@ -119,7 +122,9 @@ int dd_short(DD_ACTION action, int id)
     break;
     
   case Load:
-    sscanf(dd_save_string, "%d", value);
+    if (sscanf(dd_save_string, "%d", &itmp) == 1 &&
+	dd_store(dd, &itmp, sizeof(int)) < 0)
+      return -1;
     break;
 
   }
@@ -150,8 +155,10 @@ int dd_byte(DD_ACTION action, int id)
 	break;
 
     case Input:
-      if (DD_SCANF("Byte: ", "%d", &itmp) == 1)
-	*value = itmp;
+      if (DD_SCANF("Byte: ", "%d", &itmp) == 1) {
+	char ctmp = itmp;
+	dd_store(dd, &ctmp, sizeof(char));
+      }
       break;
 	
       case Save:
@@ -189,7 +196,7 @@ int dd_float(DD_ACTION action, int id)
     
   case Input:
     if (DD_SCANF("Float: ", "%f", &ftmp) == 1)
-      *value = ftmp;
+      dd_store(dd, &ftmp, sizeof(float));
     break;
     
   case Save:
@@ -197,8 +204,9 @@ int dd_float(DD_ACTION action, int id)
     break;
     
   case Load:
-    if(sscanf(dd_save_string, "%f", &ftmp)==1)
-      *value = ftmp;
+    if(sscanf(dd_save_string, "%f", &ftmp)==1 &&
+	dd_store(dd, &ftmp, sizeof(float)) < 0)
+      return -1;
     break;
     
   }
@@ -230,6 +238,7 @@ int dd_long(DD_ACTION action, int id)
   DD_IDENT *dd = ddtbl + id;
   char ibuf[32];
   long *value = (long *)dd->value, *current = (long *)dd->current;
+  long ltmp;
   
   switch (action) {
   case Update:
@@ -247,14 +256,17 @@ int dd_long(DD_ACTION action, int id)
     break;
     
   case Input:
-    DD_SCANF("Integer: ", "%ld", value);
+    if (DD_SCANF("Integer: ", "%ld", &ltmp) == 1)
+      dd_store(dd, &ltmp, sizeof(long));
     break;
     
   case Save:
     sprintf(dd_save_string, "%ld", *value);
     break;
   case Load:
-    sscanf(dd_save_string, "%ld", value);
+    if (sscanf(dd_save_string, "%ld", &ltmp) == 1 &&
+	dd_store(dd, &ltmp, sizeof(long)) < 0)
+      return -1;
     break;
   }
   return 0;
@@ -295,7 +307,7 @@ int dd_string(DD_ACTION action, int id)
     dd->foreground = oldfg;
     
     /* Copy temporrary buffer into storage and redisplay */
-    strcpy((char *) dd->value, ibuf);
+    dd_store(dd, ibuf, strlen(ibuf) + 1);
     dd_puts(dd, ibuf);
     break;
     
@@ -305,7 +317,8 @@ int dd_string(DD_ACTION action, int id)
     break;
     
   case Load:
-    strcpy((char *) dd->value, dd_save_string);
+    if (dd_store(dd, dd_save_string, strlen(dd_save_string) + 1) < 0)
+      return -1;
     break;
     
   }
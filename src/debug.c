@@ -27,6 +27,14 @@
  *     dbg_add_module(name)	print messages from file "name"
  *     dbg_delete_module	remove module from list
  *
+ * Each dbg_* call site caches whether its module is in the list, so
+ * the list is only searched again after it changes.  Messages can also
+ * be formatted and written by a background thread, so that a call only
+ * copies its arguments into a per-thread buffer:
+ *
+ *     dbg_async_start()	start background logging
+ *     dbg_async_stop()		write out waiting messages and stop
+ *
  * Finally, there are a few functions that were original intended for
  * a command line processing program, but still might be useful:
  *
@@ -74,6 +82,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "dbglib.h"			/* turn on debugging */
 
 /* Global variables used by debugging routines */
@@ -92,12 +104,15 @@ int (*dbg_post_hook)() = NULL;	/* return screen to proper mode */
 
 extern int dbg_module_count;    /* number of modules in list */
 extern char *dbg_module_list[]; /* list of module names */
+extern int dbg_module_gen;	/* changes whenever the list does */
+
+static void dbg_record(struct dbg_site *, const char *, va_list);
 
 int _dbg_puts(char *);		/* internal function to print strings */
 
 /* Command types */
 enum  cmd_token {
-  Use, Unuse, Quit, List, On, Off, Help, All, Unknown, Output
+  Use, Unuse, Quit, List, On, Off, Help, All, Unknown, Output, Async
 };
 
 
@@ -114,34 +129,40 @@ static struct cmd_entry {
     {"on",      On,         "turn debuggging on"},
     {"off",     Off,        "turn debugging off"},
     {"output",  Output,	    "turn output on/off"},
+    {"async",   Async,	    "turn background logging on/off"},
     {"help",    Help,       "print this list"},
     {"all",     All,        "turn on debugging for all modules"},
     {NULL,      Unknown,    NULL}
 };
 
-/*VARARGS2*/
-/* Print a message if a module is active */
-void _dbg_printf(enum dbg_type type, char *module, int line, char *fmt, ...)
+/* Minute and second of a time for the log file; localtime() is only
+   called when the minute changes */
+static void dbg_stamp(time_t t, int *min, int *sec)
 {
-    va_list arg_ptr;
-    register int index = 0;
+  static __thread time_t minute = -1;
+  static __thread int tm_min;
+  struct tm tm;
+
+  if (t / 60 != minute) {
+    localtime_r(&t, &tm);
+    minute = t / 60;
+    tm_min = tm.tm_min;
+  }
+  *min = tm_min;
+  *sec = t % 60;
+}
 
-    /* See if we should run */
-    if (!dbg_flag) return;
+/* Print and log a message from an active module */
+static void dbg_vprint(enum dbg_type type, const char *module, int line,
+		       const char *fmt, va_list ap)
+{
+    va_list arg_ptr;
+    int min, sec;
+    int newline = *fmt == '\0' || fmt[strlen(fmt)-1] != '\n';
 
     /* Make sure outfile was initialized */
     if (dbg_outfile == NULL) dbg_outfile = stderr;
 
-    /* Search module list to see if it is active */
-    index = dbg_find_module(module);
-    if (index < 0) {
-	if (dbg_all) {
-	    /* Insert the module in the list */
-	  if (dbg_capture) dbg_add_module(module);
-	} else
-	    return;
-    }
-
     /* Check to see if the screen display needs to be set up */
     if (dbg_pre_hook != NULL) 		/* see if screen hook exists */
       if ((*dbg_pre_hook)() < 0) 	/* call screen hook */
@@ -149,10 +170,10 @@ void _dbg_printf(enum dbg_type type, char *module, int line, char *fmt, ...)
 
     /* Print the information */
     if (dbg_outf & type) {
-      va_start(arg_ptr, fmt);
+      va_copy(arg_ptr, ap);
       fprintf(dbg_outfile, "%s [%d]: ", module, line);
       vfprintf(dbg_outfile, fmt, arg_ptr);
-      if (fmt[strlen(fmt)-1] != '\n') fprintf(dbg_outfile, "\n");
+      if (newline) fprintf(dbg_outfile, "\n");
       va_end(arg_ptr);
     }
 
@@ -161,15 +182,422 @@ void _dbg_printf(enum dbg_type type, char *module, int line, char *fmt, ...)
 
     /* Log the information */
     if ((dbg_logf & type) && dbg_logfile != NULL) {
-      va_start(arg_ptr, fmt);
-      time_t now = time(NULL); struct tm *timeval = localtime(&now);
+      va_copy(arg_ptr, ap);
+      dbg_stamp(time(NULL), &min, &sec);
       fprintf(dbg_logfile, "%2x %s [%d] @ %d.%d: ", type, module, line,
-	      timeval->tm_min, timeval->tm_sec);
+	      min, sec);
       vfprintf(dbg_logfile, fmt, arg_ptr);
-      if (fmt[strlen(fmt)-1] != '\n') fprintf(dbg_logfile, "\n");
+      if (newline) fprintf(dbg_logfile, "\n");
       va_end(arg_ptr);
     }
+}
+
+/*VARARGS2*/
+/* Print a message if a module is active (without a call site record) */
+void _dbg_printf(enum dbg_type type, char *module, int line, char *fmt, ...)
+{
+    va_list arg_ptr;
+
+    /* See if we should run */
+    if (!dbg_flag) return;
+
+    /* Search module list to see if it is active */
+    if (dbg_find_module(module) < 0) {
+	if (dbg_all) {
+	    /* Insert the module in the list */
+	  if (dbg_capture) dbg_add_module(module);
+	} else
+	    return;
+    }
+
+    va_start(arg_ptr, fmt);
+    dbg_vprint(type, module, line, fmt, arg_ptr);
+    va_end(arg_ptr);
+}
+
+/*VARARGS2*/
+/* Print a message from a dbg_* call site (see dbglib.h) */
+void _dbg_log(struct dbg_site *sp, const char *fmt, ...)
+{
+    va_list arg_ptr;
+    int gen = __atomic_load_n(&dbg_module_gen, __ATOMIC_ACQUIRE);
+
+    /* See if we should run */
+    if (!dbg_flag) return;
+
+    /* Look the module up again only if the list has changed */
+    if (__atomic_load_n(&sp->gen, __ATOMIC_ACQUIRE) != gen) {
+      sp->active = dbg_find_module((char *) sp->module) >= 0;
+      __atomic_store_n(&sp->gen, gen, __ATOMIC_RELEASE);
+    }
+    if (!sp->active) {
+	if (dbg_all) {
+	    /* Insert the module in the list */
+	  if (dbg_capture) dbg_add_module((char *) sp->module);
+	} else
+	    return;
+    }
+
+    va_start(arg_ptr, fmt);
+    if (dbg_async)
+      dbg_record(sp, fmt, arg_ptr);
+    else
+      dbg_vprint(sp->type, sp->module, sp->line, fmt, arg_ptr);
+    va_end(arg_ptr);
+}
+
+/*
+ * Background logging
+ *
+ * With dbg_async_start(), messages from the dbg_* macros are no longer
+ * formatted by the caller.  Each thread copies the call site, the time
+ * and the raw arguments (with strings copied) into its own ring
+ * buffer, created the first time the thread logs something, and a
+ * background thread formats and writes them every 20 ms.  The format
+ * string of each call site is parsed once.  Formats that can't be
+ * split into single arguments (`*' widths, %n, %Lf, wide strings, more
+ * than DBG_MAXARGS conversions) and sites whose format changes from
+ * call to call are formatted into the ring by the caller instead.
+ * Messages are dropped (and counted) if a ring fills up between
+ * writes.  Terminal output goes straight to dbg_outfile, without the
+ * screen hooks; under the display that is the stderr pipe into the
+ * error log.
+ */
+#define DBG_RING 256			/* messages per thread (power of 2) */
+#define DBG_MAXARGS 8			/* conversions in a parsed format */
+#define DBG_TEXTLEN 160			/* string arguments or message */
+#define DBG_LINELEN 1024		/* formatted message */
+
+enum dbg_argtype {
+  DbgInt, DbgLong, DbgLLong, DbgSize, DbgIntmax, DbgPtrdiff,
+  DbgDouble, DbgPtr, DbgString
+};
+
+/* Format split into pieces that each end with one conversion */
+struct dbg_format {
+  const char *fmt;			/* format this was parsed from */
+  int nargs;				/* -1 if it can't be parsed */
+  enum dbg_argtype type[DBG_MAXARGS];
+  char *seg[DBG_MAXARGS + 1];		/* pieces, then the trailing text */
+  char text[1];
+};
+
+struct dbg_record {
+  struct dbg_site *site;
+  struct dbg_format *format;		/* NULL if text is the message */
+  time_t time;
+  int mask;				/* 1 = print, 2 = log */
+  union { long long i; double d; void *p; } arg[DBG_MAXARGS];
+  char text[DBG_TEXTLEN];		/* strings (arg is the offset) */
+};
+
+struct dbg_ring {
+  struct dbg_record rec[DBG_RING];
+  unsigned long head;			/* next message to write (thread) */
+  unsigned long tail;			/* next message to print */
+  unsigned long dropped;		/* messages lost to a full ring */
+  struct dbg_ring *link;
+};
+
+int dbg_async = 0;			/* log from a background thread */
+static struct dbg_ring *dbg_rings = NULL;
+static pthread_mutex_t dbg_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct dbg_ring *dbg_ring = NULL;
+static pthread_t dbg_thread;
+static volatile int dbg_running = 0;
+static unsigned long dbg_dropped;	/* drops already reported */
+
+/* Split a format into pieces; returns NULL if out of memory */
+static struct dbg_format *dbg_parse(const char *fmt)
+{
+  struct dbg_format *fp;
+  enum dbg_argtype type[DBG_MAXARGS];
+  const char *s, *end[DBG_MAXARGS], *from;
+  char *to;
+  int n = 0, i, size;
+
+  for (s = fmt; *s != '\0'; ++s) {
+    if (*s != '%') continue;
+    if (*++s == '%') continue;
+    s += strspn(s, "-+ #0'");		/* flags */
+    s += strspn(s, "0123456789");	/* width */
+    if (*s == '.') { ++s; s += strspn(s, "0123456789"); }
+
+    /* Length modifier: 0 = int, or the letter (doubled for hh, ll) */
+    size = 0;
+    if (strchr("hlzjtL", *s) != NULL && *s != '\0') {
+      size = *s++;
+      if ((size == 'h' || size == 'l') && *s == size) { size *= 2; ++s; }
+    }
+
+    if (n == DBG_MAXARGS) { n = -1; break; }
+    switch (*s) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+      switch (size) {
+      case 0: case 'h': case 'h' * 2: type[n] = DbgInt; break;
+      case 'l': type[n] = DbgLong; break;
+      case 'l' * 2: type[n] = DbgLLong; break;
+      case 'z': type[n] = DbgSize; break;
+      case 'j': type[n] = DbgIntmax; break;
+      case 't': type[n] = DbgPtrdiff; break;
+      default: n = -1; break;
+      }
+      if (*s == 'c' && size != 0) n = -1;
+      break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+      if (size == 0 || size == 'l') type[n] = DbgDouble; else n = -1;
+      break;
+    case 's': if (size == 0) type[n] = DbgString; else n = -1; break;
+    case 'p': if (size == 0) type[n] = DbgPtr; else n = -1; break;
+    default: n = -1; break;		/* %n, %m, `*', positional, ... */
+    }
+    if (n < 0) break;
+    end[n++] = s + 1;
+  }
+
+  if ((fp = malloc(sizeof(struct dbg_format) + strlen(fmt) +
+		   DBG_MAXARGS + 1)) == NULL)
+    return NULL;
+  fp->fmt = fmt;
+  fp->nargs = n;
+  if (n < 0) return fp;
+
+  /* Copy the pieces, ending each one after its conversion */
+  for (i = 0, from = fmt, to = fp->text; i <= n; ++i) {
+    fp->seg[i] = to;
+    s = i < n ? end[i] : from + strlen(from);
+    memcpy(to, from, s - from);
+    to += s - from;
+    *to++ = '\0';
+    from = s;
+    if (i < n) fp->type[i] = type[i];
+  }
+  return fp;
+}
+
+/* Create the ring for this thread */
+static struct dbg_ring *dbg_register(void)
+{
+  struct dbg_ring *rp;
+
+  if ((rp = calloc(1, sizeof(struct dbg_ring))) == NULL) return NULL;
+  pthread_mutex_lock(&dbg_mutex);
+  rp->link = dbg_rings;
+  dbg_rings = rp;
+  pthread_mutex_unlock(&dbg_mutex);
+  return dbg_ring = rp;
+}
+
+/* Copy a message into the ring of the calling thread */
+static void dbg_record(struct dbg_site *sp, const char *fmt, va_list ap)
+{
+  struct dbg_ring *rp = dbg_ring;
+  struct dbg_record *r;
+  struct dbg_format *fp, *old = NULL;
+  unsigned long head;
+  int mask = 0, used = 0, len, i;
+  char *str;
+
+  if (dbg_outf & sp->type) mask |= 1;
+  if ((dbg_logf & sp->type) && dbg_logfile != NULL) mask |= 2;
+  if (mask == 0) return;
+
+  /* Parse the format the first time through */
+  if ((fp = __atomic_load_n((struct dbg_format **) &sp->format,
+			    __ATOMIC_ACQUIRE)) == NULL) {
+    if ((fp = dbg_parse(fmt)) == NULL) return;
+    if (!__atomic_compare_exchange_n((struct dbg_format **) &sp->format,
+				     &old, fp, 0, __ATOMIC_ACQ_REL,
+				     __ATOMIC_ACQUIRE)) {
+      free(fp);				/* another thread got there first */
+      fp = old;
+    }
+  }
+  if (fp->fmt != fmt || fp->nargs < 0) fp = NULL;
+
+  if (rp == NULL && (rp = dbg_register()) == NULL) return;
+  head = rp->head;
+  if (head - __atomic_load_n(&rp->tail, __ATOMIC_ACQUIRE) >= DBG_RING) {
+    __atomic_add_fetch(&rp->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  r = rp->rec + (head & (DBG_RING - 1));
+  r->site = sp;
+  r->format = fp;
+  r->time = time(NULL);
+  r->mask = mask;
+
+  if (fp == NULL)
+    vsnprintf(r->text, DBG_TEXTLEN, fmt, ap);
+  else for (i = 0; i < fp->nargs; ++i) switch (fp->type[i]) {
+    case DbgInt: r->arg[i].i = va_arg(ap, int); break;
+    case DbgLong: r->arg[i].i = va_arg(ap, long); break;
+    case DbgLLong: r->arg[i].i = va_arg(ap, long long); break;
+    case DbgSize: r->arg[i].i = va_arg(ap, size_t); break;
+    case DbgIntmax: r->arg[i].i = va_arg(ap, intmax_t); break;
+    case DbgPtrdiff: r->arg[i].i = va_arg(ap, ptrdiff_t); break;
+    case DbgDouble: r->arg[i].d = va_arg(ap, double); break;
+    case DbgPtr: r->arg[i].p = va_arg(ap, void *); break;
+    case DbgString:
+      if ((str = va_arg(ap, char *)) == NULL) str = "(null)";
+      len = strlen(str);
+      if (len > DBG_TEXTLEN - 1 - used) len = DBG_TEXTLEN - 1 - used;
+      memcpy(r->text + used, str, len);
+      r->text[used + len] = '\0';
+      r->arg[i].i = used;
+      used += len + 1;
+      if (used > DBG_TEXTLEN - 1) used = DBG_TEXTLEN - 1;
+      break;
+  }
+  __atomic_store_n(&rp->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Format a recorded message */
+static void dbg_format(struct dbg_record *r, char *buf)
+{
+  struct dbg_format *fp = r->format;
+  char *s, *end = buf + DBG_LINELEN - 1;
+  int i, n = 0;
+
+  if (fp == NULL) {
+    strcpy(buf, r->text);
+    return;
+  }
+  for (i = 0; i < fp->nargs && buf < end; ++i, buf += n) {
+    s = fp->seg[i];
+    switch (fp->type[i]) {
+    case DbgInt: n = snprintf(buf, end - buf, s, (int) r->arg[i].i); break;
+    case DbgLong: n = snprintf(buf, end - buf, s, (long) r->arg[i].i); break;
+    case DbgLLong: n = snprintf(buf, end - buf, s, r->arg[i].i); break;
+    case DbgSize: n = snprintf(buf, end - buf, s, (size_t) r->arg[i].i); break;
+    case DbgIntmax:
+      n = snprintf(buf, end - buf, s, (intmax_t) r->arg[i].i); break;
+    case DbgPtrdiff:
+      n = snprintf(buf, end - buf, s, (ptrdiff_t) r->arg[i].i); break;
+    case DbgDouble: n = snprintf(buf, end - buf, s, r->arg[i].d); break;
+    case DbgPtr: n = snprintf(buf, end - buf, s, r->arg[i].p); break;
+    case DbgString:
+      n = snprintf(buf, end - buf, s, r->text + r->arg[i].i); break;
+    }
+    if (n < 0) n = 0;
+    if (n > end - buf) n = end - buf;
+  }
+
+  /* Trailing text, which can only have %% in it */
+  for (s = fp->seg[fp->nargs]; *s != '\0' && buf < end; ++s) {
+    if (*s == '%' && s[1] == '%') ++s;
+    *buf++ = *s;
+  }
+  *buf = '\0';
+}
+
+/* Print and log everything in the rings; called with dbg_mutex held */
+static void dbg_drain(void)
+{
+  struct dbg_ring *rp;
+  struct dbg_record *r;
+  unsigned long head, tail, dropped = 0;
+  char msg[DBG_LINELEN], *nl;
+  int min, sec, n = 0;
+
+  if (dbg_outfile == NULL) dbg_outfile = stderr;
+  for (rp = dbg_rings; rp != NULL; rp = rp->link) {
+    head = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE);
+    for (tail = rp->tail; tail != head; ++tail, ++n) {
+      r = rp->rec + (tail & (DBG_RING - 1));
+      dbg_format(r, msg);
+      nl = *msg == '\0' || msg[strlen(msg)-1] != '\n' ? "\n" : "";
+      if (r->mask & 1)
+	fprintf(dbg_outfile, "%s [%d]: %s%s", r->site->module, r->site->line,
+		msg, nl);
+      if ((r->mask & 2) && dbg_logfile != NULL) {
+	dbg_stamp(r->time, &min, &sec);
+	fprintf(dbg_logfile, "%2x %s [%d] @ %d.%d: %s%s", r->site->type,
+		r->site->module, r->site->line, min, sec, msg, nl);
+      }
+    }
+    __atomic_store_n(&rp->tail, tail, __ATOMIC_RELEASE);
+    dropped += __atomic_load_n(&rp->dropped, __ATOMIC_RELAXED);
+  }
+
+  /* Say when messages have been lost */
+  if (dropped != dbg_dropped) {
+    if (dbg_outf)
+      fprintf(dbg_outfile, "dbg: %lu messages dropped\n",
+	      dropped - dbg_dropped);
+    if (dbg_logf && dbg_logfile != NULL)
+      fprintf(dbg_logfile, "dbg: %lu messages dropped\n",
+	      dropped - dbg_dropped);
+    dbg_dropped = dropped;
+    ++n;
+  }
+  if (n > 0) {
+    fflush(dbg_outfile);
+    if (dbg_logfile != NULL) fflush(dbg_logfile);
+  }
+}
 
+/* Background thread: write out messages fifty times a second */
+static void *dbg_writer(void *arg)
+{
+  while (dbg_running) {
+    usleep(20000);
+    pthread_mutex_lock(&dbg_mutex);
+    dbg_drain();
+    pthread_mutex_unlock(&dbg_mutex);
+  }
+  return NULL;
+}
+
+/*!
+ * \fn int dbg_async_start(void)
+ * \brief format and write debug messages from a background thread
+ *
+ * Returns 0 on success or -1 if the thread can't be started or is
+ * already running.
+ */
+int dbg_async_start(void)
+{
+  struct dbg_ring *rp;
+
+  if (dbg_running) {
+    fprintf(stderr, "dbg_async_start: already running\n");
+    return -1;
+  }
+  pthread_mutex_lock(&dbg_mutex);
+  for (rp = dbg_rings; rp != NULL; rp = rp->link)
+    __atomic_store_n(&rp->dropped, 0, __ATOMIC_RELAXED);
+  dbg_dropped = 0;
+  pthread_mutex_unlock(&dbg_mutex);
+
+  dbg_running = 1;
+  if (pthread_create(&dbg_thread, NULL, dbg_writer, NULL) != 0) {
+    fprintf(stderr, "dbg_async_start: can't start writer thread\n");
+    dbg_running = 0;
+    return -1;
+  }
+  dbg_async = 1;
+  return 0;
+}
+
+/*!
+ * \fn int dbg_async_stop(void)
+ * \brief write out any waiting messages and go back to printing directly
+ *
+ * Returns the number of messages that were dropped because a ring was
+ * full, or -1 if background logging wasn't running.
+ */
+int dbg_async_stop(void)
+{
+  if (!dbg_running) return -1;
+  dbg_async = 0;
+  dbg_running = 0;
+  pthread_join(dbg_thread, NULL);
+  pthread_mutex_lock(&dbg_mutex);
+  dbg_drain();
+  pthread_mutex_unlock(&dbg_mutex);
+  return dbg_dropped;
 }
 
 /* Open a log file */
@@ -196,8 +624,12 @@ int dbg_openlog(char *file, char *mode)
 
 int dbg_closelog()
 {
+  /* Write out messages still waiting for the log */
+  pthread_mutex_lock(&dbg_mutex);
+  if (dbg_running) dbg_drain();
   if (dbg_logfile != NULL) fclose(dbg_logfile);
   dbg_logfile = NULL;
+  pthread_mutex_unlock(&dbg_mutex);
   dbg_logf = 0;
   return 0;
 }
@@ -233,6 +665,11 @@ static int dbg_execute_command(char *command)
 	printf("Terminal output is %s\n", dbg_outf ? "on" : "off");
 	break;
 
+    case Async:
+	if (dbg_async) dbg_async_stop(); else dbg_async_start();
+	printf("Background logging is %s\n", dbg_async ? "on" : "off");
+	break;
+
     case Use:                   /* Put module name in list */
 	dbg_token(parse, &parse, &end);
 	dbg_add_module(parse);
@@ -305,6 +742,7 @@ void dbg_token(char *command, char **start, char **end)
 #define DBG_MODULE_MAX 256      /* maximum number of modules allowed */
 char *dbg_module_list[256];     /* list of modules currently active */
 int dbg_module_count = 0;       /* number of modules currently active */
+int dbg_module_gen = 0;         /* changes whenever the list does */
 
 /* Add a module to the list */
 int dbg_add_module(char *name)
@@ -325,6 +763,7 @@ int dbg_add_module(char *name)
 	(char *) calloc((unsigned) strlen(name)+1, sizeof(char));
     if (s != NULL) (void) strcpy(s, name);
     ++dbg_module_count;
+    __atomic_add_fetch(&dbg_module_gen, 1, __ATOMIC_RELEASE);
 	 return(1);
 }
 
@@ -349,6 +788,7 @@ int dbg_delete_module(char *name)
 	    if (dbg_module_list[tail] != NULL)
 		dbg_module_list[head++] = dbg_module_list[tail];
 	dbg_module_count = head;
+	__atomic_add_fetch(&dbg_module_gen, 1, __ATOMIC_RELEASE);
     }
     return(1);
 }
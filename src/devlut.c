@@ -49,10 +49,12 @@
 extern int virtual_driver(DEV_ACTION, ...);
 extern int fcn_driver(DEV_ACTION, ...);
 extern int sertest_driver(DEV_ACTION, ...);
+extern int playback_driver(DEV_ACTION, ...);
 
 DEV_LOOKUP chn_devlut[CHN_MAXDEV] = {		
     {"virtual", virtual_driver},	/* virtual channels */
     {"function-gen", fcn_driver},	/* fcn_gen.c */
     {"sertest", sertest_driver},	/* sertest.c */
+    {"playback", playback_driver},	/* playback.c */
     {NULL, NULL}			/* end of table */
 };
@@ -92,6 +92,7 @@
 #include "ddkeymap.h"		/* default key binding tables */
 #include "hook.h"
 #include "flag.h"
+#include "profile.h"
 #include <unistd.h>
 
 extern int c86_sprintf(char *fmt, ...);
@@ -132,13 +133,16 @@ int dd_errlog_new = 0;		/* new message in error log */
 void (*dd_cls_fcn)(long arg) = NULL;
 void (*dd_prompt_fcn)(char *) = NULL;
 int (*dd_scanf_fcn)(char *, char *, void *) = NULL;
+void (*dd_errlog_fcn)(char *) = NULL;
 
 DECL_HOOKLIST(dd_loop_hooks, NUMHOOKS);
 
 /* Static variables used in this file */
 static int abort_loop = 0;	/* abort dd_loop */
-static int errpipe[2];		/* file descriptors for stderr pipe */
-static FILE *errfp = NULL;	/* receiving end of stderr pipe */
+static int errpipe[2] = {-1, -1};	/* file descriptors for stderr pipe */
+static char errline[256];	/* line being read from stderr pipe */
+static int errlen = 0;
+static void dd_errdrain(void);
 
 /*
  * Library functions - called to setup and communicated with dispay manager
@@ -205,8 +209,8 @@ int dd_open()
     if (pipe(errpipe) < 0) { return -1; }
     dup2(errpipe[1], fileno(stderr));
     fcntl(errpipe[0], F_SETFL, O_NONBLOCK);
-    if ((errfp = fdopen(errpipe[0], "r")) == NULL) { return -1; }
     dd_errlog[0] = '\0';
+    errlen = 0;
 
     DD_CLS((long) 0);
     co_setcursortype(_NOCURSOR);	/* turn off cursor */
@@ -251,6 +255,7 @@ int dd_usetbl(DD_IDENT *tbl)
    /* Save the old display table and mark this one as the new one */
    ddprv = ddtbl;
    ddtbl = tbl;
+   dd_index_clear(tbl);		/* rebuild variable index on demand */
 
     /* Intialize the display table */    
     for (entry = 0; tbl[entry].value != NULL; ++entry) {
@@ -320,12 +325,14 @@ DD_IDENT *dd_gettbl() { return ddtbl; }
 int dd_update()
 {
     int entry;
+    PROF_BEGIN(t0);
     
     /* Go through and update data items (only) */
     for (entry = 0; ddtbl[entry].value != NULL; ++entry)
 	if (ddtbl[entry].type == Data || !ddtbl[entry].initialized)
 	    (*ddtbl[entry].function)(Update, entry);
     	
+    PROF_END(PROF_DISPLAY, t0);
     return 0;
 }
 
@@ -390,16 +397,12 @@ int dd_rebind_tbl(char *name, void *addr, DD_IDENT *tbl)
 {
   int entry;
 
-  /* Search for the variable in the table */
-  for (entry = 0; tbl[entry].value != NULL; ++entry) {
-    if (strcmp(name, tbl[entry].varname) == 0) {
-      tbl[entry].value = addr;
-      return 0;
-    }
-  }
+  /* Look up the variable in the table */
+  if ((entry = dd_lookup_tbl(name, tbl)) < 0)
+    return -1;			/* didn't find the variable */
 
-  /* If we got here, we didn't find the variable */
-  return -1;
+  tbl[entry].value = addr;
+  return 0;
 }
 
 /*!
@@ -479,6 +482,7 @@ int dd_loop()
   
     /* Reset the abort flag */
     abort_loop = 0;
+    prof_trace_thread("display");
   
     while (!abort_loop) {
 	int count;
@@ -506,16 +510,7 @@ int dd_loop()
 	}
 #endif
 	/* Process any data sent to stderr (via redirect pipe) */
-	int errcount = 0;
-	while (errfp != NULL && fgets(dd_errlog, 80, errfp) != NULL) {
-	  /* See if we should actually print the line */
-	  if (dd_errprint) {
-	    /* Got a line of input; beep and display on prompt line */
-	    if (!errcount++) dd_beep(0);
-	    DD_PROMPT(dd_errlog);
-	    dd_errlog_new = 1;		/* flag new error log message */
-	  }
-	}
+	dd_errdrain();
     
 	/* See if any keys have been hit */
 	if (dd_debug) flag(DISPLAY_FLAG, 'K', GREEN);
@@ -611,6 +606,9 @@ int dd_input(long arg)
     DD_IDENT *ip = ddtbl + dd_cur;
     if (dd_cur != -1) {
       if ((*ip->function)(Input, dd_cur) != -1) {
+	/* Make sure the servo thread has the new value before the callback */
+	if (ip->mailbox && dd_mbox_enable) dd_mbox_sync();
+
 	/* On success, execute callback function */
 	if (ip->callback != NULL) 
 	  (*ip->callback)(ip->userarg == NULL ?
@@ -960,6 +958,38 @@ int dd_read(char *prompt, char *address, int length)
     return 0;
 }
 
+/*
+ * Read everything that has been sent to stderr and handle it a line at
+ * a time: display it on the prompt line (if dd_errprint is set), leave
+ * it in dd_errlog and pass it to the error log.  Called once per
+ * dd_loop() iteration, so that bursts of messages aren't lost.  A line
+ * that doesn't fit in errline is truncated.
+ */
+static void dd_errdrain(void)
+{
+    char buf[1024];
+    int n, i, count = 0;
+
+    while (errpipe[0] >= 0 && (n = read(errpipe[0], buf, sizeof(buf))) > 0)
+	for (i = 0; i < n; ++i) {
+	    if (buf[i] != '\n') {
+		if (errlen < sizeof(errline) - 1) errline[errlen++] = buf[i];
+		continue;
+	    }
+	    errline[errlen] = '\0';
+	    errlen = 0;
+	    snprintf(dd_errlog, sizeof(dd_errlog), "%.*s",
+		     (int) sizeof(dd_errlog) - 1, errline);
+	    if (dd_errlog_fcn != NULL) (*dd_errlog_fcn)(errline);
+
+	    /* Beep (once) and display on prompt line */
+	    if (dd_errprint) {
+		if (!count++) dd_beep(0);
+		DD_PROMPT(dd_errlog);
+	    }
+	}
+}
+
 /* Print a string on the prompt line */
 void dd_text_prompt(char *s)
 {
@@ -1027,7 +1057,8 @@ void dd_close()
     dbg_post_hook = NULL;
 
     /* Close off any open files */
-    if (errfp != NULL) fclose(errfp);
+    if (errpipe[0] >= 0) close(errpipe[0]);
+    errpipe[0] = -1;
 
 #   ifdef unix
     tc_close();
@@ -118,6 +118,7 @@ typedef struct display_entry {
   int up, down, left, right;    //!< indices of entries in each direction
   unsigned initialized: 1;	//!< flag to keep track of initialization
   unsigned reverse: 1;		//!< flag to reverse display colors
+  unsigned mailbox: 1;		//!< pass writes to the servo thread
 
   /* Offsets to adjacent (selectable) entries */
   /* Initialization done in dd_usetbl() */
@@ -157,6 +158,7 @@ extern long long dd_dummyvar;	//!< placeholder for reference entries */
 extern void (*dd_cls_fcn)(long);
 extern void (*dd_prompt_fcn)(char *);
 extern int (*dd_scanf_fcn)(char *, char *, void *); 
+extern void (*dd_errlog_fcn)(char *);	//!< stderr lines (errlog.c) */
 
 /*
  * Display functions 
@@ -209,6 +211,8 @@ extern void dd_refresh_tbl(int, DD_IDENT *);
 extern int dd_bindkey(int key, int (*fcn)(long));
 extern int dd_rebind_tbl(char *name, void *addr, DD_IDENT *tbl);
 extern int dd_rebind(char *, void *);
+extern int dd_lookup_tbl(char *name, DD_IDENT *tbl);
+extern void dd_index_clear(DD_IDENT *tbl);
 
 extern int dd_setcolor(int offset, int bg, int fg);
 extern int dd_setcolor_tbl(int offset, int bg, int fg, DD_IDENT *);
@@ -225,6 +229,30 @@ extern int dd_load(char *filename);
 #define dd_tbl_load(f, t)	dd_load_tbl(f, t)
 extern int dd_load_tbl(char *filename, DD_IDENT *tbl);
 
+/* Mailbox for writes from the display to the servo thread (ddmbox.c) */
+#include <stddef.h>
+#define DD_MBOX_DATALEN 256		//!< longest value that can be posted
+#define DD_MBOX_BUDGET 32		//!< entries applied per servo cycle
+extern int dd_mbox_enable;
+extern int dd_mbox_post(void *dst, void *src, size_t len);
+extern int dd_mbox_call(int (*fcn)(long), long arg);
+extern int dd_mbox_apply(int max);
+extern int dd_mbox_sync(void);
+extern int dd_store(DD_IDENT *dd, void *src, size_t len);
+extern int dd_setmbox(int offset, int flag);
+extern int dd_setmbox_tbl(int offset, int flag, DD_IDENT *tbl);
+
+/* Versioned parameter sets (ddparam.c) */
+typedef struct dd_pset DD_PSET;
+extern DD_PSET *dd_pset_create(DD_IDENT *tbl, int depth);
+extern void dd_pset_free(DD_PSET *);
+extern void dd_pset_validate(DD_PSET *, int (*)(char *, void *));
+extern int dd_pset_load(DD_PSET *, char *filename);
+extern int dd_pset_apply(DD_PSET *);
+extern int dd_pset_rollback(DD_PSET *, int steps);
+extern int dd_pset_version(DD_PSET *);
+extern int dd_pset_save(DD_PSET *, char *filename);
+
 extern int dd_select(int);
 extern int dd_beep(long);
 extern void dd_quiet(), dd_noisy();
@@ -269,6 +297,21 @@ int dd_vsprintf(char *, char *, int, va_list);
 #include <stdio.h>
 int chn_gettok(FILE * fp, char *string, int length, char *delimiters, int *line);
 
+/* Memory based configuration file lexer (chngettok.c) */
+#include <stddef.h>
+typedef struct chn_lex {
+  char *buf, *p, *end;			/* file contents and read pointer */
+  size_t size;				/* size of the buffer */
+  int mapped;				/* buffer is mmap'ed */
+  char *delimiters;			/* delimiters used to build isdelim */
+  char isdelim[256];			/* delimiter lookup table */
+} CHN_LEX;
+CHN_LEX *chn_lex_open(char *file);
+int chn_lex_gettok(CHN_LEX *lp, char *string, int length, char *delimiters,
+		   int *line);
+int chn_lex_eof(CHN_LEX *lp);
+void chn_lex_close(CHN_LEX *lp);
+
 /* Display hooks for debugging output */
 extern int dd_dbgout_setup();
 extern void dd_dbgout_cleanup();
@@ -6,9 +6,18 @@
  * \date 30 December 2006
  *
  * This file implements the ability to keep a log of error messages
- * and replay elements of that log.  The functionality is implemented
- * via display hooks and only included if the dd_errlog_init()
- * function is called.
+ * and replay elements of that log.  The functionality is only
+ * included if the dd_errlog_init() function is called.
+ *
+ * dd_loop() reads everything sent to stderr each time through the
+ * loop and passes each line to dd_errlog_add() (via dd_errlog_fcn).
+ * Messages are kept, with the time they arrived, in a ring of fixed
+ * size slots that is allocated once by dd_errlog_init(); when the
+ * ring is full the oldest message is dropped.  Messages are numbered
+ * from 0 in the order they arrived, and the number of messages
+ * dropped is available from dd_errlog_dropped().  From the display,
+ * the log can be searched for a string and a filter can be set so
+ * that only the messages that contain a string are shown.
  *
  * \ingroup display
  *
@@ -48,7 +57,10 @@
  */
 
 #include <stdlib.h>			/* for calloc() */
-#include <string.h>			/* for strdup() */
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
 #include "display.h"
 #include "hook.h"
 #include "errlog.h"
@@ -58,12 +70,19 @@ extern char dd_errlog[];		/* error log buffer */
 extern int dd_errprint;			/* error print flag */
 extern int dd_errlog_new;		/* flag to indicate new contents */
 
+/* A message in the log */
+struct errlog_msg {
+  struct timeval time;			/* when it was received */
+  char text[DD_ERRLOG_MSGLEN];
+};
+
 /* Static variables */
-static char **logbuf;			/* buffered messages */
+static struct errlog_msg *logbuf;	/* buffered messages (cyclic) */
 static int logsize;			/* size of error log */
-static int logoff;			/* offset into log (cyclic) */
 static int logcur = -1;			/* currently displayed message */
 static int logcnt = 0;			/* count number of message */
+static char logsearch[DD_ERRLOG_MSGLEN];	/* last search string */
+static char logfilter[DD_ERRLOG_MSGLEN];	/* show only matching messages */
 
 /* Static functions */
 static void errlog_display(int);	/* display message from log */
@@ -73,9 +92,9 @@ static void errlog_display(int);	/* display message from log */
  * \brief enable error logging
  *
  * This function enables the storage and replay of error messages
- * generated that are redirected from stderr.  It establishes a
- * display hook that keeps track of new error messages and stores them
- * in a buffer.
+ * generated that are redirected from stderr.  It allocates space for
+ * bufsize messages and has dd_loop() pass each line sent to stderr to
+ * dd_errlog_add().
  */
 
 int dd_errlog_init(int bufsize)
@@ -85,23 +104,51 @@ int dd_errlog_init(int bufsize)
 
   /* Allocate the memory required for the log buffer */
   if (bufsize <= 0 ||
-      (logbuf = (char **) calloc(bufsize, sizeof(char *))) == NULL) 
+      (logbuf = (struct errlog_msg *)
+       calloc(bufsize, sizeof(struct errlog_msg))) == NULL)
     return -1;
   logsize = bufsize;			/* store size of the buffer */
-  logoff = 0;				/* store from start of buffer */
+  logcnt = 0;
+  logcur = -1;
+  *logfilter = '\0';
 
-  /* Set up a display loop hook to store the log buffer */
+  /* Get lines from stderr; also keep messages posted in dd_errlog */
+  dd_errlog_fcn = dd_errlog_add;
+  hook_remove(dd_loop_hooks, dd_errlog_hook);
   if (hook_add(dd_loop_hooks, dd_errlog_hook) < 0) return -1;
 
   return 0;
 }
 
+/*!
+ * \fn void dd_errlog_add(char *msg)
+ * \brief Store a message in the error log
+ *
+ * Long messages are truncated and a trailing newline is removed.  If
+ * the log is full the oldest message is dropped.
+ */
+void dd_errlog_add(char *msg)
+{
+  struct errlog_msg *mp;
+  char *cp;
+
+  if (logbuf == NULL || logsize == 0) return;
+
+  mp = logbuf + logcnt % logsize;
+  gettimeofday(&mp->time, NULL);
+  strncpy(mp->text, msg, DD_ERRLOG_MSGLEN - 1);
+  mp->text[DD_ERRLOG_MSGLEN - 1] = '\0';
+  if ((cp = strchr(mp->text, '\n')) != NULL) *cp = '\0';
+  logcnt++;
+}
+
 /*!
  * \fn int dd_errlog_hook()
  * \brief Hook function for storing error log
  * 
  * The dd_errlog_hook() function is a hook function for dd_loop() that
- * keeps a copy of any messages posted to the error buffer.
+ * keeps a copy of any message posted directly to the error buffer
+ * (by setting dd_errlog and dd_errlog_new).
  *
  */
 int dd_errlog_hook()
@@ -111,15 +158,8 @@ int dd_errlog_hook()
   /* Make sure we have been initialized properly */
   if (logbuf == NULL || logsize == 0) return -1;
 
-  /* Store the message in our buffer */
-  if (logbuf[logoff] != NULL) free(logbuf[logoff]);
-  logbuf[logoff] = strdup(dd_errlog);
+  dd_errlog_add(dd_errlog);
   dd_errlog_new = 0;			/* reset new flag  */
-
-  /* Increment offset for next run */
-  logoff = (logoff + 1) % logsize;
-  logcnt++;
-  
   return 0;
 }
 
@@ -130,23 +170,89 @@ int dd_errlog_hook()
  */
 void dd_errlog_clear()
 {
-  int i;
-  if (logbuf == NULL || logsize == 0); return;
-  for (i = 0; i < logsize; ++i)
-    if (logbuf[i] != NULL) free (logbuf[i]);
+  if (logbuf == NULL || logsize == 0) return;
+  dd_errlog_fcn = NULL;
+  hook_remove(dd_loop_hooks, dd_errlog_hook);
   free(logbuf);
+  logbuf = NULL;
   logsize = logcnt = 0;
+  logcur = -1;
+}
+
+/*
+ * Access to the log
+ *
+ * dd_errlog_count	number of messages received
+ * dd_errlog_dropped	number of messages dropped from the log
+ * dd_errlog_get	get a message and the time it was received
+ * dd_errlog_find	find a message that contains a string
+ *
+ */
+
+/*! \brief number of messages received since dd_errlog_init() */
+int dd_errlog_count() { return logcnt; }
+
+/*! \brief number of messages that have been dropped because the log was full */
+int dd_errlog_dropped() { return logcnt > logsize ? logcnt - logsize : 0; }
+
+/*!
+ * \fn char *dd_errlog_get(int msgno, struct timeval *tp)
+ * \brief Get a message from the log
+ *
+ * Returns the text of message msgno (numbered from 0) and, if tp is
+ * not NULL, stores the time it was received in *tp.  Returns NULL if
+ * the message has been dropped or hasn't been received yet.
+ */
+char *dd_errlog_get(int msgno, struct timeval *tp)
+{
+  struct errlog_msg *mp;
+
+  if (msgno < dd_errlog_dropped() || msgno >= logcnt) return NULL;
+  mp = logbuf + msgno % logsize;
+  if (tp != NULL) *tp = mp->time;
+  return mp->text;
+}
+
+/*!
+ * \fn int dd_errlog_find(int msgno, int dir, char *str)
+ * \brief Find a message that contains a string
+ *
+ * Looks at messages msgno, msgno + dir, msgno + 2*dir, ... (dir is 1
+ * or -1) and returns the number of the first that contains str, or -1
+ * if there isn't one in the log.  A NULL or empty string matches any
+ * message.
+ */
+int dd_errlog_find(int msgno, int dir, char *str)
+{
+  int first = dd_errlog_dropped();
+
+  if (msgno < first) {
+    if (dir < 0) return -1;
+    msgno = first;
+  }
+  if (msgno >= logcnt) {
+    if (dir > 0) return -1;
+    msgno = logcnt - 1;
+  }
+  for (; msgno >= first && msgno < logcnt; msgno += dir)
+    if (str == NULL || *str == '\0' ||
+	strstr(logbuf[msgno % logsize].text, str) != NULL)
+      return msgno;
+  return -1;
 }
 
 /*
  * Display callbacks
  *
  * The callbacks below can be used to display information from the 
- * error log.
+ * error log.  When a filter is set, only the messages that match it
+ * are shown.
  *
  * dd_errlog_keybind	set up standard key bindings for errlog
  * dd_errlog_prev	display previous entry in the log
  * dd_errlog_next	display next entry in the log
+ * dd_errlog_search	search back through the log for a string
+ * dd_errlog_filter	only show messages that contain a string
  * dd_errprint_toggle	turn off/on printing of stderr output
  *
  */
@@ -160,6 +266,8 @@ void dd_errlog_clear()
  *   * ^E	end of errror log
  *   * ^N	next error
  *   * ^P	previous error
+ *   * ^R	search back for a string
+ *   * ^T	set filter
  *   * ^Oi	toggle printing of error messages
  */
 
@@ -167,8 +275,10 @@ void dd_errlog_bindkey()
 {
   dd_bindkey('P'-'A' + 1, dd_errlog_prev);	/* ^P - scroll errlog */
   dd_bindkey('N'-'A' + 1, dd_errlog_next);	/* ^N - scroll errlog */
-  dd_bindkey('A'-'A' + 1, dd_errlog_start);	/* ^N - start of log */
-  dd_bindkey('E'-'A' + 1, dd_errlog_end);	/* ^N - end of log */
+  dd_bindkey('A'-'A' + 1, dd_errlog_start);	/* ^A - start of log */
+  dd_bindkey('E'-'A' + 1, dd_errlog_end);	/* ^E - end of log */
+  dd_bindkey('R'-'A' + 1, dd_errlog_search);	/* ^R - search */
+  dd_bindkey('T'-'A' + 1, dd_errlog_filter);	/* ^T - filter */
   dd_bindkey('O'-'A' + 1, dd_errprint_toggle);	/* ^O - toggle printing */
 
   return;
@@ -184,7 +294,13 @@ void dd_errlog_bindkey()
 
 int dd_errlog_start(long arg)
 {
-  errlog_display(logcur = 0);
+  int msgno = dd_errlog_find(0, 1, logfilter);
+
+  if (msgno < 0) {
+    DD_PROMPT("errlog: no messages");
+    return 0;
+  }
+  errlog_display(logcur = msgno);
   return 0;
 }
 
@@ -198,16 +314,22 @@ int dd_errlog_start(long arg)
 
 int dd_errlog_prev(long arg)
 {
-  /* Move to the prev message, unless we are already at beginning */
-  if (logcur >= 0) --logcur;
+  char msg[80];
+  int msgno = logcur > 0 ? dd_errlog_find(logcur - 1, -1, logfilter) : -1;
 
   /* Make sure the message exists */
-  if (logcur < 0) {
-    DD_PROMPT("errlog: start of buffer"); 
+  if (msgno < 0) {
+    if (dd_errlog_dropped() > 0) {
+      sprintf(msg, "errlog: start of buffer (%d older messages dropped)",
+	      dd_errlog_dropped());
+      DD_PROMPT(msg);
+    } else
+      DD_PROMPT("errlog: start of buffer"); 
+    logcur = -1;
     return 0; 
   }
 
-  errlog_display(logcur);
+  errlog_display(logcur = msgno);
   return 0;
 }
 
@@ -221,16 +343,16 @@ int dd_errlog_prev(long arg)
 
 int dd_errlog_next(long arg)
 {
-  /* Move to the next message, unless we are already at end */
-  if (logcur < logcnt) ++logcur;
+  int msgno = dd_errlog_find(logcur + 1, 1, logfilter);
 
   /* Make sure the message we want exists */
-  if (logcur >= logcnt) {
+  if (msgno < 0) {
     DD_PROMPT("errlog: end of buffer");
+    logcur = logcnt;
     return 0; 
   }
 
-  errlog_display(logcur);
+  errlog_display(logcur = msgno);
   return 0;
 }
 
@@ -243,11 +365,69 @@ int dd_errlog_next(long arg)
 
 int dd_errlog_end(long arg)
 {
-  if (logcnt == 0) {
+  int msgno = dd_errlog_find(logcnt - 1, -1, logfilter);
+
+  if (msgno < 0) {
     DD_PROMPT("errlog: end of buffer");
     return 0;
   }
-  errlog_display(logcur = logcnt-1);
+  errlog_display(logcur = msgno);
+  return 0;
+}
+
+/*!
+ * \fn int dd_errlog_search(long arg)
+ * \brief Search back through the error log for a string
+ *
+ * Prompts for a string and displays the last message before the
+ * current one that contains it (and the filter).  An empty string
+ * repeats the last search.
+ */
+
+int dd_errlog_search(long arg)
+{
+  char str[DD_ERRLOG_MSGLEN];
+  int msgno;
+
+  dd_read("Search errlog: ", str, 60);
+  if (*str != '\0') strcpy(logsearch, str);
+  if (*logsearch == '\0') return 0;
+
+  /* Start from the message before the current one (or the end) */
+  msgno = logcur < 0 || logcur >= logcnt ? logcnt - 1 : logcur - 1;
+  for (; (msgno = dd_errlog_find(msgno, -1, logsearch)) >= 0; --msgno)
+    if (dd_errlog_find(msgno, -1, logfilter) == msgno) break;
+
+  if (msgno < 0) {
+    DD_PROMPT("errlog: not found");
+    return 0;
+  }
+  errlog_display(logcur = msgno);
+  return 0;
+}
+
+/*!
+ * \fn int dd_errlog_filter(long arg)
+ * \brief Only show the messages that contain a string
+ *
+ * Prompts for a string; after that the other callbacks skip over
+ * messages that don't contain it.  An empty string shows all
+ * messages again.
+ */
+
+int dd_errlog_filter(long arg)
+{
+  char msg[80];
+  int msgno, n = 0;
+
+  dd_read("Filter errlog: ", logfilter, 60);
+  for (msgno = dd_errlog_find(0, 1, logfilter); msgno >= 0;
+       msgno = dd_errlog_find(msgno + 1, 1, logfilter))
+    ++n;
+  sprintf(msg, "errlog: %d of %d messages shown", n,
+	  logcnt - dd_errlog_dropped());
+  DD_PROMPT(msg);
+  logcur = logcnt;			/* ^P goes to the last match */
   return 0;
 }
 
@@ -256,7 +436,7 @@ int dd_errlog_end(long arg)
  * \brief Toggle printing of error messages
  *
  * This function toggles whether or not error messages are printed 
- * to the screen.
+ * to the screen.  Messages are saved in the log either way.
  */
 
 int dd_errprint_toggle(long arg)
@@ -276,26 +456,28 @@ int dd_errprint_toggle(long arg)
  * \fn void errlog_display(int offset)
  * \brief Display message at the current location in the log
  *
- * If the message is no longer available (because it has scrolled out
- * of the buffer), it prints an error message and sets the offset to
- * the oldest message available.
+ * The message is shown with its number and the time it was received.
  */
 
 void errlog_display(int offset)
 {
-  /* Check to make sure the message is in the buffer */
-  if (logcnt - offset > logsize) { 
-    DD_PROMPT("errlog: message not available; resetting to start of buffer");
-    logcur = logcnt - logsize;
+  struct timeval tv;
+  struct tm tm;
+  char msgbuf[81], *text;
+  int n;
+
+  if ((text = dd_errlog_get(offset, &tv)) == NULL) {
+    DD_PROMPT("errlog: message not available");
     return;
   }
 
-  /* Now construct the message (with limited line length) */  
-  const int msglen = 80;
-  static char msgbuf[81];
-
-  sprintf(msgbuf, "%d: ", offset);
-  strncat(msgbuf, logbuf[offset % logsize], msglen-strlen(msgbuf));
+  /* Now construct the message, cut off at the width of the prompt line */
+  localtime_r(&tv.tv_sec, &tm);
+  n = snprintf(msgbuf, sizeof(msgbuf), "%d %02d:%02d:%02d.%03d: ", offset,
+	       tm.tm_hour, tm.tm_min, tm.tm_sec, (int) (tv.tv_usec / 1000));
+  if (n >= 0 && n < (int) sizeof(msgbuf))
+    snprintf(msgbuf + n, sizeof(msgbuf) - n, "%.*s",
+	     (int) sizeof(msgbuf) - 1 - n, text);
   DD_PROMPT(msgbuf);
 
   return;
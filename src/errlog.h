@@ -47,22 +47,35 @@
 #ifndef ERRLOG_INCLUDED
 #define ERRLOG_INCLUDED
 
+#include <sys/time.h>
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+#define DD_ERRLOG_MSGLEN 160		/* longest message kept */
+
 /* Function calls for setting up error logging */
 extern int dd_errlog_init(int);
 extern int dd_errlog_hook();
 extern void dd_errlog_clear();
 void dd_errlog_bindkey();
 
+/* Access to the log */
+void dd_errlog_add(char *msg);
+int dd_errlog_count();
+int dd_errlog_dropped();
+char *dd_errlog_get(int msgno, struct timeval *tp);
+int dd_errlog_find(int msgno, int dir, char *str);
+
 /* Callback functions */
 int dd_errlog_prev(long);
 int dd_errlog_next(long);
 int dd_errlog_start(long);
 int dd_errlog_end(long);
+int dd_errlog_search(long);
+int dd_errlog_filter(long);
 int dd_errprint_toggle(long);
 
 #ifdef __cplusplus
@@ -0,0 +1,101 @@
+/*!
+ * \file errlogtst.c
+ * \brief test the error log
+ *
+ * \date 19 Oct 26
+ *
+ * Fills the error log past its size and checks the message numbers,
+ * times, drop count and truncation, searching and filtering with
+ * dd_errlog_find(), the scrolling callbacks (with the prompt line
+ * captured), messages posted through dd_errlog and dd_errlog_new, and
+ * that dd_errlog_clear() empties the log.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "display.h"
+#include "hook.h"
+#include "errlog.h"
+
+#define TST_NAME "errlogtst"
+#include "tstutil.h"
+
+extern char dd_errlog[];
+extern int dd_errlog_new;
+
+static char prompt[256];
+
+static void save_prompt(char *s) { strncpy(prompt, s, sizeof(prompt) - 1); }
+
+int main(int argc, char **argv)
+{
+  struct timeval t0, t1;
+  char msg[300], *text;
+  int i;
+
+  dd_prompt_fcn = save_prompt;
+  check(dd_errlog_init(8) == 0, "dd_errlog_init failed");
+  check(dd_errlog_fcn == dd_errlog_add, "stderr lines not sent to log");
+
+  /* 20 messages into 8 slots: 0-11 are dropped */
+  for (i = 0; i < 20; ++i) {
+    sprintf(msg, "%s %d\n", i % 3 == 0 ? "motor fault" : "sensor", i);
+    dd_errlog_add(msg);
+  }
+  check(dd_errlog_count() == 20, "count");
+  check(dd_errlog_dropped() == 12, "dropped");
+  check(dd_errlog_get(11, NULL) == NULL, "dropped message returned");
+  check(dd_errlog_get(20, NULL) == NULL, "future message returned");
+  text = dd_errlog_get(12, &t0);
+  check(text != NULL && strcmp(text, "motor fault 12") == 0, "message 12");
+  text = dd_errlog_get(19, &t1);
+  check(text != NULL && strcmp(text, "sensor 19") == 0, "message 19");
+  check(t1.tv_sec > t0.tv_sec || (t1.tv_sec == t0.tv_sec &&
+				  t1.tv_usec >= t0.tv_usec), "times");
+
+  /* Searching */
+  check(dd_errlog_find(19, -1, "motor") == 18, "search back");
+  check(dd_errlog_find(0, 1, "motor") == 12, "search forward from dropped");
+  check(dd_errlog_find(17, -1, "fault 12") == 12, "search for 12");
+  check(dd_errlog_find(13, 1, "fault 12") == -1, "search past end");
+  check(dd_errlog_find(100, -1, NULL) == 19, "last message");
+
+  /* Scrolling */
+  check(dd_errlog_end(0) == 0 && strncmp(prompt, "19 ", 3) == 0, "^E");
+  check(dd_errlog_prev(0) == 0 && strstr(prompt, "motor fault 18") != NULL, "^P");
+  dd_errlog_start(0);
+  check(strncmp(prompt, "12 ", 3) == 0 &&
+	strstr(prompt, "motor fault 12") != NULL, "^A");
+  dd_errlog_prev(0);
+  check(strstr(prompt, "12 older messages dropped") != NULL, "^P at start");
+  dd_errlog_next(0);
+  check(strstr(prompt, "motor fault 12") != NULL, "^N after start");
+
+  /* Long messages are truncated */
+  memset(msg, 'x', sizeof(msg) - 1);
+  msg[sizeof(msg) - 1] = '\0';
+  dd_errlog_add(msg);
+  check(strlen(dd_errlog_get(20, NULL)) == DD_ERRLOG_MSGLEN - 1, "truncation");
+
+  /* Messages posted through dd_errlog */
+  strcpy(dd_errlog, "posted message");
+  dd_errlog_new = 1;
+  hook_execute(dd_loop_hooks);
+  check(dd_errlog_new == 0 && dd_errlog_count() == 22 &&
+	strcmp(dd_errlog_get(21, NULL), "posted message") == 0, "dd_errlog");
+
+  /* Clearing, then starting again (the hook is only added once) */
+  dd_errlog_clear();
+  check(dd_errlog_count() == 0 && dd_errlog_get(0, NULL) == NULL, "clear");
+  check(dd_errlog_fcn == NULL, "stderr lines still sent to cleared log");
+  check(dd_errlog_init(4) == 0 && dd_errlog_init(4) == 0, "re-init");
+  strcpy(dd_errlog, "again");
+  dd_errlog_new = 1;
+  hook_execute(dd_loop_hooks);
+  check(dd_errlog_count() == 1, "message after re-init");
+  dd_errlog_clear();
+
+  return status;
+}
@@ -6,13 +6,15 @@
  *
  * This file contains a pseudo-device driver which, instead 
  * of reading an actual physical device, generates functions.
- * It can be used to generate sine, square, and triangle
- * waves, and behaves like a normal device driver.
- * The output of the function generator device is a function
- * of real time, the calculation of which depends on the frequency
- * the servo routine is running at (servo_frequency, declared
- * in servo.h), and assumes that the device is "read" once
- * per servo cycle.
+ * It can be used to generate sine, square, triangle, chirp,
+ * PRBS and multisine signals, or to play back a waveform
+ * stored in a MATLAB file, and behaves like a normal device
+ * driver.  The output of the function generator device is a
+ * function of real time, the calculation of which depends on
+ * the frequency the servo routine is running at (servo_frequency,
+ * declared in servo.h), and assumes that the device is "read"
+ * once per servo cycle.  Without SERVO, the time between reads
+ * is taken from the monotonic clock.
  *
  * Copyright (c) 2008 by California Institute of Technology
  * All rights reserved.
@@ -56,14 +58,19 @@
 #include "channel.h"
 #ifdef SERVO
 #include "servo.h"
-#else				/* if no servo, use gettimeofday */
-#include <sys/time.h>
+#else				/* if no servo, use clock_gettime */
 #include <time.h>
 #endif
 #include "display.h"
+#include "matrix.h"
 #include "fcn_gen.h"
 
-#define PI 3.14159265
+#define PI 3.14159265358979
+
+#define FCN_SINELEN 4096		/* sine table size (power of 2) */
+#define FCN_MAXBITS 31			/* longest PRBS register */
+#define FCN_MAXSINES 64			/* most components in a multisine */
+#define FCN_MAXFILES 8			/* waveform files kept in memory */
 
 /* Local function declarations */
 int fcn_channel_scan(long type);
@@ -73,130 +80,342 @@ struct fcn_gen_sp{
   double frequency;
   double dc_offset;
   FCN_TYPE type;
+
+  double phase;			/* phase accumulator, in cycles */
+  double f1, duration, t;	/* chirp end frequency, sweep time, clock */
+  unsigned lfsr;		/* PRBS shift register */
+  int bits;			/* PRBS register length */
+  int nsines;			/* number of multisine components */
+  double norm;			/* multisine normalization */
+  MATRIX *list;			/* matrices loaded for arbitrary waveform */
+  char var[20];			/* name of the waveform matrix */
+  double *wave;			/* arbitrary waveform samples */
+  int nwave;			/* number of samples */
+  double rate;			/* playback sample rate (0 = use frequency) */
+  double last;			/* time of the last read */
 };
 typedef struct fcn_gen_sp SPECIFIC3;
 
+static double fcn_sintbl[FCN_SINELEN + 1];
+static int fcn_sintbl_init = 0;
+
+static void fcn_sintbl_setup(void)
+{
+  int i;
+
+  if (fcn_sintbl_init) return;
+  for (i = 0; i <= FCN_SINELEN; ++i)
+    fcn_sintbl[i] = sin(2*PI*i/FCN_SINELEN);
+  fcn_sintbl_init = 1;
+}
+
+/*
+ * Feedback masks for maximal length Galois shift registers, indexed
+ * by the number of bits in the register.
+ */
+static const unsigned fcn_prbs_taps[FCN_MAXBITS + 1] = {
+  0, 0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240, 0x500,
+  0x829, 0x100D, 0x2015, 0x6000, 0xD008, 0x12000, 0x20400, 0x40023,
+  0x90000, 0x140000, 0x300000, 0x420000, 0xE10000, 0x1200000,
+  0x2000023, 0x4000013, 0x9000000, 0x14000000, 0x20000029, 0x48000000
+};
+
+/* Names accepted by the -type flag, in FCN_TYPE order */
+static char *fcn_type_names[] = {
+  "sine", "square", "triangle", "chirp", "prbs", "multisine", "arbitrary",
+  NULL
+};
+
+/* Files that have been loaded for arbitrary waveforms */
+static struct { char file[64]; MATRIX *list; } fcn_files[FCN_MAXFILES];
+
+/* Sine of an angle given in cycles, by interpolation in fcn_sintbl */
+static inline double fcn_sin(double cycles)
+{
+  double x = (cycles - floor(cycles)) * FCN_SINELEN;
+  int i = (int) x;
+  double *tp = fcn_sintbl + (i & (FCN_SINELEN - 1));
+
+  return tp[0] + (x - i) * (tp[1] - tp[0]);
+}
+
+/* Compute the multisine scaling so that the peak value is one */
+static void fcn_multisine_norm(SPECIFIC3 *sp)
+{
+  int i, k, n = sp->nsines;
+  double sum, peak = 0;
+
+  fcn_sintbl_setup();
+  for (i = 0; i < 1024; ++i) {
+    for (sum = 0, k = 1; k <= n; ++k)
+      sum += fcn_sin(k * i / 1024.0 - k * (k - 1) / (2.0 * n));
+    if (fabs(sum) > peak) peak = fabs(sum);
+  }
+  sp->norm = peak > 0 ? 1 / peak : 1;
+}
+
+/* Select the waveform matrix from the list loaded for a channel */
+static int fcn_wave_select(SPECIFIC3 *sp)
+{
+  MATRIX *mp = sp->list;
+
+  if (mp == NULL) return 0;
+  if (*sp->var != '\0' && (mp = mat_find(sp->list, sp->var)) == NULL) {
+    fprintf(stderr, "fcn_gen: no matrix \"%s\" in waveform file\n", sp->var);
+    return -1;
+  }
+  if (mp->real == NULL || mp->nrows * mp->ncols <= 0) {
+    fprintf(stderr, "fcn_gen: waveform \"%s\" is empty\n", mp->name);
+    return -1;
+  }
+  sp->wave = mp->real;
+  sp->nwave = mp->nrows * mp->ncols;
+  return 1;
+}
+
+/* Load (or find the already loaded) matrices in a waveform file */
+static int fcn_wave_load(SPECIFIC3 *sp, char *file)
+{
+  int i;
+
+  for (i = 0; i < FCN_MAXFILES && fcn_files[i].list != NULL; ++i)
+    if (strcmp(fcn_files[i].file, file) == 0) break;
+
+  if (i == FCN_MAXFILES) {
+    fprintf(stderr, "fcn_gen: too many waveform files\n");
+    return -1;
+  }
+  if (fcn_files[i].list == NULL) {
+    MATRIX *list = mat_load(file);
+    if (list == NULL || list->real == NULL) {
+      fprintf(stderr, "fcn_gen: couldn't load waveform file \"%s\"\n", file);
+      if (list != NULL) mat_list_free(list);
+      return -1;
+    }
+    strncpy(fcn_files[i].file, file, sizeof(fcn_files[i].file) - 1);
+    fcn_files[i].list = list;
+  }
+  sp->list = fcn_files[i].list;
+  return fcn_wave_select(sp);
+}
+
+/* Process a flag for either the device defaults or a single channel */
+static int fcn_flag(SPECIFIC3 *sp)
+{
+  double val;
+  int i;
+
+  if (!strcmp(chn_flag_name, "type")) {
+    for (i = 0; fcn_type_names[i] != NULL; ++i)
+      if (!strcmp(chn_flag_value, fcn_type_names[i])) break;
+    if (fcn_type_names[i] == NULL &&
+	(sscanf(chn_flag_value, "%d", &i) != 1 || i < 0 || i > Arbitrary))
+      return -1;
+    sp->type = (FCN_TYPE) i;
+  }
+  else if (!strcmp(chn_flag_name, "frequency")) {
+    if (sscanf(chn_flag_value, "%lf", &sp->frequency) != 1) return -1;
+  }
+  else if (!strcmp(chn_flag_name, "dc_offset")) {
+    if (sscanf(chn_flag_value, "%lf", &sp->dc_offset) != 1) return -1;
+  }
+  else if (!strcmp(chn_flag_name, "f1")) {
+    if (sscanf(chn_flag_value, "%lf", &sp->f1) != 1) return -1;
+  }
+  else if (!strcmp(chn_flag_name, "duration")) {
+    /* the sweep rate is (f1 - frequency) / duration */
+    if (sscanf(chn_flag_value, "%lf", &val) != 1 || val <= 0) return -1;
+    sp->duration = val;
+  }
+  else if (!strcmp(chn_flag_name, "bits")) {
+    if (sscanf(chn_flag_value, "%d", &i) != 1 || i < 2 || i > FCN_MAXBITS)
+      return -1;
+    sp->bits = i;
+    sp->lfsr = 1;
+  }
+  else if (!strcmp(chn_flag_name, "nsines")) {
+    if (sscanf(chn_flag_value, "%d", &i) != 1 || i < 1 || i > FCN_MAXSINES)
+      return -1;
+    sp->nsines = i;
+    fcn_multisine_norm(sp);
+  }
+  else if (!strcmp(chn_flag_name, "file")) {
+    return fcn_wave_load(sp, chn_flag_value) < 0 ? -1 : 1;
+  }
+  else if (!strcmp(chn_flag_name, "var")) {
+    strncpy(sp->var, chn_flag_value, sizeof(sp->var) - 1);
+    return fcn_wave_select(sp) < 0 ? -1 : 1;
+  }
+  else if (!strcmp(chn_flag_name, "rate")) {
+    if (sscanf(chn_flag_value, "%lf", &sp->rate) != 1) return -1;
+  }
+  else
+    return 0;
+
+  return 1;
+}
+
+/* Reset a channel specific part to the default settings */
+static void fcn_reset(SPECIFIC3 *sp)
+{
+  memset(sp, 0, sizeof(SPECIFIC3));
+  sp->frequency = 1;
+  sp->type = Sine;
+  sp->f1 = 10;
+  sp->duration = 10;
+  sp->lfsr = 1;
+  sp->bits = 10;
+  sp->nsines = 1;
+  sp->norm = 1;
+}
+
 /*!
  * \fn int fcn_driver(DEV_ACTION action, ...)
  * \brief function generator device
  *
+ * Each channel keeps its own phase, in cycles, which is advanced by
+ * frequency * dt on every read.  Since the phase is kept in [0, 1)
+ * there is no loss of precision on long runs.  Sine values come from
+ * an interpolated table rather than calls to sin().
  */
 int fcn_driver(DEV_ACTION action, ...)
 {
   va_list ap;
-  static double time = 0;
   register int i;
-  int status = 0;
-  double temp, dummy;
+  int k, status = 0;
+  double dt, p, u, x;
+  SPECIFIC3 *sp;
+# ifndef SERVO
+  double now;
+# endif
+
+  static SPECIFIC3 defaults;	/* defaults for channel configuration */
+  static int defaults_init = 0;
 
-  static double frequency=1;	/* defaults for channel configuration */
-  static double dc_offset=0;
-  static FCN_TYPE type=Sine;
-  
   va_start(ap, action);
   DEVICE *dp = va_arg(ap, DEVICE *);
   CHANNEL *cp = va_arg(ap, CHANNEL *);
-  
+
+  if (!defaults_init) { fcn_reset(&defaults); defaults_init = 1; }
+
   switch (action) {
   case Read:
 #   ifdef SERVO
-    time += (double)1/servo_freq;
+    dt = (double)1/servo_freq;
 #   else
     {
-      struct timeval tv;
-      gettimeofday(&tv, NULL);
-      time = tv.tv_sec + ((double) tv.tv_usec)/1000.0;
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now = ts.tv_sec + ts.tv_nsec * 1e-9;
     }
 #   endif // SERVO
     for(i=0; i<dp->size; i++){
-      switch(((SPECIFIC3*)cp[i].dev_sp)->type){
+      sp = (SPECIFIC3 *) cp[i].dev_sp;
+#     ifndef SERVO
+      dt = sp->last == 0 ? 0 : now - sp->last;
+      sp->last = now;
+#     endif
+
+      /* Chirps sweep the frequency linearly and restart each sweep */
+      if (sp->type == Chirp) {
+	sp->t += dt;
+	if (sp->duration > 0 && sp->t >= sp->duration) {
+	  sp->t -= sp->duration * floor(sp->t / sp->duration);
+	  sp->phase = 0;
+	}
+	sp->phase += (sp->frequency + (sp->f1 - sp->frequency) *
+		      sp->t / sp->duration) * dt;
+      }
+      else if (sp->type == Arbitrary && sp->rate > 0 && sp->nwave > 0)
+	sp->phase += sp->rate / sp->nwave * dt;
+      else
+	sp->phase += sp->frequency * dt;
+
+      /* Clock the shift register once for every full cycle */
+      if (sp->type == Prbs) {
+	for (k = (int) sp->phase; k > 0; --k)
+	  sp->lfsr = (sp->lfsr >> 1) ^ (-(sp->lfsr & 1) & fcn_prbs_taps[sp->bits]);
+      }
+      sp->phase -= floor(sp->phase);
+      p = sp->phase + cp[i].offset / 360.0;
+
+      switch(sp->type){
       case Sine:
-	cp[i].data.d = ((SPECIFIC3*)cp[i].dev_sp)->dc_offset + cp[i].scale * sin((double)2*PI*((SPECIFIC3*)cp[i].dev_sp)->frequency*time + cp[i].offset*PI/180);
+      case Chirp:
+	u = fcn_sin(p);
 	break;
 
       case Square:
-	cp[i].data.d = ((SPECIFIC3*)cp[i].dev_sp)->dc_offset + cp[i].scale * ((sin((double)2*PI*((SPECIFIC3*)cp[i].dev_sp)->frequency*time+cp[i].offset*PI/180) > 0) ? 1 : -1);
+	u = (p - floor(p) < 0.5) ? 1 : -1;
 	break;
 
       case Triangle:
-	temp = modf((double)(time*((SPECIFIC3*)cp[i].dev_sp)->frequency+cp[i].offset/360), &dummy);  /* ranging from 0 to 1 each period*/
-	cp[i].data.d = ((SPECIFIC3*)cp[i].dev_sp)->dc_offset + cp[i].scale * (4*fabs((double)0.5-temp)-1);
+	u = 4*fabs((double)0.5 - (p - floor(p))) - 1;
+	break;
+
+      case Prbs:
+	u = (sp->lfsr & 1) ? 1 : -1;
+	break;
+
+      case Multisine:
+	/* Schroeder phases keep the crest factor low */
+	for (u = 0, k = 1; k <= sp->nsines; ++k)
+	  u += fcn_sin(k * p - k * (k - 1) / (2.0 * sp->nsines));
+	u *= sp->norm;
+	break;
+
+      case Arbitrary:
+	if (sp->nwave == 0) { u = 0; break; }
+	x = (p - floor(p)) * sp->nwave;
+	k = (int) x;
+	if (k >= sp->nwave) k = sp->nwave - 1;
+	u = sp->wave[k] + (x - k) * (sp->wave[(k+1) % sp->nwave] - sp->wave[k]);
+	break;
+
+      default:
+	u = 0;
 	break;
       }
+      cp[i].data.d = sp->dc_offset + cp[i].scale * u;
     }
     break;
 
   case Init:
     break;
-  
+
   case Close:
     break;
-    
+
   case NewChannels:
+    fcn_sintbl_setup();
+
     /* create fcn_gen specific part of the channel entries */
     for(i=0; i<dp->size; i++){
       if ((cp+i)->dev_sp != NULL)
 	free((cp+i)->dev_sp);          /* don't want to clutter memory */
       ((cp+i)->dev_sp = (SPECIFIC3 *)malloc(sizeof(SPECIFIC3)));
       if( (cp+i)->dev_sp == NULL){
-	 status=-1; 
+	 status=-1;
 	 break;
        }
-      ((SPECIFIC3*)((cp+i)->dev_sp))->frequency = frequency; 
-      ((SPECIFIC3*)((cp+i)->dev_sp))->dc_offset = dc_offset;
-      ((SPECIFIC3*)((cp+i)->dev_sp))->type = type;   
+      *(SPECIFIC3 *)(cp+i)->dev_sp = defaults;
     }
-    frequency=1;		/* reset defaults for next fcn_gen */
-    dc_offset=0;
-    type=Sine;
-    status=1;
-    break; 
+    fcn_reset(&defaults);	/* reset defaults for next fcn_gen */
+    if (status == 0) status=1;
+    break;
 
   case HandleFlag:
     switch(chn_flag_type) {
     case Device:
-      if(!strcmp(chn_flag_name, "type")){
-	if(sscanf(chn_flag_value, "%d", (int *) &type))
-	  status = 1;
-	else status=-1;
-	break;
-      }
-      else if(!strcmp(chn_flag_name, "frequency")){
-	if(sscanf(chn_flag_value, "%lf", &frequency))
-	  status = 1;
-	else status=-1;
-	break;
-      }
-      else if(!strcmp(chn_flag_name, "dc_offset")){
-	if(sscanf(chn_flag_value, "%lf", &dc_offset))
-	  status = 1;
-	else status=-1;
-	break;
-      }
+      status = fcn_flag(&defaults);
       break;
-      
+
     case Channel:
-      if(!strcmp(chn_flag_name, "type")){
-	if(sscanf(chn_flag_value, "%d", 
-		  (int *) &((SPECIFIC3*)cp->dev_sp)->type))
-	  status = 1;
-	else status=-1;
-	break;
-      }
-      else if(!strcmp(chn_flag_name, "frequency")){
-	if(sscanf(chn_flag_value, "%lf", &((SPECIFIC3*)cp->dev_sp)->frequency))
-	  status = 1;
-	else status=-1;
-	break;
-      }
-      else if(!strcmp(chn_flag_name, "dc_offset")){
-	if(sscanf(chn_flag_value, "%lf", &((SPECIFIC3*)cp->dev_sp)->dc_offset))
-	  status = 1;
-	else status=-1;
-	break;
-      }
+      status = fcn_flag((SPECIFIC3 *) cp->dev_sp);
+      break;
+
+    default:
       break;
-      
     }
   }
   va_end(ap);
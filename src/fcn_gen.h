@@ -45,6 +45,10 @@ enum fcn_type{
   Sine,
   Square,
   Triangle,
+  Chirp,			/* linear sweep from frequency to f1 */
+  Prbs,				/* maximal length binary sequence */
+  Multisine,			/* harmonics with Schroeder phases */
+  Arbitrary,			/* waveform loaded from a .mat file */
 };
 typedef enum fcn_type FCN_TYPE;
 
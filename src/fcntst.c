@@ -0,0 +1,77 @@
+/*!
+ * \file fcntst.c
+ * \brief test the function generator driver
+ *
+ * \date 19 Oct 26
+ *
+ * Configures a function generator with two sine channels, the second
+ * with a 90 degree phase offset, and checks that they stay a quarter
+ * cycle apart.  Also checks that a chirp with a duration that isn't
+ * positive is refused.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "channel.h"
+#include "fcn_gen.h"
+
+#define TST_NAME "fcntst"
+#include "tstutil.h"
+
+static char config[] =
+  "device: function-gen 2 0x0 -frequency=5;\n"
+  "  channel: 1 -offset=90;\n";
+
+int main(int argc, char **argv)
+{
+  char file[32] = "/tmp/fcntstXXXXXX";
+  double s, c;
+  int fd, i, bad;
+
+  if ((fd = mkstemp(file)) < 0) { perror("fcntst"); exit(1); }
+  write(fd, config, strlen(config));
+  close(fd);
+  chn_cache_enable = 0;
+  if (chn_config(file) < 0 || chn_nchan != 2) {
+    fprintf(stderr, "fcntst: configuration failed\n");
+    unlink(file);
+    exit(1);
+  }
+  unlink(file);
+
+  /* The first read is at phase 0: sin(0) and sin(90 deg) */
+  chn_read();
+  check(fabs(chn_data(0)) < 1e-6 && fabs(chn_data(1) - 1) < 1e-6,
+	"channel 1 not offset by 90 degrees");
+
+  /* A quarter cycle apart, so s^2 + c^2 = 1 */
+  for (i = 0, bad = 0; i < 200; ++i) {
+    usleep(1000);
+    chn_read();
+    s = chn_data(0);
+    c = chn_data(1);
+    if (fabs(s * s + c * c - 1) > 1e-3) ++bad;
+  }
+  check(bad == 0, "channels not a quarter cycle apart");
+
+  /* The chirp sweep rate divides by the duration */
+  chn_flag_type = Device;
+  strcpy(chn_flag_name, "duration");
+  strcpy(chn_flag_value, "0");
+  check(fcn_driver(HandleFlag, chn_devtbl, chn_chantbl) < 0,
+	"zero duration accepted");
+  strcpy(chn_flag_value, "-2");
+  check(fcn_driver(HandleFlag, chn_devtbl, chn_chantbl) < 0,
+	"negative duration accepted");
+  strcpy(chn_flag_value, "2");
+  check(fcn_driver(HandleFlag, chn_devtbl, chn_chantbl) == 1,
+	"duration refused");
+
+  chn_close();
+  return status;
+}
@@ -44,6 +44,7 @@
 
 #include <stdio.h>
 #include "hook.h"
+#include "profile.h"
 
 /* our standard sparrow hooks */
 
@@ -94,11 +95,17 @@ int hook_execute(HOOK_LIST *hl)
   int i, status = 0;
 
   if(hl->lock!=0)return 0;
+  if (hl->nhooks == 0) return 0;
 
-  /* Execute hooks in order; abort on error */
-  for (i = 0; i < hl->nhooks; ++i) {
-    status = (hl->fcnlist[i])();
-    if (status < 0) break;
+  {
+    PROF_BEGIN(t0);
+
+    /* Execute hooks in order; abort on error */
+    for (i = 0; i < hl->nhooks; ++i) {
+      status = (hl->fcnlist[i])();
+      if (status < 0) break;
+    }
+    if (hl->prof) PROF_END(hl->prof, t0);
   }
   return status;
 }
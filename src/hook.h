@@ -51,6 +51,7 @@ struct hook_list {
     int nhooks;                 /* number of hooks currently defined */
     int lock; 
     int (**fcnlist)(void);      /* list of hook functions */
+    int prof;			/* profiler stage (0 = none; profile.h) */
 };
 typedef struct hook_list HOOK_LIST;
 
@@ -72,6 +72,8 @@
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
+#include "matkern.h"
 
 /*#define LM_DEBUG*/
 
@@ -79,6 +81,7 @@ long convert_long(int dataformat, int desformat, long value);
 double convert_double(int dataformat, int desformat, double value);
 
 int getformat(long typeval);
+static int hostformat(void);
 /* These are the values assigned by matlab */
 #define DF_LITTLEENDIAN    0
 #define DF_BIGENDIAN       1
@@ -93,14 +96,9 @@ int loadmat(FILE *fp, int *type, int *mrows, int *ncols,
 {
   int mn, namelen, i;
   int dataformat, desformat, datasize, datatype;
-  long ltype, lmrows, lncols, limagf, lnamelen;
-  double temp;
+  int32_t ltype, lmrows, lncols, limagf, lnamelen;
 
-#ifdef MSDOS
-  desformat = DF_LITTLEENDIAN;
-#else
-  desformat = DF_BIGENDIAN;
-#endif
+  desformat = hostformat();
 
   /*
    * Get the matrix size/type information.
@@ -111,11 +109,11 @@ int loadmat(FILE *fp, int *type, int *mrows, int *ncols,
 #endif
 
   /* Read the type of the matrix */
-  if (fread(&ltype,    sizeof(long), 1, fp) !=1) return 1;
-  if (fread(&lmrows,   sizeof(long), 1, fp) !=1) return -1;
-  if (fread(&lncols,   sizeof(long), 1, fp) !=1) return -1;
-  if (fread(&limagf,   sizeof(long), 1, fp) !=1) return -1;
-  if (fread(&lnamelen, sizeof(long), 1, fp) !=1) return -1;
+  if (fread(&ltype,    sizeof(int32_t), 1, fp) !=1) return 1;
+  if (fread(&lmrows,   sizeof(int32_t), 1, fp) !=1) return -1;
+  if (fread(&lncols,   sizeof(int32_t), 1, fp) !=1) return -1;
+  if (fread(&limagf,   sizeof(int32_t), 1, fp) !=1) return -1;
+  if (fread(&lnamelen, sizeof(int32_t), 1, fp) !=1) return -1;
   
 #ifdef LM_DEBUG
   printf("  Unconverted Info:  Type of matrix is %i\n",ltype);
@@ -191,18 +189,12 @@ int loadmat(FILE *fp, int *type, int *mrows, int *ncols,
     return -1;
   }
 
-  if (datasize != 0){
-    printf("\nError:  only 8 bit doubles can be loaded.\n");
+  if ((datasize = mat_convert_v4type(datasize)) == 0 ||
+      (dataformat != DF_LITTLEENDIAN && dataformat != DF_BIGENDIAN)) {
+    printf("\nError:  unsupported number format.\n");
     return -1;
   }
 
-  /*
-   * Get Real part of matrix from file
-   */
-#ifdef LM_DEBUG
-  printf("    In loadmat.c: getting real part.\n");
-#endif
-
   if (mn <= 0){  /* No data for the matrix! */
     printf("Warning:  loadmat.c: Null matrix\n");
     *preal=NULL;
@@ -210,61 +202,31 @@ int loadmat(FILE *fp, int *type, int *mrows, int *ncols,
     return 0;
   }
 
-  /*  So we now know that the matrix has elements */
-  if ((*preal = (double *) malloc(mn*sizeof(double)))==NULL) {
+  /*
+   * Read each part of the matrix in one go and convert it in place.
+   * Narrower types are read into the end of the buffer, so that each
+   * element is converted before it is overwritten.
+   */
+  *pimag = NULL;
+  if ((*preal = (double *) malloc(mn*sizeof(double)))==NULL ||
+      (*imagf && (*pimag = (double *) malloc(mn*sizeof(double)))==NULL)) {
     printf("\nError: Variable too big to load\n");
+    free(*preal); *preal = NULL;
     return -1;
   }
-
-#ifdef LM_DEBUG
-  printf("    In loadmat.c: malloced the real part.\n");
-#endif
-
-  for(i=0; i<mn; i++){
-#ifdef LM_DEBUG
-    printf("entry %3i: ",i);
-#endif
-    if (fread(&temp, sizeof(double), 1, fp) != 1) {
-      printf("\nError: Failed to read real part of matrix\n");
-      free(*preal); *preal=NULL; return -1;
-    }
-#ifdef LM_DEBUG
-    printf("%12.4g, ",temp);
-#endif
-
-    *(*preal + i) = convert_double(dataformat,desformat,temp);
-
-#ifdef LM_DEBUG
-    printf("%12.4g\n",*(*preal + i));
-#endif
-  }
-
-#ifdef LM_DEBUG  
-  printf("    In loadmat.c: got real part\n");
-#endif
-
-  /* If there is no imaginary part, we are done! */
-  if (*imagf == 0) return 0;
-
-  /* Otherwise get the imaginary part */
-  if ((*pimag = (double *) malloc(mn*sizeof(double)))==NULL) {
-    printf("\nError: Variable too big to load\n");
-    free(*preal);preal = NULL;
+  i = mat_convert_size(datasize);
+  if (fread((char *) (*preal + mn) - mn*i, i, mn, fp) != mn ||
+      (*imagf && fread((char *) (*pimag + mn) - mn*i, i, mn, fp) != mn)) {
+    printf("\nError: Failed to read matrix\n");
+    free(*preal); free(*pimag); *preal = *pimag = NULL;
     return -1;
   }
-  for(i=0; i<mn; i++){
-    if (fread(&temp, sizeof(double), 1, fp) != 1) {
-      printf("\nError: Failed to read imaginary part of matrix\n");
-      free(*preal); free(*pimag); *preal = *pimag = NULL; return -1;
-    }
-
-    *(*pimag+i) = convert_double(dataformat,desformat,temp);
-  }
+  mat_convert(*preal, (char *) (*preal + mn) - mn*i, mn, datasize,
+	      dataformat != desformat);
+  if (*imagf)
+    mat_convert(*pimag, (char *) (*pimag + mn) - mn*i, mn, datasize,
+		dataformat != desformat);
 
-#ifdef LM_DEBUG
-  printf("    In loadmat.c: got imag part (if it exists)\n");
-#endif
-  
   return(0);
 }
 
@@ -343,10 +305,25 @@ int getformat(long type){
     return -1;
   }
 #else
-  /* Assume we are on a sun */
+  /* The header is 32 bits; a type of zero is a little endian file,
+     otherwise a value that is out of range was written with the
+     opposite byte order to ours. */
+  type &= 0xffffffff;
   if (type == 0) return DF_LITTLEENDIAN;
-  if (type & 0xffff0000) return DF_LITTLEENDIAN;
-  return DF_BIGENDIAN;
+  if (type & 0xffff0000)
+    return hostformat() == DF_LITTLEENDIAN ? DF_BIGENDIAN : DF_LITTLEENDIAN;
+  return hostformat();
 #endif  
 
 }
+
+/* Byte order of the machine we are running on */
+static int hostformat(void)
+{
+#ifdef MSDOS
+  return DF_LITTLEENDIAN;
+#else
+  int one = 1;
+  return *(char *) &one ? DF_LITTLEENDIAN : DF_BIGENDIAN;
+#endif
+}
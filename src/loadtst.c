@@ -0,0 +1,378 @@
+/*!
+ * \file loadtst.c
+ * \brief test loading MATLAB files
+ *
+ * \date 19 Oct 26
+ *
+ * Writes version 4 and version 5 MATLAB files in both byte orders,
+ * with each element type, complex data, N-dimensional and char
+ * arrays, and variables that should be skipped, and checks what
+ * mat_load() and loadmat() read back.  Also checks that mat_find()
+ * still works after matrices in a loaded list have been renamed,
+ * freed or added.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "matrix.h"
+
+#define TST_NAME "loadtst"
+#include "tstutil.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOSTBIG 1
+#else
+#define HOSTBIG 0
+#endif
+
+static char matfile[] = "/tmp/loadtstXXXXXX.mat";
+
+/* File contents, built in memory; swapped = opposite byte order to ours */
+static unsigned char buf[65536];
+static size_t len, base;		/* base: where padding is counted from */
+static int swapped;
+
+static void put(const void *p, int size, int n)
+{
+  const unsigned char *s = p;
+  int i, j;
+
+  for (i = 0; i < n; ++i, s += size)
+    for (j = 0; j < size; ++j)
+      buf[len++] = s[swapped ? size - 1 - j : j];
+}
+
+static void put32(uint32_t v) { put(&v, 4, 1); }
+static void pad(int n) { while ((len - base) % n) buf[len++] = 0; }
+
+static void save(void)
+{
+  FILE *fp = fopen(matfile, "wb");
+  fwrite(buf, 1, len, fp);
+  fclose(fp);
+}
+
+/* Compare a loaded matrix with the values expected */
+static void check_matrix(MATRIX *list, char *name, int m, int n,
+			 double *re, double *im)
+{
+  MATRIX *mp = mat_find(list, name);
+  char msg[128];
+  int i;
+
+  snprintf(msg, sizeof(msg), "%s: wrong size or type", name);
+  if (mp == NULL) {
+    snprintf(msg, sizeof(msg), "%s not loaded", name);
+    check(0, msg);
+    return;
+  }
+  check(mp->nrows == m && mp->ncols == n && mp->imagf == (im != NULL), msg);
+  if (mp->nrows != m || mp->ncols != n) return;
+  snprintf(msg, sizeof(msg), "%s: wrong values", name);
+  for (i = 0; i < m * n; ++i)
+    if (mp->real[i] != re[i] ||
+	(im != NULL && (mp->imag == NULL || mp->imag[i] != im[i]))) {
+      check(0, msg);
+      return;
+    }
+}
+
+/*
+ * Version 4 files.  Each precision is written as a 3x4 matrix; double
+ * and single precision are also written with an imaginary part.
+ */
+static int32_t v4_int32[12];
+static int16_t v4_int16[12];
+static uint16_t v4_uint16[12];
+static uint8_t v4_uint8[12];
+static float v4_single[12], v4_single_im[12];
+static double v4_double[12], v4_double_im[12];
+static void *v4_data[6] = {v4_double, v4_single, v4_int32, v4_int16,
+			   v4_uint16, v4_uint8};
+static int v4_size[6] = {8, 4, 4, 2, 2, 1};
+static double v4_value[6][12], v4_value_im[12];
+
+static void v4_matrix(char *name, int prec, int type, int m, int n,
+		      void *re, void *im)
+{
+  int32_t hdr[5];
+
+  hdr[0] = (HOSTBIG ^ swapped) * 1000 + prec * 10 + type;
+  hdr[1] = m;
+  hdr[2] = n;
+  hdr[3] = im != NULL;
+  hdr[4] = strlen(name) + 1;
+  put(hdr, 4, 5);
+  put(name, 1, hdr[4]);
+  put(re, v4_size[prec], m * n);
+  if (im != NULL) put(im, v4_size[prec], m * n);
+}
+
+static void test_v4(void)
+{
+  static char *names[] = {"double", "single", "int32", "int16", "uint16",
+			  "uint8"};
+  MATRIX *list;
+  FILE *fp;
+  char name[MAT_NAMELEN];
+  int i, p, type, m, n, imagf;
+  double *re, *im;
+
+  for (i = 0; i < 12; ++i) {
+    v4_double[i] = v4_value[0][i] = i * 0.25 - 1;
+    v4_double_im[i] = v4_value_im[i] = -i;
+    v4_single[i] = v4_value[1][i] = i * 0.25 - 1;
+    v4_single_im[i] = -i;
+    v4_int32[i] = v4_value[2][i] = i * 100000 - 300000;
+    v4_int16[i] = v4_value[3][i] = i * 1000 - 3000;
+    v4_uint16[i] = v4_value[4][i] = i * 5000;
+    v4_uint8[i] = v4_value[5][i] = i * 20;
+  }
+
+  for (swapped = 0; swapped < 2; ++swapped) {
+    len = 0;
+    for (p = 0; p < 6; ++p) v4_matrix(names[p], p, 0, 3, 4, v4_data[p], NULL);
+    v4_matrix("zsparse", 0, 2, 3, 4, v4_double, NULL);
+    v4_matrix("cdouble", 0, 0, 3, 4, v4_double, v4_double_im);
+    v4_matrix("csingle", 1, 0, 3, 4, v4_single, v4_single_im);
+    v4_matrix("empty", 0, 0, 0, 0, NULL, NULL);
+    save();
+
+    fprintf(stderr, "loadtst: expect a message about a sparse matrix:\n");
+    list = mat_load(matfile);
+    check(list != NULL && list->index != NULL, "v4: no list or index");
+    for (p = 0; p < 6; ++p)
+      check_matrix(list, names[p], 3, 4, v4_value[p], NULL);
+    check(mat_find(list, "zsparse") == NULL, "v4: sparse matrix loaded");
+    check_matrix(list, "cdouble", 3, 4, v4_value[0], v4_value_im);
+    check_matrix(list, "csingle", 3, 4, v4_value[0], v4_value_im);
+    check_matrix(list, "empty", 0, 0, NULL, NULL);
+    check(mat_find(list, "missing") == NULL, "v4: found a missing name");
+    mat_list_free(list);
+
+    /* loadmat() reads the same data one matrix at a time */
+    fp = fopen(matfile, "rb");
+    for (p = 0; p < 6; ++p) {
+      check(loadmat(fp, &type, &m, &n, &imagf, name, &re, &im) == 0 &&
+	    strcmp(name, names[p]) == 0 && m == 3 && n == 4 && !imagf &&
+	    memcmp(re, v4_value[p], sizeof(v4_value[p])) == 0,
+	    "v4: loadmat");
+      free(re);
+    }
+    fclose(fp);
+  }
+
+  /* A truncated file gives the matrices before the error */
+  len -= 30;
+  save();
+  fprintf(stderr, "loadtst: expect messages about a truncated file:\n");
+  list = mat_load(matfile);
+  check(list != NULL && mat_find(list, "cdouble") != NULL &&
+	mat_find(list, "csingle") == NULL, "v4: truncated file");
+  mat_list_free(list);
+  len = 8;
+  save();
+  check(mat_load(matfile) == NULL, "v4: short file gave a list");
+}
+
+/* Version 5 type codes and array classes */
+#define MI_INT8 1
+#define MI_UINT8 2
+#define MI_INT16 3
+#define MI_INT32 5
+#define MI_UINT32 6
+#define MI_DOUBLE 9
+#define MI_MATRIX 14
+#define MI_COMPRESSED 15
+#define MI_UTF16 17
+#define MX_CELL 1
+#define MX_CHAR 4
+#define MX_DOUBLE 6
+#define MX_INT16 10
+
+static int mi_size(int type)
+{
+  return type == MI_DOUBLE ? 8 : type == MI_INT32 || type == MI_UINT32 ? 4 :
+    type == MI_INT16 || type == MI_UTF16 ? 2 : 1;
+}
+
+/* Write a data element, packed into the tag if it is small enough */
+static void v5_elem(int type, const void *data, int n)
+{
+  int nbytes = n * mi_size(type);
+
+  if (nbytes > 0 && nbytes <= 4) {
+    put32(nbytes << 16 | type);
+    put(data, mi_size(type), n);
+    pad(4);
+  } else {
+    put32(type);
+    put32(nbytes);
+    put(data, mi_size(type), n);
+    pad(8);
+  }
+}
+
+/* Write an array; im is NULL for real data */
+static void v5_array(char *name, int cls, int ndims, int32_t *dims,
+		     int rtype, void *re, int itype, void *im)
+{
+  uint32_t flags[2] = {cls | (im != NULL ? 0x800 : 0), 0};
+  size_t start, end;
+  int i, n = 1;
+
+  for (i = 0; i < ndims; ++i) n *= dims[i];
+  base = len;
+  put32(MI_MATRIX);
+  start = len;
+  put32(0);
+  v5_elem(MI_UINT32, flags, 2);
+  v5_elem(MI_INT32, dims, ndims);
+  v5_elem(MI_INT8, name, strlen(name));
+  if (cls != MX_CELL) {
+    v5_elem(rtype, re, n);
+    if (im != NULL) v5_elem(itype, im, n);
+  }
+
+  /* Fill in the size */
+  end = len;
+  len = start;
+  put32(end - start - 4);
+  len = end;
+}
+
+static void test_v5(void)
+{
+  static double a[6] = {1.5, -2, 3, 4e100, -5e-100, 6};
+  static int16_t g16[4] = {-300, 200, 32767, -32768};
+  static int8_t g8[4] = {1, -2, 3, -4};
+  static double gre[4] = {-300, 200, 32767, -32768}, gim[4] = {1, -2, 3, -4};
+  static uint8_t u8[3] = {0, 128, 255};
+  static double u8d[3] = {0, 128, 255};
+  static double nd[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  static uint16_t str[2] = {'h', 'i'};
+  static double strd[2] = {'h', 'i'};
+  static char longname[] =
+    "a_name_that_is_longer_than_the_sixty_three_characters_matlab_allows";
+  int32_t d23[2] = {2, 3}, d22[2] = {2, 2}, d13[2] = {1, 3}, d222[3] = {2, 2, 2};
+  int32_t d12[2] = {1, 2}, d11[2] = {1, 1};
+  MATRIX *list;
+#ifdef HAVE_ZLIB
+  static unsigned char zbuf[4096];
+  uLongf zlen;
+  size_t start;
+#endif
+
+  for (swapped = 0; swapped < 2; ++swapped) {
+    /* Header: text, subsystem offset, version and byte order mark */
+    len = 0;
+    memset(buf, ' ', 116);
+    memcpy(buf, "MATLAB 5.0 MAT-file, written by loadtst", 39);
+    memset(buf + 116, 0, 8);
+    len = 124;
+    put(&(uint16_t) {0x0100}, 2, 1);
+    put(&(uint16_t) {'M' << 8 | 'I'}, 2, 1);
+
+    v5_array("A", MX_DOUBLE, 2, d23, MI_DOUBLE, a, 0, NULL);
+    v5_array(longname, MX_INT16, 2, d22, MI_INT16, g16, MI_INT8, g8);
+    v5_array("u8", MX_DOUBLE, 2, d13, MI_UINT8, u8, 0, NULL);
+    v5_array("cell", MX_CELL, 2, d11, 0, NULL, 0, NULL);
+    v5_array("nd", MX_DOUBLE, 3, d222, MI_DOUBLE, nd, 0, NULL);
+    v5_array("s", MX_CHAR, 2, d12, MI_UTF16, str, 0, NULL);
+#ifdef HAVE_ZLIB
+    start = len;
+    v5_array("z", MX_DOUBLE, 2, d23, MI_DOUBLE, a, 0, NULL);
+    zlen = sizeof(zbuf);
+    check(compress(zbuf, &zlen, buf + start, len - start) == Z_OK,
+	  "v5: compress");
+    len = start;
+    put32(MI_COMPRESSED);
+    put32(zlen);
+    memcpy(buf + len, zbuf, zlen);
+    len += zlen;
+#endif
+    v5_array("last", MX_DOUBLE, 2, d11, MI_DOUBLE, a, 0, NULL);
+    save();
+
+    fprintf(stderr, "loadtst: expect a message about a cell array:\n");
+    list = mat_load(matfile);
+    check(list != NULL, "v5: nothing loaded");
+    check_matrix(list, "A", 2, 3, a, NULL);
+    longname[MAT_NAMELEN - 1] = '\0';
+    check_matrix(list, longname, 2, 2, gre, gim);
+    longname[MAT_NAMELEN - 1] = 'h';
+    check_matrix(list, "u8", 1, 3, u8d, NULL);
+    check(mat_find(list, "cell") == NULL, "v5: cell array loaded");
+    check_matrix(list, "nd", 2, 4, nd, NULL);
+    check_matrix(list, "s", 1, 2, strd, NULL);
+#ifdef HAVE_ZLIB
+    check_matrix(list, "z", 2, 3, a, NULL);
+#endif
+    check_matrix(list, "last", 1, 1, a, NULL);
+    mat_list_free(list);
+  }
+}
+
+/* mat_find() after the list has been changed */
+static void test_find(void)
+{
+  MATRIX *list, *mp, *last;
+  int i;
+
+  swapped = 0;
+  len = 0;
+  for (i = 0; i < 100; ++i) {
+    char name[16];
+    snprintf(name, sizeof(name), "m%d", i);
+    v4_matrix(name, 0, 0, 1, 1, v4_double + i % 12, NULL);
+  }
+  save();
+  list = mat_load(matfile);
+  check(list != NULL && list->index != NULL, "find: no index");
+  for (i = 0; i < 100; ++i) {
+    char name[16];
+    snprintf(name, sizeof(name), "m%d", i);
+    mp = mat_find(list, name);
+    check(mp != NULL && strcmp(mp->name, name) == 0 &&
+	  mp->real[0] == v4_double[i % 12], "find: wrong matrix");
+  }
+
+  /* Renaming, freeing and adding matrices */
+  mat_set_name(mat_find(list, "m10"), "renamed");
+  check(mat_find(list, "renamed") != NULL && mat_find(list, "m10") == NULL,
+	"find: after rename");
+  mat_free(mat_find(list, "m50"));
+  check(mat_find(list, "m50") == NULL && mat_find(list, "m51") != NULL,
+	"find: after free");
+  mat_list_free(list);
+
+  list = mat_load(matfile);
+  for (last = list; last->next != NULL; last = last->next) ;
+  mp = mat_create();
+  mat_set_name(mp, "added");
+  last->next = mp;
+  mp->prev = last;
+  check(mat_find(list, "added") == mp && mat_find(list, "m99") != NULL,
+	"find: after adding to the list");
+  check(mat_find(list->next, "m0") == NULL &&
+	mat_find(list->next, "m1") != NULL, "find: from the middle of a list");
+  mat_list_free(list);
+}
+
+int main(int argc, char **argv)
+{
+  tst_tmpfile(matfile, 4);
+  test_v4();
+  test_v5();
+  test_find();
+  unlink(matfile);
+  return status;
+}
@@ -0,0 +1,426 @@
+/*!
+ * \file lut.c
+ * \brief linear interpolation in 1-D and 2-D lookup tables
+ *
+ * \date 19 Oct 26
+ *
+ * A lookup table maps one or two inputs through a table of values at
+ * a grid of breakpoints, using linear (1-D) or bilinear (2-D)
+ * interpolation, as for calibration curves and gain schedules.
+ * Tables are read from MATLAB files: the table NAME, with breakpoints
+ * NAME_x for the rows and, for a 2-D table, NAME_y for the columns.
+ *
+ * Finding the interval that an input falls in is most of the work.
+ * When a table is created, each set of breakpoints is checked to see
+ * if it is evenly spaced; if so, the interval is found directly from
+ * the input, otherwise with a binary search.
+ *
+ * A channel is mapped through a table with the -lut flag in the
+ * channel configuration file (see chnconf.c).  The output replaces
+ * the channel value unless -lutout gives another channel, and the
+ * second input of a 2-D table is the channel given with -lutin.
+ * Tables are applied at the end of chn_read(), after the filters.
+ * lut_chn_init() (called by chn_init) groups the mapped channels by
+ * table, so that each table is evaluated once per cycle for all of
+ * its channels with lut_eval_n().  All of the inputs of a table are
+ * read before any of its outputs are written.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "channel.h"
+#include "lut.h"
+
+static LUT *lut_list = NULL;		/* tables shared by lut_open() */
+
+/* Check breakpoints and see if they are evenly spaced */
+static int lut_grid(LUT *lp, int k, MATRIX *mp, char *name)
+{
+  double *bp = lp->bp[k], dx;
+  int i, n;
+
+  if (mp->nrows != 1 && mp->ncols != 1) {
+    fprintf(stderr, "lut_create: breakpoints %s are not a vector\n", name);
+    return -1;
+  }
+  if ((n = lp->n[k] = mp->nrows * mp->ncols) < 2) {
+    fprintf(stderr, "lut_create: %s needs at least 2 breakpoints\n", name);
+    return -1;
+  }
+  memcpy(bp, mp->real, n * sizeof(double));
+  for (i = 1; i < n; ++i)
+    if (!(bp[i] > bp[i - 1])) {
+      fprintf(stderr, "lut_create: breakpoints %s are not increasing\n",
+	      name);
+      return -1;
+    }
+
+  dx = (bp[n - 1] - bp[0]) / (n - 1);
+  lp->uniform[k] = 1;
+  for (i = 1; i < n - 1; ++i)
+    if (fabs(bp[i] - (bp[0] + i * dx)) > 1e-9 * (bp[n - 1] - bp[0]))
+      lp->uniform[k] = 0;
+  lp->rdx[k] = 1 / dx;
+  return 0;
+}
+
+/*!
+ * \fn LUT *lut_create(MATRIX *x, MATRIX *y, MATRIX *table)
+ * \brief create a table from breakpoint and value matrices
+ * \ingroup channel
+ *
+ * y is NULL for a 1-D table, in which case table is a vector with one
+ * value for each breakpoint in x.  Otherwise table has a row for each
+ * breakpoint in x and a column for each breakpoint in y.  The data is
+ * copied.  Returns NULL if the sizes don't match or the breakpoints
+ * aren't increasing.
+ */
+LUT *lut_create(MATRIX *x, MATRIX *y, MATRIX *table)
+{
+  LUT *lp;
+  int nx, ny;
+
+  if (x == NULL || table == NULL) return NULL;
+  nx = x->nrows * x->ncols;
+  ny = y != NULL ? y->nrows * y->ncols : 1;
+  if (y == NULL && (table->nrows * table->ncols != nx ||
+		    (table->nrows != 1 && table->ncols != 1))) {
+    fprintf(stderr, "lut_create: table %s is %d x %d, should have %d values\n",
+	    table->name, table->nrows, table->ncols, nx);
+    return NULL;
+  }
+  if (y != NULL && (table->nrows != nx || table->ncols != ny)) {
+    fprintf(stderr, "lut_create: table %s is %d x %d, should be %d x %d\n",
+	    table->name, table->nrows, table->ncols, nx, ny);
+    return NULL;
+  }
+
+  /* One allocation: breakpoints, values, then the structure */
+  if ((lp = calloc(1, sizeof(LUT) + (nx + ny + nx * ny) * sizeof(double)))
+      == NULL) {
+    fprintf(stderr, "lut_create: out of memory\n");
+    return NULL;
+  }
+  lp->ndim = y != NULL ? 2 : 1;
+  lp->bp[0] = (double *) (lp + 1);
+  lp->bp[1] = lp->bp[0] + nx;
+  lp->table = lp->bp[1] + ny;
+  lp->n[1] = 1;
+  lp->refs = 1;
+  if (lut_grid(lp, 0, x, x->name) < 0 ||
+      (y != NULL && lut_grid(lp, 1, y, y->name) < 0)) {
+    free(lp);
+    return NULL;
+  }
+  memcpy(lp->table, table->real, nx * ny * sizeof(double));
+  return lp;
+}
+
+/*!
+ * \fn LUT *lut_load(MATRIX *list, char *name)
+ * \brief create a table from the matrices name, name_x and name_y
+ * \ingroup channel
+ *
+ * The table is 2-D if name_y is in the list.
+ */
+LUT *lut_load(MATRIX *list, char *name)
+{
+  MATRIX *table, *x;
+  char xname[MAT_NAMELEN + 2], yname[MAT_NAMELEN + 2];
+
+  snprintf(xname, sizeof(xname), "%s_x", name);
+  snprintf(yname, sizeof(yname), "%s_y", name);
+  if ((table = mat_find(list, name)) == NULL ||
+      (x = mat_find(list, xname)) == NULL) {
+    fprintf(stderr, "lut_load: can't find %s and %s\n", name, xname);
+    return NULL;
+  }
+  return lut_create(x, mat_find(list, yname), table);
+}
+
+/*!
+ * \fn LUT *lut_open(char *file, char *name)
+ * \brief load a table from a MATLAB file, sharing tables already loaded
+ * \ingroup channel
+ *
+ * name defaults to "lut".  Opening the same table again returns the
+ * same LUT; each lut_open() should be matched with a lut_free().
+ */
+LUT *lut_open(char *file, char *name)
+{
+  MATRIX *list;
+  LUT *lp;
+
+  if (name == NULL || *name == '\0') name = "lut";
+  for (lp = lut_list; lp != NULL; lp = lp->next)
+    if (strcmp(lp->file, file) == 0 && strcmp(lp->name, name) == 0) {
+      ++lp->refs;
+      return lp;
+    }
+
+  if ((list = mat_load(file)) == NULL) {
+    fprintf(stderr, "lut_open: can't load %s\n", file);
+    return NULL;
+  }
+  lp = lut_load(list, name);
+  mat_list_free(list);
+  if (lp == NULL) return NULL;
+  if ((lp->file = strdup(file)) == NULL) {
+    free(lp);
+    return NULL;
+  }
+  strncpy(lp->name, name, MAT_NAMELEN - 1);
+  lp->next = lut_list;
+  lut_list = lp;
+  return lp;
+}
+
+void lut_free(LUT *lp)
+{
+  LUT **lpp;
+
+  if (lp == NULL || --lp->refs > 0) return;
+  for (lpp = &lut_list; *lpp != NULL; lpp = &(*lpp)->next)
+    if (*lpp == lp) { *lpp = lp->next; break; }
+  free(lp->file);
+  free(lp);
+}
+
+/*
+ * Find the interval of breakpoints k that x is in; returns the index
+ * of its first breakpoint and sets *f to the fraction of the way
+ * across it.  NaN is treated as below the first breakpoint.
+ */
+static inline int lut_index(const LUT *lp, int k, double x, double *f)
+{
+  const double *bp = lp->bp[k];
+  int n = lp->n[k], lo, hi, mid;
+  double t;
+
+  if (lp->uniform[k]) {
+    t = (x - bp[0]) * lp->rdx[k];
+    t = t > 0 ? t : 0;
+    t = t < n - 1 ? t : n - 1;
+    lo = (int) t;
+    if (lo > n - 2) lo = n - 2;
+    *f = t - lo;
+    return lo;
+  }
+
+  if (!(x > bp[0])) { *f = 0; return 0; }
+  if (x >= bp[n - 1]) { *f = 1; return n - 2; }
+  for (lo = 0, hi = n - 1; hi - lo > 1; ) {	/* bp[lo] <= x < bp[hi] */
+    mid = (lo + hi) >> 1;
+    if (bp[mid] <= x) lo = mid;
+    else hi = mid;
+  }
+  *f = (x - bp[lo]) / (bp[lo + 1] - bp[lo]);
+  return lo;
+}
+
+/*!
+ * \fn double lut_eval(LUT *lp, double x, double y)
+ * \brief interpolate in a table (y is ignored for a 1-D table)
+ * \ingroup channel
+ */
+double lut_eval(LUT *lp, double x, double y)
+{
+  const double *t = lp->table;
+  double fx, fy;
+  int i, j, n0 = lp->n[0];
+
+  i = lut_index(lp, 0, x, &fx);
+  if (lp->ndim == 1) return t[i] + fx * (t[i + 1] - t[i]);
+
+  j = lut_index(lp, 1, y, &fy);
+  t += i + j * n0;
+  return (1 - fy) * (t[0] + fx * (t[1] - t[0])) +
+    fy * (t[n0] + fx * (t[n0 + 1] - t[n0]));
+}
+
+/*!
+ * \fn void lut_eval_n(LUT *lp, int n, const double *x, const double *y,
+ *		       double *z)
+ * \brief interpolate n points: z[k] = lut(x[k], y[k])
+ * \ingroup channel
+ *
+ * y is not used for a 1-D table and can be NULL.  z can be x or y.
+ */
+void lut_eval_n(LUT *lp, int n, const double *x, const double *y, double *z)
+{
+  const double *t = lp->table, *bp = lp->bp[0];
+  double fx, fy, x0, rdx, tmax;
+  int i, j, k, n0 = lp->n[0];
+
+  if (lp->ndim == 2) {
+    for (k = 0; k < n; ++k) {
+      i = lut_index(lp, 0, x[k], &fx);
+      j = lut_index(lp, 1, y[k], &fy);
+      t = lp->table + i + j * n0;
+      z[k] = (1 - fy) * (t[0] + fx * (t[1] - t[0])) +
+	fy * (t[n0] + fx * (t[n0 + 1] - t[n0]));
+    }
+    return;
+  }
+
+  /* Uniform 1-D tables: the index computation without branches */
+  if (lp->uniform[0]) {
+    x0 = bp[0];
+    rdx = lp->rdx[0];
+    tmax = n0 - 1;
+    for (k = 0; k < n; ++k) {
+      fx = (x[k] - x0) * rdx;
+      fx = fx > 0 ? fx : 0;
+      fx = fx < tmax ? fx : tmax;
+      i = (int) fx;
+      i = i < n0 - 2 ? i : n0 - 2;
+      fx -= i;
+      z[k] = t[i] + fx * (t[i + 1] - t[i]);
+    }
+    return;
+  }
+
+  for (k = 0; k < n; ++k) {
+    i = lut_index(lp, 0, x[k], &fx);
+    z[k] = t[i] + fx * (t[i + 1] - t[i]);
+  }
+}
+
+/*
+ * Channels mapped through tables, grouped by table.  lut_chan, lut_in2
+ * and lut_out hold the input, second input and output channels of
+ * each mapped channel; a group is a run of them with the same table.
+ */
+static struct lut_group {
+  LUT *lut;
+  int start, n;
+} lut_groups[CHN_MAXCHN];
+static int lut_ngroups = 0;
+static int lut_chan[CHN_MAXCHN], lut_in2[CHN_MAXCHN], lut_out[CHN_MAXCHN];
+static double lut_x[CHN_MAXCHN], lut_y[CHN_MAXCHN];
+
+/*!
+ * \fn int lut_chn_init(void)
+ * \brief build the list of channels that are mapped through tables
+ * \ingroup channel
+ *
+ * Called by chn_init().  Returns the number of channels mapped.
+ */
+int lut_chn_init(void)
+{
+  struct lut_group *gp;
+  CHN_LUT *mp;
+  int i, g, n = 0;
+
+  lut_ngroups = 0;
+  for (g = 0; g < chn_nchan; ++g) {
+    LUT *lp = NULL;
+
+    /* Next table that hasn't been grouped yet */
+    for (i = 0; i < chn_nchan; ++i) {
+      if ((mp = chn_chantbl[i].lut) == NULL || mp->lut == NULL) continue;
+      for (gp = lut_groups; gp < lut_groups + lut_ngroups; ++gp)
+	if (gp->lut == mp->lut) break;
+      if (gp == lut_groups + lut_ngroups) { lp = mp->lut; break; }
+    }
+    if (lp == NULL) break;
+
+    gp = lut_groups + lut_ngroups++;
+    gp->lut = lp;
+    gp->start = n;
+    for (; i < chn_nchan; ++i) {
+      if ((mp = chn_chantbl[i].lut) == NULL || mp->lut != lp) continue;
+      if (mp->out_chn < 0 || mp->out_chn >= chn_nchan ||
+	  (lp->ndim == 2 && (mp->in_chn < 0 || mp->in_chn >= chn_nchan))) {
+	fprintf(stderr, "lut_chn_init: channel %d: %s\n", i,
+		lp->ndim == 2 && mp->in_chn < 0 ?
+		"2-D table needs -lutin" : "bad channel number");
+	continue;
+      }
+      lut_chan[n] = i;
+      lut_in2[n] = mp->in_chn;
+      lut_out[n++] = mp->out_chn;
+    }
+    gp->n = n - gp->start;
+  }
+  return n;
+}
+
+/*!
+ * \fn void lut_chn_clear(int chan)
+ * \brief remove the lookup table from a channel
+ * \ingroup channel
+ *
+ * Called when the channel table is (re)built.
+ */
+void lut_chn_clear(int chan)
+{
+  CHN_LUT *mp = chn_chantbl[chan].lut;
+
+  if (mp != NULL) {
+    lut_free(mp->lut);
+    free(mp);
+  }
+  chn_chantbl[chan].lut = NULL;
+}
+
+/*!
+ * \fn void lut_chn_apply(void)
+ * \brief map the channels through their tables (called by chn_read)
+ * \ingroup channel
+ */
+void lut_chn_apply(void)
+{
+  struct lut_group *gp;
+  int k;
+
+  for (gp = lut_groups; gp < lut_groups + lut_ngroups; ++gp) {
+    for (k = gp->start; k < gp->start + gp->n; ++k)
+      lut_x[k] = chn_data(lut_chan[k]);
+    if (gp->lut->ndim == 2)
+      for (k = gp->start; k < gp->start + gp->n; ++k)
+	lut_y[k] = chn_data(lut_in2[k]);
+    lut_eval_n(gp->lut, gp->n, lut_x + gp->start, lut_y + gp->start,
+	       lut_x + gp->start);
+    for (k = gp->start; k < gp->start + gp->n; ++k)
+      chn_data(lut_out[k]) = lut_x[k];
+  }
+}
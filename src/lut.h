@@ -0,0 +1,86 @@
+/*!
+ * \file lut.h
+ * \brief linear interpolation in 1-D and 2-D lookup tables
+ *
+ * \date 19 Oct 26
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#ifndef __LUT_INCLUDED__
+#define __LUT_INCLUDED__
+
+#include "matrix.h"
+
+/*!
+ * \struct lut
+ * \brief table of values at a grid of breakpoints
+ *
+ * A 1-D table has n[0] values at the breakpoints bp[0].  A 2-D table
+ * is an n[0] x n[1] matrix (column-major, like MATRIX): rows go with
+ * the first input and columns with the second.  Inputs outside the
+ * breakpoints are clamped to the first or last one.
+ */
+struct lut {
+  int ndim;				/* number of inputs (1 or 2) */
+  int n[2];				/* breakpoints for each input */
+  double *bp[2];			/* breakpoints, increasing */
+  double *table;			/* values */
+  int uniform[2];			/* breakpoints are evenly spaced */
+  double rdx[2];			/* 1 / spacing, if uniform */
+
+  /* Tables shared by lut_open() */
+  char *file;				/* file it was loaded from */
+  char name[MAT_NAMELEN];
+  int refs;
+  struct lut *next;
+};
+typedef struct lut LUT;
+
+LUT *lut_create(MATRIX *x, MATRIX *y, MATRIX *table);
+LUT *lut_load(MATRIX *list, char *name);
+LUT *lut_open(char *file, char *name);
+void lut_free(LUT *lp);
+double lut_eval(LUT *lp, double x, double y);
+void lut_eval_n(LUT *lp, int n, const double *x, const double *y, double *z);
+
+/* Tables on channels (chnconf.c -lut, -lutin and -lutout flags) */
+int lut_chn_init(void);
+void lut_chn_clear(int chan);
+void lut_chn_apply(void);
+
+#endif /* __LUT_INCLUDED__ */
@@ -0,0 +1,219 @@
+/*!
+ * \file luttst.c
+ * \brief test lookup tables
+ *
+ * \date 19 Oct 26
+ *
+ * Writes a MATLAB file with a non-uniform and a uniform 1-D table and
+ * a 2-D table, and checks lut_eval() and lut_eval_n() against a
+ * direct search of the breakpoints, including inputs outside the
+ * table.  The tables are then put on virtual channels with the -lut,
+ * -lutin and -lutout flags, both parsed and replayed from the
+ * configuration cache.  Also checks that bad tables are rejected.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include "channel.h"
+#include "lut.h"
+
+#define TST_NAME "luttst"
+#include "tstutil.h"
+
+static char devfile[] = "/tmp/luttstXXXXXX.dev";
+static char cachefile[sizeof(devfile) + 6];
+static char matfile[] = "/tmp/luttstXXXXXX.mat";
+
+/* Tables: lut is non-uniform, u is uniform, m is 2-D (x uniform) */
+static double lut_x[] = {0, 1, 3, 7, 10};
+static double lut[] = {0, 2, -1, 5, 4};
+static double u_x[] = {-1, -0.5, 0, 0.5, 1, 1.5};
+static double u[] = {0.3, -0.2, 0.9, 1.4, 0.1, 0.6};
+static double m_x[] = {0, 1, 2};
+static double m_y[] = {0, 2, 5, 6};
+static double m[] = {1, 2, 0, 4,	/* given row by row */
+		     -1, 3, 2, 2,
+		     5, 0, 1, -2};
+
+/* Append a matrix (given row by row) to a MATLAB v4 file */
+static void write_matrix(FILE *fp, char *name, int m, int n, double *rows)
+{
+  int32_t hdr[5] = {0, 0, 0, 0, 0};
+  int i, j;
+
+  hdr[1] = m;
+  hdr[2] = n;
+  hdr[4] = strlen(name) + 1;
+  fwrite(hdr, sizeof(hdr), 1, fp);
+  fwrite(name, hdr[4], 1, fp);
+  for (j = 0; j < n; ++j)
+    for (i = 0; i < m; ++i) fwrite(rows + i * n + j, sizeof(double), 1, fp);
+}
+
+/* Reference 1-D interpolation; stride is the spacing of the values */
+static double ref1(double *bp, double *v, int stride, int n, double x)
+{
+  int i;
+
+  if (x <= bp[0]) return v[0];
+  if (x >= bp[n - 1]) return v[(n - 1) * stride];
+  for (i = 0; x >= bp[i + 1]; ++i);
+  return v[i * stride] + (x - bp[i]) / (bp[i + 1] - bp[i]) *
+    (v[(i + 1) * stride] - v[i * stride]);
+}
+
+/* Reference 2-D interpolation: along x in each column, then along y */
+static double ref2(double x, double y)
+{
+  double col[4];
+  int j;
+
+  for (j = 0; j < 4; ++j) col[j] = ref1(m_x, m + j, 4, 3, x);
+  return ref1(m_y, col, 1, 4, y);
+}
+
+/* Compare a table with the reference at points across (and beyond) it */
+static void check_table(LUT *lp, char *name, double *bp, double *v, int n)
+{
+  double x[200], y[200], z[200], ref;
+  int k, bad = 0;
+
+  for (k = 0; k < 200; ++k) {
+    x[k] = -2 + 0.071 * k;
+    y[k] = -1 + 0.043 * k;
+  }
+  x[0] = bp[0];				/* exactly on the ends */
+  x[1] = bp[n - 1];
+  lut_eval_n(lp, 200, x, y, z);
+  for (k = 0; k < 200; ++k) {
+    ref = lp->ndim == 1 ? ref1(bp, v, 1, n, x[k]) : ref2(x[k], y[k]);
+    if (fabs(lut_eval(lp, x[k], y[k]) - ref) > 1e-12 ||
+	fabs(z[k] - ref) > 1e-12)
+      ++bad;
+  }
+  if (bad) {
+    fprintf(stderr, "luttst: table %s: %d points wrong\n", name, bad);
+    status = 1;
+  }
+  check(lut_eval(lp, NAN, NAN) == lp->table[0], "NaN input");
+}
+
+/* Set the inputs, read the channels and compare with the tables */
+static void check_channels(char *when)
+{
+  int k, bad = 0;
+
+  for (k = 0; k < 40; ++k) {
+    double x = -3 + 0.37 * k, y = 7 - 0.23 * k;
+
+    chn_data(0) = x;
+    chn_data(1) = x / 4;
+    chn_data(2) = x / 3;
+    chn_data(3) = y;
+    chn_data(6) = y;
+    chn_read();
+    if (fabs(chn_data(0) - ref1(lut_x, lut, 1, 5, x)) > 1e-12 ||
+	chn_data(1) != x / 4 ||
+	fabs(chn_data(4) - ref1(u_x, u, 1, 6, x / 4)) > 1e-12 ||
+	chn_data(2) != x / 3 ||
+	fabs(chn_data(5) - ref2(x / 3, y)) > 1e-12 ||
+	fabs(chn_data(6) - ref1(lut_x, lut, 1, 5, y)) > 1e-12)
+      ++bad;
+  }
+  if (bad) {
+    fprintf(stderr, "luttst: channels (%s): %d reads wrong\n", when, bad);
+    status = 1;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static double one[] = {1}, bad_x[] = {0, 2, 1};
+  MATRIX *list, *x, *v;
+  LUT *lp, *up, *mp;
+  FILE *fp;
+
+  tst_tmpfile(devfile, 4);
+  tst_tmpfile(matfile, 4);
+  sprintf(cachefile, "%s.cache", devfile);
+  fp = fopen(matfile, "wb");
+  write_matrix(fp, "lut_x", 1, 5, lut_x);
+  write_matrix(fp, "lut", 5, 1, lut);
+  write_matrix(fp, "u_x", 1, 6, u_x);
+  write_matrix(fp, "u", 1, 6, u);
+  write_matrix(fp, "m_x", 3, 1, m_x);
+  write_matrix(fp, "m_y", 1, 4, m_y);
+  write_matrix(fp, "m", 3, 4, m);
+  write_matrix(fp, "bad_x", 1, 3, bad_x);
+  write_matrix(fp, "bad", 1, 3, bad_x);
+  write_matrix(fp, "one_x", 1, 1, one);
+  write_matrix(fp, "one", 1, 1, one);
+  write_matrix(fp, "short_x", 1, 3, lut_x);
+  write_matrix(fp, "short", 1, 2, lut);
+  fclose(fp);
+
+  /* Direct evaluation */
+  if ((lp = lut_open(matfile, NULL)) == NULL ||
+      (up = lut_open(matfile, "u")) == NULL ||
+      (mp = lut_open(matfile, "m")) == NULL) {
+    fprintf(stderr, "luttst: lut_open failed\n");
+    return 1;
+  }
+  check(lp->ndim == 1 && !lp->uniform[0], "lut should be non-uniform");
+  check(up->ndim == 1 && up->uniform[0], "u should be uniform");
+  check(mp->ndim == 2 && mp->uniform[0] && !mp->uniform[1], "m grid");
+  check_table(lp, "lut", lut_x, lut, 5);
+  check_table(up, "u", u_x, u, 6);
+  check_table(mp, "m", m_x, NULL, 3);
+  check(lut_open(matfile, "lut") == lp && lp->refs == 2, "tables not shared");
+  lut_free(lp);
+  lut_free(lp);
+  lut_free(up);
+  lut_free(mp);
+
+  /* Bad tables */
+  fprintf(stderr, "luttst: expect 5 error messages:\n");
+  list = mat_load(matfile);
+  check(lut_load(list, "bad") == NULL, "decreasing breakpoints accepted");
+  check(lut_load(list, "one") == NULL, "single breakpoint accepted");
+  check(lut_load(list, "short") == NULL, "wrong size accepted");
+  check(lut_load(list, "none") == NULL, "missing table accepted");
+  x = mat_find(list, "m_x");
+  v = mat_find(list, "m");
+  check(lut_create(x, NULL, v) == NULL, "2-D values for 1-D table accepted");
+  mat_list_free(list);
+
+  /* Tables on channels, without and then with the cache */
+  fp = fopen(devfile, "w");
+  fprintf(fp, "device: virtual 8 0x00;\n");
+  fprintf(fp, "channel: 0 -lut=%s;\n", matfile);
+  fprintf(fp, "channel: 1 -lut=%s:u -lutout=4;\n", matfile);
+  fprintf(fp, "channel: 2 -lut=%s:m -lutin=3 -lutout=5;\n", matfile);
+  fprintf(fp, "channel: 6 -lut=%s:lut;\n", matfile);
+  fclose(fp);
+  unlink(cachefile);
+  chn_cache_enable = 0;
+  check(chn_config(devfile) >= 0, "configuration failed");
+  check(chn_chantbl[0].lut->lut == chn_chantbl[6].lut->lut,
+	"channel tables not shared");
+  check_channels("parsed");
+
+  chn_cache_enable = 1;
+  check(chn_config(devfile) >= 0, "configuration failed (writing cache)");
+  check(access(cachefile, R_OK) == 0, "cache not written");
+  check(chn_config(devfile) >= 0, "configuration failed (from cache)");
+  check_channels("cached");
+
+  unlink(cachefile);
+  unlink(devfile);
+  unlink(matfile);
+  chn_close();
+
+  return status;
+}
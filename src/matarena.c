@@ -0,0 +1,234 @@
+/*!
+ * \file matarena.c
+ * \brief preallocated workspace for matrix operations
+ *
+ * \date 19 Oct 26
+ *
+ * Matrix routines allocate memory for their results and temporaries,
+ * which a servo routine can't afford: malloc can take a lock or fault
+ * in new pages.  An arena is a block of memory allocated (and touched,
+ * so that it is paged in) when the program starts.  Once a thread has
+ * selected an arena with mat_arena_use(), all of the memory that the
+ * matrix routines allocate in that thread is taken from the arena,
+ * and freeing it does nothing.  The arena is emptied with
+ * mat_arena_reset(), normally once per servo cycle; the servo loop
+ * does this itself for servo_arena (see servo.c).  Every arena is
+ * registered when it is created, so memory from any arena is
+ * recognized when it is freed, whichever arena the thread is using
+ * at the time.
+ *
+ * Matrices created from an arena are only valid until the next reset.
+ * Matrices that need to last longer (gains, state estimates) should
+ * be created before the thread starts using the arena.  If such a
+ * matrix (or a MAT_FACTOR) has to be resized while an arena is in use,
+ * its new storage comes from the heap, not the arena, so that it
+ * stays valid; with mat_arena_check set this is reported like any
+ * other heap allocation.
+ *
+ * If mat_arena_check is set, a matrix routine that needs heap memory
+ * in a thread that has used an arena (because the arena is full or
+ * has been deselected) prints a message and aborts.
+ *
+ * \ingroup servo
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "matrix.h"
+
+#define MAT_ALIGN 32			/* enough for AVX loads */
+#define MAT_MAXARENA 16			/* arenas that can exist at once */
+
+int mat_arena_check = 0;		/* abort on heap use after an arena */
+static __thread MAT_ARENA *mat_arena_cur = NULL;
+static __thread int mat_arena_thread = 0;	/* thread has used an arena */
+static MAT_ARENA *mat_arenas[MAT_MAXARENA];	/* all existing arenas */
+
+/*!
+ * \fn MAT_ARENA *mat_arena_init(size_t size)
+ * \brief allocate an arena of the given size in bytes
+ * \ingroup servo
+ *
+ * The memory is touched and (if permitted) locked into memory.
+ * Returns NULL if it can't be allocated.
+ */
+MAT_ARENA *mat_arena_init(size_t size)
+{
+  MAT_ARENA *ap, *empty;
+  int i;
+
+  if ((ap = (MAT_ARENA *) calloc(1, sizeof(MAT_ARENA))) == NULL ||
+      posix_memalign((void **) &ap->base, MAT_ALIGN, size) != 0) {
+    fprintf(stderr, "mat_arena_init: can't allocate %lu bytes\n",
+	    (unsigned long) size);
+    free(ap);
+    return NULL;
+  }
+  ap->size = size;
+  memset(ap->base, 0, size);
+  mlock(ap->base, size);		/* fails without privileges; ignore */
+
+  /* Register the arena so that mat_release() knows its memory */
+  for (i = 0; i < MAT_MAXARENA; ++i) {
+    empty = NULL;
+    if (__atomic_compare_exchange_n(mat_arenas + i, &empty, ap, 0,
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return ap;
+  }
+  fprintf(stderr, "mat_arena_init: more than %d arenas\n", MAT_MAXARENA);
+  munlock(ap->base, size);
+  free(ap->base);
+  free(ap);
+  return NULL;
+}
+
+/*! Release an arena; it must not be in use by any thread */
+void mat_arena_free(MAT_ARENA *ap)
+{
+  int i;
+
+  if (ap == NULL) return;
+  if (ap == mat_arena_cur) mat_arena_cur = NULL;
+  for (i = 0; i < MAT_MAXARENA; ++i)
+    if (__atomic_load_n(mat_arenas + i, __ATOMIC_RELAXED) == ap)
+      __atomic_store_n(mat_arenas + i, NULL, __ATOMIC_RELEASE);
+  munlock(ap->base, ap->size);
+  free(ap->base);
+  free(ap);
+}
+
+/*! Empty an arena; everything allocated from it becomes invalid */
+void mat_arena_reset(MAT_ARENA *ap)
+{
+  ap->used = 0;
+}
+
+/*!
+ * \fn void *mat_arena_alloc(MAT_ARENA *ap, size_t size)
+ * \brief allocate memory from an arena
+ * \ingroup servo
+ *
+ * Returns NULL (and counts a failure) if the arena is full.
+ */
+void *mat_arena_alloc(MAT_ARENA *ap, size_t size)
+{
+  size_t start = (ap->used + MAT_ALIGN - 1) & ~(size_t) (MAT_ALIGN - 1);
+
+  if (start + size > ap->size) {
+    ++ap->failed;
+    return NULL;
+  }
+  ap->used = start + size;
+  if (ap->used > ap->high) ap->high = ap->used;
+  return ap->base + start;
+}
+
+/*!
+ * \fn MAT_ARENA *mat_arena_use(MAT_ARENA *ap)
+ * \brief select the arena used by matrix routines in this thread
+ * \ingroup servo
+ *
+ * Returns the arena that was in use before.  NULL goes back to
+ * allocating from the heap.
+ */
+MAT_ARENA *mat_arena_use(MAT_ARENA *ap)
+{
+  MAT_ARENA *prev = mat_arena_cur;
+
+  mat_arena_cur = ap;
+  if (ap != NULL) mat_arena_thread = 1;
+  return prev;
+}
+
+/* Find the arena that a pointer belongs to (NULL for the heap) */
+static MAT_ARENA *mat_arena_find(void *p)
+{
+  MAT_ARENA *ap;
+  int i;
+
+  if ((ap = mat_arena_cur) != NULL &&
+      (char *) p >= ap->base && (char *) p < ap->base + ap->size)
+    return ap;
+  for (i = 0; i < MAT_MAXARENA; ++i)
+    if ((ap = __atomic_load_n(mat_arenas + i, __ATOMIC_ACQUIRE)) != NULL &&
+	(char *) p >= ap->base && (char *) p < ap->base + ap->size)
+      return ap;
+  return NULL;
+}
+
+/* Allocate from the heap, complaining if this thread uses an arena */
+static void *mat_alloc_heap(size_t size)
+{
+  if (mat_arena_check && mat_arena_thread) {
+    fprintf(stderr, "mat_alloc: heap allocation of %lu bytes in a thread "
+	    "using an arena (%s)\n", (unsigned long) size,
+	    mat_arena_cur != NULL ? "arena full" : "no arena selected");
+    abort();
+  }
+  return malloc(size);
+}
+
+/* Allocate memory for the matrix routines */
+void *mat_alloc(size_t size)
+{
+  void *p;
+
+  if (mat_arena_cur != NULL &&
+      (p = mat_arena_alloc(mat_arena_cur, size)) != NULL)
+    return p;
+  return mat_alloc_heap(size);
+}
+
+/*
+ * Allocate new storage for an existing object (a matrix being resized,
+ * for instance).  It only comes from the arena if the object does;
+ * storage for an object on the heap has to outlive the next reset.
+ */
+void *mat_alloc_for(void *owner, size_t size)
+{
+  return mat_arena_find(owner) != NULL ? mat_alloc(size) :
+    mat_alloc_heap(size);
+}
+
+/* Free memory from mat_alloc; memory in any arena is left alone */
+void mat_release(void *p)
+{
+  if (p != NULL && mat_arena_find(p) != NULL) return;
+  free(p);
+}
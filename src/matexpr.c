@@ -0,0 +1,297 @@
+/*!
+ * \file matexpr.c
+ * \brief fused evaluation of matrix expressions
+ *
+ * \date 19 Oct 26
+ *
+ * Updates like x = A*x + B*u + c written with mat_mult() and mat_add()
+ * make one pass over memory, and one intermediate matrix, per
+ * operation.  A MAT_EXPR collects the terms of a sum instead:
+ *
+ *   MAT_EXPR e;
+ *   mat_expr_init(&e);
+ *   mat_expr_mult(&e, 1.0, A, x);	   e += A*x
+ *   mat_expr_mult(&e, 1.0, B, u);	   e += B*u
+ *   mat_expr_add(&e, 1.0, c);		   e += c
+ *   mat_expr_eval(x, &e);		   x = e
+ *
+ * and mat_expr_eval() computes the result a block of rows at a time in
+ * a buffer on the stack, adding in every term before the block is
+ * stored, so there are no intermediates and dst is written once.
+ * Terms can be products (scale*a*b), element-wise products
+ * (scale*a.*b), matrices (scale*a) or scalars added to every element.
+ * The expression only holds pointers to its operands, so it can be
+ * built once and evaluated every servo cycle.
+ *
+ * mat_statespace() and mat_observer() are the usual controller and
+ * estimator updates written in terms of these.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "matkern.h"
+
+#define MAT_EXPR_ROWS 64		/* rows evaluated at a time */
+#define MAT_EXPR_STACK 4096		/* operands copied on the stack */
+
+void mat_expr_init(MAT_EXPR *e)
+{
+  e->nterm = 0;
+}
+
+/* Append a term; returns -1 if the expression is full */
+static int mat_expr_term(MAT_EXPR *e, int op, double scale, MATRIX *a,
+			 MATRIX *b)
+{
+  struct mat_term *tp;
+
+  if (e == NULL || e->nterm >= MAT_EXPR_MAX) return -1;
+  tp = e->term + e->nterm++;
+  tp->op = op;
+  tp->scale = scale;
+  tp->a = a;
+  tp->b = b;
+  return 0;
+}
+
+/* e += scale * a * b */
+int mat_expr_mult(MAT_EXPR *e, double scale, MATRIX *a, MATRIX *b)
+{
+  if (a == NULL || b == NULL || a->ncols != b->nrows) return -1;
+  return mat_expr_term(e, MAT_EXPR_MULT, scale, a, b);
+}
+
+/* e += scale * a .* b */
+int mat_expr_dotmult(MAT_EXPR *e, double scale, MATRIX *a, MATRIX *b)
+{
+  if (a == NULL || b == NULL || a->nrows != b->nrows || a->ncols != b->ncols)
+    return -1;
+  return mat_expr_term(e, MAT_EXPR_DOTMULT, scale, a, b);
+}
+
+/* e += scale * a */
+int mat_expr_add(MAT_EXPR *e, double scale, MATRIX *a)
+{
+  if (a == NULL) return -1;
+  return mat_expr_term(e, MAT_EXPR_ADD, scale, a, NULL);
+}
+
+/* e += offset (every element) */
+int mat_expr_offset(MAT_EXPR *e, double offset)
+{
+  return mat_expr_term(e, MAT_EXPR_OFFSET, offset, NULL, NULL);
+}
+
+/* Size of the result, or -1 if the terms don't agree */
+static int mat_expr_size(MAT_EXPR *e, int *nrows, int *ncols)
+{
+  struct mat_term *tp;
+  int i, m = -1, n = -1, tm, tn;
+
+  for (i = 0, tp = e->term; i < e->nterm; i++, tp++) {
+    if (tp->op == MAT_EXPR_OFFSET) continue;
+    tm = tp->a->nrows;
+    tn = tp->op == MAT_EXPR_MULT ? tp->b->ncols : tp->a->ncols;
+    if (m >= 0 && (tm != m || tn != n)) return -1;
+    m = tm;
+    n = tn;
+  }
+  if (m >= 0) {
+    *nrows = m;
+    *ncols = n;
+  }
+  return 0;
+}
+
+/*
+ * dst = e.  dst can appear in e: it is copied first if it is used in
+ * a product in a way that the blocked evaluation would overwrite.
+ */
+int mat_expr_eval(MATRIX *dst, MAT_EXPR *e)
+{
+  double buf[MAT_EXPR_STACK], *tmp = buf;
+  MATRIX copy;
+  MAT_EXPR e1;
+  int i, m, n, size, alias = 0;
+
+  if (dst == NULL || e == NULL) return -1;
+  m = dst->nrows;
+  n = dst->ncols;
+  if (mat_expr_size(e, &m, &n) < 0) return -1;
+
+  /* Products only read column j of b for column j of dst, as long as
+     dst keeps its size; resizing it would lose b before it is read */
+  for (i = 0; i < e->nterm; i++)
+    if (e->term[i].op == MAT_EXPR_MULT &&
+	(e->term[i].a == dst ||
+	 (e->term[i].b == dst && (m > MAT_EXPR_ROWS || dst->nrows != m ||
+				  dst->ncols != n))))
+      alias = 1;
+
+  if (alias) {
+    size = dst->nrows * dst->ncols;
+    if (size > MAT_EXPR_STACK &&
+	(tmp = (double *) mat_alloc(size * sizeof(double))) == NULL)
+      return -1;
+    memcpy(tmp, dst->real, size * sizeof(double));
+    copy = *dst;
+    copy.real = tmp;
+    e1 = *e;
+    for (i = 0; i < e1.nterm; i++) {
+      if (e1.term[i].a == dst) e1.term[i].a = &copy;
+      if (e1.term[i].b == dst) e1.term[i].b = &copy;
+    }
+    e = &e1;
+  }
+
+  if (dst->nrows != m || dst->ncols != n) mat_resize(dst, m, n);
+  mat_expr_eval_f(dst, e);
+
+  if (tmp != buf) mat_release(tmp);
+  return 0;
+}
+
+/* dst = e; dst must be the right size and not overlap a product */
+void mat_expr_eval_f(MATRIX *dst, MAT_EXPR *e)
+{
+  double acc[MAT_EXPR_ROWS], offset = 0, s;
+  const double *a, *b;
+  struct mat_term *tp;
+  int i, j, t, i0, mc, m = dst->nrows, n = dst->ncols;
+
+  for (t = 0; t < e->nterm; t++)
+    if (e->term[t].op == MAT_EXPR_OFFSET) offset += e->term[t].scale;
+
+  for (j = 0; j < n; j++)
+    for (i0 = 0; i0 < m; i0 += MAT_EXPR_ROWS) {
+      mc = m - i0 < MAT_EXPR_ROWS ? m - i0 : MAT_EXPR_ROWS;
+      for (i = 0; i < mc; i++) acc[i] = offset;
+
+      for (t = 0, tp = e->term; t < e->nterm; t++, tp++) {
+	s = tp->scale;
+	switch (tp->op) {
+	case MAT_EXPR_MULT:
+	  mat_tile_edge(mc, 1, tp->a->ncols, s, tp->a->real + i0, m,
+			tp->b->real + j * tp->b->nrows, tp->b->nrows, acc, m);
+	  break;
+	case MAT_EXPR_DOTMULT:
+	  a = tp->a->real + i0 + j*m;
+	  b = tp->b->real + i0 + j*m;
+	  for (i = 0; i < mc; i++) acc[i] += s * a[i] * b[i];
+	  break;
+	case MAT_EXPR_ADD:
+	  a = tp->a->real + i0 + j*m;
+	  for (i = 0; i < mc; i++) acc[i] += s * a[i];
+	  break;
+	}
+      }
+      memcpy(dst->real + i0 + j*m, acc, mc * sizeof(double));
+    }
+}
+
+/*
+ * Controller update: dst = a*x + b*u (the usual x[k+1] = A x[k] + B u[k]
+ * or y = C x + D u).  dst can be x or u.  Each column of the result is
+ * accumulated on the stack and stored once, without going through a
+ * MAT_EXPR.
+ */
+int mat_statespace(MATRIX *dst, MATRIX *a, MATRIX *x, MATRIX *b, MATRIX *u)
+{
+  double acc[MAT_EXPR_STACK];
+  MAT_EXPR e;
+  int j, m;
+
+  if (dst == NULL || a == NULL || x == NULL || b == NULL || u == NULL)
+    return -1;
+  if (a->ncols != x->nrows || b->ncols != u->nrows ||
+      a->nrows != b->nrows || x->ncols != u->ncols)
+    return -1;
+  m = a->nrows;
+
+  /* Cases the direct loop can't do */
+  if (m > MAT_EXPR_STACK || dst == a || dst == b ||
+      ((dst == x || dst == u) && (dst->nrows != m))) {
+    mat_expr_init(&e);
+    mat_expr_mult(&e, 1.0, a, x);
+    mat_expr_mult(&e, 1.0, b, u);
+    return mat_expr_eval(dst, &e);
+  }
+
+  if (dst->nrows != m || dst->ncols != x->ncols)
+    mat_resize(dst, m, x->ncols);
+  for (j = 0; j < x->ncols; j++) {
+    memset(acc, 0, m * sizeof(double));
+    mat_tile_edge(m, 1, a->ncols, 1.0, a->real, m, x->real + j * x->nrows,
+		  x->nrows, acc, m);
+    mat_tile_edge(m, 1, b->ncols, 1.0, b->real, m, u->real + j * u->nrows,
+		  u->nrows, acc, m);
+    memcpy(dst->real + j * m, acc, m * sizeof(double));
+  }
+  return 0;
+}
+
+/*
+ * Observer update: xhat = a*xhat + b*u + l*(y - c*xhat).  The
+ * innovation y - c*xhat is computed first (on the stack) and then the
+ * rest in one pass.
+ */
+int mat_observer(MATRIX *xhat, MATRIX *a, MATRIX *b, MATRIX *l, MATRIX *c,
+		 MATRIX *u, MATRIX *y)
+{
+  double rbuf[MAT_EXPR_STACK];
+  MATRIX r;
+  MAT_EXPR e;
+
+  if (xhat == NULL || c == NULL || y == NULL) return -1;
+  if (c->nrows != y->nrows || c->nrows > MAT_EXPR_STACK ||
+      xhat->ncols != 1 || y->ncols != 1)
+    return -1;
+
+  r = *y;
+  r.real = rbuf;
+  mat_expr_init(&e);
+  if (mat_expr_mult(&e, -1.0, c, xhat) < 0 || mat_expr_add(&e, 1.0, y) < 0)
+    return -1;
+  mat_expr_eval_f(&r, &e);
+
+  mat_expr_init(&e);
+  if (mat_expr_mult(&e, 1.0, a, xhat) < 0 ||
+      mat_expr_mult(&e, 1.0, b, u) < 0 || mat_expr_mult(&e, 1.0, l, &r) < 0)
+    return -1;
+  return mat_expr_eval(xhat, &e);
+}
@@ -0,0 +1,558 @@
+/*!
+ * \file matfile.c
+ * \brief load matrices from MATLAB files
+ *
+ * \date 19 Oct 26
+ *
+ * mat_load() maps the whole file into memory (or reads it with a
+ * single read() if it is small or can't be mapped) and copies each
+ * matrix body to its MATRIX with one memcpy.  The data is only byte
+ * swapped, in a separate pass over the copy, if the file was written
+ * on a machine with the opposite byte order.  Single precision and integer data are
+ * converted to double as they are copied.
+ *
+ * Both MATLAB formats are read:
+ *
+ *  - version 4 files (save -v4), with double, single, int32, int16,
+ *    uint16 and uint8 data.  Text matrices are loaded as numbers.
+ *  - version 5 files (save -v6 and -v7), with any numeric or char
+ *    class.  Compressed variables (the -v7 default) need zlib; without
+ *    it they are skipped with a message.  N-dimensional arrays are
+ *    loaded with the trailing dimensions folded into the columns, as
+ *    reshape(x, size(x,1), []) would.
+ *
+ * Sparse matrices, cells, structures and objects are skipped.  Names
+ * longer than MAT_NAMELEN-1 characters are truncated.
+ *
+ * mat_load() also builds a hash table of the names, which mat_find()
+ * uses instead of searching the list.  The table belongs to the first
+ * matrix in the list.  It is dropped if a matrix in the list is freed
+ * or renamed, and mat_find() goes back to searching the list if
+ * matrices have been added to the end of it.
+ *
+ * \ingroup matrix
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "matrix.h"
+#include "matkern.h"
+
+extern int mat_vflag;
+
+#define MF_MAPSIZE 65536			/* smaller files are read */
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MF_HOSTBIG 1
+#else
+#define MF_HOSTBIG 0
+#endif
+
+/* Element types, in the order of the MATLAB 5 type codes */
+enum {
+  MF_NONE, MF_INT8, MF_UINT8, MF_INT16, MF_UINT16, MF_INT32, MF_UINT32,
+  MF_SINGLE, MF_RESERVED8, MF_DOUBLE, MF_RESERVED10, MF_RESERVED11,
+  MF_INT64, MF_UINT64, MF_MATRIX, MF_COMPRESSED, MF_UTF8, MF_UTF16,
+  MF_UTF32, MF_NTYPES
+};
+static const int mf_size[MF_NTYPES] = {
+  0, 1, 1, 2, 2, 4, 4, 4, 0, 8, 0, 0, 8, 8, 0, 0, 1, 2, 4
+};
+
+/* Precision field of a version 4 header -> element type */
+static const int mf_v4type[6] = {
+  MF_DOUBLE, MF_SINGLE, MF_INT32, MF_INT16, MF_UINT16, MF_UINT8
+};
+
+/* Version 5 array classes that are loaded: char and numeric */
+#define MF_CLASS_CHAR 4
+#define MF_CLASS_NUMERIC(c) ((c) >= 6 && (c) <= 15)
+
+/* Name index built by mat_load() (see mat_find()) */
+struct mat_index {
+  unsigned mask;			/* table size - 1 */
+  MATRIX *last;				/* last matrix when built */
+  MATRIX *slot[];			/* open addressing, NULL = empty */
+};
+
+/* File being loaded */
+struct mf_file {
+  char *file;				/* for messages */
+  int swap;				/* byte order differs from ours */
+  MATRIX *first, *last;			/* matrices loaded so far */
+};
+
+static uint32_t mf_u32(const unsigned char *p, int swap)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return swap ? __builtin_bswap32(v) : v;
+}
+
+/*
+ * Convert n elements of the given type at src to doubles at dst,
+ * swapping bytes first if needed.  src can be unaligned.  dst can
+ * overlap src as long as src ends at the same place or after dst[n]
+ * (loadmat() reads narrow data into the end of the buffer).
+ */
+void mat_convert(double *dst, const void *src, size_t n, int type, int swap)
+{
+  const unsigned char *s = src;
+  size_t i;
+
+  /* The common case: one copy, then a pass to fix the byte order */
+  if (type == MF_DOUBLE) {
+    memmove(dst, src, n * sizeof(double));
+    if (swap) {
+      uint64_t *u = (uint64_t *) dst;
+      for (i = 0; i < n; ++i) u[i] = __builtin_bswap64(u[i]);
+    }
+    return;
+  }
+
+#define MF_CONVERT(ctype, utype, bswap) 				\
+  for (i = 0; i < n; ++i) {						\
+    utype u; ctype v;							\
+    memcpy(&u, s + i * sizeof(u), sizeof(u));				\
+    if (swap) u = bswap(u);						\
+    memcpy(&v, &u, sizeof(v));						\
+    dst[i] = v;								\
+  }									\
+  break
+
+#define MF_NOSWAP(u) (u)
+  switch (type) {
+  case MF_INT8:		MF_CONVERT(int8_t, uint8_t, MF_NOSWAP);
+  case MF_UTF8:
+  case MF_UINT8:	MF_CONVERT(uint8_t, uint8_t, MF_NOSWAP);
+  case MF_INT16:	MF_CONVERT(int16_t, uint16_t, __builtin_bswap16);
+  case MF_UTF16:
+  case MF_UINT16:	MF_CONVERT(uint16_t, uint16_t, __builtin_bswap16);
+  case MF_INT32:	MF_CONVERT(int32_t, uint32_t, __builtin_bswap32);
+  case MF_UTF32:
+  case MF_UINT32:	MF_CONVERT(uint32_t, uint32_t, __builtin_bswap32);
+  case MF_SINGLE:	MF_CONVERT(float, uint32_t, __builtin_bswap32);
+  case MF_INT64:	MF_CONVERT(int64_t, uint64_t, __builtin_bswap64);
+  case MF_UINT64:	MF_CONVERT(uint64_t, uint64_t, __builtin_bswap64);
+  }
+#undef MF_NOSWAP
+#undef MF_CONVERT
+}
+
+/* Size in bytes of an element type, or 0 if it isn't numeric */
+int mat_convert_size(int type)
+{
+  return type > 0 && type < MF_NTYPES ? mf_size[type] : 0;
+}
+
+/* Element type for the precision field of a version 4 header */
+int mat_convert_v4type(int prec)
+{
+  return prec >= 0 && prec < 6 ? mf_v4type[prec] : MF_NONE;
+}
+
+/*
+ * Create a matrix from a header and its data and add it to the list.
+ * re and im point to the data in the file, with element types rtype
+ * and itype; im is NULL for real data.
+ */
+static int mf_add(struct mf_file *f, int type, const char *name, int namelen,
+		  int nrows, int ncols, int rtype, const void *re,
+		  int itype, const void *im)
+{
+  MATRIX *mp;
+  size_t n = (size_t) nrows * ncols;
+
+  if ((mp = mat_create()) == NULL) return -1;
+  mp->type = type;
+  mp->nrows = nrows;
+  mp->ncols = ncols;
+  mp->imagf = im != NULL;
+  if (namelen > MAT_NAMELEN - 1) namelen = MAT_NAMELEN - 1;
+  memcpy(mp->name, name, namelen);
+  mp->name[namelen] = '\0';
+  mp->namelen = strlen(mp->name) + 1;
+
+  if (n > 0) {
+    if ((mp->real = mat_alloc(n * sizeof(double))) == NULL ||
+	(im != NULL && (mp->imag = mat_alloc(n * sizeof(double))) == NULL)) {
+      fprintf(stderr, "mat_load: %s: no memory for %s\n", f->file, mp->name);
+      mat_free(mp);
+      return -1;
+    }
+    mat_convert(mp->real, re, n, rtype, f->swap);
+    if (im != NULL) mat_convert(mp->imag, im, n, itype, f->swap);
+  }
+
+  if (f->last == NULL) f->first = mp;
+  else { f->last->next = mp; mp->prev = f->last; }
+  f->last = mp;
+  if (mat_vflag) printf("Loaded matrix %s (%dx%d)\n", mp->name, nrows, ncols);
+  return 0;
+}
+
+/* Version 4: a sequence of headers, each followed by the name and data */
+static int mf_load_v4(struct mf_file *f, const unsigned char *p,
+		      const unsigned char *end)
+{
+  int32_t hdr[5];
+  int i, mopt, prec, etype;
+  size_t n, len;
+
+  while (end - p >= 20) {
+    memcpy(hdr, p, sizeof(hdr));
+
+    /* Type is MOPT in decimal; M (the byte order) tells us how to read */
+    f->swap = 0;
+    if (hdr[0] < 0 || hdr[0] > 4999) {
+      for (i = 0; i < 5; ++i) hdr[i] = __builtin_bswap32(hdr[i]);
+      f->swap = 1;
+    }
+    mopt = hdr[0];
+    if (mopt < 0 || mopt > 4999 || mopt / 1000 > 1 ||
+	(mopt / 1000 == 1) != (f->swap ^ MF_HOSTBIG) ||
+	(mopt % 1000) / 100 != 0 || (prec = (mopt % 100) / 10) > 5 ||
+	mopt % 10 > 2) {
+      fprintf(stderr, "mat_load: %s: unknown matrix type %d\n", f->file,
+	      mopt);
+      return -1;
+    }
+    etype = mf_v4type[prec];
+    if (hdr[1] < 0 || hdr[2] < 0 || hdr[4] <= 0 || hdr[4] > end - p - 20) {
+      fprintf(stderr, "mat_load: %s: bad matrix header\n", f->file);
+      return -1;
+    }
+    p += 20;
+    n = (size_t) hdr[1] * hdr[2];
+    len = n * mf_size[etype];
+    if (len / mf_size[etype] != n ||
+	(size_t) (end - p - hdr[4]) / (hdr[3] ? 2 : 1) < len) {
+      fprintf(stderr, "mat_load: %s: file is truncated\n", f->file);
+      return -1;
+    }
+
+    if (mopt % 10 == 2)
+      fprintf(stderr, "mat_load: %s: skipping sparse matrix %.*s\n", f->file,
+	      (int) strnlen((char *) p, hdr[4]), p);
+    else if (mf_add(f, mopt, (char *) p, strnlen((char *) p, hdr[4]), hdr[1],
+		    hdr[2], etype, p + hdr[4], etype,
+		    hdr[3] ? p + hdr[4] + len : NULL) < 0)
+      return -1;
+    p += hdr[4] + (hdr[3] ? 2 : 1) * len;
+  }
+  return 0;
+}
+
+/*
+ * Version 5 data elements start with a tag: the type and the number
+ * of bytes.  Elements of up to 4 bytes can be packed into the tag, in
+ * which case the upper half of the type word is the number of bytes.
+ * Otherwise the data is padded to a multiple of 8 bytes.
+ */
+struct mf_elem {
+  int type;
+  uint32_t nbytes;
+  const unsigned char *data, *next;
+};
+
+static int mf_elem(struct mf_file *f, const unsigned char *p,
+		   const unsigned char *end, struct mf_elem *ep)
+{
+  uint32_t type;
+
+  if (end - p < 8) return -1;
+  type = mf_u32(p, f->swap);
+  if (type >> 16) {
+    ep->type = type & 0xffff;
+    ep->nbytes = type >> 16;
+    ep->data = p + 4;
+    ep->next = p + 8;
+    return ep->nbytes <= 4 ? 0 : -1;
+  }
+  ep->type = type;
+  ep->nbytes = mf_u32(p + 4, f->swap);
+  ep->data = p + 8;
+  if (ep->nbytes > (size_t) (end - ep->data)) return -1;
+  ep->next = ep->data + ((ep->nbytes + 7) & ~(size_t) 7);
+  if (ep->next > end) ep->next = end;
+  return 0;
+}
+
+/* Load the array in a miMATRIX element */
+static int mf_load_array(struct mf_file *f, const unsigned char *p,
+			 const unsigned char *end)
+{
+  struct mf_elem flags, dims, name, re, im;
+  int cls, complex, nrows, ncols, i;
+  size_t n;
+
+  if (mf_elem(f, p, end, &flags) < 0 || flags.nbytes != 8 ||
+      mf_elem(f, flags.next, end, &dims) < 0 ||
+      mf_elem(f, dims.next, end, &name) < 0)
+    goto bad;
+  cls = mf_u32(flags.data, f->swap) & 0xff;
+  complex = (mf_u32(flags.data, f->swap) & 0x800) != 0;
+
+  if (cls != MF_CLASS_CHAR && !MF_CLASS_NUMERIC(cls)) {
+    fprintf(stderr, "mat_load: %s: skipping %.*s (not a numeric array)\n",
+	    f->file, (int) name.nbytes, name.data);
+    return 0;
+  }
+
+  /* Fold dimensions after the first into the columns */
+  if (dims.type != MF_INT32 || dims.nbytes < 8) goto bad;
+  n = 1;
+  for (i = 1; i < dims.nbytes / 4; ++i)
+    if ((n *= mf_u32(dims.data + 4 * i, f->swap)) > INT32_MAX) goto bad;
+  ncols = n;
+  if (mf_u32(dims.data, f->swap) > INT32_MAX ||
+      (n *= mf_u32(dims.data, f->swap)) > INT32_MAX)
+    goto bad;
+  nrows = mf_u32(dims.data, f->swap);
+
+  /* Data can be stored in a smaller type than the class */
+  if (mf_elem(f, name.next, end, &re) < 0 ||
+      mat_convert_size(re.type) == 0 ||
+      re.nbytes != n * mf_size[re.type])
+    goto bad;
+  if (complex &&
+      (mf_elem(f, re.next, end, &im) < 0 ||
+       mat_convert_size(im.type) == 0 || im.nbytes != n * mf_size[im.type]))
+    goto bad;
+
+  return mf_add(f, 0, (char *) name.data, name.nbytes, nrows, ncols,
+		re.type, re.data, complex ? im.type : 0, complex ? im.data : NULL);
+
+ bad:
+  fprintf(stderr, "mat_load: %s: bad array\n", f->file);
+  return -1;
+}
+
+#ifdef HAVE_ZLIB
+/* Inflate a miCOMPRESSED element, which holds a miMATRIX element */
+static int mf_load_compressed(struct mf_file *f, const unsigned char *p,
+			      uint32_t nbytes)
+{
+  z_stream zs;
+  unsigned char tag[8], *buf = NULL;
+  uint32_t size;
+  int status = -1;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) return -1;
+  zs.next_in = (unsigned char *) p;
+  zs.avail_in = nbytes;
+
+  /* Read the tag to find out how much to allocate */
+  zs.next_out = tag;
+  zs.avail_out = sizeof(tag);
+  if (inflate(&zs, Z_SYNC_FLUSH) < 0 || zs.avail_out != 0 ||
+      mf_u32(tag, f->swap) != MF_MATRIX)
+    goto done;
+  size = mf_u32(tag + 4, f->swap);
+  if ((buf = malloc(size ? size : 1)) == NULL) goto done;
+  zs.next_out = buf;
+  zs.avail_out = size;
+  if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_out != 0) {
+    fprintf(stderr, "mat_load: %s: bad compressed data\n", f->file);
+    goto done;
+  }
+  status = mf_load_array(f, buf, buf + size);
+
+ done:
+  inflateEnd(&zs);
+  free(buf);
+  return status;
+}
+#endif
+
+/* Version 5: a 128 byte header followed by data elements */
+static int mf_load_v5(struct mf_file *f, const unsigned char *p,
+		      const unsigned char *end)
+{
+  struct mf_elem el;
+
+  f->swap = (p[126] == 'M') != MF_HOSTBIG;
+  for (p += 128; p < end; p = el.next) {
+    if (mf_elem(f, p, end, &el) < 0) {
+      fprintf(stderr, "mat_load: %s: file is truncated\n", f->file);
+      return -1;
+    }
+    if (el.type == MF_COMPRESSED) {
+      el.next = el.data + el.nbytes;	/* not padded */
+#ifdef HAVE_ZLIB
+      if (mf_load_compressed(f, el.data, el.nbytes) < 0) return -1;
+#else
+      fprintf(stderr, "mat_load: %s: skipping compressed variable "
+	      "(no zlib; save with -v6)\n", f->file);
+#endif
+    } else if (el.type == MF_MATRIX) {
+      if (mf_load_array(f, el.data, el.data + el.nbytes) < 0) return -1;
+    }
+  }
+  return 0;
+}
+
+/*!
+ * \fn MATRIX *mat_load(char *file)
+ * \brief load all of the matrices in a MATLAB file
+ * \ingroup matrix
+ *
+ * Returns a list of the matrices, or NULL if the file can't be read or
+ * has no matrices that can be loaded.  If there is an error part way
+ * through the file, the matrices before it are returned.
+ */
+MATRIX *mat_load(char *file)
+{
+  struct mf_file f = {file, 0, NULL, NULL};
+  struct stat st;
+  unsigned char *buf;
+  int fd, mapped = 1;
+
+  if ((fd = open(file, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) { close(fd); return NULL; }
+
+  /*
+   * Map the file; if it is small (mapping costs more than copying) or
+   * that doesn't work, read it in one go.
+   */
+  if (st.st_size < MF_MAPSIZE ||
+      (buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+		  fd, 0)) == MAP_FAILED) {
+    mapped = 0;
+    if ((buf = malloc(st.st_size)) == NULL ||
+	read(fd, buf, st.st_size) != st.st_size) {
+      fprintf(stderr, "mat_load: can't read %s\n", file);
+      free(buf);
+      close(fd);
+      return NULL;
+    }
+  }
+  close(fd);
+
+  if (st.st_size >= 128 && memcmp(buf, "MATLAB", 6) == 0 &&
+      ((buf[126] == 'I' && buf[127] == 'M') ||
+       (buf[126] == 'M' && buf[127] == 'I')))
+    mf_load_v5(&f, buf, buf + st.st_size);
+  else
+    mf_load_v4(&f, buf, buf + st.st_size);
+
+  if (mapped) munmap(buf, st.st_size);
+  else free(buf);
+
+  mat_index_build(f.first);
+  return f.first;
+}
+
+/* Hash of a matrix name (FNV-1a) */
+static unsigned mf_hash(const char *s)
+{
+  unsigned h = 2166136261u;
+  while (*s) h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+/* Build the name index for a list; the list is left unindexed on error */
+void mat_index_build(MATRIX *list)
+{
+  struct mat_index *ip;
+  MATRIX *mp;
+  unsigned n = 0, size = 8, h;
+
+  if (list == NULL) return;
+  for (mp = list; mp != NULL; mp = mp->next) ++n;
+  while (size < 2 * n) size *= 2;
+  if ((ip = mat_alloc(sizeof(*ip) + size * sizeof(MATRIX *))) == NULL)
+    return;
+  memset(ip->slot, 0, size * sizeof(MATRIX *));
+  ip->mask = size - 1;
+
+  /* Earlier matrices win if a name appears twice, as in a search */
+  for (mp = list; mp != NULL; mp = mp->next) {
+    for (h = mf_hash(mp->name); ip->slot[h & ip->mask] != NULL; ++h)
+      if (strcmp(ip->slot[h & ip->mask]->name, mp->name) == 0) break;
+    if (ip->slot[h & ip->mask] == NULL) ip->slot[h & ip->mask] = mp;
+    ip->last = mp;
+  }
+  list->index = ip;
+}
+
+/* Drop the index of the list that a matrix is in */
+void mat_index_drop(MATRIX *mp)
+{
+  if (mp == NULL) return;
+  while (mp->prev != NULL) mp = mp->prev;
+  mat_release(mp->index);
+  mp->index = NULL;
+}
+
+/*!
+ * \fn MATRIX *mat_find(MATRIX *list, char *name)
+ * \brief find a matrix in a list by name
+ * \ingroup matrix
+ */
+MATRIX *mat_find(MATRIX *list, char *name)
+{
+  struct mat_index *ip;
+  MATRIX *mp;
+  unsigned h;
+
+  if (name == NULL || list == NULL) return NULL;
+
+  /* Use the index unless something has been added to the list */
+  if ((ip = list->index) != NULL && ip->last->next == NULL) {
+    for (h = mf_hash(name); (mp = ip->slot[h & ip->mask]) != NULL; ++h)
+      if (strcmp(mp->name, name) == 0) return mp;
+    return NULL;
+  }
+
+  for (mp = list; mp != NULL; mp = mp->next)
+    if (strcmp(mp->name, name) == 0) return mp;
+  return NULL;
+}
@@ -0,0 +1,60 @@
+/*!
+ * \file matkern.h
+ * \brief kernels shared by the matrix routines (not installed)
+ *
+ * \date 19 Oct 26
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#ifndef __MATKERN_INCLUDED__
+#define __MATKERN_INCLUDED__
+
+#include "matrix.h"
+
+/* c (mr x nr) += scale * a (mr x kc) * b (kc x nr), column-major (matmult.c) */
+void mat_tile_edge(int mr, int nr, int kc, double scale, const double *a,
+		   int lda, const double *b, int ldb, double *c, int ldc);
+
+/* MATLAB file data -> double; type is a MATLAB 5 type code (matfile.c) */
+void mat_convert(double *dst, const void *src, size_t n, int type, int swap);
+int mat_convert_size(int type);
+int mat_convert_v4type(int prec);
+
+/* Name index of a list of matrices (matfile.c) */
+void mat_index_build(MATRIX *list);
+void mat_index_drop(MATRIX *mp);
+
+#endif /* __MATKERN_INCLUDED__ */
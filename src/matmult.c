@@ -0,0 +1,352 @@
+/*!
+ * \file matmult.c
+ * \brief matrix multiply kernels
+ *
+ * \date 19 Oct 26
+ *
+ * mat_mult_f() is used for observers and feedback gains in the servo
+ * loop, where most products are small, so there are two cases.
+ * Products where a is N x N for N = 2 to 8 (including matrix-vector
+ * products) use code written for that size, which the compiler
+ * unrolls completely, except that 8 x 8 products go to the AVX2 tile
+ * when there is one.  Everything else uses a blocked multiply: the
+ * product is computed in blocks that fit in the cache, and each block
+ * with a register tile that keeps a small block of dst in registers
+ * while it runs down the columns of a and the rows of b.  On x86-64
+ * the tile uses AVX2/FMA instructions if the processor has them and
+ * SSE2 otherwise; elsewhere it is plain C.  Rows and columns left
+ * over from the tiles are done a column at a time.
+ *
+ * The pairs of doubles used for the fixed sizes and the edges are GCC
+ * vector extensions, which the compiler turns into SSE2 or NEON
+ * instructions, or scalar code if there are none.
+ *
+ * mat_mult_kernel selects the kernel (for testing and benchmarks);
+ * the default is the fastest one available.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "matrix.h"
+#include "matkern.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MAT_X86
+#include <immintrin.h>
+#endif
+
+int mat_mult_kernel = MAT_KERNEL_AUTO;
+
+#define MC 64				/* rows of a per block */
+#define KC 128				/* columns of a per block */
+
+/* Pairs of doubles; GCC generates SSE2 (or the equivalent) for these */
+typedef double mat_v2d __attribute__((vector_size(16)));
+
+static inline mat_v2d mat_load2(const double *p)
+{
+  mat_v2d v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void mat_store2(double *p, mat_v2d v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Fixed size products: dst (N x n) = a (N x N) * b (N x n).  Each
+ * column of dst is kept in registers, two rows per register.
+ */
+#define MAT_MULT_N(N)							\
+static void mat_mult_##N(double *c, const double *a, const double *b,	\
+			 int n)						\
+{									\
+  mat_v2d s[N/2], t;							\
+  double r = 0;								\
+  int i, j, p;								\
+									\
+  for (j = 0; j < n; j++, b += N, c += N) {				\
+    t = (mat_v2d) {b[0], b[0]};						\
+    _Pragma("GCC unroll 4")						\
+    for (i = 0; i < N/2; i++) s[i] = mat_load2(a + 2*i) * t;		\
+    if (N % 2) r = a[N-1] * b[0];					\
+    _Pragma("GCC unroll 8")						\
+    for (p = 1; p < N; p++) {						\
+      t = (mat_v2d) {b[p], b[p]};					\
+      _Pragma("GCC unroll 4")						\
+      for (i = 0; i < N/2; i++) s[i] += mat_load2(a + p*N + 2*i) * t;	\
+      if (N % 2) r += a[p*N + N-1] * b[p];				\
+    }									\
+    _Pragma("GCC unroll 4")						\
+    for (i = 0; i < N/2; i++) mat_store2(c + 2*i, s[i]);		\
+    if (N % 2) c[N-1] = r;						\
+  }									\
+}
+
+MAT_MULT_N(2) MAT_MULT_N(3) MAT_MULT_N(4) MAT_MULT_N(5)
+MAT_MULT_N(6) MAT_MULT_N(7) MAT_MULT_N(8)
+
+static void (*mat_mult_fixed[])(double *, const double *, const double *,
+				int) = {
+  NULL, NULL, mat_mult_2, mat_mult_3, mat_mult_4, mat_mult_5,
+  mat_mult_6, mat_mult_7, mat_mult_8
+};
+
+/*
+ * Register tiles: c (MR x NR) += a (MR x kc) * b (kc x NR), with
+ * leading dimensions lda, ldb and ldc
+ */
+typedef void mat_tile_t(int kc, const double *a, int lda, const double *b,
+			int ldb, double *c, int ldc);
+
+static void mat_tile_c(int kc, const double *a, int lda, const double *b,
+		       int ldb, double *c, int ldc)
+{
+  double c0[4], c1[4], c2[4], c3[4], b0, b1, b2, b3;
+  int i, p;
+
+  for (i = 0; i < 4; i++) {
+    c0[i] = c[i]; c1[i] = c[i + ldc];
+    c2[i] = c[i + 2*ldc]; c3[i] = c[i + 3*ldc];
+  }
+  for (p = 0; p < kc; p++, a += lda, b++) {
+    b0 = b[0]; b1 = b[ldb]; b2 = b[2*ldb]; b3 = b[3*ldb];
+    for (i = 0; i < 4; i++) {
+      c0[i] += a[i] * b0; c1[i] += a[i] * b1;
+      c2[i] += a[i] * b2; c3[i] += a[i] * b3;
+    }
+  }
+  for (i = 0; i < 4; i++) {
+    c[i] = c0[i]; c[i + ldc] = c1[i];
+    c[i + 2*ldc] = c2[i]; c[i + 3*ldc] = c3[i];
+  }
+}
+
+#ifdef MAT_X86
+static void mat_tile_sse2(int kc, const double *a, int lda, const double *b,
+			  int ldb, double *c, int ldc)
+{
+  __m128d c00, c01, c10, c11, c20, c21, c30, c31, a0, a1, t;
+  int p;
+
+  c00 = _mm_loadu_pd(c);         c01 = _mm_loadu_pd(c + 2);
+  c10 = _mm_loadu_pd(c + ldc);   c11 = _mm_loadu_pd(c + ldc + 2);
+  c20 = _mm_loadu_pd(c + 2*ldc); c21 = _mm_loadu_pd(c + 2*ldc + 2);
+  c30 = _mm_loadu_pd(c + 3*ldc); c31 = _mm_loadu_pd(c + 3*ldc + 2);
+  for (p = 0; p < kc; p++, a += lda, b++) {
+    a0 = _mm_loadu_pd(a); a1 = _mm_loadu_pd(a + 2);
+    t = _mm_set1_pd(b[0]);
+    c00 = _mm_add_pd(c00, _mm_mul_pd(a0, t));
+    c01 = _mm_add_pd(c01, _mm_mul_pd(a1, t));
+    t = _mm_set1_pd(b[ldb]);
+    c10 = _mm_add_pd(c10, _mm_mul_pd(a0, t));
+    c11 = _mm_add_pd(c11, _mm_mul_pd(a1, t));
+    t = _mm_set1_pd(b[2*ldb]);
+    c20 = _mm_add_pd(c20, _mm_mul_pd(a0, t));
+    c21 = _mm_add_pd(c21, _mm_mul_pd(a1, t));
+    t = _mm_set1_pd(b[3*ldb]);
+    c30 = _mm_add_pd(c30, _mm_mul_pd(a0, t));
+    c31 = _mm_add_pd(c31, _mm_mul_pd(a1, t));
+  }
+  _mm_storeu_pd(c, c00);         _mm_storeu_pd(c + 2, c01);
+  _mm_storeu_pd(c + ldc, c10);   _mm_storeu_pd(c + ldc + 2, c11);
+  _mm_storeu_pd(c + 2*ldc, c20); _mm_storeu_pd(c + 2*ldc + 2, c21);
+  _mm_storeu_pd(c + 3*ldc, c30); _mm_storeu_pd(c + 3*ldc + 2, c31);
+}
+
+/* 8 x 4 tile: 8 accumulators of 4 doubles */
+__attribute__((target("avx2,fma")))
+static void mat_tile_avx2(int kc, const double *a, int lda, const double *b,
+			  int ldb, double *c, int ldc)
+{
+  __m256d c00, c01, c10, c11, c20, c21, c30, c31, a0, a1, t;
+  int p;
+
+  c00 = _mm256_loadu_pd(c);         c01 = _mm256_loadu_pd(c + 4);
+  c10 = _mm256_loadu_pd(c + ldc);   c11 = _mm256_loadu_pd(c + ldc + 4);
+  c20 = _mm256_loadu_pd(c + 2*ldc); c21 = _mm256_loadu_pd(c + 2*ldc + 4);
+  c30 = _mm256_loadu_pd(c + 3*ldc); c31 = _mm256_loadu_pd(c + 3*ldc + 4);
+  for (p = 0; p < kc; p++, a += lda, b++) {
+    a0 = _mm256_loadu_pd(a); a1 = _mm256_loadu_pd(a + 4);
+    t = _mm256_broadcast_sd(b);
+    c00 = _mm256_fmadd_pd(a0, t, c00); c01 = _mm256_fmadd_pd(a1, t, c01);
+    t = _mm256_broadcast_sd(b + ldb);
+    c10 = _mm256_fmadd_pd(a0, t, c10); c11 = _mm256_fmadd_pd(a1, t, c11);
+    t = _mm256_broadcast_sd(b + 2*ldb);
+    c20 = _mm256_fmadd_pd(a0, t, c20); c21 = _mm256_fmadd_pd(a1, t, c21);
+    t = _mm256_broadcast_sd(b + 3*ldb);
+    c30 = _mm256_fmadd_pd(a0, t, c30); c31 = _mm256_fmadd_pd(a1, t, c31);
+  }
+  _mm256_storeu_pd(c, c00);         _mm256_storeu_pd(c + 4, c01);
+  _mm256_storeu_pd(c + ldc, c10);   _mm256_storeu_pd(c + ldc + 4, c11);
+  _mm256_storeu_pd(c + 2*ldc, c20); _mm256_storeu_pd(c + 2*ldc + 4, c21);
+  _mm256_storeu_pd(c + 3*ldc, c30); _mm256_storeu_pd(c + 3*ldc + 4, c31);
+}
+#endif
+
+/*
+ * c (mr x nr) += scale * a (mr x kc) * b (kc x nr), one column at a
+ * time.  Used for the edges that don't fill a tile, matrix-vector
+ * products and fused expressions (matexpr.c).  Short columns are done
+ * eight rows at a time with the sums in registers; tall ones four
+ * columns of a at a time, so that a is read in order and c stays in
+ * the cache.
+ */
+#define MAT_TALL 32
+void mat_tile_edge(int mr, int nr, int kc, double scale, const double *a,
+		   int lda, const double *b, int ldb, double *c, int ldc)
+{
+  mat_v2d s0, s1, s2, s3, t, t1, t2, t3;
+  const double *ap;
+  double r;
+  int i, j, p;
+
+  for (j = 0; j < nr; j++, b += ldb, c += ldc) {
+    if (mr > MAT_TALL) {
+      for (p = 0, ap = a; p + 4 <= kc; p += 4, ap += 4*lda) {
+	t = (mat_v2d) {b[p], b[p]} * scale;
+	t1 = (mat_v2d) {b[p+1], b[p+1]} * scale;
+	t2 = (mat_v2d) {b[p+2], b[p+2]} * scale;
+	t3 = (mat_v2d) {b[p+3], b[p+3]} * scale;
+	for (i = 0; i + 2 <= mr; i += 2)
+	  mat_store2(c + i, mat_load2(c + i) + mat_load2(ap + i) * t +
+		     mat_load2(ap + lda + i) * t1 +
+		     mat_load2(ap + 2*lda + i) * t2 +
+		     mat_load2(ap + 3*lda + i) * t3);
+	if (i < mr)
+	  c[i] += scale * (ap[i] * b[p] + ap[lda + i] * b[p+1] +
+			   ap[2*lda + i] * b[p+2] + ap[3*lda + i] * b[p+3]);
+      }
+      for (; p < kc; p++, ap += lda) {
+	t = (mat_v2d) {b[p], b[p]} * scale;
+	for (i = 0; i + 2 <= mr; i += 2)
+	  mat_store2(c + i, mat_load2(c + i) + mat_load2(ap + i) * t);
+	if (i < mr) c[i] += ap[i] * (b[p] * scale);
+      }
+      continue;
+    }
+
+    for (i = 0; i + 8 <= mr; i += 8) {
+      s0 = mat_load2(c + i); s1 = mat_load2(c + i + 2);
+      s2 = mat_load2(c + i + 4); s3 = mat_load2(c + i + 6);
+      for (p = 0, ap = a + i; p < kc; p++, ap += lda) {
+	t = (mat_v2d) {b[p], b[p]} * scale;
+	s0 += mat_load2(ap) * t; s1 += mat_load2(ap + 2) * t;
+	s2 += mat_load2(ap + 4) * t; s3 += mat_load2(ap + 6) * t;
+      }
+      mat_store2(c + i, s0); mat_store2(c + i + 2, s1);
+      mat_store2(c + i + 4, s2); mat_store2(c + i + 6, s3);
+    }
+    for (; i + 2 <= mr; i += 2) {
+      s0 = mat_load2(c + i);
+      for (p = 0, ap = a + i; p < kc; p++, ap += lda)
+	s0 += mat_load2(ap) * ((mat_v2d) {b[p], b[p]} * scale);
+      mat_store2(c + i, s0);
+    }
+    if (i < mr) {
+      for (r = c[i], p = 0; p < kc; p++) r += a[i + p*lda] * (b[p] * scale);
+      c[i] = r;
+    }
+  }
+}
+
+/* Pick the tile for the kernel requested; returns its height */
+static int mat_tile_select(mat_tile_t **tile)
+{
+  int kernel = mat_mult_kernel;
+
+#ifdef MAT_X86
+  static int have_avx2 = -1;
+
+  if (have_avx2 < 0)
+    have_avx2 = __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma");
+  if (kernel == MAT_KERNEL_AUTO) kernel = have_avx2 ? MAT_KERNEL_AVX2 :
+				   MAT_KERNEL_SSE2;
+  if (kernel == MAT_KERNEL_AVX2 && have_avx2) {
+    *tile = mat_tile_avx2;
+    return 8;
+  }
+  if (kernel != MAT_KERNEL_C) {
+    *tile = mat_tile_sse2;
+    return 4;
+  }
+#endif
+  *tile = mat_tile_c;
+  return 4;
+}
+
+/* c (m x n) = a (m x k) * b (k x n), blocked; c must not overlap a or b */
+static void mat_mult_blocked(mat_tile_t *tile, int mr, int m, int n, int k,
+			     const double *a, const double *b, double *c)
+{
+  int i, j, p, i0, mc, kc, nr = 4;
+
+  memset(c, 0, m*n*sizeof(double));
+  for (p = 0; p < k; p += KC) {
+    kc = k - p < KC ? k - p : KC;
+    for (i0 = 0; i0 < m; i0 += MC) {
+      mc = m - i0 < MC ? m - i0 : MC;
+      for (j = 0; j + nr <= n; j += nr) {
+	for (i = i0; i + mr <= i0 + mc; i += mr)
+	  tile(kc, a + i + p*m, m, b + p + j*k, k, c + i + j*m, m);
+	if (i < i0 + mc)
+	  mat_tile_edge(i0 + mc - i, nr, kc, 1.0, a + i + p*m, m, b + p + j*k, k,
+			c + i + j*m, m);
+      }
+      if (j < n)
+	mat_tile_edge(mc, n - j, kc, 1.0, a + i0 + p*m, m, b + p + j*k, k,
+		      c + i0 + j*m, m);
+    }
+  }
+}
+
+void mat_mult_f(MATRIX *dst, MATRIX *a, MATRIX *b) { /* dst = a.b */
+
+  int m = a->nrows, n = b->ncols, k = a->ncols;
+  mat_tile_t *tile;
+  int mr = mat_tile_select(&tile);
+
+  /* Fixed sizes, unless a tile covers the whole height of a */
+  if (m == k && m >= 2 && m <= 8 && mat_mult_kernel == MAT_KERNEL_AUTO &&
+      !(m == mr && n >= 4))
+    mat_mult_fixed[m](dst->real, a->real, b->real, n);
+  else
+    mat_mult_blocked(tile, mr, m, n, k, a->real, b->real, dst->real);
+}
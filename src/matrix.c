@@ -44,6 +44,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #ifdef MSDOS
 #include <alloc.h>
@@ -53,6 +54,7 @@
 #endif
 
 #include "matrix.h"
+#include "matkern.h"
 
 int mat_vflag = 0;		/* flag to allow verbose messages */
 
@@ -75,7 +77,7 @@ MATRIX  *mat_init(int nrows, int ncols) {
 MATRIX *mat_create(){
   MATRIX *handle;
 
-  handle = (MATRIX *)malloc(sizeof(MATRIX));
+  handle = (MATRIX *)mat_alloc(sizeof(MATRIX));
 
   if (handle==NULL){
     fprintf(stderr, " mat_create error!\n");
@@ -91,6 +93,7 @@ MATRIX *mat_create(){
   handle->imag = NULL;
   handle->prev = NULL;
   handle->next = NULL;
+  handle->index = NULL;
 
   handle->namelen = 7;
   strcpy(handle->name,"NONAME");
@@ -103,8 +106,10 @@ int mat_set_name(MATRIX *a, char *name){
 
   if (a==NULL) return -1;
   
-  strcpy(a->name,name);
-  a->namelen=strlen(name)+1;
+  mat_index_drop(a);
+  strncpy(a->name,name,MAT_NAMELEN-1);
+  a->name[MAT_NAMELEN-1] = '\0';
+  a->namelen=strlen(a->name)+1;
   return 0;
 }
 
@@ -125,11 +130,13 @@ int mat_resize(MATRIX *mx, int nrows, int ncols) {
 
   if (mx == NULL) return -1;
 
-  free(mx->real);
-  r = (double *)malloc(nrows*ncols*sizeof(double));
-  if (r == NULL) return -1;
-
-  mx->real = r;
+  /* Keep the storage if the number of elements is the same */
+  if (mx->real == NULL || nrows*ncols != mx->nrows*mx->ncols) {
+    mat_release(mx->real);
+    r = (double *)mat_alloc_for(mx, nrows*ncols*sizeof(double));
+    if (r == NULL) return -1;
+    mx->real = r;
+  }
   mx->nrows = nrows;
   mx->ncols = ncols;
   return 0;
@@ -240,12 +247,13 @@ void mat_free(MATRIX *a) {
   if (a==NULL) return;
 
   /* Clear a from any list */
+  mat_index_drop(a);
   if (a->prev != NULL) a->prev->next = a->next;
   if (a->next != NULL) a->next->prev = a->prev;
 
-  free(a->real);
-  free(a->imag);
-  free(a);
+  mat_release(a->real);
+  mat_release(a->imag);
+  mat_release(a);
 
 }
 
@@ -269,54 +277,39 @@ void mat_copy_f(MATRIX *dst, MATRIX *src){ /* dst = src */
       *(dst->real + i) = *(src->real + i);
 }
 
+/* Products up to this many elements are copied on the stack if dst is a or b */
+#define MAT_MULT_STACK 4096
+
 int mat_mult(MATRIX *dst, MATRIX *a, MATRIX *b) { /* dst = a.b */
-  MATRIX *a1, *b1;
-  int freea1=0;
-  int freeb1=0;
+  double buf[MAT_MULT_STACK], *tmp = buf;
+  MATRIX a1, b1;
+  int n;
 
   if ((dst == NULL) || (a == NULL) || (b == NULL)) return -1;
   if (a->ncols != b->nrows) return -1;
 
-  if (dst == a){
-    a1 = mat_create();
-    mat_copy(a1,a);
-    freea1 = 1;
+  /* Copy the input that dst overwrites */
+  a1 = *a;
+  b1 = *b;
+  if (dst == a || dst == b) {
+    n = dst->nrows*dst->ncols;
+    if (n > MAT_MULT_STACK &&
+	(tmp = (double *)mat_alloc(n*sizeof(double))) == NULL) return -1;
+    memcpy(tmp, dst->real, n*sizeof(double));
+    if (dst == a) a1.real = tmp;
+    if (dst == b) b1.real = tmp;
   }
-  else
-    a1 = a;
 
-  if (dst == b){
-    b1 = mat_create();
-    mat_copy(b1,b);
-    freeb1 = 1;
-  }
-  else
-    b1 = b;
-
-  mat_resize(dst,a1->nrows,b1->ncols);
+  if (dst->nrows != a->nrows || dst->ncols != b->ncols)
+    mat_resize(dst,a->nrows,b->ncols);
 
-  mat_mult_f(dst,a1,b1);
+  mat_mult_f(dst,&a1,&b1);
 
-  if (freea1) mat_free(a1);
-  if (freeb1) mat_free(b1);
-  
+  if (tmp != buf) mat_release(tmp);
   return 0;
 }
 
-void mat_mult_f(MATRIX *dst, MATRIX *a, MATRIX *b) { /* dst = a.b */
-
-  register int i,j,k;
-
-  mat_reset(dst);
-
-  for (i = 0; i < dst->nrows; i++)
-    for (j = 0; j < dst->ncols; j++)
-      for (k = 0; k < a->ncols; k++)
-	*(dst->real + i + j*dst->nrows) += 
-	  *(a->real + i + k*a->nrows ) * *(b->real + k + j*b->nrows);
-
-}
-
+/* mat_mult_f is in matmult.c */
 
 int mat_dotmult(MATRIX *dst, MATRIX *a, MATRIX *b) { /* dst = a .* b */
   MATRIX *a1, *b1;
@@ -522,58 +515,6 @@ int mat_get_cols(MATRIX *a){
   return a->ncols;
 }
 
-/* Find a matrix and return a pointer to the matrix data structure */
-MATRIX *mat_find(MATRIX *list, char *name)
-{
-    /* Do a bit of error checking */
-    if (name == NULL) return NULL;
-
-    while (list != NULL){
-      if (list->name == NULL) break;
-      if (strcmp(list->name, name) == 0) return list;
-      list = list->next;
-    }
-
-    /* Couldn't find the matrix */
-    return NULL;
-}
-
-
-MATRIX *mat_load(char *file)
-{
-    FILE *fp;
-    int i=0;
-    MATRIX *first, *prev, *cur;
-
-    /* Open the file */
-    if ((fp = fopen(file, "rb")) == NULL) return NULL;
-
-    first = mat_create(); cur = first; prev = cur;
-    /* For the first pass, prev=cur so that if the first loadmat fails,
-     * the assignment prev->next = NULL will not seg fault.  If loadmat
-     * is successful, things are fine. */
-
-    /* Read in a matrix */
-    while (loadmat(fp, &cur->type, &cur->nrows, &cur->ncols,
-		  &cur->imagf, cur->name, &cur->real, &cur->imag) == 0){
-
-      if (mat_vflag) printf("Loaded matrix %i, name %s\n",++i,cur->name);
-      prev = cur;
-      cur = mat_create();
-      prev->next = cur;
-      cur->prev = prev;
-      
-    }
-
-    /* In case the load_mat fails on the first one */
-    prev->next = NULL;
-    mat_free(cur);
-
-    fclose(fp);
-
-    return first;
-}
-
 void mat_list(MATRIX *list){
 
   if (list == NULL){
@@ -600,97 +541,371 @@ int mat_det(double *det, MATRIX *mat){
   return 0;
 }
 
+/* Determinant from the LU factorization (0 if singular) */
 double mat_det_f(MATRIX *mat){
 
-  register int i,j,k;
-  register int rows = mat_get_rows(mat);
-  register int sign = 1;
-  register double det = 0;
-  MATRIX *minor;
-
-  if (rows==1) 
-    return mat->real[0];
-  if (rows==2)
-    return (mat->real[0]*mat->real[3] - mat->real[1]*mat->real[2]);
-
-  minor = mat_init(rows-1,rows-1);
-  
-  for (i=0; i<rows; i++){
-    int cnt=0;
-
-    for (j=1; j<rows; j++)      /* We skip the first column always */
-      for (k=0; k<rows; k++){   /* Skip the appropriate row of stuff */
-	if (k==i) continue;
-	minor->real[cnt] = mat->real[j*rows+k];
-	cnt++;
-      }
-    det = det + sign*mat->real[i]*mat_det_f(minor);
-    sign *= -1;
-  }
+  MAT_FACTOR *f = mat_factor_init(mat->nrows);
+  double det;
 
-  mat_free(minor);
+  if (f == NULL) return 0;
+  mat_lu(f, mat);
+  det = mat_factor_det(f);
+  mat_factor_free(f);
   return det;
 }
 
 int mat_inverse(MATRIX *dst, MATRIX *src){
 
-  MATRIX *a1;
-  int freea1=0;
+  MAT_FACTOR *f;
+  int status;
 
   if ((dst == NULL) || (src == NULL)) return -1;
+  if (src->nrows != src->ncols) return -1;
 
-  if (dst == src){
-    a1 = mat_create();
-    mat_copy(a1,src);
-    freea1=1;
+  /* Factor first so that dst can be the same as src */
+  if ((f = mat_factor_init(src->nrows)) == NULL) return -1;
+  status = mat_lu(f, src);
+  if (dst->nrows != src->nrows || dst->ncols != src->ncols)
+    mat_resize(dst, src->nrows, src->ncols);
+  mat_factor_inverse_f(dst, f);
+  mat_factor_free(f);
+
+  return status;
+}
+
+void mat_inverse_f(MATRIX *dst, MATRIX *src){
+
+  MAT_FACTOR *f = mat_factor_init(src->nrows);
+
+  if (f == NULL) return;
+  mat_lu(f, src);
+  mat_factor_inverse_f(dst, f);
+  mat_factor_free(f);
+}
+
+/*
+ * Factorizations
+ *
+ * mat_lu() and mat_chol() store the factors of a square matrix in a
+ * MAT_FACTOR, which can then be used to solve any number of systems
+ * with mat_factor_solve() without factoring again.  A factor can be
+ * reused for other matrices of the same size without allocating
+ * memory, so factoring and solving can be done in the servo loop once
+ * the factor has been created with mat_factor_init().
+ */
+
+MAT_FACTOR *mat_factor_init(int n){
+
+  MAT_FACTOR *f;
+
+  if (n <= 0) return NULL;
+  if ((f = (MAT_FACTOR *) mat_alloc(sizeof(MAT_FACTOR))) == NULL)
+    return NULL;
+  memset(f, 0, sizeof(MAT_FACTOR));
+  f->n = n;
+  f->lu = (double *) mat_alloc(n*n*sizeof(double));
+  f->piv = (int *) mat_alloc(n*sizeof(int));
+  if (f->lu == NULL || f->piv == NULL) {
+    mat_factor_free(f);
+    return NULL;
   }
-  else
-    a1=src;
- 
-  mat_resize(dst,a1->ncols,a1->nrows);
+  return f;
+}
 
-  mat_inverse_f(dst,a1);
+void mat_factor_free(MAT_FACTOR *f){
 
-  if (freea1) mat_free(a1);
+  if (f == NULL) return;
+  mat_release(f->lu);
+  mat_release(f->piv);
+  mat_release(f);
+}
+
+/* Make the factor the right size for an n x n matrix */
+static int mat_factor_size(MAT_FACTOR *f, int n){
 
+  double *lu;
+  int *piv;
+
+  if (f->n == n) return 0;
+  lu = (double *) mat_alloc_for(f, n*n*sizeof(double));
+  piv = (int *) mat_alloc_for(f, n*sizeof(int));
+  if (lu == NULL || piv == NULL) {
+    mat_release(lu);
+    mat_release(piv);
+    return -1;
+  }
+  mat_release(f->lu);
+  mat_release(f->piv);
+  f->lu = lu;
+  f->piv = piv;
+  f->n = n;
   return 0;
+}
 
+/*
+ * LU factorization with partial pivoting, PA = LU.  L (unit diagonal)
+ * and U are stored in place of a, piv[k] is the row swapped with row
+ * k at step k.  Returns -1 if a zero pivot was found, in which case
+ * the factors are still computed but U is singular.
+ */
+int mat_lu(MAT_FACTOR *f, MATRIX *a){
+
+  register int i, j, k;
+  int n, p, status = 0;
+  double *lu, *ck, *cj, t;
+
+  if ((f == NULL) || (a == NULL)) return -1;
+  if (a->nrows != a->ncols) return -1;
+  if (mat_factor_size(f, a->nrows) < 0) return -1;
+
+  n = f->n;
+  lu = f->lu;
+  memcpy(lu, a->real, n*n*sizeof(double));
+  f->type = MAT_LU;
+  f->sign = 1;
+
+  for (k = 0; k < n; k++) {
+    ck = lu + k*n;
+
+    /* Pick the largest element in column k as the pivot */
+    for (p = k, i = k+1; i < n; i++)
+      if (fabs(ck[i]) > fabs(ck[p])) p = i;
+    f->piv[k] = p;
+    if (p != k) {
+      for (j = 0; j < n; j++) {
+	t = lu[k + j*n]; lu[k + j*n] = lu[p + j*n]; lu[p + j*n] = t;
+      }
+      f->sign = -f->sign;
+    }
+    if (ck[k] == 0) { status = -1; continue; }
+
+    /* Eliminate below the pivot, one column at a time */
+    for (i = k+1; i < n; i++) ck[i] /= ck[k];
+    for (j = k+1; j < n; j++) {
+      cj = lu + j*n;
+      if ((t = cj[k]) != 0)
+	for (i = k+1; i < n; i++) cj[i] -= ck[i] * t;
+    }
+  }
+  return status;
 }
 
-void mat_inverse_f(MATRIX *dst, MATRIX *src){
+/*
+ * Cholesky factorization, A = L L', for symmetric positive definite
+ * matrices.  Only the lower triangle of a is used.  Returns -1 if a is
+ * not positive definite.
+ */
+int mat_chol(MAT_FACTOR *f, MATRIX *a){
+
+  register int i, j, k;
+  int n;
+  double *l, *cj, *ck, t;
+
+  if ((f == NULL) || (a == NULL)) return -1;
+  if (a->nrows != a->ncols) return -1;
+  if (mat_factor_size(f, a->nrows) < 0) return -1;
+
+  n = f->n;
+  l = f->lu;
+  memcpy(l, a->real, n*n*sizeof(double));
+  f->type = MAT_CHOL;
+  f->sign = 1;
+
+  for (j = 0; j < n; j++) {
+    cj = l + j*n;
+    for (k = 0; k < j; k++) {
+      ck = l + k*n;
+      t = ck[j];
+      for (i = j; i < n; i++) cj[i] -= ck[i] * t;
+    }
+    if (!(cj[j] > 0)) return -1;
+    cj[j] = sqrt(cj[j]);
+    for (i = j+1; i < n; i++) cj[i] /= cj[j];
+    for (i = 0; i < j; i++) cj[i] = 0;
+  }
+  return 0;
+}
+
+/* Solve A x = b for one column, in place */
+static void mat_factor_solve1(MAT_FACTOR *f, double *x){
 
-  register int i,j,k,l;
-  int rows = mat_get_rows(src);
-  double det = mat_det_f(src);
-  double signr = 1;
-  double signc = 1;
-  MATRIX *temp, *minor;
-
-  temp = mat_init(rows,rows);
-  minor = mat_init(rows-1,rows-1);
-
-  mat_transpose_f(temp,src);
-
-  for(i=0; i<rows; i++){
-    signr = 1.0;
-    for(j=0; j<rows; j++){
-      
-      int cnt =0;
-      
-      for (k=0; k<rows; k++)      /* column always */
-	for (l=0; l<rows; l++){   /* Skip the appropriate row of stuff */
-	  if (k==i) continue;
-	  if (l==j) continue;
-	  minor->real[cnt] = temp->real[k*rows+l];
-	  cnt++;
-	}
-      dst->real[i*rows+j] = signr * signc * mat_det_f(minor)/det;
-      signr = -1.0 * signr;
+  register int i, k;
+  int n = f->n;
+  double *lu = f->lu, *ck, t;
+
+  if (f->type == MAT_LU) {
+    for (k = 0; k < n; k++)
+      if (f->piv[k] != k) {
+	t = x[k]; x[k] = x[f->piv[k]]; x[f->piv[k]] = t;
+      }
+    for (k = 0; k < n; k++) {		/* L y = Pb */
+      ck = lu + k*n;
+      if ((t = x[k]) != 0)
+	for (i = k+1; i < n; i++) x[i] -= ck[i] * t;
+    }
+    for (k = n-1; k >= 0; k--) {	/* U x = y */
+      ck = lu + k*n;
+      t = x[k] /= ck[k];
+      for (i = 0; i < k; i++) x[i] -= ck[i] * t;
+    }
+  } else {
+    for (k = 0; k < n; k++) {		/* L y = b */
+      ck = lu + k*n;
+      t = x[k] /= ck[k];
+      for (i = k+1; i < n; i++) x[i] -= ck[i] * t;
+    }
+    for (k = n-1; k >= 0; k--) {	/* L' x = y */
+      ck = lu + k*n;
+      for (t = x[k], i = k+1; i < n; i++) t -= ck[i] * x[i];
+      x[k] = t / ck[k];
     }
-    signc=-1.0 * signc;
   }
-  
-  mat_free(temp);
-  mat_free(minor);
 }
 
+/* x = inverse(A) b using a factor; b can have any number of columns */
+int mat_factor_solve(MATRIX *x, MAT_FACTOR *f, MATRIX *b){
+
+  if ((x == NULL) || (f == NULL) || (b == NULL)) return -1;
+  if (b->nrows != f->n) return -1;
+
+  if (x != b) {
+    if (x->nrows != b->nrows || x->ncols != b->ncols)
+      mat_resize(x, b->nrows, b->ncols);
+    mat_copy_f(x, b);
+  }
+  mat_factor_solve_f(x, f);
+  return 0;
+}
+
+/* x = inverse(A) x, in place */
+void mat_factor_solve_f(MATRIX *x, MAT_FACTOR *f){
+
+  register int j;
+
+  for (j = 0; j < x->ncols; j++)
+    mat_factor_solve1(f, x->real + j*f->n);
+}
+
+/* Determinant of the factored matrix */
+double mat_factor_det(MAT_FACTOR *f){
+
+  register int k;
+  double det = f->sign;
+
+  for (k = 0; k < f->n; k++) det *= f->lu[k + k*f->n];
+  if (f->type == MAT_CHOL) det *= det;
+  return det;
+}
+
+/* ainv = inverse(A); ainv must already be n x n */
+void mat_factor_inverse_f(MATRIX *ainv, MAT_FACTOR *f){
+
+  register int j;
+
+  mat_reset(ainv);
+  for (j = 0; j < f->n; j++) {
+    ainv->real[j + j*f->n] = 1;
+    mat_factor_solve1(f, ainv->real + j*f->n);
+  }
+}
+
+/*
+ * x = inverse(a) b, solved by LU factorization.  Returns -1 if a is
+ * singular.
+ */
+int mat_solve(MATRIX *x, MATRIX *a, MATRIX *b){
+
+  MAT_FACTOR *f;
+  int status;
+
+  if ((x == NULL) || (a == NULL) || (b == NULL)) return -1;
+  if ((a->nrows != a->ncols) || (a->nrows != b->nrows)) return -1;
+
+  if ((f = mat_factor_init(a->nrows)) == NULL) return -1;
+  if ((status = mat_lu(f, a)) == 0)
+    status = mat_factor_solve(x, f, b);
+  mat_factor_free(f);
+
+  return status;
+}
+
+/*
+ * Least squares solution of a x = b for an m x n matrix a with m >= n,
+ * using a Householder QR factorization of a.  x minimizes |a x - b|
+ * for each column of b.  Returns -1 if a doesn't have full rank.
+ */
+int mat_lstsqr(MATRIX *x, MATRIX *a, MATRIX *b){
+
+  MATRIX *x1;
+  int status;
+
+  if ((x == NULL) || (a == NULL) || (b == NULL)) return -1;
+  if ((a->nrows < a->ncols) || (a->nrows != b->nrows)) return -1;
+
+  if (x == a || x == b) {
+    x1 = mat_init(a->ncols, b->ncols);
+    status = mat_lstsqr_f(x1, a, b);
+    mat_copy(x, x1);
+    mat_free(x1);
+  } else {
+    if (x->nrows != a->ncols || x->ncols != b->ncols)
+      mat_resize(x, a->ncols, b->ncols);
+    status = mat_lstsqr_f(x, a, b);
+  }
+  return status;
+}
+
+/* x must already be n x p */
+int mat_lstsqr_f(MATRIX *x, MATRIX *a, MATRIX *b){
+
+  register int i, j, k;
+  int m = a->nrows, n = a->ncols, p = b->ncols;
+  double *qr, *y, *rdiag, *ck, *cj, norm, t, rmax = 0;
+  int status = 0;
+
+  qr = (double *) mat_alloc((m*n + m*p + n) * sizeof(double));
+  if (qr == NULL) return -1;
+  y = qr + m*n;
+  rdiag = y + m*p;
+  memcpy(qr, a->real, m*n*sizeof(double));
+  memcpy(y, b->real, m*p*sizeof(double));
+
+  for (k = 0; k < n; k++) {
+    ck = qr + k*m;
+
+    /* Householder vector v for column k, stored in place */
+    for (norm = 0, i = k; i < m; i++) norm = hypot(norm, ck[i]);
+    if (norm == 0) { status = -1; break; }
+    if (ck[k] < 0) norm = -norm;
+    for (i = k; i < m; i++) ck[i] /= norm;
+    ck[k] += 1;
+    rdiag[k] = -norm;
+    if (fabs(norm) > rmax) rmax = fabs(norm);
+
+    /* Apply I - v v'/v(k) to the remaining columns and to b */
+    for (j = k+1; j < n + p; j++) {
+      cj = j < n ? qr + j*m : y + (j-n)*m;
+      for (t = 0, i = k; i < m; i++) t += ck[i] * cj[i];
+      t = -t / ck[k];
+      for (i = k; i < m; i++) cj[i] += t * ck[i];
+    }
+  }
+
+  /* Rank check relative to the largest diagonal element of R */
+  for (k = 0; status == 0 && k < n; k++)
+    if (fabs(rdiag[k]) <= m * 1e-15 * rmax) status = -1;
+
+  /* Back substitution, R x = Q'b */
+  if (status == 0)
+    for (j = 0; j < p; j++) {
+      cj = y + j*m;
+      for (k = n-1; k >= 0; k--) {
+	t = cj[k] /= rdiag[k];
+	for (i = 0; i < k; i++) cj[i] -= qr[i + k*m] * t;
+      }
+      memcpy(x->real + j*n, cj, n*sizeof(double));
+    }
+
+  mat_release(qr);
+  return status;
+}
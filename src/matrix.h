@@ -45,16 +45,22 @@
 #ifndef _have_matrix
 #define _have_matrix
 
+#include <stdio.h>
+#include <stddef.h>
+
+#define MAT_NAMELEN 64		/* longest name + 1, as in MATLAB */
+
 typedef struct matlab_entry {
     int type;			/* data type */
     int nrows, ncols;		/* size of matrix */
     int imagf;			/* flag indicating imag part */
     int namelen;		/* name length (including NULL) */
-    char name[20];		/* name of matrix */
+    char name[MAT_NAMELEN];	/* name of matrix */
     double *real;		/* real data (row, column format) */
     double *imag;		/* imaginary data (if imagf set) */
     struct matlab_entry *prev;  /* previous element in list */
     struct matlab_entry *next;  /* next element in list */
+    struct mat_index *index;	/* names in the list (matfile.c) */
 } MATRIX;
 
 /* matrix Inits and removal stuff */
@@ -92,6 +98,39 @@ int mat_get_cols(MATRIX *mat);
 int mat_transpose(MATRIX *dst, MATRIX *a);
 void mat_transpose_f(MATRIX *dst, MATRIX *a);
 
+/*
+ * LU and Cholesky factors of a square matrix, for solving several
+ * systems with the same matrix (see matrix.c).  Stored column-major,
+ * like MATRIX.
+ */
+typedef struct mat_factor {
+    int type;			/* MAT_LU or MAT_CHOL */
+    int n;			/* size of matrix */
+    double *lu;			/* factors */
+    int *piv;			/* row swaps (LU) */
+    int sign;			/* sign of permutation (LU) */
+} MAT_FACTOR;
+#define MAT_LU 0
+#define MAT_CHOL 1
+
+MAT_FACTOR *mat_factor_init(int n);
+void mat_factor_free(MAT_FACTOR *f);
+int mat_lu(MAT_FACTOR *f, MATRIX *a);	/* PA = LU */
+int mat_chol(MAT_FACTOR *f, MATRIX *a);	/* A = LL', A pos. definite */
+double mat_factor_det(MAT_FACTOR *f);
+void mat_factor_inverse_f(MATRIX *ainv, MAT_FACTOR *f);
+
+/* x = inverse(A) b, using a factor of A; x can be b */
+int mat_factor_solve(MATRIX *x, MAT_FACTOR *f, MATRIX *b);
+void mat_factor_solve_f(MATRIX *x, MAT_FACTOR *f);
+
+/* x = inverse(a) b */
+int mat_solve(MATRIX *x, MATRIX *a, MATRIX *b);
+
+/* least squares solution of a x = b (QR) */
+int mat_lstsqr(MATRIX *x, MATRIX *a, MATRIX *b);
+int mat_lstsqr_f(MATRIX *x, MATRIX *a, MATRIX *b);
+
 /* det = determinant(mat) */
 int mat_det(double *det, MATRIX *mat);
 double mat_det_f(MATRIX *mat);
@@ -100,10 +139,17 @@ double mat_det_f(MATRIX *mat);
 int mat_inverse(MATRIX *ainv, MATRIX *a);
 void mat_inverse_f(MATRIX *ainv, MATRIX *a);
 
-/* matrix multiplication: dst = ab */
+/* matrix multiplication: dst = ab (dst can be a or b, but not for _f) */
 int mat_mult(MATRIX *dst, MATRIX *a, MATRIX *b);
 void mat_mult_f(MATRIX *dst, MATRIX *a, MATRIX *b);
 
+/* multiply kernel used by mat_mult_f (see matmult.c) */
+extern int mat_mult_kernel;
+#define MAT_KERNEL_AUTO 0	/* fastest available */
+#define MAT_KERNEL_C 1		/* portable C */
+#define MAT_KERNEL_SSE2 2	/* x86-64 only */
+#define MAT_KERNEL_AVX2 3	/* x86-64 with AVX2 and FMA */
+
 /* matrix mult, element by element:  dst = a.*b */
 int mat_dotmult(MATRIX *dst, MATRIX *a, MATRIX *b);
 void mat_dotmult_f(MATRIX *dst, MATRIX *a, MATRIX *b);
@@ -124,9 +170,62 @@ void mat_scale_f(MATRIX *dst, MATRIX *a, double scale);
 int mat_offset(MATRIX *dst, MATRIX *a, double offset);
 void mat_offset_f(MATRIX *dst, MATRIX *a, double offset);
 
-/* Still to be done */
-int mat_lstsqr();
-int mat_lstsqr_f();
+/*
+ * Fused expressions: dst = sum of terms, evaluated in one pass (see
+ * matexpr.c)
+ */
+#define MAT_EXPR_MAX 8		/* terms per expression */
+#define MAT_EXPR_MULT 0		/* scale * a * b */
+#define MAT_EXPR_DOTMULT 1	/* scale * a .* b */
+#define MAT_EXPR_ADD 2		/* scale * a */
+#define MAT_EXPR_OFFSET 3	/* scale added to each element */
+
+typedef struct mat_expr {
+    int nterm;
+    struct mat_term {
+	int op;
+	double scale;
+	MATRIX *a, *b;
+    } term[MAT_EXPR_MAX];
+} MAT_EXPR;
+
+void mat_expr_init(MAT_EXPR *e);
+int mat_expr_mult(MAT_EXPR *e, double scale, MATRIX *a, MATRIX *b);
+int mat_expr_dotmult(MAT_EXPR *e, double scale, MATRIX *a, MATRIX *b);
+int mat_expr_add(MAT_EXPR *e, double scale, MATRIX *a);
+int mat_expr_offset(MAT_EXPR *e, double offset);
+int mat_expr_eval(MATRIX *dst, MAT_EXPR *e);
+void mat_expr_eval_f(MATRIX *dst, MAT_EXPR *e);
+
+/* dst = a x + b u */
+int mat_statespace(MATRIX *dst, MATRIX *a, MATRIX *x, MATRIX *b, MATRIX *u);
+
+/* xhat = a xhat + b u + l (y - c xhat) */
+int mat_observer(MATRIX *xhat, MATRIX *a, MATRIX *b, MATRIX *l, MATRIX *c,
+		 MATRIX *u, MATRIX *y);
+
+/*
+ * Preallocated workspace for use in servo routines (see matarena.c)
+ */
+typedef struct mat_arena {
+    char *base;			/* memory */
+    size_t size;		/* bytes in the arena */
+    size_t used;		/* bytes allocated since the last reset */
+    size_t high;		/* largest value of used */
+    unsigned long failed;	/* allocations that didn't fit */
+} MAT_ARENA;
+
+extern int mat_arena_check;	/* abort on heap use in arena threads */
+MAT_ARENA *mat_arena_init(size_t size);
+void mat_arena_free(MAT_ARENA *ap);
+void mat_arena_reset(MAT_ARENA *ap);
+void *mat_arena_alloc(MAT_ARENA *ap, size_t size);
+MAT_ARENA *mat_arena_use(MAT_ARENA *ap);
+
+/* memory used by the matrix routines: from the arena or the heap */
+void *mat_alloc(size_t size);
+void *mat_alloc_for(void *owner, size_t size);
+void mat_release(void *p);
 
 int loadmat(FILE *fp, int *type, int *mrows, int *ncols, int *imagf,
 	    char *pname, double **preal, double **pimag);
@@ -0,0 +1,358 @@
+/*!
+ * \file mattst.c
+ * \brief test the matrix factorizations and solvers
+ *
+ * \date 19 Oct 26
+ *
+ * Checks mat_mult() with each kernel against a simple loop over a
+ * range of sizes, including products where dst is one of the inputs,
+ * and fused expressions against the same operations done one at a
+ * time.
+ * Checks mat_det() against cofactor expansion on a small matrix,
+ * solves ill-conditioned Hilbert systems with LU and Cholesky, fits
+ * polynomials with mat_lstsqr() and checks that singular, indefinite
+ * and rank deficient matrices are reported.  Finally repeats some of
+ * the operations with an arena and mat_arena_check set, so that any
+ * heap allocation aborts the test, and checks that heap matrices
+ * resized in the arena stay on the heap and that arena matrices can
+ * be freed outside it.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "matrix.h"
+
+#define TST_NAME "mattst"
+#include "tstutil.h"
+
+/* Determinant by cofactor expansion along the first column */
+static double cofactor_det(MATRIX *a)
+{
+  int n = a->nrows, i, j, k, r;
+  double det = 0, sign = 1;
+  MATRIX *m;
+
+  if (n == 1) return a->real[0];
+  m = mat_init(n - 1, n - 1);
+  for (i = 0; i < n; ++i, sign = -sign) {
+    for (j = 1; j < n; ++j)
+      for (k = 0, r = 0; k < n; ++k)
+	if (k != i) mat_element_set(m, r++, j - 1, mat_element_get(a, k, j));
+    det += sign * mat_element_get(a, i, 0) * cofactor_det(m);
+  }
+  mat_free(m);
+  return det;
+}
+
+/* Largest element of |a - b| relative to the largest of |b| */
+static double relerr(MATRIX *a, MATRIX *b)
+{
+  double err = 0, max = 0;
+  int i;
+
+  for (i = 0; i < a->nrows * a->ncols; ++i) {
+    if (fabs(a->real[i] - b->real[i]) > err) err = fabs(a->real[i] - b->real[i]);
+    if (fabs(b->real[i]) > max) max = fabs(b->real[i]);
+  }
+  return err / max;
+}
+
+/* Fill a matrix with values in [-1, 1) */
+static MATRIX *random_matrix(int m, int n)
+{
+  MATRIX *a = mat_init(m, n);
+  int i;
+
+  for (i = 0; i < m * n; ++i) a->real[i] = 2.0 * rand() / RAND_MAX - 1;
+  return a;
+}
+
+/* Compare mat_mult() with the obvious loop */
+static void check_mult(int m, int n, int k)
+{
+  static int kernels[] = {MAT_KERNEL_AUTO, MAT_KERNEL_C, MAT_KERNEL_SSE2,
+			  MAT_KERNEL_AVX2};
+  MATRIX *a = random_matrix(m, k), *b = random_matrix(k, n);
+  MATRIX *c = mat_init(m, n), *d = mat_create();
+  char msg[64];
+  int i, j, p;
+
+  for (i = 0; i < m; ++i)
+    for (j = 0; j < n; ++j)
+      for (p = 0; p < k; ++p)
+	c->real[i + j*m] += a->real[i + p*m] * b->real[p + j*k];
+
+  for (i = 0; i < 4; ++i) {
+    mat_mult_kernel = kernels[i];
+    mat_mult(d, a, b);
+    snprintf(msg, sizeof(msg), "mat_mult %dx%d * %dx%d, kernel %d",
+	     m, k, k, n, kernels[i]);
+    check(d->nrows == m && d->ncols == n && relerr(d, c) < 1e-14, msg);
+  }
+  mat_mult_kernel = MAT_KERNEL_AUTO;
+
+  /* dst = a * dst and dst = dst * b */
+  if (m == k) {
+    mat_copy(d, b);
+    mat_mult(d, a, d);
+    check(relerr(d, c) < 1e-14, "mat_mult with dst == b");
+  }
+  if (k == n) {
+    mat_copy(d, a);
+    mat_mult(d, d, b);
+    check(relerr(d, c) < 1e-14, "mat_mult with dst == a");
+  }
+  mat_free(a); mat_free(b); mat_free(c); mat_free(d);
+}
+
+/* x = A x + B u + c - 0.5 (x .* x) + 1 with n states, fused and not */
+static void check_expr(int n, int p)
+{
+  MATRIX *A = random_matrix(n, n), *B = random_matrix(n, p);
+  MATRIX *x = random_matrix(n, 1), *u = random_matrix(p, 1);
+  MATRIX *c = random_matrix(n, 1), *C = random_matrix(p, n);
+  MATRIX *L = random_matrix(n, p), *y = random_matrix(p, 1);
+  MATRIX *D = random_matrix(p, p);
+  MATRIX *ref = mat_create(), *t = mat_create(), *r = mat_create();
+  MAT_EXPR e;
+  char msg[64];
+
+  mat_mult(ref, A, x);
+  mat_mult(t, B, u);
+  mat_add(ref, ref, t);
+  mat_add(ref, ref, c);
+  mat_dotmult(t, x, x);
+  mat_scale(t, t, -0.5);
+  mat_add(ref, ref, t);
+  mat_offset(ref, ref, 1);
+
+  mat_expr_init(&e);
+  mat_expr_mult(&e, 1.0, A, x);
+  mat_expr_mult(&e, 1.0, B, u);
+  mat_expr_add(&e, 1.0, c);
+  mat_expr_dotmult(&e, -0.5, x, x);
+  mat_expr_offset(&e, 1);
+  mat_copy(r, x);
+  check(mat_expr_eval(r, &e) == 0, "mat_expr_eval failed");
+  snprintf(msg, sizeof(msg), "mat_expr_eval, %d states", n);
+  check(relerr(r, ref) < 1e-14, msg);
+  check(mat_expr_eval(x, &e) == 0 && relerr(x, ref) < 1e-14, msg);
+
+  /* State-space and observer updates in place */
+  mat_mult(ref, A, x);
+  mat_mult(t, B, u);
+  mat_add(ref, ref, t);
+  mat_copy(r, x);
+  mat_statespace(r, A, r, B, u);
+  snprintf(msg, sizeof(msg), "mat_statespace, %d states", n);
+  check(relerr(r, ref) < 1e-14, msg);
+
+  mat_mult(t, C, x);
+  mat_subtract(t, y, t);
+  mat_mult(t, L, t);
+  mat_add(ref, ref, t);
+  mat_copy(r, x);
+  check(mat_observer(r, A, B, L, C, u, y) == 0, "mat_observer failed");
+  snprintf(msg, sizeof(msg), "mat_observer, %d states", n);
+  check(relerr(r, ref) < 1e-13, msg);
+
+  /* Output equation into x, which changes size (C isn't square) */
+  mat_mult(ref, C, x);
+  mat_mult(t, D, u);
+  mat_add(ref, ref, t);
+  mat_copy(r, x);
+  mat_statespace(r, C, r, D, u);
+  snprintf(msg, sizeof(msg), "mat_statespace output, %d states", n);
+  check(r->nrows == p && relerr(r, ref) < 1e-14, msg);
+
+  /* Shapes that don't match */
+  check(mat_expr_add(&e, 1.0, A) == 0 && mat_expr_eval(r, &e) < 0,
+	"mat_expr_eval size mismatch");
+  mat_free(A); mat_free(B); mat_free(x); mat_free(u); mat_free(c);
+  mat_free(C); mat_free(L); mat_free(y); mat_free(ref); mat_free(t);
+  mat_free(r); mat_free(D);
+}
+
+static MATRIX *hilbert(int n)
+{
+  MATRIX *h = mat_init(n, n);
+  int i, j;
+
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < n; ++j) mat_element_set(h, i, j, 1.0 / (i + j + 1));
+  return h;
+}
+
+int main(int argc, char **argv)
+{
+  MATRIX *a, *ainv, *x, *b, *r, *eye;
+  MAT_FACTOR *f;
+  MAT_ARENA *ar;
+  double det;
+  int i, j, n;
+
+  /* Fixed sizes, tiles and edges, several cache blocks and a * a */
+  for (n = 1; n <= 9; ++n) {
+    check_mult(n, n, n);
+    check_mult(n, 1, n);
+    check_mult(n, 3, n + 1);
+  }
+  check_mult(13, 17, 11);
+  check_mult(64, 64, 64);
+  check_mult(150, 70, 300);
+  check_expr(3, 1);
+  check_expr(64, 4);
+  check_expr(200, 20);
+  a = random_matrix(80, 80);
+  b = mat_create();
+  mat_mult(b, a, a);
+  mat_mult(a, a, a);
+  check(relerr(a, b) == 0, "mat_mult with dst == a == b");
+  mat_free(a); mat_free(b);
+
+  /* Determinant and inverse of a general 5x5 matrix */
+  a = mat_init(5, 5);
+  for (i = 0; i < 5; ++i)
+    for (j = 0; j < 5; ++j)
+      mat_element_set(a, i, j, ((i * 7 + j * 3) % 11) - 5 + (i == j));
+  mat_det(&det, a);
+  check(fabs(det - cofactor_det(a)) <= 1e-12 * fabs(det), "det 5x5");
+
+  ainv = mat_create();
+  eye = mat_init(5, 5);
+  for (i = 0; i < 5; ++i) mat_element_set(eye, i, i, 1);
+  r = mat_create();
+  check(mat_inverse(ainv, a) == 0, "inverse 5x5 failed");
+  mat_mult(r, a, ainv);
+  check(relerr(r, eye) < 1e-13, "a * inverse(a) != I");
+  mat_copy(r, a);
+  mat_inverse(r, r);
+  check(relerr(r, ainv) == 0, "inverse in place");
+  mat_free(a); mat_free(ainv); mat_free(eye); mat_free(r);
+
+  /* Hilbert matrices: cond(H10) is about 1.6e13 */
+  check(fabs(mat_det_f(a = hilbert(4)) * 6048000 - 1) < 1e-10, "det H4");
+  mat_free(a);
+
+  n = 10;
+  a = hilbert(n);
+  x = mat_init(n, 2);
+  b = mat_init(n, 2);
+  r = mat_create();
+  for (i = 0; i < n; ++i) {
+    mat_element_set(x, i, 0, 1);
+    mat_element_set(x, i, 1, i % 2 ? -1 : 1);
+  }
+  mat_mult(b, a, x);
+
+  check(mat_solve(r, a, b) == 0, "LU solve of H10 failed");
+  check(relerr(r, x) < 1e-2, "LU solution of H10");
+  mat_mult(r, a, r);
+  check(relerr(r, b) < 1e-14, "LU residual of H10");
+
+  f = mat_factor_init(n);
+  check(mat_chol(f, a) == 0, "Cholesky of H10 failed");
+  mat_copy(r, b);
+  mat_factor_solve(r, f, r);
+  check(relerr(r, x) < 1e-2, "Cholesky solution of H10");
+  mat_mult(r, a, r);
+  check(relerr(r, b) < 1e-14, "Cholesky residual of H10");
+  check(fabs(mat_factor_det(f) / 2.1641792264314918e-53 - 1) < 1e-3,
+	"Cholesky determinant of H10");
+  check(fabs(mat_det_f(a) / 2.1641792264314918e-53 - 1) < 1e-3,
+	"LU determinant of H10");
+
+  /* Singular and indefinite matrices */
+  mat_element_set(a, 0, 0, -1);
+  check(mat_chol(f, a) < 0, "indefinite matrix not detected");
+  mat_resize(a, 3, 3);
+  for (i = 0; i < 3; ++i)
+    for (j = 0; j < 3; ++j) mat_element_set(a, i, j, (i + 1) * (j + 1));
+  check(mat_lu(f, a) < 0, "singular matrix not detected");
+  check(mat_det_f(a) == 0, "det of singular matrix");
+  mat_free(a); mat_free(x); mat_free(b); mat_free(r);
+  mat_factor_free(f);
+
+  /* Least squares: exact fit of a degree 8 polynomial at 50 points */
+  a = mat_init(50, 9);
+  x = mat_init(9, 1);
+  b = mat_create();
+  r = mat_create();
+  for (j = 0; j < 9; ++j) mat_element_set(x, j, 0, j - 4);
+  for (i = 0; i < 50; ++i)
+    for (j = 0; j < 9; ++j) mat_element_set(a, i, j, pow(i / 49.0, j));
+  mat_mult(b, a, x);
+  check(mat_lstsqr(r, a, b) == 0, "lstsqr failed");
+  check(relerr(r, x) < 1e-6, "lstsqr polynomial fit");
+
+  /* Residual must be orthogonal to the columns of a */
+  for (i = 0; i < 50; ++i)
+    mat_element_set(b, i, 0, mat_element_get(b, i, 0) + (i % 3 - 1) * 0.1);
+  mat_lstsqr(r, a, b);
+  mat_mult(r, a, r);
+  mat_subtract(r, b, r);
+  mat_transpose(a, a);
+  mat_mult(x, a, r);
+  for (det = 0, i = 0; i < 9; ++i) det += fabs(mat_element_get(x, i, 0));
+  check(det < 1e-9, "lstsqr residual not orthogonal");
+
+  /* Rank deficient: two equal columns */
+  mat_transpose(a, a);
+  for (i = 0; i < 50; ++i) mat_element_set(a, i, 8, mat_element_get(a, i, 1));
+  check(mat_lstsqr(r, a, b) < 0, "rank deficient matrix not detected");
+  mat_free(a); mat_free(x); mat_free(b); mat_free(r);
+
+  /* Arena: results match and nothing comes from the heap */
+  a = hilbert(6);
+  b = random_matrix(6, 2);
+  x = mat_create();
+  mat_solve(x, a, b);
+  ar = mat_arena_init(64 * 1024);
+  check(mat_arena_use(ar) == NULL, "arena already in use");
+  mat_arena_check = 1;
+  for (i = 0; i < 3; ++i) {
+    mat_arena_reset(ar);
+    r = mat_create();
+    mat_solve(r, a, b);
+    check(relerr(r, x) == 0, "mat_solve in arena");
+    mat_det_f(a);
+    mat_inverse(r, a);
+    mat_mult(r, a, r);
+    mat_add(r, r, r);
+    mat_lstsqr(r, a, b);
+    mat_copy(r, b);
+    mat_statespace(r, a, r, a, b);
+    mat_free(r);
+  }
+  check(ar->used > 0 && ar->used == ar->high && ar->failed == 0,
+	"arena usage");
+
+  /* Full arena falls back to the heap and counts the failure */
+  mat_arena_check = 0;
+  check(mat_arena_alloc(ar, ar->size) == NULL && ar->failed == 1,
+	"arena overflow");
+  mat_arena_reset(ar);
+  check(ar->used == 0, "arena reset");
+
+  /* A heap matrix resized in the arena stays on the heap */
+  mat_resize(x, 20, 20);
+  check((char *) x->real < ar->base || (char *) x->real >= ar->base + ar->size,
+	"heap matrix moved into the arena");
+  mat_element_set(x, 19, 19, 1.5);
+  mat_arena_reset(ar);
+  r = mat_create();
+  mat_resize(r, 20, 20);
+  for (i = 0; i < 20; ++i) mat_element_set(r, 19, i, -1);
+  check(mat_element_get(x, 19, 19) == 1.5, "heap matrix lost at reset");
+
+  /* Arena matrices can be freed after leaving the arena */
+  mat_arena_use(NULL);
+  mat_free(r);
+  mat_arena_free(ar);
+  mat_free(a); mat_free(b); mat_free(x);
+
+  return status;
+}
@@ -0,0 +1,167 @@
+/*!
+ * \file mboxtst.c
+ * \brief test the display to servo mailbox
+ *
+ * \date 19 Oct 26
+ *
+ * A "display" thread posts a sequence of blocks, each filled with a
+ * single counter value, and an occasional function call, while the
+ * main thread plays the servo loop and applies the mailbox.  The servo
+ * checks that every block it sees is complete and that the values
+ * arrive in the order they were posted.  Then loads a table with more
+ * mailbox entries than the queue holds while a servo thread applies
+ * them, and checks that every value arrives.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "display.h"
+
+#define NPOST 20000
+#define NWORD 16
+#define NLOAD 1000			/* entries in the loaded table */
+
+static double block[NWORD];		/* written only by the servo */
+static long ncalls = 0;
+
+static int count_call(long arg) { ncalls += arg; return 0; }
+static volatile int running;
+
+/* Servo thread for the load: apply a budget's worth per millisecond */
+static void *servo(void *arg)
+{
+  while (running) {
+    dd_mbox_apply(DD_MBOX_BUDGET);
+    usleep(1000);
+  }
+  return NULL;
+}
+
+static void *producer(void *arg)
+{
+  double buf[NWORD];
+  int i, j;
+
+  for (i = 1; i <= NPOST; ++i) {
+    for (j = 0; j < NWORD; ++j) buf[j] = i;
+    while (dd_mbox_post(block, buf, sizeof(buf)) < 0) usleep(10);
+    if (i % 100 == 0)
+      while (dd_mbox_call(count_call, 1) < 0) usleep(10);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t thread;
+  double last = 0;
+  int j, loops, status = 0;
+
+  pthread_create(&thread, NULL, producer, NULL);
+
+  /* Servo loop; give up after about 10 seconds */
+  for (loops = 0; last < NPOST && loops < 1000000; ++loops) {
+    dd_mbox_apply(DD_MBOX_BUDGET);
+    for (j = 1; j < NWORD; ++j)
+      if (block[j] != block[0]) {
+	fprintf(stderr, "mboxtst: torn block at %g\n", block[0]);
+	status = 1;
+	break;
+      }
+    if (block[0] < last) {
+      fprintf(stderr, "mboxtst: %g applied after %g\n", block[0], last);
+      status = 1;
+    }
+    last = block[0];
+    if (status) break;
+    usleep(10);
+  }
+  pthread_join(thread, NULL);
+  dd_mbox_apply(DD_MBOX_BUDGET);
+
+  if (last != NPOST || ncalls != NPOST / 100) {
+    fprintf(stderr, "mboxtst: %g values and %ld calls applied\n",
+	    last, ncalls);
+    status = 1;
+  }
+  if (status == 0) printf("mboxtst: %d values applied in order\n", NPOST);
+
+  /* Load a table bigger than the mailbox */
+  {
+    static char file[] = "/tmp/mboxtstXXXXXX";
+    DD_IDENT *tbl = calloc(NLOAD + 1, sizeof(DD_IDENT));
+    double *value = calloc(NLOAD, sizeof(double));
+    FILE *fp;
+    int fd, bad;
+
+    if ((fd = mkstemp(file)) < 0 || (fp = fdopen(fd, "w")) == NULL) {
+      perror("mboxtst");
+      return 1;
+    }
+    for (j = 0; j < NLOAD; ++j) {
+      tbl[j].value = value + j;
+      tbl[j].function = dd_double;
+      tbl[j].format = "%g";
+      sprintf(tbl[j].varname, "v%d", j);
+      fprintf(fp, "v%d %d\n", j, j + 1);
+    }
+    fclose(fp);
+    dd_setmbox_tbl(-1, 1, tbl);
+    dd_mbox_enable = 1;
+    running = 1;
+    pthread_create(&thread, NULL, servo, NULL);
+    if (dd_tbl_load(file, tbl) != 1) {
+      fprintf(stderr, "mboxtst: dd_tbl_load failed\n");
+      status = 1;
+    }
+    dd_mbox_sync();
+    running = 0;
+    pthread_join(thread, NULL);
+    for (j = 0, bad = 0; j < NLOAD; ++j) if (value[j] != j + 1) ++bad;
+    if (bad) {
+      fprintf(stderr, "mboxtst: %d of %d loaded values lost\n", bad, NLOAD);
+      status = 1;
+    }
+    unlink(file);
+    free(tbl);
+    free(value);
+  }
+  return status;
+}
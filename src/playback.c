@@ -0,0 +1,349 @@
+/*!
+ * \file playback.c
+ * \brief device driver that plays back recorded data
+ *
+ * \date 19 Oct 26
+ *
+ * This driver takes its inputs from a file of previously recorded
+ * data instead of from hardware.  The file can either be a data file
+ * written by chn_capture_dump() (one line per sample, one column per
+ * dumped channel) or a MATLAB file that can be read by mat_load() (one
+ * row per sample).  One row is used each time the device is read, so
+ * running the servo loop replays the data at the rate at which it was
+ * captured.
+ *
+ * The file is read by a background thread, which keeps a ring buffer
+ * of rows filled ahead of the servo loop.  The servo loop only copies
+ * rows out of the buffer and never touches the disk.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "channel.h"
+#include "matrix.h"
+
+#define PLAYBACK_ROWS 1024		/* number of rows read ahead */
+
+/*
+ * Device-specific data
+ *
+ * As with other drivers, the device specific data is attached to the
+ * first channel of the device.  The ring buffer holds ncols values
+ * per row; head is the number of rows written by the reader thread
+ * and tail is the number of rows used by the servo loop.  The avail
+ * and space semaphores count the full and empty rows in the ring.
+ */
+struct playback_sp {
+  int loop;				/* start over at the end of the file */
+  int sync;				/* wait for data instead of holding */
+  char var[20];				/* matrix name (MATLAB files) */
+  int *column;				/* file column for each channel */
+  int ncols;				/* number of columns kept per row */
+
+  FILE *fp;				/* data file (capture format) */
+  char *line;				/* line buffer for data file */
+  size_t linelen;
+  MATRIX *list, *mat;			/* matrices (MATLAB format) */
+  int matrow;				/* next row of mat */
+
+  double *ring;				/* ring buffer of rows */
+  double *last;				/* most recent row */
+  unsigned head, tail;			/* rows written, rows used */
+  sem_t avail, space;			/* full, empty rows */
+  pthread_t thread;
+  int running, stop;
+};
+
+static struct playback_sp playback_settings;	/* device line flags */
+static void *playback_thread(void *);
+static int playback_start(DEVICE *, struct playback_sp *);
+static void playback_stop(struct playback_sp *);
+
+/*!
+ * \fn int playback_driver(DEV_ACTION action, ...)
+ * \brief play back recorded data as channel inputs
+ * \ingroup channel
+ *
+ * The path of the data file is given in place of the device name.
+ * Device flags: -loop (repeat the data), -sync (wait for data if the
+ * reader falls behind) and -var=name (matrix to use from a MATLAB
+ * file).  Channel flag: -column=n (file column; default is the
+ * channel number).
+ */
+int playback_driver(DEV_ACTION action, ...)
+{
+  int i, status = 0, stale;
+  struct playback_sp *sp;
+  va_list ap;
+
+  va_start(ap, action);
+  DEVICE *dp = va_arg(ap, DEVICE *);
+  CHANNEL *cp = va_arg(ap, CHANNEL *);
+  sp = (struct playback_sp *) cp->dev_sp;
+
+  switch (action) {
+  case NewChannels:
+    if (sp != NULL) { playback_stop(sp); free(sp->column); free(sp); }
+    if ((sp = (struct playback_sp *) calloc(1, sizeof(*sp))) == NULL ||
+	(sp->column = (int *) malloc(dp->size * sizeof(int))) == NULL) {
+      free(sp);
+      status = -1;
+      break;
+    }
+    sp->loop = playback_settings.loop;
+    sp->sync = playback_settings.sync;
+    strcpy(sp->var, playback_settings.var);
+    for (i = 0; i < dp->size; ++i) sp->column[i] = i;
+    cp->dev_sp = sp;
+    memset(&playback_settings, 0, sizeof(playback_settings));
+    status = 1;
+    break;
+
+  case HandleFlag:
+    if (chn_flag_type == Device) {
+      if (strcmp(chn_flag_name, "loop") == 0)
+	playback_settings.loop = 1, status = 1;
+      else if (strcmp(chn_flag_name, "sync") == 0)
+	playback_settings.sync = 1, status = 1;
+      else if (strcmp(chn_flag_name, "var") == 0) {
+	strncpy(playback_settings.var, chn_flag_value,
+		sizeof(playback_settings.var) - 1);
+	status = 1;
+      }
+    } else if (chn_flag_type == Channel &&
+	       strcmp(chn_flag_name, "column") == 0) {
+      /* device data is attached to the first channel of the device */
+      sp = (struct playback_sp *) (cp - cp->chnid)->dev_sp;
+      if (sp == NULL || sscanf(chn_flag_value, "%d", &i) != 1 || i < 0)
+	status = -1;
+      else {
+	sp->column[cp->chnid] = i;
+	status = 1;
+      }
+    }
+    break;
+
+  case Init:
+    playback_stop(sp);
+    status = playback_start(dp, sp) < 0 ? -1 : 1;
+    break;
+
+  case Read:
+    stale = 1;
+    if (!sp->running) ;
+    else if (sp->sync ? sem_wait(&sp->avail) : sem_trywait(&sp->avail))
+      ;					/* reader is behind; hold the data */
+    else if (sp->tail == __atomic_load_n(&sp->head, __ATOMIC_ACQUIRE)) {
+      sem_post(&sp->avail);		/* end of data; leave the marker */
+    }
+    else {
+      memcpy(sp->last, sp->ring + (sp->tail % PLAYBACK_ROWS) * sp->ncols,
+	     sp->ncols * sizeof(double));
+      ++sp->tail;
+      sem_post(&sp->space);
+      stale = 0;
+    }
+
+    for (i = 0; i < dp->size; ++i) {
+      if (sp->last != NULL) cp[i].data.d = sp->last[sp->column[i]];
+      cp[i].stale = stale;
+    }
+    status = 1;
+    break;
+
+  case Close:
+    if (sp != NULL) playback_stop(sp);
+    break;
+
+  default:
+    break;
+  }
+
+  va_end(ap);
+  return status;
+}
+
+/* Open the data file and start the reader thread */
+static int playback_start(DEVICE *dp, struct playback_sp *sp)
+{
+  int i, len = strlen(dp->devname);
+
+  if (len == 0) {
+    fprintf(stderr, "playback: no data file given\n");
+    return -1;
+  }
+
+  for (sp->ncols = 1, i = 0; i < dp->size; ++i)
+    if (sp->column[i] >= sp->ncols) sp->ncols = sp->column[i] + 1;
+
+  if (len > 4 && strcmp(dp->devname + len - 4, ".mat") == 0) {
+    /* MATLAB files are small enough to load all at once */
+    if ((sp->list = mat_load(dp->devname)) == NULL ||
+	(sp->mat = *sp->var ? mat_find(sp->list, sp->var) : sp->list) == NULL
+	|| sp->mat->real == NULL) {
+      fprintf(stderr, "playback: couldn't load data from %s\n", dp->devname);
+      return -1;
+    }
+    sp->matrow = 0;
+
+  } else if ((sp->fp = fopen(dp->devname, "r")) == NULL) {
+    perror(dp->devname);
+    return -1;
+  }
+
+  sp->ring = (double *) calloc(PLAYBACK_ROWS * sp->ncols, sizeof(double));
+  sp->last = (double *) calloc(sp->ncols, sizeof(double));
+  if (sp->ring == NULL || sp->last == NULL) {
+    playback_stop(sp);
+    return -1;
+  }
+  sp->head = sp->tail = 0;
+  sp->stop = 0;
+  sem_init(&sp->avail, 0, 0);
+  sem_init(&sp->space, 0, PLAYBACK_ROWS);
+
+  if (pthread_create(&sp->thread, NULL, playback_thread, sp) != 0) {
+    fprintf(stderr, "playback: couldn't start reader thread\n");
+    sem_destroy(&sp->avail);
+    sem_destroy(&sp->space);
+    playback_stop(sp);
+    return -1;
+  }
+  sp->running = 1;
+  return 0;
+}
+
+/* Stop the reader thread and release the data file */
+static void playback_stop(struct playback_sp *sp)
+{
+  if (sp->running) {
+    __atomic_store_n(&sp->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&sp->space);
+    pthread_join(sp->thread, NULL);
+    sem_destroy(&sp->avail);
+    sem_destroy(&sp->space);
+    sp->running = 0;
+  }
+  if (sp->fp != NULL) fclose(sp->fp);
+  if (sp->list != NULL) mat_list_free(sp->list);
+  free(sp->line); free(sp->ring); free(sp->last);
+  sp->fp = NULL; sp->list = sp->mat = NULL;
+  sp->line = NULL; sp->linelen = 0;
+  sp->ring = sp->last = NULL;
+}
+
+/* Read the next row of data; returns 0 at the end of the data */
+static int playback_next(struct playback_sp *sp, double *row)
+{
+  int i;
+  char *s, *end;
+
+  if (sp->mat != NULL) {
+    MATRIX *mp = sp->mat;
+    if (sp->matrow >= mp->nrows) return 0;
+    for (i = 0; i < sp->ncols; ++i)
+      row[i] = i < mp->ncols ? mp->real[sp->matrow + i * mp->nrows] : 0;
+    ++sp->matrow;
+    return 1;
+  }
+
+  /* Capture format: whitespace separated columns, one line per row */
+  while (getline(&sp->line, &sp->linelen, sp->fp) > 0) {
+    for (s = sp->line; *s == ' ' || *s == '\t'; ++s);
+    if (*s == '\n' || *s == '\0' || *s == '#') continue;
+
+    for (i = 0; i < sp->ncols; ++i) {
+      row[i] = strtod(s, &end);
+      if (end == s) break;
+      s = end;
+    }
+    for (; i < sp->ncols; ++i) row[i] = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/* Go back to the start of the data */
+static void playback_rewind(struct playback_sp *sp)
+{
+  if (sp->mat != NULL) sp->matrow = 0;
+  else rewind(sp->fp);
+}
+
+/*
+ * playback_thread - keep the ring buffer full
+ *
+ * Waits for an empty row, reads the next row of data into it and
+ * makes it available to the servo loop.  At the end of the data the
+ * thread either starts over (-loop) or posts an extra token on the
+ * avail semaphore without adding a row, which tells the reader that
+ * there is no more data.
+ */
+static void *playback_thread(void *arg)
+{
+  struct playback_sp *sp = (struct playback_sp *) arg;
+  unsigned head = 0;
+  double *row;
+  int status;
+
+  for (;;) {
+    while (sem_wait(&sp->space) < 0 && errno == EINTR);
+    if (__atomic_load_n(&sp->stop, __ATOMIC_ACQUIRE)) break;
+
+    row = sp->ring + (head % PLAYBACK_ROWS) * sp->ncols;
+    status = playback_next(sp, row);
+    if (status == 0 && sp->loop && head > 0) {
+      playback_rewind(sp);
+      status = playback_next(sp, row);
+    }
+    if (status <= 0) {
+      sem_post(&sp->avail);		/* end of data marker */
+      break;
+    }
+
+    __atomic_store_n(&sp->head, ++head, __ATOMIC_RELEASE);
+    sem_post(&sp->avail);
+  }
+  return NULL;
+}
@@ -0,0 +1,133 @@
+/*!
+ * \file playtst.c
+ * \brief test the playback device driver
+ *
+ * \date 19 Oct 26
+ *
+ * Writes a small data file in the format used by chn_capture_dump()
+ * and a MATLAB file, configures a playback device for each and checks
+ * that the channels step through the recorded rows, hold the last
+ * row (marked stale) at the end of the data and start over with
+ * -loop.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "channel.h"
+
+static char datfile[] = "/tmp/playtstXXXXXX.dat";
+static char matfile[] = "/tmp/playtstXXXXXX.mat";
+static char devfile[] = "/tmp/playtstXXXXXX.dev";
+
+/* Check a condition and report failures */
+static int status = 0;
+static void check(int cond, char *msg, int row)
+{
+  if (!cond) {
+    fprintf(stderr, "playtst: %s (row %d)\n", msg, row);
+    status = 1;
+  }
+}
+
+/* Write a MATLAB v4 file with a single 3x2 matrix */
+static void write_mat(char *file)
+{
+  int32_t hdr[5] = {0, 3, 2, 0, 2};	/* little endian doubles */
+  double data[6] = {1, 2, 3, 10, 20, 30};
+  FILE *fp = fopen(file, "wb");
+
+  fwrite(hdr, sizeof(hdr), 1, fp);
+  fwrite("m", 2, 1, fp);
+  fwrite(data, sizeof(data), 1, fp);
+  fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+  FILE *fp;
+  int i, fd;
+
+  if ((fd = mkstemps(datfile, 4)) < 0 || close(fd) < 0 ||
+      (fd = mkstemps(matfile, 4)) < 0 || close(fd) < 0 ||
+      (fd = mkstemps(devfile, 4)) < 0 || close(fd) < 0) {
+    perror("playtst");
+    return 1;
+  }
+
+  /* Capture format: one row per line, tab separated */
+  fp = fopen(datfile, "w");
+  for (i = 0; i < 2000; ++i) fprintf(fp, "%d\t%g\t%d\t\n", i, i * 0.5, -i);
+  fclose(fp);
+  write_mat(matfile);
+
+  fp = fopen(devfile, "w");
+  fprintf(fp, "device: playback 2 %s -sync;\n", datfile);
+  fprintf(fp, "\tchannel: 1 -column=2;\n");
+  fprintf(fp, "device: playback 2 %s -loop -sync;\n", matfile);
+  fclose(fp);
+
+  chn_cache_enable = 0;
+  if (chn_config(devfile) < 0 || chn_ndev != 2) {
+    fprintf(stderr, "playtst: configuration failed\n");
+    return 1;
+  }
+
+  /* Read past the end of the ring buffer and then past the data */
+  for (i = 0; i < 2005; ++i) {
+    chn_read();
+    if (i < 2000) {
+      check(chn_data(0) == i && chn_data(1) == -i, "wrong data", i);
+      check(!chn_stale(0), "data stale", i);
+      check(chn_data(2) == i % 3 + 1 && chn_data(3) == 10 * (i % 3 + 1),
+	    "wrong looped data", i);
+    } else {
+      check(chn_data(0) == 1999 && chn_data(1) == -1999,
+	    "last row not held", i);
+      check(chn_stale(0) && chn_stale(1), "data not marked stale", i);
+    }
+  }
+  chn_close();
+
+  unlink(datfile);
+  unlink(matfile);
+  unlink(devfile);
+  if (status == 0) printf("playtst: 2005 rows played back\n");
+  return status;
+}
@@ -0,0 +1,131 @@
+/*!
+ * \file plugexmp.c
+ * \brief sample device driver plugin
+ *
+ * \date 19 Oct 26
+ *
+ * This file is an example of a device driver that is loaded at run
+ * time.  It is compiled as a shared object (plugexmp.so) and can be
+ * used in a configuration file as
+ *
+ *   device: plugin:./plugexmp.so 2 0x0;
+ *     channel: 1 -step=3;
+ *
+ * Each channel counts up by step (default 1) every time it is read.
+ * The data on the channel is scale * (count + offset).
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "channel.h"			/* normally sparrow/channel.h */
+
+/* Driver specific part of each channel */
+struct plugexmp_sp {
+  int count;				/* current count */
+  int step;				/* increment per read */
+};
+
+static int plugexmp_driver(DEV_ACTION action, ...)
+{
+  va_list ap;
+  int i, status = 0;
+  struct plugexmp_sp *sp;
+
+  va_start(ap, action);
+  DEVICE *dp = va_arg(ap, DEVICE *);
+  CHANNEL *cp = va_arg(ap, CHANNEL *);
+
+  switch (action) {
+  case Init:
+  case Zero:
+    for (i = 0; i < dp->size; ++i)
+      ((struct plugexmp_sp *) cp[i].dev_sp)->count = 0;
+    status = 1;
+    break;
+
+  case Read:
+    for (i = 0; i < dp->size; ++i) {
+      sp = (struct plugexmp_sp *) cp[i].dev_sp;
+      cp[i].raw = (sp->count += sp->step);
+      cp[i].data.d = cp[i].scale * (cp[i].raw + cp[i].offset);
+    }
+    status = 1;
+    break;
+
+  case NewChannels:
+    for (i = 0; i < dp->size; ++i) {
+      if ((sp = (struct plugexmp_sp *) malloc(sizeof(*sp))) == NULL) {
+	status = -1;
+	break;
+      }
+      sp->count = 0;
+      sp->step = 1;
+      cp[i].dev_sp = sp;
+    }
+    break;
+
+  case HandleFlag:
+    /* Only the step flag is supported, and only for channels */
+    if (chn_flag_type == Channel && strcmp(chn_flag_name, "step") == 0)
+      status = sscanf(chn_flag_value, "%d",
+		      &((struct plugexmp_sp *) cp->dev_sp)->step) == 1 ? 1 : -1;
+    break;
+
+  case Close:
+    for (i = 0; i < dp->size; ++i) {
+      free(cp[i].dev_sp);
+      cp[i].dev_sp = NULL;
+    }
+    break;
+
+  default:
+    break;
+  }
+  va_end(ap);
+  return status;
+}
+
+/* Registration function, called by chn_load_plugin() */
+int chn_plugin_register(DEV_LOOKUP *lp)
+{
+  lp->driver = plugexmp_driver;
+  return 0;
+}
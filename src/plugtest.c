@@ -0,0 +1,117 @@
+/*!
+ * \file plugtest.c
+ * \brief test loading a device driver plugin from the build tree
+ *
+ * \date 19 Oct 26
+ *
+ * Writes a configuration file that uses the sample plugin
+ * (plugexmp.so), reads it with chn_config() and checks that the
+ * channels behave as expected.  The configuration is read once with
+ * the cache off by default, checking that no cache file is written, and
+ * then twice with it on, so that the second time the tables are
+ * restored from the cache.  Also checks that a plugin path too long for
+ * the device table is refused.
+ *
+ * Must be run from the directory containing plugexmp.so.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "channel.h"
+
+static char config[] =
+  "device: plugin:./plugexmp.so 2 0x0 -scale=2;\n"
+  "  channel: 1 -step=3 -offset=1;\n";
+
+/* Read the configuration and check the channel values */
+static int check(char *file, char *pass)
+{
+  int i;
+
+  if (chn_config(file) < 0 || chn_ndev != 1 || chn_nchan != 2) {
+    fprintf(stderr, "plugtest: %s: configuration failed\n", pass);
+    return -1;
+  }
+  for (i = 1; i <= 3; ++i) chn_read();
+  chn_close();
+
+  /* channel 0: 2 * 3; channel 1: 2 * (9 + 1) */
+  if (chn_data(0) != 6 || chn_data(1) != 20) {
+    fprintf(stderr, "plugtest: %s: wrong data (%g, %g)\n", pass,
+	    chn_data(0), chn_data(1));
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char file[40] = "plugtestXXXXXX", name[80];
+  int fd, status;
+
+  if ((fd = mkstemp(file)) < 0) { perror("plugtest"); exit(1); }
+  write(fd, config, strlen(config));
+  close(fd);
+
+  /* The cache is off unless it is asked for */
+  unsetenv("SPARROW_CHN_CACHE");
+  status = check(file, "no cache") < 0;
+  sprintf(name, "%s.cache", file);
+  if (access(name, F_OK) == 0) {
+    fprintf(stderr, "plugtest: cache written without being asked for\n");
+    status = 1;
+  }
+  chn_cache_enable = 1;
+  status |= check(file, "parse") < 0 || check(file, "cache") < 0;
+
+  /* The name is stored in the device table, so it can't be truncated */
+  sprintf(name, "plugin:./%0*d/plugexmp.so", CHNDEVLEN, 0);
+  fprintf(stderr, "plugtest: expect 1 error message:\n");
+  if (chn_load_plugin(name) >= 0) {
+    fprintf(stderr, "plugtest: long plugin path accepted\n");
+    status = 1;
+  }
+
+  unlink(file);
+  strcat(file, ".cache");
+  unlink(file);
+  return status;
+}
@@ -0,0 +1,322 @@
+/*!
+ * \file profile.c
+ * \brief timing of the stages of the servo cycle
+ *
+ * \date 19 Oct 26
+ *
+ * The servo loop (servo.c), chn_read() and chn_write() (channel.c)
+ * and hook lists (hook.c) record how long each stage of the servo
+ * cycle takes, including the read and write for each device, when
+ * prof_enable is set.  Each stage keeps its most recent PROF_WINDOW
+ * samples; prof_update() computes the mean and percentiles over that
+ * window.  The servo thread only stores samples, so the statistics
+ * are computed by whoever looks at them (normally the display).
+ *
+ * The results can be viewed with a display table that is generated
+ * from the stages in use (prof_display_cb()) or written to a file
+ * (prof_dump()).
+ *
+ * \ingroup servo
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "display.h"
+#include "hook.h"
+
+int prof_enable = 0;
+PROF_STAGE prof_stages[PROF_MAXSTAGE] = {
+  {"servo cycle"}, {"servo period"}, {"display mailbox"}, {"user servo"},
+  {"chn_read"}, {"channel filters"}, {"channel tables"}, {"channel stages"},
+  {"chn_read hooks"}, {"chn_write"}, {"chn_write hooks"},
+  {"dd_update"}, {"serial input"}, {"serial output"}
+};
+static int prof_nuser = 0;		/* number of user stages */
+
+/*!
+ * \fn void prof_record(int id, uint64_t start)
+ * \brief record the time since start for a stage
+ * \ingroup servo
+ *
+ * Also logs an event if a trace is running (see trace.c).
+ */
+void prof_record(int id, uint64_t start)
+{
+  PROF_STAGE *sp = prof_stages + id;
+  uint64_t now = prof_clock(), dt = now - start;
+  uint32_t ns = dt > UINT32_MAX ? UINT32_MAX : (uint32_t) dt;
+
+  /* The period overlaps the cycles, so it isn't traced */
+  if (prof_tracing && id != PROF_PERIOD) prof_trace_event(id, start, now);
+  if (!prof_enable) return;
+
+  sp->win[sp->count & (PROF_WINDOW - 1)] = ns;
+  sp->last = ns;
+  if (ns > sp->max) sp->max = ns;
+  ++sp->count;
+}
+
+/*!
+ * \fn int prof_add(char *name)
+ * \brief add a stage for timing part of a user servo routine
+ * \ingroup servo
+ *
+ * Returns the stage id to use with PROF_END, or -1 if there are
+ * already PROF_MAXUSER user stages.
+ */
+int prof_add(char *name)
+{
+  int id;
+
+  if (prof_nuser >= PROF_MAXUSER) {
+    fprintf(stderr, "prof_add: too many stages\n");
+    return -1;
+  }
+  id = PROF_DEVREAD(PROF_MAXDEV) + prof_nuser++;
+  prof_setname(id, name);
+  return id;
+}
+
+/*! Set the name shown for a stage (used for device stages) */
+void prof_setname(int id, char *name)
+{
+  strncpy(prof_stages[id].name, name, PROF_NAMELEN - 1);
+  prof_stages[id].name[PROF_NAMELEN - 1] = '\0';
+}
+
+static int prof_cmp(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/*!
+ * \fn int prof_update(void)
+ * \brief compute statistics for each stage over its sample window
+ * \ingroup servo
+ *
+ * Safe to call while the servo loop is running; samples recorded
+ * while the window is being copied may be counted in either update.
+ * Returns the number of stages with data.
+ */
+int prof_update(void)
+{
+  static uint32_t buf[PROF_WINDOW];
+  PROF_STAGE *sp;
+  unsigned long count;
+  double sum;
+  int i, j, n, nstages = 0;
+
+  for (i = 0, sp = prof_stages; i < PROF_MAXSTAGE; ++i, ++sp) {
+    if ((count = sp->count) == 0) continue;
+    n = count < PROF_WINDOW ? count : PROF_WINDOW;
+    memcpy(buf, sp->win, n * sizeof(uint32_t));
+    qsort(buf, n, sizeof(uint32_t), prof_cmp);
+
+    for (sum = 0, j = 0; j < n; ++j) sum += buf[j];
+    sp->mean = sum / n * 1e-3;
+    sp->p50 = buf[(n - 1) * 50 / 100] * 1e-3;
+    sp->p90 = buf[(n - 1) * 90 / 100] * 1e-3;
+    sp->p99 = buf[(n - 1) * 99 / 100] * 1e-3;
+    sp->wmax = buf[n - 1] * 1e-3;
+    ++nstages;
+  }
+  return nstages;
+}
+
+/*! Clear the samples for all stages */
+void prof_reset(void)
+{
+  PROF_STAGE *sp;
+
+  for (sp = prof_stages; sp < prof_stages + PROF_MAXSTAGE; ++sp) {
+    sp->count = 0;
+    sp->last = sp->max = 0;
+    sp->mean = sp->p50 = sp->p90 = sp->p99 = sp->wmax = 0;
+  }
+}
+
+/*!
+ * \fn int prof_dump(char *filename)
+ * \brief write the timing statistics to a file
+ * \ingroup servo
+ *
+ * One line per stage with data; times are in microseconds.  The
+ * statistics are over the last PROF_WINDOW samples except for the
+ * last column, which is the longest time since the last reset.
+ */
+int prof_dump(char *filename)
+{
+  PROF_STAGE *sp;
+  FILE *fp;
+
+  if ((fp = fopen(filename, "w")) == NULL) {
+    fprintf(stderr, "prof_dump: can't open %s\n", filename);
+    return -1;
+  }
+  prof_update();
+  fprintf(fp, "# %-22s %10s %9s %9s %9s %9s %9s %9s\n", "stage", "count",
+	  "mean", "p50", "p90", "p99", "max", "worst");
+  for (sp = prof_stages; sp < prof_stages + PROF_MAXSTAGE; ++sp) {
+    if (sp->count == 0) continue;
+    fprintf(fp, "%-24s %10lu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+	    sp->name, sp->count, sp->mean, sp->p50, sp->p90, sp->p99,
+	    sp->wmax, sp->max * 1e-3);
+  }
+  fclose(fp);
+  return 0;
+}
+
+/*
+ * Display table
+ *
+ * The table is built when it is selected, with one row for each
+ * stage that has a name.  The statistics are recomputed twice a
+ * second by a display loop hook while the table is up.
+ */
+
+#define PROF_NCOL 6			/* numeric columns per row */
+static DD_IDENT prof_tbl[(PROF_NCOL + 1) * PROF_MAXSTAGE + 16];
+static double prof_buf[PROF_NCOL * PROF_MAXSTAGE];
+static char prof_enable_buf[sizeof(long)];
+
+static int prof_hook(void)
+{
+  static uint64_t last = 0;
+  uint64_t now = prof_clock();
+
+  if (now - last < 500000000ULL) return 0;
+  last = now;
+  prof_update();
+  return 0;
+}
+
+static int prof_return_cb(long arg)
+{
+  hook_remove(dd_loop_hooks, prof_hook);
+  return dd_prvtbl();
+}
+
+int prof_dump_cb(long arg)
+{
+  if (prof_dump("profile.dat") == 0)
+    DD_PROMPT("profile written to profile.dat");
+  return 0;
+}
+
+int prof_reset_cb(long arg) { prof_reset(); return 0; }
+
+/* Fill in a table entry */
+static DD_IDENT *prof_entry(DD_IDENT *dd, int row, int col, void *value,
+			    int (*fcn)(DD_ACTION, int), char *format,
+			    char *current, int (*callback)(long))
+{
+  memset(dd, 0, sizeof(DD_IDENT));
+  dd->row = row;
+  dd->col = col;
+  dd->value = value;
+  dd->function = fcn;
+  dd->format = format;
+  dd->current = current;
+  dd->selectable = callback != NULL;
+  dd->callback = callback != NULL ? callback : dd_nilcbk;
+  dd->type = fcn == dd_label ? Label : Data;
+  dd->length = -1;
+  return dd + 1;
+}
+
+/*!
+ * \fn int prof_display_cb(long arg)
+ * \brief display the timing statistics (display callback)
+ * \ingroup servo
+ *
+ * Turns profiling on and switches to a generated display table; the
+ * RETURN button goes back to the previous table.
+ */
+int prof_display_cb(long arg)
+{
+  static char *heads[PROF_NCOL + 1] =
+    {"stage", "count", "mean", "p50", "p90", "p99", "max"};
+  static int cols[PROF_NCOL + 1] = {1, 26, 35, 44, 53, 62, 71};
+  DD_IDENT *dd = prof_tbl;
+  PROF_STAGE *sp;
+  double *bp = prof_buf;
+  int i, row;
+
+  prof_enable = 1;
+  dd = prof_entry(dd, 1, 20, "Servo cycle profile (times in usec)",
+		  dd_label, "NULL", NULL, NULL);
+  for (i = 0; i <= PROF_NCOL; ++i)
+    dd = prof_entry(dd, 3, cols[i] + 9 - (i ? strlen(heads[i]) : 9),
+		    heads[i], dd_label, "NULL", NULL, NULL);
+
+  for (i = 0, row = 4, sp = prof_stages;
+       i < PROF_MAXSTAGE && row < dd_rows - 3; ++i, ++sp) {
+    if (sp->name[0] == '\0') continue;
+    dd = prof_entry(dd, row, cols[0], sp->name, dd_label, "NULL", NULL, NULL);
+    dd = prof_entry(dd, row, cols[1], &sp->count, dd_long, "%9ld",
+		    (char *) bp++, NULL);
+    dd = prof_entry(dd, row, cols[2], &sp->mean, dd_double, "%9.1f",
+		    (char *) bp++, NULL);
+    dd = prof_entry(dd, row, cols[3], &sp->p50, dd_double, "%9.1f",
+		    (char *) bp++, NULL);
+    dd = prof_entry(dd, row, cols[4], &sp->p90, dd_double, "%9.1f",
+		    (char *) bp++, NULL);
+    dd = prof_entry(dd, row, cols[5], &sp->p99, dd_double, "%9.1f",
+		    (char *) bp++, NULL);
+    dd = prof_entry(dd, row, cols[6], &sp->wmax, dd_double, "%9.1f",
+		    (char *) bp++, NULL);
+    ++row;
+  }
+
+  row = dd_rows - 2;
+  dd = prof_entry(dd, row, 1, "RETURN", dd_label, NULL, NULL,
+		  prof_return_cb);
+  dd = prof_entry(dd, row, 10, "RESET", dd_label, NULL, NULL,
+		  prof_reset_cb);
+  dd = prof_entry(dd, row, 18, "DUMP", dd_label, NULL, NULL, prof_dump_cb);
+  dd = prof_entry(dd, row, 26, "enabled =", dd_label, "NULL", NULL, NULL);
+  dd = prof_entry(dd, row, 36, &prof_enable, dd_short, "%d",
+		  prof_enable_buf, dd_nilcbk);
+  memset(dd, 0, sizeof(DD_IDENT));	/* end of table */
+
+  hook_remove(dd_loop_hooks, prof_hook);
+  hook_add(dd_loop_hooks, prof_hook);
+  return dd_usetbl(prof_tbl);
+}
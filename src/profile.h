@@ -0,0 +1,139 @@
+/*!
+ * \file profile.h
+ * \brief timing of the stages of the servo cycle
+ *
+ * \date 19 Oct 26
+ *
+ * \ingroup servo
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#ifndef __PROFILE_INCLUDED__
+#define __PROFILE_INCLUDED__
+
+#include <stdint.h>
+#include <time.h>
+
+#define PROF_WINDOW 1024		/* samples kept per stage (power of 2) */
+#define PROF_MAXDEV 64			/* same as CHN_MAXDEV */
+#define PROF_MAXUSER 16			/* stages added with prof_add() */
+#define PROF_NAMELEN 24
+
+/* Fixed stages; device stages follow these */
+enum prof_stage_id {
+  PROF_CYCLE,				/* whole servo cycle */
+  PROF_PERIOD,				/* time between cycle starts */
+  PROF_MBOX,				/* display mailbox (ddmbox.c) */
+  PROF_USER,				/* user servo routine */
+  PROF_READ,				/* chn_read, all devices */
+  PROF_FILTER,				/* channel filters */
+  PROF_LUT,				/* channel lookup tables (lut.c) */
+  PROF_STAGES,				/* channel stages (chnstage.c) */
+  PROF_RHOOKS,				/* chn_read hooks (ssblock.c) */
+  PROF_WRITE,				/* chn_write, all devices */
+  PROF_HOOKS,				/* chn_write hooks (capture) */
+  PROF_DISPLAY,				/* dd_update */
+  PROF_SERIN,				/* serial input (serial.c) */
+  PROF_SEROUT,				/* serial output */
+  PROF_NFIXED
+};
+#define PROF_DEVREAD(dev)	(PROF_NFIXED + 2 * (dev))
+#define PROF_DEVWRITE(dev)	(PROF_NFIXED + 2 * (dev) + 1)
+#define PROF_MAXSTAGE		(PROF_NFIXED + 2 * PROF_MAXDEV + PROF_MAXUSER)
+
+/*!
+ * \struct prof_stage
+ * \brief timing data for one stage of the servo cycle
+ *
+ * Times are recorded in nanoseconds by the servo thread.  The
+ * statistics at the end are in microseconds over the last PROF_WINDOW
+ * samples and are only computed when prof_update() is called.
+ */
+struct prof_stage {
+  char name[PROF_NAMELEN];		/* stage name (empty if unused) */
+  unsigned long count;			/* number of samples recorded */
+  uint32_t last, max;			/* latest and largest time (ns) */
+  uint32_t win[PROF_WINDOW];		/* most recent samples (ns) */
+
+  /* Computed by prof_update() */
+  double mean, p50, p90, p99, wmax;
+};
+typedef struct prof_stage PROF_STAGE;
+
+extern int prof_enable;			/* record times */
+extern int prof_tracing;		/* log events (trace.c) */
+extern PROF_STAGE prof_stages[];
+
+/* Clock used for all measurements, in nanoseconds */
+static inline uint64_t prof_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Instrumentation points.  PROF_BEGIN declares a start time that is
+ * zero if profiling and tracing are off; PROF_END records the time
+ * since then.
+ * Compiling with -DSPARROW_NOPROFILE (configure --disable-profile)
+ * removes them entirely.
+ */
+#ifdef SPARROW_NOPROFILE
+#define PROF_BEGIN(t)
+#define PROF_END(id, t)
+#else
+#define PROF_BEGIN(t)	\
+  uint64_t t = (prof_enable | prof_tracing) ? prof_clock() : 0
+#define PROF_END(id, t)	do { if (t) prof_record(id, t); } while (0)
+#endif
+
+void prof_record(int id, uint64_t start);
+int prof_add(char *name);
+void prof_setname(int id, char *name);
+int prof_update(void);
+void prof_reset(void);
+int prof_dump(char *filename);
+int prof_dump_cb(long), prof_reset_cb(long), prof_display_cb(long);
+
+/* Trace files (trace.c) */
+void prof_trace_thread(char *name);
+void prof_trace_event(int id, uint64_t start, uint64_t end);
+int prof_trace_start(char *filename);
+int prof_trace_stop(void);
+int prof_trace_cb(long);
+
+#endif /* __PROFILE_INCLUDED__ */
@@ -0,0 +1,208 @@
+/*!
+ * \file proftst.c
+ * \brief test the servo cycle profiler
+ *
+ * \date 19 Oct 26
+ *
+ * Runs a few hundred read/write cycles on a small channel table with a
+ * write hook and a user stage, then checks that every stage was
+ * counted once per cycle, that the statistics are consistent and that
+ * the dump file lists each stage.  Then traces the same cycles from
+ * two threads and checks the events in the trace file.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "channel.h"
+#include "hook.h"
+#include "profile.h"
+
+#define NCYCLES 500
+
+extern HOOK_LIST *chn_write_hooks;
+static char devfile[] = "/tmp/proftstXXXXXX.dev";
+static char dumpfile[] = "/tmp/proftstXXXXXX.dat";
+static char tracefile[] = "/tmp/proftstXXXXXX.json";
+static int user2;
+
+static int hook(void) { usleep(10); return 0; }
+
+/* Second thread for the trace */
+static void *worker(void *arg)
+{
+  int i;
+
+  prof_trace_thread("worker");
+  for (i = 0; i < 100; ++i) {
+    PROF_BEGIN(t0);
+    usleep(100);
+    PROF_END(user2, t0);
+  }
+  return NULL;
+}
+
+/* Count the occurrences of a string in a file */
+static int count(char *file, char *s)
+{
+  FILE *fp = fopen(file, "r");
+  char line[256];
+  int n = 0;
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+    if (strstr(line, s) != NULL) ++n;
+  fclose(fp);
+  return n;
+}
+
+int main(int argc, char **argv)
+{
+  static int ids[] = {PROF_READ, PROF_WRITE, PROF_HOOKS, PROF_DEVREAD(0),
+		      PROF_DEVREAD(1), PROF_DEVWRITE(0), PROF_DEVWRITE(1)};
+  PROF_STAGE *sp;
+  pthread_t thread;
+  FILE *fp;
+  char line[128];
+  int i, fd, user, nlines, status = 0;
+
+#ifdef SPARROW_NOPROFILE
+  return 77;				/* profiler compiled out; skip */
+#endif
+
+  if ((fd = mkstemps(devfile, 4)) < 0 || close(fd) < 0 ||
+      (fd = mkstemps(dumpfile, 4)) < 0 || close(fd) < 0 ||
+      (fd = mkstemps(tracefile, 5)) < 0 || close(fd) < 0) {
+    perror("proftst");
+    return 1;
+  }
+
+  fp = fopen(devfile, "w");
+  fprintf(fp, "device: virtual 2 0x00;\n");
+  fprintf(fp, "device: function-gen 1 0x00;\n");
+  fclose(fp);
+
+  chn_cache_enable = 0;
+  if (chn_config(devfile) < 0 || chn_ndev != 2) {
+    fprintf(stderr, "proftst: configuration failed\n");
+    return 1;
+  }
+  unlink(devfile);
+  hook_add(chn_write_hooks, hook);
+  user = prof_add("user stage");
+
+  /* Nothing is recorded until profiling is turned on */
+  chn_read();
+  chn_write();
+  prof_enable = 1;
+  for (i = 0; i < NCYCLES; ++i) {
+    PROF_BEGIN(t0);
+    chn_read();
+    chn_write();
+    PROF_END(user, t0);
+  }
+
+  prof_update();
+  for (i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+    sp = prof_stages + ids[i];
+    if (sp->count != NCYCLES ||
+	!(sp->p50 <= sp->p90 && sp->p90 <= sp->p99 && sp->p99 <= sp->wmax)) {
+      fprintf(stderr, "proftst: bad statistics for %s (count %lu)\n",
+	      sp->name, sp->count);
+      status = 1;
+    }
+  }
+  if (strstr(prof_stages[PROF_DEVWRITE(1)].name, "function-gen") == NULL) {
+    fprintf(stderr, "proftst: device stage not named\n");
+    status = 1;
+  }
+  if (prof_stages[PROF_HOOKS].p50 < 10) {
+    fprintf(stderr, "proftst: hook time too short\n");
+    status = 1;
+  }
+  if (prof_stages[user].p50 < prof_stages[PROF_HOOKS].p50) {
+    fprintf(stderr, "proftst: user stage shorter than its contents\n");
+    status = 1;
+  }
+
+  /* One line per stage used plus a header */
+  if (prof_dump(dumpfile) < 0) return 1;
+  fp = fopen(dumpfile, "r");
+  for (nlines = 0; fgets(line, sizeof(line), fp) != NULL; ++nlines);
+  fclose(fp);
+  unlink(dumpfile);
+  if (nlines != sizeof(ids) / sizeof(ids[0]) + 2) {
+    fprintf(stderr, "proftst: %d lines in dump file\n", nlines);
+    status = 1;
+  }
+
+  /* Trace: eight stages per cycle plus the worker thread's stage */
+  user2 = prof_add("worker stage");
+  prof_enable = 0;
+  prof_trace_thread("main");
+  if (prof_trace_start(tracefile) < 0) return 1;
+  pthread_create(&thread, NULL, worker, NULL);
+  for (i = 0; i < NCYCLES; ++i) {
+    PROF_BEGIN(t0);
+    chn_read();
+    chn_write();
+    PROF_END(user, t0);
+  }
+  pthread_join(thread, NULL);
+  if (prof_trace_stop() != 0) {
+    fprintf(stderr, "proftst: trace events dropped\n");
+    status = 1;
+  }
+  chn_close();
+
+  if (count(tracefile, "\"ph\":\"X\"") != 8 * NCYCLES + 100 ||
+      count(tracefile, "\"name\":\"worker\"") != 1 ||
+      count(tracefile, "\"name\":\"main\"") != 1 ||
+      count(tracefile, "]}") != 1) {
+    fprintf(stderr, "proftst: wrong events in trace file\n");
+    status = 1;
+  }
+  if (prof_stages[user2].count != 0) {
+    fprintf(stderr, "proftst: statistics recorded while only tracing\n");
+    status = 1;
+  }
+  unlink(tracefile);
+
+  if (status == 0) printf("proftst: %d cycles profiled and traced\n", NCYCLES);
+  return status;
+}
@@ -0,0 +1,221 @@
+/*!
+ * \file psettst.c
+ * \brief test versioned parameter sets
+ *
+ * \date 19 Oct 26
+ *
+ * Loads parameter files into a set and checks that nothing reaches
+ * the variables until dd_pset_apply(), that a new version can't be
+ * loaded before the last one is applied, rollback, names too long for
+ * the table and saving.  A servo thread then applies the set while
+ * files are loaded and rolled back as fast as it will take them, and
+ * checks that it only ever sees complete versions.  Also checks that
+ * dd_save_tbl() saves a table without making it the current table and
+ * that dd_tbl_load() skips names too long for the table and keeps '#'
+ * in values.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "display.h"
+
+#define TST_NAME "psettst"
+#include "tstutil.h"
+
+#define NGAIN 4
+#define NLOAD 500
+
+static double gain[NGAIN];
+static long count;
+static char label[32] = "start";
+
+/* Manager that notes whether it was asked to save from ddtbl */
+static int spied = 0;
+static int spy(DD_ACTION action, int id)
+{
+  if (action == Save) {
+    spied = 1;
+    strcpy(dd_save_string, "spy");
+  }
+  return 0;
+}
+
+static DD_IDENT tbl[] = {
+  {1, 1, gain + 0, dd_double, "%g", NULL, 0, NULL, 0, 0, 0, Data, "k0", -1},
+  {2, 1, gain + 1, dd_double, "%g", NULL, 0, NULL, 0, 0, 0, Data, "k1", -1},
+  {3, 1, gain + 2, dd_double, "%g", NULL, 0, NULL, 0, 0, 0, Data, "k2", -1},
+  {4, 1, gain + 3, dd_double, "%g", NULL, 0, NULL, 0, 0, 0, Data, "k3", -1},
+  {5, 1, &count, dd_long, "%ld", NULL, 0, NULL, 0, 0, 0, Data, "count", -1},
+  {6, 1, label, dd_string, "%s", NULL, 0, NULL, 0, 0, 0, Data, "label", -1},
+  {7, 1, label, spy, "%s", NULL, 0, NULL, 0, 0, 0, Data, "spy", -1},
+  DD_End
+};
+static char note[32];
+static DD_IDENT notes[] = {
+  {1, 1, note, dd_string, "%s", NULL, 0, NULL, 0, 0, 0, Data,
+   "abcdefghijklmnopqrstuvwxyz01234", -1},
+  DD_End
+};
+static DD_IDENT other[] = {
+  {1, 1, "other", dd_label, NULL, NULL, 0, NULL, 0, 0, 0, Label, "", -1},
+  DD_End
+};
+
+static char parfile[32] = "/tmp/psettstXXXXXX";
+static char savefile[32] = "/tmp/psettstXXXXXX";
+static DD_PSET *ps;
+static volatile int running;
+
+/* Write a parameter file with every gain and the count set to v */
+static void write_set(double v, char *extra)
+{
+  FILE *fp = fopen(parfile, "w");
+  int i;
+
+  if (extra != NULL) fputs(extra, fp);
+  for (i = 0; i < NGAIN; ++i) fprintf(fp, "k%d\t%.17g\n", i, v);
+  fprintf(fp, "count\t%ld\n", (long) v);
+  fclose(fp);
+}
+
+/* Are the variables a complete copy of version v? */
+static int is_set(double v)
+{
+  int i;
+
+  for (i = 0; i < NGAIN; ++i) if (gain[i] != v) return 0;
+  return count == (long) v;
+}
+
+/* Servo: apply the set and check that every version is complete */
+static void *servo(void *arg)
+{
+  long *bad = (long *) arg;
+  int i;
+
+  while (running) {
+    dd_pset_apply(ps);
+    for (i = 1; i < NGAIN; ++i) if (gain[i] != gain[0]) ++*bad;
+    if (count != (long) gain[0]) ++*bad;
+    usleep(50);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t thread;
+  char line[64], *longname;
+  long bad = 0;
+  int i, v, changed;
+  FILE *fp;
+
+  tst_tmpfile(parfile, 0);
+  tst_tmpfile(savefile, 0);
+  if ((ps = dd_pset_create(tbl, 3)) == NULL) {
+    fprintf(stderr, "psettst: dd_pset_create failed\n");
+    return 1;
+  }
+  check(dd_pset_version(ps) == 0, "initial version");
+
+  /* Nothing changes until the set is applied */
+  write_set(1, NULL);
+  check(dd_pset_load(ps, parfile) == 1, "load 1");
+  check(is_set(0), "variables changed before apply");
+  check(dd_pset_apply(ps) == 1 && is_set(1), "apply 1");
+  check(dd_pset_apply(ps) == 0, "applied twice");
+
+  /* Only one change at a time can be waiting for the servo */
+  write_set(2, NULL);
+  check(dd_pset_load(ps, parfile) == 2, "load 2");
+  write_set(3, NULL);
+  fprintf(stderr, "psettst: expect 1 error message:\n");
+  check(dd_pset_load(ps, parfile) < 0, "load before apply accepted");
+  check(dd_pset_apply(ps) == 1 && is_set(2), "apply 2");
+
+  /* Rollback, with 3 previous versions kept */
+  for (v = 3; v <= 5; ++v) {
+    write_set(v, NULL);
+    check(dd_pset_load(ps, parfile) == v, "load 3-5");
+    dd_pset_apply(ps);
+  }
+  check(dd_pset_rollback(ps, 3) == 2, "rollback 3");
+  check(dd_pset_apply(ps) == 1 && is_set(2), "apply after rollback");
+  check(dd_pset_rollback(ps, 4) < 0, "rollback past the ring accepted");
+  check(dd_pset_rollback(ps, 0) == 5, "rollback 0");
+  dd_pset_apply(ps);
+  check(is_set(5), "apply after rollback 0");
+
+  /* Names too long for the table are skipped, value and all */
+  longname = malloc(200);
+  memset(longname, 'x', 120);
+  strcpy(longname + 120, " 99\n");
+  write_set(6, longname);
+  fprintf(stderr, "psettst: expect 1 error message:\n");
+  check(dd_pset_load(ps, parfile) == 6, "file with long name rejected");
+  dd_pset_apply(ps);
+  check(is_set(6), "long name threw off the file");
+  free(longname);
+
+  /* Saving writes the current version */
+  check(dd_pset_save(ps, savefile) == 1, "dd_pset_save");
+  dd_pset_rollback(ps, 1);
+  dd_pset_apply(ps);
+  check(is_set(5), "rollback before reload");
+  check(dd_pset_load(ps, savefile) == 7, "reload");
+  dd_pset_apply(ps);
+  check(is_set(6), "saved values");
+
+  /* Loads and rollbacks while the servo is applying */
+  running = 1;
+  pthread_create(&thread, NULL, servo, &bad);
+  for (i = 0, changed = 0; i < NLOAD; ++i) {
+    write_set(100 + i, NULL);
+    if (dd_pset_load(ps, parfile) >= 0) ++changed;
+    if (i % 7 == 0 && dd_pset_rollback(ps, 1 + i % 3) >= 0) ++changed;
+  }
+  running = 0;
+  pthread_join(thread, NULL);
+  if (bad > 0) {
+    fprintf(stderr, "psettst: servo saw %ld partial versions\n", bad);
+    status = 1;
+  }
+  check(changed >= NLOAD, "loads failed while the servo was running");
+  dd_pset_free(ps);
+
+  /* dd_save_tbl doesn't switch the current table: entries with their
+     own managers can only be saved from the current table */
+  ddtbl = other;
+  fprintf(stderr, "psettst: expect 1 error message:\n");
+  check(dd_save_tbl(savefile, tbl) == 1, "dd_save_tbl failed");
+  check(ddtbl == other && !spied, "ddtbl switched by dd_save_tbl");
+  fp = fopen(savefile, "r");
+  for (i = 0, bad = 0; fgets(line, sizeof(line), fp) != NULL; ++i)
+    if ((i == 0 && strncmp(line, "k0\t", 3) != 0) ||
+	(i == 5 && strcmp(line, "label\tstart\n") != 0))
+      ++bad;
+  fclose(fp);
+  check(i == 6 && bad == 0, "dd_save_tbl output");
+  ddtbl = tbl;
+  check(dd_save_tbl(savefile, tbl) == 1 && spied, "current table not saved");
+  ddtbl = NULL;
+
+  /* A name that only matches in its first 31 characters; '#' in a value */
+  fp = fopen(parfile, "w");
+  fprintf(fp, "# comment\n");
+  fprintf(fp, "abcdefghijklmnopqrstuvwxyz01234extra wrong\n");
+  fprintf(fp, "abcdefghijklmnopqrstuvwxyz01234 a#b # comment\n");
+  fclose(fp);
+  fprintf(stderr, "psettst: expect 1 error message:\n");
+  check(dd_tbl_load(parfile, notes) == 1 && strcmp(note, "a#b") == 0,
+	"dd_tbl_load long name or '#' in a value");
+
+  unlink(parfile);
+  unlink(savefile);
+  return status;
+}
@@ -0,0 +1,443 @@
+/*!
+ * \file ptysim.c
+ * \brief simulate a serial device on a pseudo terminal
+ *
+ * \date 19 Oct 26
+ *
+ * This program is a non-interactive version of ptycat for testing
+ * serial device drivers.  It creates a pty and answers each line that
+ * is written to it using a model of the device:
+ *
+ *   -m plant	first order plant (the default).  Each request contains
+ *		the commanded input u (optionally preceded by a tag,
+ *		which is echoed); the reply is the plant output y, with
+ *		tau dy/dt = gain * u - y.  Use -p tau=T,gain=K to set
+ *		the parameters.
+ *   -m echo	reply with the request
+ *   -s file	use a script (see below)
+ *   -m lib.so	use a model from a shared object (see below)
+ *
+ * The link to the host can be degraded with -L (latency, usec), -J
+ * (jitter, usec) and -D (probability of dropping each byte that is
+ * sent back).  Throughput is reported every -r seconds and when the
+ * program exits (after -t seconds, or on an interrupt).  Use -l path
+ * to create a symbolic link to the pty, so that the same device name
+ * can be used in config.dev every time.
+ *
+ * Scripts contain one rule per line, "prefix reply".  A request that
+ * starts with prefix (or any request, if prefix is "*") is answered
+ * with reply, in which $0 is replaced by the request, $1..$9 by the
+ * fields of the request and $t by the time since the program started.
+ * A reply of "-" means don't answer.  The first rule that matches is
+ * used; lines starting with # are comments.
+ *
+ * Model plugins define the function
+ *
+ *   int ptysim_model(char *request, char *reply, int size, double t)
+ *
+ * which writes the reply (without the newline) and returns its length
+ * (0 for no reply), and optionally ptysim_init(char *params), which
+ * gets the -p argument.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <dlfcn.h>
+
+#define SIMLEN 256			/* max length of a request or reply */
+#define SIMQUEUE 1024			/* max replies waiting to be sent */
+
+/* Replies waiting to be sent */
+static struct {
+  double when;				/* time to send the reply */
+  int len, sent;			/* bytes in reply, bytes written */
+  char buf[SIMLEN];
+} queue[SIMQUEUE];
+static int qhead = 0, qcount = 0;
+
+/* Statistics */
+static unsigned long nreq, nreply, bytes_in, bytes_out, dropped;
+static volatile int done = 0;
+static double start;
+
+/* Model */
+static int (*model)(char *, char *, int, double);
+static double tau = 0.1, gain = 1;	/* plant parameters */
+
+/* Script rules */
+static struct rule { char *prefix, *reply; } *rules;
+static int nrules = 0;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void stop(int sig) { done = 1; }
+
+/* Split a request into an optional tag and a value */
+static int get_tag(char *req, unsigned *tag, double *value)
+{
+  if (sscanf(req, "%u %lf", tag, value) == 2) return 1;
+  *value = atof(req);
+  return 0;
+}
+
+/* First order plant, driven by the commanded input */
+static int plant_model(char *req, char *reply, int size, double t)
+{
+  static double y = 0, u = 0, tlast = 0;
+  double unew;
+  unsigned tag;
+  int tagged = get_tag(req, &tag, &unew);
+
+  /* Input u has been held since the last request */
+  y += (gain * u - y) * (1 - exp(-(t - tlast) / tau));
+  tlast = t;
+  u = unew;
+
+  return tagged ? snprintf(reply, size, "%u %.6g", tag, y) :
+    snprintf(reply, size, "%.6g", y);
+}
+
+/* Echo the request back */
+static int echo_model(char *req, char *reply, int size, double t)
+{
+  return snprintf(reply, size, "%s", req);
+}
+
+/* Answer a request using the script */
+static int script_model(char *req, char *reply, int size, double t)
+{
+  char fields[SIMLEN], *field[10], *p, *r;
+  int i, n, len = 0;
+
+  for (i = 0; i < nrules; ++i)
+    if (strcmp(rules[i].prefix, "*") == 0 ||
+	strncmp(req, rules[i].prefix, strlen(rules[i].prefix)) == 0) break;
+  if (i == nrules || strcmp(rules[i].reply, "-") == 0) return 0;
+
+  /* Split the request into fields ($1..$9) */
+  strcpy(fields, req);
+  field[0] = req;
+  for (n = 1, p = strtok(fields, " \t"); n < 10; ++n, p = strtok(NULL, " \t"))
+    field[n] = p != NULL ? p : "";
+
+  /* Fill in the reply template */
+  for (r = rules[i].reply; *r != '\0' && len < size - 1; ++r) {
+    if (r[0] == '$' && r[1] >= '0' && r[1] <= '9')
+      len += snprintf(reply + len, size - len, "%s", field[*++r - '0']);
+    else if (r[0] == '$' && r[1] == 't') {
+      len += snprintf(reply + len, size - len, "%.6f", t);
+      ++r;
+    } else
+      reply[len++] = *r;
+  }
+  if (len > size - 1) len = size - 1;
+  reply[len] = '\0';
+  return len;
+}
+
+/* Read a script file */
+static int load_script(char *file)
+{
+  char line[SIMLEN], *p, *q;
+  FILE *fp;
+
+  if ((fp = fopen(file, "r")) == NULL) { perror(file); return -1; }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    for (p = line; *p == ' ' || *p == '\t'; ++p);
+    if (*p == '\0' || *p == '#') continue;
+
+    /* Split into prefix and reply */
+    for (q = p; *q != '\0' && *q != ' ' && *q != '\t'; ++q);
+    if (*q != '\0') *q++ = '\0';
+    while (*q == ' ' || *q == '\t') ++q;
+
+    rules = (struct rule *) realloc(rules, (nrules + 1) * sizeof(*rules));
+    rules[nrules].prefix = strdup(p);
+    rules[nrules].reply = strdup(q);
+    ++nrules;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* Parse plant parameters (tau=T,gain=K) */
+static int plant_params(char *params)
+{
+  char *p;
+
+  for (p = strtok(params, ","); p != NULL; p = strtok(NULL, ",")) {
+    if (sscanf(p, "tau=%lf", &tau) == 1 && tau > 0) continue;
+    if (sscanf(p, "gain=%lf", &gain) == 1) continue;
+    fprintf(stderr, "ptysim: bad plant parameter %s\n", p);
+    return -1;
+  }
+  return 0;
+}
+
+/* Queue a reply to be sent after the latency and jitter, dropping
+   bytes at random */
+static void schedule(char *reply, int len, double t, double latency,
+		     double jitter, double droprate)
+{
+  double when = t + latency + jitter * (2.0 * rand() / RAND_MAX - 1);
+  int i, tail;
+
+  if (qcount == SIMQUEUE) { dropped += len; return; }
+
+  /* Bytes on a serial line can't pass each other */
+  if (qcount > 0 && when < queue[(qhead + qcount - 1) % SIMQUEUE].when)
+    when = queue[(qhead + qcount - 1) % SIMQUEUE].when;
+
+  tail = (qhead + qcount++) % SIMQUEUE;
+  queue[tail].when = when;
+  queue[tail].len = queue[tail].sent = 0;
+  for (i = 0; i < len; ++i)
+    if (droprate > 0 && (double) rand() / RAND_MAX < droprate)
+      ++dropped;
+    else
+      queue[tail].buf[queue[tail].len++] = reply[i];
+}
+
+/*
+ * Send the replies that are due.  Returns 1 if the pty won't take any
+ * more for now; the rest of a reply that was only partly written is
+ * sent when the pty is writable again.
+ */
+static int transmit(int fd, double t)
+{
+  int n;
+
+  while (qcount > 0 && queue[qhead].when <= t) {
+    n = queue[qhead].len - queue[qhead].sent;
+    if (n > 0 && (n = write(fd, queue[qhead].buf + queue[qhead].sent, n)) < 0) {
+      if (errno == EAGAIN || errno == EINTR) return 1;
+      dropped += queue[qhead].len - queue[qhead].sent;
+    } else if (n > 0) {
+      bytes_out += n;
+      if ((queue[qhead].sent += n) < queue[qhead].len) return 1;
+    }
+    ++nreply;
+    qhead = (qhead + 1) % SIMQUEUE;
+    --qcount;
+  }
+  return 0;
+}
+
+/* Print throughput since the last report */
+static void report(double t, double *tlast, int final)
+{
+  static unsigned long lreq, lreply, lin, lout;
+  double dt = t - *tlast;
+
+  if (final) {
+    printf("requests %lu replies %lu bytes_in %lu bytes_out %lu "
+	   "dropped %lu seconds %.3f\n", nreq, nreply, bytes_in, bytes_out,
+	   dropped, t - start);
+    return;
+  }
+  if (dt <= 0) return;
+  fprintf(stderr, "ptysim: %.0f req/s, %.0f replies/s, in %.0f B/s, "
+	  "out %.0f B/s, %lu bytes dropped\n", (nreq - lreq) / dt,
+	  (nreply - lreply) / dt, (bytes_in - lin) / dt,
+	  (bytes_out - lout) / dt, dropped);
+  lreq = nreq; lreply = nreply; lin = bytes_in; lout = bytes_out;
+  *tlast = t;
+}
+
+int main(int argc, char **argv)
+{
+  int c, errflg = 0, ptyfd, slave, len = 0, n, blocked = 0;
+  char *modelname = "plant", *script = NULL, *params = NULL, *link = NULL;
+  double latency = 0, jitter = 0, droprate = 0, interval = 1, runtime = 0;
+  double t, tlast, next;
+  char inbuf[SIMLEN], reply[SIMLEN], *nl;
+  struct termios term;
+  struct pollfd pfd;
+
+  /* Parse command line arguments */
+  while ((c = getopt(argc, argv, "m:s:p:L:J:D:r:t:l:?")) != EOF)
+    switch (c) {
+    case 'm': modelname = optarg; break;
+    case 's': script = optarg; break;
+    case 'p': params = optarg; break;
+    case 'L': latency = atof(optarg) * 1e-6; break;
+    case 'J': jitter = atof(optarg) * 1e-6; break;
+    case 'D': droprate = atof(optarg); break;
+    case 'r': interval = atof(optarg); break;
+    case 't': runtime = atof(optarg); break;
+    case 'l': link = optarg; break;
+    default: errflg++; break;
+    }
+
+  if (errflg || optind != argc) {
+    fprintf(stderr, "usage: %s [-m plant|echo|lib.so] [-s script] "
+	    "[-p params]\n\t[-L latency] [-J jitter] [-D droprate] "
+	    "[-r interval] [-t time] [-l link]\n", argv[0]);
+    exit(2);
+  }
+
+  /* Set up the model */
+  if (script != NULL) {
+    if (load_script(script) < 0) exit(2);
+    model = script_model;
+
+  } else if (strcmp(modelname, "plant") == 0) {
+    if (params != NULL && plant_params(params) < 0) exit(2);
+    model = plant_model;
+
+  } else if (strcmp(modelname, "echo") == 0) {
+    model = echo_model;
+
+  } else {
+    void *handle;
+    int (*init)(char *);
+
+    if ((handle = dlopen(modelname, RTLD_NOW)) == NULL) {
+      fprintf(stderr, "ptysim: %s\n", dlerror());
+      exit(2);
+    }
+    *(void **) (&model) = dlsym(handle, "ptysim_model");
+    *(void **) (&init) = dlsym(handle, "ptysim_init");
+    if (model == NULL) {
+      fprintf(stderr, "ptysim: %s: no ptysim_model function\n", modelname);
+      exit(2);
+    }
+    if (init != NULL && (*init)(params) < 0) exit(2);
+  }
+
+  /* Open up the pty for reading and writing */
+  if ((ptyfd = posix_openpt(O_RDWR | O_NOCTTY)) < 0) {
+    perror("ptysim");
+    exit(2);
+  }
+  if (grantpt(ptyfd) < 0) { perror("grantpt"); exit(2); }
+  if (unlockpt(ptyfd) < 0) { perror("unlockpt"); exit(2); }
+
+  /* Set up the terminal for raw, non-blocking interface */
+  tcgetattr(ptyfd, &term);
+  cfmakeraw(&term);
+  tcsetattr(ptyfd, TCSANOW, &term);
+  fcntl(ptyfd, F_SETFL, fcntl(ptyfd, F_GETFL) | O_NONBLOCK);
+
+  /* Print out the pty name (and make the link if asked) */
+  if (link != NULL) {
+    unlink(link);
+    if (symlink(ptsname(ptyfd), link) < 0) { perror(link); exit(2); }
+  }
+  printf("pty = %s\n", ptsname(ptyfd));
+  fflush(stdout);
+
+  /* Hold the slave open, so that when a client closes it the master
+     doesn't see a hangup (poll returns at once and read gives EIO) */
+  if ((slave = open(ptsname(ptyfd), O_RDWR | O_NOCTTY)) < 0) {
+    perror("ptysim");
+    exit(2);
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  start = tlast = now();
+
+  /*
+   * Main loop - answer requests and send replies when they are due
+   */
+  pfd.fd = ptyfd;
+  while (!done) {
+    int timeout;
+
+    /* Sleep until data arrives or the next reply or report is due (or,
+       if the pty was full, until it can take more) */
+    t = now();
+    next = interval > 0 ? tlast + interval : -1;
+    if (qcount > 0 && !blocked && (next < 0 || queue[qhead].when < next))
+      next = queue[qhead].when;
+    if (runtime > 0 && (next < 0 || start + runtime < next))
+      next = start + runtime;
+    timeout = next < 0 ? -1 : next <= t ? 0 : (int) ((next - t) * 1000) + 1;
+    pfd.events = POLLIN | (blocked ? POLLOUT : 0);
+    if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) break;
+
+    /* Read requests and generate replies */
+    t = now();
+    while ((n = read(ptyfd, inbuf + len, sizeof(inbuf) - 1 - len)) > 0) {
+      bytes_in += n;
+      len += n;
+      inbuf[len] = '\0';
+      while ((nl = strchr(inbuf, '\n')) != NULL) {
+	*nl = '\0';
+	if (nl > inbuf && nl[-1] == '\r') nl[-1] = '\0';
+	++nreq;
+	if ((n = (*model)(inbuf, reply, SIMLEN - 1, t - start)) > 0) {
+	  if (n > SIMLEN - 2) n = SIMLEN - 2;
+	  reply[n++] = '\n';
+	  schedule(reply, n, t, latency, jitter, droprate);
+	}
+	len -= nl + 1 - inbuf;
+	memmove(inbuf, nl + 1, len + 1);
+      }
+      if (len == sizeof(inbuf) - 1) len = 0;	/* no newline; discard */
+    }
+
+    blocked = transmit(ptyfd, t);
+    if (interval > 0 && t >= tlast + interval) report(t, &tlast, 0);
+    if (runtime > 0 && t - start >= runtime) break;
+  }
+
+  report(now(), &tlast, 1);
+  close(slave);
+  if (link != NULL) unlink(link);
+  return 0;
+}
@@ -0,0 +1,154 @@
+/*!
+ * \file ptysimtst.c
+ * \brief test the serial device simulator
+ *
+ * \date 19 Oct 26
+ *
+ * Runs sparrow-ptysim with the echo model and talks to it through its
+ * pseudo terminal.  Checks that a burst of requests bigger than the
+ * pty buffer is answered completely and in order, that the simulator
+ * doesn't spin when the client closes the pty and that it answers a
+ * new client afterwards.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+#define TST_NAME "ptysimtst"
+#include "tstutil.h"
+
+#define NBURST 1000			/* requests in the burst */
+#define REQLEN 100			/* length of each request */
+
+/* Open the pty in raw mode */
+static int open_pty(char *name)
+{
+  struct termios term;
+  int fd;
+
+  if ((fd = open(name, O_RDWR | O_NOCTTY)) < 0) {
+    perror(name);
+    exit(1);
+  }
+  tcgetattr(fd, &term);
+  cfmakeraw(&term);
+  tcsetattr(fd, TCSANOW, &term);
+  return fd;
+}
+
+/* Read until len bytes have arrived or nothing comes for a second */
+static int read_all(int fd, char *buf, int len)
+{
+  struct pollfd pfd;
+  int n, got = 0;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (got < len && poll(&pfd, 1, 1000) > 0 &&
+	 (n = read(fd, buf + got, len - got)) > 0)
+    got += n;
+  return got;
+}
+
+/* Write a request of REQLEN bytes, including the newline */
+static void request(char *buf, int i)
+{
+  snprintf(buf, REQLEN, "%06d %0*d", i, REQLEN - 8, i);
+  buf[REQLEN - 1] = '\n';
+}
+
+/* CPU time used by a process, in clock ticks */
+static long cpu_ticks(pid_t pid)
+{
+  char file[64], line[1024], *p;
+  unsigned long utime, stime;
+  FILE *fp;
+
+  sprintf(file, "/proc/%d/stat", (int) pid);
+  if ((fp = fopen(file, "r")) == NULL) return -1;
+  p = fgets(line, sizeof(line), fp);
+  fclose(fp);
+  if (p == NULL || (p = strrchr(line, ')')) == NULL ||
+      sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	     &utime, &stime) != 2)
+    return -1;
+  return utime + stime;
+}
+
+int main(int argc, char **argv)
+{
+  char line[128], name[64], *out, *buf;
+  int fd, pfd[2], i, wstatus;
+  long ticks;
+  pid_t pid;
+  FILE *fp;
+
+  /* Start the simulator and get the name of its pty */
+  if (pipe(pfd) < 0 || (pid = fork()) < 0) {
+    perror("ptysimtst");
+    exit(1);
+  }
+  if (pid == 0) {
+    dup2(pfd[1], 1);
+    close(pfd[0]);
+    execl("./sparrow-ptysim", "sparrow-ptysim", "-m", "echo", "-r", "0",
+	  "-t", "30", (char *) NULL);
+    perror("sparrow-ptysim");
+    _exit(1);
+  }
+  close(pfd[1]);
+  fp = fdopen(pfd[0], "r");
+  if (fgets(line, sizeof(line), fp) == NULL ||
+      sscanf(line, "pty = %63s", name) != 1) {
+    fprintf(stderr, "ptysimtst: no pty from sparrow-ptysim\n");
+    kill(pid, SIGKILL);
+    exit(1);
+  }
+
+  /* One request */
+  fd = open_pty(name);
+  write(fd, "hello\n", 6);
+  check(read_all(fd, line, 6) == 6 && strncmp(line, "hello\n", 6) == 0,
+	"no echo");
+
+  /* A burst bigger than the pty will buffer, read after it is sent */
+  out = malloc(NBURST * REQLEN);
+  buf = malloc(NBURST * REQLEN);
+  for (i = 0; i < NBURST; ++i) request(out + i * REQLEN, i);
+  check(write(fd, out, NBURST * REQLEN) == NBURST * REQLEN, "burst not sent");
+  check(read_all(fd, buf, NBURST * REQLEN) == NBURST * REQLEN,
+	"burst replies missing");
+  check(memcmp(out, buf, NBURST * REQLEN) == 0, "burst replies garbled");
+  free(out);
+  free(buf);
+
+  /* The client goes away; the simulator should wait, not spin */
+  close(fd);
+  ticks = cpu_ticks(pid);
+  usleep(500000);
+  check(ticks >= 0 && cpu_ticks(pid) - ticks < sysconf(_SC_CLK_TCK) / 10,
+	"simulator busy after the pty was closed");
+
+  /* A new client */
+  fd = open_pty(name);
+  write(fd, "again\n", 6);
+  check(read_all(fd, line, 6) == 6 && strncmp(line, "again\n", 6) == 0,
+	"no echo after reopening");
+  close(fd);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, &wstatus, 0);
+  check(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0,
+	"sparrow-ptysim failed");
+  fclose(fp);
+  return status;
+}
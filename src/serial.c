@@ -0,0 +1,754 @@
+/*!
+ * \file serial.c
+ * \brief asynchronous serial device framework
+ *
+ * \date 19 Oct 26
+ *
+ * This file contains the I/O thread and support functions for serial
+ * device drivers.  A single thread services all of the serial ports
+ * using epoll: input is read in blocks as it arrives and split into
+ * frames, output is buffered and written when the port is ready, and
+ * each port can ask to be polled at a fixed period (typically to send
+ * the next request to the device).
+ *
+ * Requests sent with ser_request() are tracked by the framework.  Up
+ * to window requests can be outstanding at once; each has a sequence
+ * tag and a deadline.  Replies are matched to requests either in the
+ * order sent or, if the driver supplies a match function, by the tag
+ * in the reply.  Requests that are not answered in time are resent
+ * (up to retries times) and then given up on, at which point the
+ * driver's expire function is called so it can mark its data stale.
+ *
+ * Drivers exchange data with the servo loop using mailboxes
+ * (SER_MBOX), so that neither the servo nor the I/O thread ever waits
+ * for the other.  See sertest.c for an example.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "channel.h"
+#include "serial.h"
+#include "profile.h"
+
+/* I/O thread state */
+static int ser_epfd = -1;		/* epoll descriptor */
+static int ser_evfd = -1;		/* eventfd used by ser_kick */
+static pthread_t ser_thread;
+static pthread_mutex_t ser_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SER_PORT *ser_ports = NULL;	/* list of active ports */
+
+#define SER_MAXEVENTS 16
+
+/*! Current time in seconds (monotonic clock) */
+double ser_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*!
+ * \fn void ser_init(SER_PORT *sp)
+ * \brief initialize a port structure with default settings
+ * \ingroup channel
+ *
+ * The default settings are 9600 baud, 8 data bits, no parity, 1 stop
+ * bit, line framing, no periodic poll and one outstanding request
+ * with no timeout: a request waits for its reply however long it
+ * takes.  If -timeout is given, unanswered requests are resent once.
+ */
+void ser_init(SER_PORT *sp)
+{
+  memset(sp, 0, sizeof(SER_PORT));
+  sp->fd = -1;
+  sp->baud = 9600;
+  sp->parity = 'n';
+  sp->databits = 8;
+  sp->stopbits = 1;
+  sp->frame = ser_frame_line;
+  sp->window = 1;
+  sp->timeout = 0;
+  sp->retries = 1;
+}
+
+/*!
+ * \fn int ser_flag(SER_PORT *sp)
+ * \brief handle a serial port configuration flag
+ * \ingroup channel
+ *
+ * Called from the HandleFlag action of a driver to parse the flag in
+ * chn_flag_name and chn_flag_value.  The supported flags are
+ * -baud=rate, -parity=n|e|o, -databits=5..8, -stopbits=1|2,
+ * -period=usec, -window=n (outstanding requests), -timeout=usec and
+ * -retries=n.  Returns 1 if the flag was handled, -1 if the value
+ * was bad and 0 if the flag is not a serial port flag.
+ */
+int ser_flag(SER_PORT *sp)
+{
+  int ival;
+
+  if (strcmp(chn_flag_name, "baud") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival <= 0) return -1;
+    sp->baud = ival;
+
+  } else if (strcmp(chn_flag_name, "parity") == 0) {
+    if (strchr("neo", chn_flag_value[0]) == NULL || chn_flag_value[0] == '\0')
+      return -1;
+    sp->parity = chn_flag_value[0];
+
+  } else if (strcmp(chn_flag_name, "databits") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival < 5 || ival > 8)
+      return -1;
+    sp->databits = ival;
+
+  } else if (strcmp(chn_flag_name, "stopbits") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival < 1 || ival > 2)
+      return -1;
+    sp->stopbits = ival;
+
+  } else if (strcmp(chn_flag_name, "period") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival < 0) return -1;
+    sp->period = ival;
+
+  } else if (strcmp(chn_flag_name, "window") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival < 1 ||
+	ival > SER_MAXPENDING) return -1;
+    sp->window = ival;
+
+  } else if (strcmp(chn_flag_name, "timeout") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival < 0) return -1;
+    sp->timeout = ival;
+
+  } else if (strcmp(chn_flag_name, "retries") == 0) {
+    if (sscanf(chn_flag_value, "%d", &ival) != 1 || ival < 0) return -1;
+    sp->retries = ival;
+
+  } else
+    return 0;
+
+  return 1;
+}
+
+/* Convert a baud rate to a termios speed */
+static speed_t ser_speed(int baud)
+{
+  switch (baud) {
+  case 1200: return B1200;
+  case 2400: return B2400;
+  case 4800: return B4800;
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+#ifdef B460800
+  case 460800: return B460800;
+#endif
+#ifdef B921600
+  case 921600: return B921600;
+#endif
+  }
+  return B0;
+}
+
+/*!
+ * \fn int ser_configure(SER_PORT *sp)
+ * \brief set the terminal attributes of an open port
+ * \ingroup channel
+ *
+ * The port is put in raw mode with the baud rate, parity and
+ * character format given in the port structure.
+ */
+int ser_configure(SER_PORT *sp)
+{
+  struct termios term;
+  speed_t speed;
+
+  if ((speed = ser_speed(sp->baud)) == B0) {
+    fprintf(stderr, "ser_configure: %s: unsupported baud rate %d\n",
+	    sp->devname, sp->baud);
+    return -1;
+  }
+  if (tcgetattr(sp->fd, &term) < 0) {
+    perror("ser_configure");
+    return -1;
+  }
+
+  cfmakeraw(&term);
+  cfsetispeed(&term, speed);
+  cfsetospeed(&term, speed);
+
+  term.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+  term.c_cflag |= CLOCAL | CREAD;
+  switch (sp->databits) {
+  case 5: term.c_cflag |= CS5; break;
+  case 6: term.c_cflag |= CS6; break;
+  case 7: term.c_cflag |= CS7; break;
+  default: term.c_cflag |= CS8; break;
+  }
+  if (sp->parity == 'e') term.c_cflag |= PARENB;
+  if (sp->parity == 'o') term.c_cflag |= PARENB | PARODD;
+  if (sp->stopbits == 2) term.c_cflag |= CSTOPB;
+  term.c_cc[VMIN] = 1;			/* so read() returns EAGAIN, not 0 */
+  term.c_cc[VTIME] = 0;
+
+  if (tcsetattr(sp->fd, TCSANOW, &term) < 0) {
+    perror("ser_configure");
+    return -1;
+  }
+  return 0;
+}
+
+/*!
+ * \fn int ser_open(SER_PORT *sp, char *devname)
+ * \brief open and configure a serial port
+ * \ingroup channel
+ *
+ * The port is opened for non-blocking I/O.  Returns 0 on success or
+ * -1 on error.
+ */
+int ser_open(SER_PORT *sp, char *devname)
+{
+  strncpy(sp->devname, devname, SER_DEVLEN - 1);
+  sp->devname[SER_DEVLEN - 1] = '\0';
+
+  if ((sp->fd = open(sp->devname, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+    perror(sp->devname);
+    return -1;
+  }
+  if (isatty(sp->fd) && ser_configure(sp) < 0) {
+    close(sp->fd);
+    sp->fd = -1;
+    return -1;
+  }
+  sp->rlen = sp->wlen = 0;
+  memset(sp->req, 0, sizeof(sp->req));
+  sp->npending = 0;
+  sp->status = 0;
+  return 0;
+}
+
+/*!
+ * \fn int ser_frame_line(SER_PORT *sp, char *buf, int len)
+ * \brief default framing function: one frame per line
+ * \ingroup channel
+ *
+ * Returns the length of the first line in the buffer, including the
+ * newline, or 0 if there is no complete line.  A framing function
+ * for a binary protocol should do the same thing for its frames.
+ */
+int ser_frame_line(SER_PORT *sp, char *buf, int len)
+{
+  char *nl = (char *) memchr(buf, '\n', len);
+  return nl == NULL ? 0 : nl - buf + 1;
+}
+
+/* Find the request that a reply belongs to and mark it answered */
+static struct ser_request *ser_reply(SER_PORT *sp, int tag)
+{
+  struct ser_request *rp, *found = NULL;
+
+  /* Without a tag, the reply is for the oldest request */
+  for (rp = sp->req; rp < sp->req + SER_MAXPENDING; ++rp) {
+    if (!rp->active) continue;
+    if (tag >= 0 ? rp->tag == (unsigned) tag :
+	found == NULL || (int) (rp->tag - found->tag) < 0)
+      found = rp;
+  }
+  if (found != NULL) {
+    found->active = 0;
+    --sp->npending;
+  }
+  return found;
+}
+
+/* Pass a frame to the driver, along with the request it answers */
+static void ser_deliver(SER_PORT *sp, char *frame, int len)
+{
+  struct ser_request *rp;
+  int tag = -1;
+
+  ++sp->nframes;
+  if (sp->match != NULL) tag = (*sp->match)(sp, frame, len);
+
+  if ((rp = ser_reply(sp, tag)) != NULL) {
+    sp->rtag = rp->tag;
+    sp->rtt = ser_time() - rp->sent;
+  } else if (tag >= 0) {
+    ++sp->nlate;			/* request already gave up */
+    return;
+  } else {
+    sp->rtag = -1;			/* unsolicited data */
+    sp->rtt = 0;
+  }
+  if (sp->receive != NULL) (*sp->receive)(sp, frame, len);
+}
+
+/* Read data from a port and pass complete frames to the driver */
+static void ser_input(SER_PORT *sp)
+{
+  int n, flen, start;
+  PROF_BEGIN(t0);
+
+  while ((n = read(sp->fd, sp->rbuf + sp->rlen, SER_BUFSIZ - sp->rlen)) > 0) {
+    sp->rlen += n;
+
+    /* Process all of the complete frames in the buffer */
+    for (start = 0; start < sp->rlen &&
+	   (flen = (*sp->frame)(sp, sp->rbuf + start, sp->rlen - start)) > 0;
+	 start += flen) {
+      char save = sp->rbuf[start + flen];
+
+      /* Frames are passed to the driver null terminated */
+      sp->rbuf[start + flen] = '\0';
+      ser_deliver(sp, sp->rbuf + start, flen);
+      sp->rbuf[start + flen] = save;
+    }
+
+    /* Keep any partial frame; discard the buffer if it is full */
+    if (start > 0) memmove(sp->rbuf, sp->rbuf + start, sp->rlen - start);
+    sp->rlen -= start;
+    if (sp->rlen == SER_BUFSIZ) {
+      ++sp->overruns;
+      sp->rlen = 0;
+    }
+    if (sp->nopoll) break;		/* never runs dry */
+  }
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+    sp->status = -1;
+  PROF_END(PROF_SERIN, t0);
+}
+
+/* Write as much buffered output as the port will take */
+static void ser_output(SER_PORT *sp)
+{
+  struct epoll_event ev;
+  int n;
+  PROF_BEGIN(t0);
+
+  while (sp->wlen > 0 && (n = write(sp->fd, sp->wbuf, sp->wlen)) > 0) {
+    memmove(sp->wbuf, sp->wbuf + n, sp->wlen - n);
+    sp->wlen -= n;
+  }
+
+  /* Only ask to be told when the port is writable if we have data */
+  if (sp->nopoll) return;
+  ev.events = EPOLLIN | (sp->wlen > 0 ? EPOLLOUT : 0);
+  ev.data.ptr = sp;
+  epoll_ctl(ser_epfd, EPOLL_CTL_MOD, sp->fd, &ev);
+  PROF_END(PROF_SEROUT, t0);
+}
+
+/*!
+ * \fn int ser_send(SER_PORT *sp, char *buf, int len)
+ * \brief send data to a port
+ * \ingroup channel
+ *
+ * Should only be called from the I/O thread (ie, from one of the
+ * port callbacks).  The data is written immediately if possible and
+ * otherwise buffered.  Returns -1 if there is no room in the buffer.
+ */
+int ser_send(SER_PORT *sp, char *buf, int len)
+{
+  if (sp->fd < 0 || sp->wlen + len > SER_BUFSIZ) return -1;
+  memcpy(sp->wbuf + sp->wlen, buf, len);
+  sp->wlen += len;
+  ser_output(sp);
+  return 0;
+}
+
+/*!
+ * \fn unsigned ser_tag(SER_PORT *sp)
+ * \brief get the tag that the next request will be given
+ * \ingroup channel
+ *
+ * Drivers for devices that echo a sequence number should put this
+ * number in the request passed to ser_request().
+ */
+unsigned ser_tag(SER_PORT *sp)
+{
+  return sp->seq + 1;
+}
+
+/*!
+ * \fn int ser_request(SER_PORT *sp, char *buf, int len)
+ * \brief send a request that expects a reply
+ * \ingroup channel
+ *
+ * Like ser_send(), but the request is tracked until a reply arrives
+ * or its deadline passes.  Should only be called from the I/O
+ * thread.  Returns the tag of the request, or -1 if the maximum
+ * number of requests are already outstanding (or the request can't
+ * be sent).
+ */
+int ser_request(SER_PORT *sp, char *buf, int len)
+{
+  struct ser_request *rp;
+  double now = ser_time();
+
+  if (sp->npending >= sp->window || len > SER_REQLEN ||
+      ser_send(sp, buf, len) < 0)
+    return -1;
+
+  for (rp = sp->req; rp->active; ++rp);	/* npending < SER_MAXPENDING */
+  rp->tag = ++sp->seq;
+  rp->active = 1;
+  rp->retries = 0;
+  rp->sent = now;
+  rp->deadline = sp->timeout > 0 ? now + sp->timeout * 1e-6 : 0;
+  rp->len = len;
+  memcpy(rp->msg, buf, len);
+  ++sp->npending;
+  return rp->tag;
+}
+
+/* Resend or give up on requests that are past their deadline */
+static void ser_expire(SER_PORT *sp, double now)
+{
+  struct ser_request *rp;
+
+  for (rp = sp->req; rp < sp->req + SER_MAXPENDING; ++rp) {
+    if (!rp->active || rp->deadline == 0 || rp->deadline > now) continue;
+
+    if (rp->retries < sp->retries) {
+      ++rp->retries;
+      ++sp->nretries;
+      rp->sent = now;
+      rp->deadline = now + sp->timeout * 1e-6;
+      ser_send(sp, rp->msg, rp->len);
+
+    } else {
+      ++sp->ntimeouts;
+      rp->active = 0;
+      --sp->npending;
+      if (sp->expire != NULL) (*sp->expire)(sp, rp->tag);
+    }
+  }
+}
+
+/* Earliest deadline of the outstanding requests (or -1) */
+static double ser_deadline(SER_PORT *sp)
+{
+  struct ser_request *rp;
+  double next = -1;
+
+  for (rp = sp->req; rp < sp->req + SER_MAXPENDING; ++rp) {
+    if (rp->active && rp->deadline > 0 && (next < 0 || rp->deadline < next))
+      next = rp->deadline;
+  }
+  return next;
+}
+
+/*!
+ * \fn void ser_kick(SER_PORT *sp)
+ * \brief ask the I/O thread to call the poll function for a port
+ * \ingroup channel
+ *
+ * This can be called from any thread (including the servo routine)
+ * and does not block.
+ */
+void ser_kick(SER_PORT *sp)
+{
+  uint64_t one = 1;
+
+  __atomic_store_n(&sp->kick, 1, __ATOMIC_RELEASE);
+  if (ser_evfd >= 0 && write(ser_evfd, &one, sizeof(one)) < 0) {
+    /* counter is already nonzero; the thread will wake up anyway */
+  }
+}
+
+/* Poll a port and schedule the next poll */
+static void ser_poll(SER_PORT *sp, double now)
+{
+  if (sp->poll != NULL) (*sp->poll)(sp);
+  if (sp->period > 0) {
+    sp->next += sp->period * 1e-6;
+    if (sp->next < now) sp->next = now + sp->period * 1e-6;
+  }
+}
+
+/*
+ * I/O thread: service all of the active ports.  The thread keeps the
+ * descriptors it was started with and exits once ser_close() has
+ * closed the last port and taken them away.
+ */
+static void *ser_io(void *arg)
+{
+  struct epoll_event events[SER_MAXEVENTS];
+  SER_PORT *sp;
+  double now, next;
+  int i, n, timeout, epfd, evfd;
+  uint64_t count;
+
+  prof_trace_thread("serial I/O");
+  pthread_mutex_lock(&ser_mutex);
+  epfd = ser_epfd;
+  evfd = ser_evfd;
+  pthread_mutex_unlock(&ser_mutex);
+
+  while (1) {
+    /* Figure out how long until the next poll or request deadline */
+    pthread_mutex_lock(&ser_mutex);
+    if (ser_epfd != epfd) {
+      pthread_mutex_unlock(&ser_mutex);
+      break;
+    }
+    now = ser_time();
+    for (next = -1, sp = ser_ports; sp != NULL; sp = sp->link) {
+      double deadline = ser_deadline(sp);
+      if (sp->period > 0 && (next < 0 || sp->next < next)) next = sp->next;
+      if (deadline > 0 && (next < 0 || deadline < next)) next = deadline;
+    }
+    timeout = next < 0 ? -1 : next <= now ? 0 : (int) ((next - now) * 1000) + 1;
+    for (sp = ser_ports; sp != NULL; sp = sp->link)
+      if (sp->nopoll && sp->status == 0 && (timeout < 0 || timeout > SER_NOPOLL))
+	timeout = SER_NOPOLL;
+    pthread_mutex_unlock(&ser_mutex);
+
+    if ((n = epoll_wait(epfd, events, SER_MAXEVENTS, timeout)) < 0 &&
+	errno != EINTR) {
+      perror("ser_io");
+      break;
+    }
+
+    pthread_mutex_lock(&ser_mutex);
+    if (ser_epfd != epfd) {
+      pthread_mutex_unlock(&ser_mutex);
+      break;
+    }
+    for (i = 0; i < n; ++i) {
+      if (events[i].data.ptr == NULL) {
+	/* ser_kick(); check all ports below */
+	if (read(evfd, &count, sizeof(count)) < 0) continue;
+	continue;
+      }
+      sp = (SER_PORT *) events[i].data.ptr;
+      if (sp->fd < 0) continue;
+
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ser_input(sp);
+      if (events[i].events & EPOLLOUT) ser_output(sp);
+
+      /* Stop listening to ports that have failed */
+      if (sp->status < 0) epoll_ctl(epfd, EPOLL_CTL_DEL, sp->fd, NULL);
+    }
+
+    /* Request timeouts, periodic and requested polls */
+    now = ser_time();
+    for (sp = ser_ports; sp != NULL; sp = sp->link) {
+      if (sp->status < 0) continue;
+      if (sp->nopoll) {
+	ser_input(sp);
+	ser_output(sp);
+      }
+      ser_expire(sp, now);
+      if (__atomic_exchange_n(&sp->kick, 0, __ATOMIC_ACQ_REL) ||
+	  (sp->period > 0 && sp->next <= now))
+	ser_poll(sp, now);
+    }
+    pthread_mutex_unlock(&ser_mutex);
+  }
+  return NULL;
+}
+
+/*!
+ * \fn int ser_start(SER_PORT *sp)
+ * \brief start servicing a port in the I/O thread
+ * \ingroup channel
+ *
+ * The I/O thread is created when the first port is started.
+ * The poll function for the port is called once when it is started.
+ * Files that epoll can't watch (such as /dev/zero) are read and
+ * written every SER_NOPOLL msec instead.
+ */
+int ser_start(SER_PORT *sp)
+{
+  struct epoll_event ev;
+  int status = 0;
+
+  if (sp->fd < 0) return -1;
+  pthread_mutex_lock(&ser_mutex);
+
+  /* Start up the I/O thread if it isn't running */
+  if (ser_epfd < 0) {
+    if ((ser_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	(ser_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+      perror("ser_start");
+      if (ser_epfd >= 0) close(ser_epfd);
+      ser_epfd = -1;
+      pthread_mutex_unlock(&ser_mutex);
+      return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(ser_epfd, EPOLL_CTL_ADD, ser_evfd, &ev);
+    if (pthread_create(&ser_thread, NULL, ser_io, NULL) != 0) {
+      perror("ser_start");
+      close(ser_epfd);
+      close(ser_evfd);
+      ser_epfd = ser_evfd = -1;
+      pthread_mutex_unlock(&ser_mutex);
+      return -1;
+    }
+  }
+
+  /* Add the port to the list and to the epoll set */
+  ev.events = EPOLLIN;
+  ev.data.ptr = sp;
+  sp->nopoll = 0;
+  if (epoll_ctl(ser_epfd, EPOLL_CTL_ADD, sp->fd, &ev) < 0) {
+    if (errno == EPERM)
+      sp->nopoll = 1;			/* read and written in ser_io */
+    else {
+      perror("ser_start");
+      status = -1;
+    }
+  }
+  if (status == 0) {
+    sp->link = ser_ports;
+    ser_ports = sp;
+    sp->kick = 1;
+    sp->next = ser_time();
+  }
+  pthread_mutex_unlock(&ser_mutex);
+
+  /* Wake up the thread so that it polls the new port */
+  if (status == 0) ser_kick(sp);
+  return status;
+}
+
+/*!
+ * \fn void ser_close(SER_PORT *sp)
+ * \brief stop servicing a port and close it
+ * \ingroup channel
+ *
+ * When the last port is closed the I/O thread is stopped; the next
+ * call to ser_start() starts a new one.
+ */
+void ser_close(SER_PORT *sp)
+{
+  SER_PORT **spp;
+  pthread_t thread;
+  int epfd = -1, evfd = -1;
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&ser_mutex);
+  for (spp = &ser_ports; *spp != NULL; spp = &(*spp)->link)
+    if (*spp == sp) {
+      *spp = sp->link;
+      if (sp->fd >= 0) epoll_ctl(ser_epfd, EPOLL_CTL_DEL, sp->fd, NULL);
+      break;
+    }
+  if (sp->fd >= 0) close(sp->fd);
+  sp->fd = -1;
+
+  /* Take the descriptors away from the thread if it has nothing to do */
+  if (ser_ports == NULL && ser_epfd >= 0) {
+    epfd = ser_epfd;
+    evfd = ser_evfd;
+    thread = ser_thread;
+    ser_epfd = ser_evfd = -1;
+  }
+  pthread_mutex_unlock(&ser_mutex);
+
+  if (epfd >= 0) {
+    if (write(evfd, &one, sizeof(one)) < 0) {
+      /* already woken up */
+    }
+    pthread_join(thread, NULL);
+    close(epfd);
+    close(evfd);
+  }
+}
+
+/*!
+ * \fn void ser_mbox_put(SER_MBOX *mp, double *val, int n)
+ * \brief store values in a mailbox
+ * \ingroup channel
+ *
+ * Only one thread should write to a given mailbox.  The update is
+ * made visible to readers all at once.
+ */
+void ser_mbox_put(SER_MBOX *mp, double *val, int n)
+{
+  unsigned seq = mp->seq;
+  int i;
+
+  if (n > SER_MBOXLEN) n = SER_MBOXLEN;
+  __atomic_store_n(&mp->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (i = 0; i < n; ++i)
+    __atomic_store(&mp->val[i], &val[i], __ATOMIC_RELAXED);
+  __atomic_store_n(&mp->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \fn unsigned ser_mbox_get(SER_MBOX *mp, double *val, int n)
+ * \brief get the latest values from a mailbox
+ * \ingroup channel
+ *
+ * Returns the number of times the mailbox has been written, so the
+ * caller can tell whether the values have changed since it last
+ * looked.  Never blocks the writer; if an update is in progress the
+ * reader tries again.
+ */
+unsigned ser_mbox_get(SER_MBOX *mp, double *val, int n)
+{
+  unsigned seq;
+  int i;
+
+  if (n > SER_MBOXLEN) n = SER_MBOXLEN;
+  do {
+    while ((seq = __atomic_load_n(&mp->seq, __ATOMIC_ACQUIRE)) & 1);
+    for (i = 0; i < n; ++i)
+      __atomic_load(&mp->val[i], &val[i], __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&mp->seq, __ATOMIC_RELAXED) != seq);
+  return seq / 2;
+}
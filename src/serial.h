@@ -0,0 +1,163 @@
+/*!
+ * \file serial.h
+ * \brief asynchronous serial device support
+ *
+ * \date 19 Oct 26
+ *
+ * Header file for the serial device framework.  All serial ports are
+ * serviced by a single I/O thread, which reads data as it arrives,
+ * splits it into frames (lines by default) and passes each frame to
+ * the driver.  Data is exchanged with the servo loop through
+ * mailboxes, which never block either side.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#ifndef __SERIAL_INCLUDED__
+#define __SERIAL_INCLUDED__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SER_BUFSIZ 512			/* size of read/write buffers */
+#define SER_DEVLEN 64			/* max length of device path */
+#define SER_MAXPENDING 16		/* max outstanding requests */
+#define SER_REQLEN 64			/* max length of a request */
+#define SER_NOPOLL 10			/* msec between reads of files
+					   that can't be polled */
+
+/* Outstanding request (see ser_request) */
+struct ser_request {
+  unsigned tag;				/* sequence number of request */
+  int active;				/* waiting for a reply */
+  int retries;				/* number of times resent */
+  double sent, deadline;		/* time sent, time to give up */
+  int len;				/* length of the message */
+  char msg[SER_REQLEN];			/* message (kept for retries) */
+};
+
+/*!
+ * \struct ser_port
+ * \brief serial port serviced by the I/O thread
+ *
+ * The driver fills in the callbacks and settings (normally using
+ * ser_init() and ser_flag()) and then calls ser_open() and
+ * ser_start().  The callbacks are all called from the I/O thread.
+ */
+typedef struct ser_port SER_PORT;
+struct ser_port {
+  int fd;				/* file descriptor (-1 if closed) */
+  char devname[SER_DEVLEN];		/* device path */
+
+  /* Port settings (see ser_flag) */
+  int baud;				/* baud rate */
+  char parity;				/* 'n', 'e' or 'o' */
+  int databits, stopbits;		/* character format */
+  long period;				/* poll period (usec); 0 = none */
+  int window;				/* max outstanding requests */
+  long timeout;				/* request timeout (usec); 0 = none */
+  int retries;				/* times to resend a request */
+
+  /* Callbacks */
+  int (*frame)(SER_PORT *, char *, int); /* length of next frame or 0 */
+  void (*receive)(SER_PORT *, char *, int); /* process a frame */
+  void (*poll)(SER_PORT *);		/* time to send a request */
+  int (*match)(SER_PORT *, char *, int); /* tag of a reply or -1 */
+  void (*expire)(SER_PORT *, unsigned);	/* request timed out */
+  void *userarg;			/* data for callbacks */
+
+  /* Reply being processed (valid in the receive callback) */
+  int rtag;				/* tag of request, -1 if unsolicited */
+  double rtt;				/* round trip time (sec) */
+
+  /* Status */
+  int status;				/* 0 = OK, -1 = I/O error */
+  unsigned long nframes;		/* frames received */
+  unsigned long overruns;		/* input discarded (no frame) */
+  unsigned long nretries;		/* requests resent */
+  unsigned long ntimeouts;		/* requests given up on */
+  unsigned long nlate;			/* replies to expired requests */
+
+  /* Internal data used by the I/O thread */
+  char rbuf[SER_BUFSIZ + 1], wbuf[SER_BUFSIZ];
+  int rlen, wlen;
+  int kick;				/* poll requested by ser_kick() */
+  int nopoll;				/* fd can't be polled (/dev/zero) */
+  struct ser_request req[SER_MAXPENDING]; /* outstanding requests */
+  int npending;				/* requests waiting for replies */
+  unsigned seq;				/* tag of the last request */
+  double next;				/* time of next poll */
+  SER_PORT *link;			/* list of active ports */
+};
+
+/* Port setup and control */
+void ser_init(SER_PORT *);
+int ser_flag(SER_PORT *);
+int ser_open(SER_PORT *, char *devname);
+int ser_configure(SER_PORT *);
+int ser_start(SER_PORT *);
+int ser_send(SER_PORT *, char *buf, int len);
+unsigned ser_tag(SER_PORT *);
+int ser_request(SER_PORT *, char *buf, int len);
+void ser_kick(SER_PORT *);
+void ser_close(SER_PORT *);
+int ser_frame_line(SER_PORT *, char *, int);
+double ser_time(void);
+
+/*!
+ * \struct ser_mbox
+ * \brief single writer mailbox holding the latest set of values
+ *
+ * ser_mbox_put() and ser_mbox_get() can be called from different
+ * threads without any locking.  There should be only one writer.
+ */
+#define SER_MBOXLEN 8
+typedef struct ser_mbox {
+  unsigned seq;				/* update count, odd during update */
+  double val[SER_MBOXLEN];
+} SER_MBOX;
+
+void ser_mbox_put(SER_MBOX *, double *val, int n);
+unsigned ser_mbox_get(SER_MBOX *, double *val, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SERIAL_INCLUDED__ */
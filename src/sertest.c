@@ -25,6 +25,20 @@
  * status bit is currently defined as the number of times the a value
  * has been read from the serial port.
  *
+ * The driver uses the serial device framework in serial.c: all of
+ * the reading and writing is done by the serial I/O thread and data
+ * is passed to and from the servo loop through mailboxes.  A new
+ * value is requested as soon as a reply arrives, unless the -period
+ * flag is used to set a fixed request rate.  The port settings can be
+ * given as flags (-baud, -parity, -databits, -stopbits, -window,
+ * -timeout, -retries) on the device line or on channel 0.  There is
+ * no timeout by default, so with ptycat each request waits until a
+ * number is typed in reply.  With the
+ * -tagged flag each request is prefixed with its sequence number,
+ * which the device is expected to echo at the start of its reply.
+ * If the device stops answering, the read and status channels are
+ * marked stale.
+ *
  * This driver serves an example of how to implement a serial device
  * driver and also a serves as a test driver for chntest.
  *
@@ -65,23 +79,20 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>			/* file access types */
-#include <pthread.h>			/* process thread library */
-#include <string.h>			/* need for atof */
+#include <string.h>
 #include <stdarg.h>			/* variable arguments */
-#include <termios.h>
 #include "channel.h"			/* channel structure definitions */
+#include "serial.h"			/* serial device framework */
 #include "flag.h"
 
 /* 
  * Device-specific channel data
  *
  * This structure is used to store data that is specific to the
- * device.  We create a copy of the file pointer, the thread process,
- * and buffers for the output, input and status values.  While Sparrow
- * generally allows a device-dependent structure for each channel,
- * here we will only associate this with the first channel.
+ * device.  We keep the serial port and mailboxes for the output and
+ * for the input and status values.  While Sparrow generally allows a
+ * device-dependent structure for each channel, here we will only
+ * associate this with the first channel.
  *
  * Putting this information into the device specific data structure
  * allows multiple serial devices to use the same driver.
@@ -89,45 +100,56 @@
  */
 
 struct sertest_sp {
-  int sfd; 				/* file descriptor for input */
-  pthread_t ser_thread;			/* read/write process thread */
-  double obuf;				/* buffered output */
-  double ibuf;				/* buffered input */
-  double sbuf;				/* buffered status */
-  pthread_mutex_t sermutex;		/* mutually exclusive access */
+  SER_PORT port;			/* serial port */
+  SER_MBOX out;				/* output value (servo -> port) */
+  SER_MBOX in;				/* input, status, stale (port -> servo) */
+  double count;				/* number of replies received */
 };
 
 /*
  * Function and variable declarations
  *
- * Declare the thread that is used to read and write from the device
+ * The request and receive functions are called by the serial I/O
+ * thread.  Port settings given on the device line are saved in
+ * sertest_settings until the channels are created.
  */
 
-void *sertest_rw(void *);		/* read/write thread */
+static void sertest_request(SER_PORT *);
+static void sertest_fill(SER_PORT *);
+static int sertest_send(SER_PORT *);
+static void sertest_receive(SER_PORT *, char *, int);
+static void sertest_expire(SER_PORT *, unsigned);
+static int sertest_match(SER_PORT *, char *, int);
+static SER_PORT sertest_settings;
+static int sertest_settings_init = 0;
 int ser_debug = 0;			/* set to turn on debugging info */
 
 /*
  * Device driver routine
  *
- * This is a standard Sparrow device driver.  On Init, it creates a
- * thread that is used to actually talk to the device.  This allows
- * writes and reads to the serial port to be done without blocking.
- * The buffers that are part of the device specific data structure are
- * used to pass data back and forth, in principle so that we can
- * implent mutually exclusive access (not yet done).
+ * This is a standard Sparrow device driver.  On Init, it opens the
+ * port and hands it to the serial I/O thread, which talks to the
+ * device.  This allows writes and reads to the serial port to be done
+ * without blocking.  The mailboxes that are part of the device
+ * specific data structure are used to pass data back and forth.
  *
  */
 
 int sertest_driver(DEV_ACTION action, ...)
 {
-  int i, status = 0;
+  int status = 0;
+  double val[3];
   va_list ap;
 
   va_start(ap, action);
   DEVICE *dp = va_arg(ap, DEVICE *);
   CHANNEL *cp = va_arg(ap, CHANNEL *);
   struct sertest_sp *sp = (struct sertest_sp *) cp->dev_sp;
-  FILE *cfp;
+
+  if (!sertest_settings_init) {
+    ser_init(&sertest_settings);
+    sertest_settings_init = 1;
+  }
 
   switch (action) {
 
@@ -137,75 +159,70 @@ int sertest_driver(DEV_ACTION action, ...)
      *
      * This action is called during channel configuration and should
      * be used to create the data structures associated with the
-     * device and with the channels.  For now, all we do is create the
-     * device specific data structure and assign it to channel 0.
+     * device and with the channels.  We create the device specific
+     * data structure, assign it to channel 0 and copy in the port
+     * settings from the device line.
      *
      */
     if (cp->dev_sp != NULL) free(cp->dev_sp);
-    cp->dev_sp = (struct sertest_sp *) malloc(sizeof(struct sertest_sp));
-    ((struct sertest_sp *)(cp->dev_sp))->sfd = -1;
+    if ((sp = (struct sertest_sp *) calloc(1, sizeof(struct sertest_sp)))
+	== NULL) {
+      status = -1;
+      break;
+    }
+    sp->port = sertest_settings;
+    sp->port.receive = sertest_receive;
+    sp->port.poll = sertest_request;
+    sp->port.expire = sertest_expire;
+    sp->port.userarg = sp;
+    cp->dev_sp = sp;
+    ser_init(&sertest_settings);		/* reset for next device */
     break;
 
-  case HandleFlag:			/* no supported flags */
+  case HandleFlag:
     /* 
      * Parse configuration options
      *
-     * This version of the driver currently doesn't allow any optoins,
-     * but this is where you could put things like baud rate and other
-     * serial port settions for the channel.
-     *
-     * This should eventually be used to parse baud rate and other
-     * settings, including whether to turn on debugging info.
+     * The serial port settings are handled by ser_flag().  Flags on
+     * the device line are saved until the channels are created;
+     * flags on channel 0 change the port directly.
      *
      */
-    status = -1;
+    {
+      SER_PORT *port = chn_flag_type == Device ? &sertest_settings :
+	cp->chnid == 0 && sp != NULL ? &sp->port : NULL;
+
+      if (port == NULL) break;
+      if (strcmp(chn_flag_name, "tagged") == 0) {
+	port->match = sertest_match;
+	status = 1;
+      } else
+	status = ser_flag(port);
+    }
     break;
 
   case Init:				/* initialize driver */
     /*
-     * Initialize the driver (and read R/W thread)
+     * Initialize the driver
      *
      * This action is called after the configuration options have been
      * parsed and the various data structures initialized.  The main
      * function of this block of code is to open up the serial port
-     * for read/write access and start the process thread that will
-     * read and write from the device.
-     *
-     * The port is opened using non-buffered I/O, so that all reads
-     * and writes are synchronous with the device.
-     *
-     * TBD: add more error checking
+     * for read/write access and hand it to the I/O thread.
      *
      */
-    {
-      FILE *fp;				/* file pointer for device */
-      struct termios term;		/* use to set term attributes */
-
-      /* Initialize data buffers */
-      sp->ibuf = sp->obuf = sp->sbuf = 0;
-      /* for(i=0; i<dp->size; ++i){ cp[i].data.d = 0; } */
-
-      /* Open the indicated device for reading and writing */
-      if (dp->devname[0] != '\0') {
-	if ((sp->sfd = open(dp->devname, O_RDWR)) < 0) {
-	  perror("sertest");
-	  status = -1;
-	}
+    memset(&sp->in, 0, sizeof(SER_MBOX));
+    memset(&sp->out, 0, sizeof(SER_MBOX));
+    sp->count = 0;
+    val[0] = val[1] = 0;
+    val[2] = 1;				/* stale until the first reply */
+    ser_mbox_put(&sp->in, val, 3);
+
+    if (dp->devname[0] != '\0') {
+      if (ser_open(&sp->port, dp->devname) < 0 || ser_start(&sp->port) < 0) {
+	ser_close(&sp->port);
+	status = -1;
       }
-
-      /* Set up the terminal for raw interface */
-      cfmakeraw(&term);
-      tcsetattr(sp->sfd, TCSANOW, &term);
-    }
-     
-    /* Create a mutex to synchronize data access */
-    pthread_mutex_init(&sp->sermutex, NULL);
-
-    /* Now create a thread to read and write data */
-    if (pthread_create(&(((struct sertest_sp *)(cp->dev_sp))->ser_thread),
-		       NULL, sertest_rw, (void *) cp) != 0) {
-      perror("sertest");
-      status = -1;
     }
     break;
 
@@ -213,100 +230,150 @@ int sertest_driver(DEV_ACTION action, ...)
      * Read/Write actions
      *
      * The Read and Write actions just move data back and forth from
-     * the buffers.
+     * the mailboxes.
      */
 
-  case Write:		    /* Store data in buffer for later usage */
+  case Write:		    /* Store data in mailbox for later usage */
     /* TBD: we should probably convert units here */
-    pthread_mutex_lock(&sp->sermutex);
-    sp->obuf = cp[0].data.d;
-    pthread_mutex_unlock(&sp->sermutex);
+    ser_mbox_put(&sp->out, &cp[0].data.d, 1);
     break;
 
-  case Read: 				/* Copy data from buffer */
+  case Read: 				/* Copy data from mailbox */
     {
       static int count;
 
+      ser_mbox_get(&sp->in, val, 3);
+      if (sp->port.fd < 0 || sp->port.status < 0) val[1] = -1;
+
       /* If a read channel is declared, copy data to it */
-      pthread_mutex_lock(&sp->sermutex);
-      if (dp->size > 1)
-	cp[1].data.d = (double) sp->ibuf + (double) (count++ % 1000) / 1000;
+      if (dp->size > 1) {
+	cp[1].data.d = val[0] + (double) (count++ % 1000) / 1000;
+	cp[1].stale = val[2] != 0;
+      }
 
       /* If a status channel is declared, copy data to it */
-      if (dp->size > 2)
-	cp[2].data.d = sp->sbuf;
-      pthread_mutex_unlock(&sp->sermutex);
+      if (dp->size > 2) {
+	cp[2].data.d = val[1];
+	cp[2].stale = val[2] != 0;
+      }
 
       break; 
     }
     
   case Close:
+    if (sp != NULL) ser_close(&sp->port);
+    break;
+
+  default:
     break;
-  
   }
 
   va_end(ap);
   return status;
-  }
+}
 
 /*
- * sertest_rw - thread to read and write from serial device
+ * sertest_request - send the latest output value to the device
  *
- * This thread continuously writes the latest value of the output to
- * the device and reads back information from the device.  The status
- * of the device is just set to the value of a counter.
+ * Called by the I/O thread when the port is started and at the
+ * polling period (if set).  Without a period, the driver keeps as
+ * many requests outstanding as the port allows (see sertest_fill).
  *
  * For more complete drivers, this is the location where you send
- * commands to the device and read back the current value of the
- * device (eg, its positions, if this is a motor) and the status of
- * the device.  Note that in the version presented here, we always
- * read from the device, even if we only have a write channel.
+ * commands to the device.  Note that in the version presented here,
+ * we always read from the device, even if we only have a write
+ * channel.
+ */
+
+static void sertest_request(SER_PORT *port)
+{
+  if (port->period == 0) {
+    sertest_fill(port);
+    return;
+  }
+
+  if (ser_debug) flag(0, 'o', 0);
+  if (sertest_send(port) < 0 && ser_debug)
+    fprintf(stderr, "sertest: request not sent\n");
+  if (ser_debug) flag(0, 'O', 0);
+}
+
+/* Send requests until the maximum number are outstanding */
+static void sertest_fill(SER_PORT *port)
+{
+  while (port->npending < port->window && sertest_send(port) >= 0);
+}
+
+/* Send the current output value (with a tag if requested) */
+static int sertest_send(SER_PORT *port)
+{
+  struct sertest_sp *sp = (struct sertest_sp *) port->userarg;
+  char msg[SER_REQLEN];
+  double obuf;
+  int len;
+
+  ser_mbox_get(&sp->out, &obuf, 1);
+  if (port->match != NULL)
+    len = snprintf(msg, sizeof(msg), "%u %g\n", ser_tag(port), obuf);
+  else
+    len = snprintf(msg, sizeof(msg), "%g\n", obuf);
+  return ser_request(port, msg, len);
+}
+
+/*
+ * sertest_receive - process a reply from the device
  *
- * For now, this device always reads and writes from the device,
- * independent of the number of channels that are declared.  The real
- * way to do this depends on the specific device that is being used.
- * 
+ * Called by the I/O thread with each line that is read from the
+ * device.  The value and the number of replies so far are posted to
+ * the input mailbox for the servo loop.  The status of the device is
+ * just set to the value of a counter.
  */
 
-void *sertest_rw(void *ptr)
+static void sertest_receive(SER_PORT *port, char *msg, int len)
 {
-  CHANNEL *cp = (CHANNEL *) ptr;
-  struct sertest_sp *sp = (struct sertest_sp *) cp->dev_sp;
-  static int count = 0;			/* keep track of # of calls */
+  struct sertest_sp *sp = (struct sertest_sp *) port->userarg;
+  double val[3];
 
-  while (1) {
-    int sfd = ((struct sertest_sp *)(cp[0].dev_sp))->sfd;
+  if (ser_debug) flag(0, 'i', 0);
 
-    if (sfd >= 0) {
-      char msg[128];
+  /* Skip over the tag if there is one */
+  if (port->match != NULL) strtoul(msg, &msg, 10);
 
-      /* Write the data to the port */
-      if (ser_debug) flag(0, 'o', 0);
-      sprintf(msg, "%g\n", sp->obuf);
-      if (write(sfd, msg, strlen(msg)) < 0) perror("write()");
-      if (ser_debug) flag(0, 'O', 0);
+  val[0] = strtod(msg, NULL);
+  val[1] = ++sp->count;
+  val[2] = 0;				/* data is fresh */
+  ser_mbox_put(&sp->in, val, 3);
+  if (ser_debug) flag(0, 'I', 0);
 
-      /* Read the data from the port and save its status */
-      if (ser_debug) flag(0, 'i', 0);
-      int i = 0;
-      while (read(sfd, msg+i, 1) >= 0 && i < 127 && msg[i] != '\n') ++i;
-      msg[i+1] = '\0';
-      if (ser_debug) flag(0, 'I', 0);
+  /* Ask for the next value right away unless we are polling */
+  if (port->period == 0) sertest_fill(port);
+}
 
-      pthread_mutex_lock(&sp->sermutex);
-      sp->ibuf = atof(msg);
+/*
+ * sertest_expire - a request was not answered
+ *
+ * Marks the data stale (keeping the last value) and, if we are not
+ * polling, sends another request so we notice when the device comes
+ * back.
+ */
 
-      /* Update status count */
-      sp->sbuf = ++count;
+static void sertest_expire(SER_PORT *port, unsigned tag)
+{
+  struct sertest_sp *sp = (struct sertest_sp *) port->userarg;
+  double val[3];
 
-      pthread_mutex_unlock(&sp->sermutex);
+  ser_mbox_get(&sp->in, val, 3);
+  val[2] = 1;
+  ser_mbox_put(&sp->in, val, 3);
 
-    } else 
-      sp->sbuf = -1;
+  if (port->period == 0) sertest_fill(port);
+}
 
-    /* Sleep for a bit to let the computer get other things done */
-    usleep(10000);
-  }
+/* Get the tag from the start of a reply */
+static int sertest_match(SER_PORT *port, char *msg, int len)
+{
+  char *end;
+  unsigned long tag = strtoul(msg, &end, 10);
 
-  return NULL;
+  return end == msg ? -1 : (int) tag;
 }
@@ -0,0 +1,216 @@
+/*!
+ * \file sertst.c
+ * \brief test the serial device framework using a pseudo terminal
+ *
+ * \date 19 Oct 26
+ *
+ * Creates a pseudo terminal and runs a thread on the master side that
+ * plays the part of a device: it reads numbers, one per line, and
+ * replies with the number plus one.  A sertest device is configured
+ * on the slave side and the servo side of the driver is exercised by
+ * calling chn_write() and chn_read().  The test checks that replies
+ * come back and that they arrive faster than the old 100 Hz limit,
+ * that pipelined and tagged requests work when the device drops some
+ * of them and that the channels are marked stale when the device
+ * stops answering (and fresh again when it comes back).  Finally a
+ * device on /dev/zero, which can't be polled, is checked to run
+ * without errors, and the I/O thread is checked to have stopped once
+ * the last port is closed.
+ *
+ * \ingroup channel
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <termios.h>
+#include <dirent.h>
+#include "channel.h"
+#include "serial.h"
+
+#define TST_NAME "sertst"
+#include "tstutil.h"
+
+static int master;			/* master side of the pty */
+static volatile int drop = 0;		/* ignore every drop'th request */
+static volatile int silent = 0;		/* ignore all requests */
+
+/* Device stand in: reply to each line with the value plus one */
+static void *device(void *arg)
+{
+  int n, len = 0, nreq = 0;
+  char buf[256], reply[64], *nl;
+  unsigned tag;
+  double value;
+
+  while ((n = read(master, buf + len, sizeof(buf) - 1 - len)) > 0) {
+    len += n;
+    buf[len] = '\0';
+    while ((nl = strchr(buf, '\n')) != NULL) {
+      *nl = '\0';
+      ++nreq;
+      if (silent || (drop && nreq % drop == 0))
+	n = 0;
+      else if (sscanf(buf, "%u %lf", &tag, &value) == 2)
+	n = snprintf(reply, sizeof(reply), "%u %g\n", tag, value + 1);
+      else
+	n = snprintf(reply, sizeof(reply), "%g\n", atof(buf) + 1);
+      if (n > 0 && write(master, reply, n) < 0) return NULL;
+      len -= nl + 1 - buf;
+      memmove(buf, nl + 1, len + 1);
+    }
+  }
+  return NULL;
+}
+
+/* Configure a sertest device on the given port with the given flags */
+static int configure(char *port, char *flags)
+{
+  char file[32] = "/tmp/sertstXXXXXX", config[128];
+  int fd, status;
+
+  if ((fd = mkstemp(file)) < 0) { perror("sertst"); exit(1); }
+  snprintf(config, sizeof(config), "device: sertest 3 %s %s;\n",
+	   port, flags);
+  write(fd, config, strlen(config));
+  close(fd);
+
+  status = chn_config(file);
+  unlink(file);
+  if (status < 0 || chn_ndev != 1) {
+    fprintf(stderr, "sertst: configuration failed (%s)\n", flags);
+    exit(1);
+  }
+  return 0;
+}
+
+/* Run the "servo" for a while and return the number of replies */
+static double run(double duration)
+{
+  double start = ser_time();
+
+  while (ser_time() - start < duration) {
+    chn_data(0) = 10;
+    chn_write();
+    chn_read();
+    usleep(1000);
+  }
+  return chn_data(2);
+}
+
+/* Number of threads in this process */
+static int count_threads(void)
+{
+  DIR *dir = opendir("/proc/self/task");
+  struct dirent *de;
+  int n = 0;
+
+  if (dir == NULL) return -1;
+  while ((de = readdir(dir)) != NULL) if (de->d_name[0] != '.') ++n;
+  closedir(dir);
+  return n;
+}
+
+int main(int argc, char **argv)
+{
+  struct termios term;
+  pthread_t thread;
+  double count;
+  int nthread;
+
+  /* Set up the pseudo terminal and the device thread */
+  if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+      grantpt(master) < 0 || unlockpt(master) < 0) {
+    perror("sertst");
+    exit(1);
+  }
+  tcgetattr(master, &term);
+  cfmakeraw(&term);
+  tcsetattr(master, TCSANOW, &term);
+
+  /* Hold the slave open so that the master doesn't see a hangup (EIO)
+     while the device is being reconfigured */
+  if (open(ptsname(master), O_RDWR | O_NOCTTY) < 0) {
+    perror("sertst");
+    exit(1);
+  }
+  pthread_create(&thread, NULL, device, NULL);
+  chn_cache_enable = 0;
+  nthread = count_threads();
+
+  /* One request at a time */
+  configure(ptsname(master), "-baud=115200 -parity=e");
+  count = run(0.5);
+  printf("sertst: %g replies in 0.5 sec, last value %g\n", count, chn_data(1));
+  check(count >= 100, "too few replies");
+  check(chn_data(1) >= 11 && chn_data(1) < 12, "wrong value");
+  check(!chn_stale(1), "data stale");
+  chn_close();
+
+  /* Tagged, pipelined requests with some lost */
+  drop = 50;
+  configure(ptsname(master), "-tagged -window=8 -timeout=20000 -retries=1");
+  count = run(0.5);
+  printf("sertst: %g tagged replies in 0.5 sec, last value %g\n", count,
+	 chn_data(1));
+  check(count >= 100, "too few tagged replies");
+  check(chn_data(1) >= 11 && chn_data(1) < 12, "wrong tagged value");
+  check(!chn_stale(1), "tagged data stale");
+
+  /* Device stops answering, then comes back */
+  silent = 1;
+  run(0.2);
+  check(chn_stale(1) && chn_stale(2), "data not marked stale");
+  silent = 0;
+  run(0.2);
+  check(!chn_stale(1), "data still stale");
+  chn_close();
+
+  /* Requests are written to /dev/zero and never answered */
+  configure("/dev/zero", "");
+  run(0.1);
+  check(chn_data(2) == 0, "error on /dev/zero");
+  check(chn_stale(1), "reply from /dev/zero");
+  chn_close();
+  check(count_threads() == nthread, "I/O thread still running");
+
+  return status;
+}
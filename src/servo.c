@@ -49,6 +49,9 @@
 #include <unistd.h>
 #include <pthread.h>
 #include "servo.h"
+#include "display.h"
+#include "profile.h"
+#include "matrix.h"
 #include <stdio.h>
 #include <sys/time.h>
 
@@ -56,6 +59,7 @@ static pthread_t servo_thread;	        /* servo thread */
 static void *isr_handler(void *arg);	/* servo routine */
 static void (*isr_userisr)()  = NULL;	/* user servo function */
 int servo_freq = -1;		        /* servo frequency */
+MAT_ARENA *servo_arena = NULL;		/* matrix workspace (matarena.c) */
 int isr_count = 0;                      /* counter */
 unsigned long servo_period;	        /* servo period time in 10^-6 sec */
 struct timeval tv;                      /* for calls of gettimeofday */
@@ -79,6 +83,8 @@ int servo_setup(void (*routine)(), int freq, int flags)
   time1 = (unsigned long long)tv.tv_usec + 1000000ULL * tv.tv_sec;
 
   if (isr_userisr != NULL){
+    /* display writes to mailbox entries are now applied by the servo */
+    dd_mbox_enable = 1;
     pthread_create(&servo_thread, NULL, isr_handler, (void *) NULL);
   }
 
@@ -108,7 +114,17 @@ void servo_disable()
 
 static void *isr_handler(void *arg)
 {
+#ifndef SPARROW_NOPROFILE
+  uint64_t t_last = 0;			/* start of last cycle (profiler) */
+#endif
+
+  prof_trace_thread("servo");
   while (1) {
+    PROF_BEGIN(t_cycle);
+#ifndef SPARROW_NOPROFILE
+    if (t_cycle && t_last) prof_record(PROF_PERIOD, t_last);
+    t_last = t_cycle;
+#endif
 	  
     temp_time1 = ((double)time1)/1000000.0;
 
@@ -125,8 +141,25 @@ static void *isr_handler(void *arg)
     fprintf(stderr,"%1.10f, %d",temp_time2/n,n);
 #endif
     
+    // apply values entered on the display (see ddmbox.c)
+    {
+      PROF_BEGIN(t_mbox);
+      dd_mbox_apply(DD_MBOX_BUDGET);
+      PROF_END(PROF_MBOX, t_mbox);
+    }
+
+    // matrix workspace, emptied every cycle
+    if (servo_arena != NULL) {
+      mat_arena_use(servo_arena);
+      mat_arena_reset(servo_arena);
+    }
+
     // servo function
-    (*isr_userisr)();
+    {
+      PROF_BEGIN(t_user);
+      (*isr_userisr)();
+      PROF_END(PROF_USER, t_user);
+    }
     
     isr_count++;
 
@@ -136,6 +169,7 @@ static void *isr_handler(void *arg)
 
     // for measuring purposes, this variable can be displayed by the dd
     time_it_took = ((double)(time2 - time1))/1000000.0;
+    PROF_END(PROF_CYCLE, t_cycle);
     
     if((servo_period)>((time2 - time1) + SERVO_OVERHEAD)){
       usleep(servo_period - (time2 - time1) - SERVO_OVERHEAD);
@@ -53,6 +53,7 @@
 extern int servo_running, servo_overflow; 	/* flags */
 extern int servo_freq;				/* frequency */
 extern int isr_count;		/* counter, incremented by handler */
+extern struct mat_arena *servo_arena;	/* matrix workspace (matarena.c) */
 
 /* Function prototypes */
 int servo_setup(void (*)(), int, int);
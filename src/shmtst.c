@@ -0,0 +1,178 @@
+/*!
+ * \file shmtst.c
+ * \brief test the shared memory export of the channel table
+ *
+ * \date 19 Oct 26
+ *
+ * Exports the channel table and forks a client process.  The parent
+ * runs a "servo" loop that stores the loop count in one virtual
+ * channel and its negative in another; the client checks that every
+ * frame it reads is consistent and then writes a value into the
+ * first virtual channel, which the parent should see after its next
+ * chn_read().  Finally the parent leaves a frame half published and
+ * checks that chn_shm_read() gives up on it.
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include "channel.h"
+
+static char devfile[] = "/tmp/shmtstXXXXXX.dev";
+
+/* Client: read frames, then write a channel and wait for it to echo */
+static int client(char *name)
+{
+  CHN_SHM *sp;
+  double data[8];
+  uint64_t frame, last = 0;
+  int nframes = 0, ntorn = 0, chan, fcn, size;
+
+  if ((sp = chn_shm_attach(name, 1)) == NULL) return 1;
+  chan = chn_shm_device(sp, "virtual", &size);
+  fcn = chn_shm_device(sp, "function-gen", NULL);
+  if (chn_shm_nchan(sp) != 4 || chan != 0 || size != 3 || fcn != 3) {
+    fprintf(stderr, "shmtst: wrong channel table in client\n");
+    return 1;
+  }
+
+  while (nframes < 200) {
+    frame = chn_shm_read(sp, data, NULL, 4);
+    if (frame == last || frame == CHN_SHM_BUSY) continue;
+    if (data[1] != -data[2]) ++ntorn;
+    last = frame;
+    ++nframes;
+  }
+  if (ntorn) {
+    fprintf(stderr, "shmtst: %d inconsistent frames\n", ntorn);
+    return 1;
+  }
+
+  if (chn_shm_write(sp, fcn, 1.0) != -1) {
+    fprintf(stderr, "shmtst: write to function generator allowed\n");
+    return 1;
+  }
+  chn_shm_write(sp, 0, 42.0);
+  while (chn_shm_read(sp, data, NULL, 4) == CHN_SHM_BUSY || data[0] != 42.0);
+
+  printf("shmtst: %d frames read, write echoed\n", nframes);
+  chn_shm_detach(sp);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char name[32];
+  FILE *fp;
+  pid_t pid;
+  CHN_SHM *sp;
+  uint64_t *seq;
+  double data[4];
+  int i, fd, status, bad = 0, stale[4];
+
+  if ((fd = mkstemps(devfile, 4)) < 0 || close(fd) < 0) {
+    perror("shmtst");
+    return 1;
+  }
+  fp = fopen(devfile, "w");
+  fprintf(fp, "device: virtual 3 0x00;\n");
+  fprintf(fp, "device: function-gen 1 0x00;\n");
+  fclose(fp);
+
+  chn_cache_enable = 0;
+  if (chn_config(devfile) < 0 || chn_ndev != 2) {
+    fprintf(stderr, "shmtst: configuration failed\n");
+    return 1;
+  }
+  unlink(devfile);
+
+  snprintf(name, sizeof(name), "/shmtst.%d", (int) getpid());
+  if (chn_shm_export(name) < 0) return 1;
+
+  if ((pid = fork()) == 0) exit(client(name));
+
+  /* Servo loop; give up after 10 seconds */
+  for (i = 0; i < 100000; ++i) {
+    chn_read();
+    chn_data(1) = i;
+    chn_data(2) = -i;
+    chn_write();
+    if (waitpid(pid, &status, WNOHANG) == pid) break;
+    usleep(100);
+  }
+  if (i == 100000) {
+    fprintf(stderr, "shmtst: client timed out\n");
+    kill(pid, SIGKILL);
+    status = 1;
+  }
+
+  /* A frame that is never finished (the servo died while publishing):
+     the sequence number follows magic, version, ndev and nchan */
+  if ((sp = chn_shm_attach(name, 0)) == NULL ||
+      (fd = shm_open(name, O_RDWR, 0)) < 0 ||
+      (seq = (uint64_t *) mmap(NULL, 32, PROT_READ | PROT_WRITE, MAP_SHARED,
+			       fd, 0)) == MAP_FAILED) {
+    perror("shmtst");
+    return 1;
+  }
+  close(fd);
+  ++seq[2];
+  if (chn_shm_read(sp, data, stale, 4) != CHN_SHM_BUSY ||
+      !stale[0] || !stale[3]) {
+    fprintf(stderr, "shmtst: read of an unfinished frame didn't fail\n");
+    bad = 1;
+  }
+  ++seq[2];
+  if (chn_shm_read(sp, data, stale, 4) == CHN_SHM_BUSY || stale[0]) {
+    fprintf(stderr, "shmtst: read failed after the frame was finished\n");
+    bad = 1;
+  }
+  munmap(seq, 32);
+  chn_shm_detach(sp);
+  chn_shm_unexport();
+  chn_close();
+
+  if (chn_data(0) != 42.0) {
+    fprintf(stderr, "shmtst: client write not seen\n");
+    return 1;
+  }
+  return bad || !WIFEXITED(status) ? 1 : WEXITSTATUS(status);
+}
@@ -0,0 +1,330 @@
+/*!
+ * \file ssblock.c
+ * \brief discrete-time state-space controller blocks
+ *
+ * \date 19 Oct 26
+ *
+ * A state-space block implements the discrete-time system
+ *
+ *   x[k+1] = A x[k] + B u[k]
+ *   y[k]   = C x[k] + D u[k]
+ *
+ * with the matrices read from a MATLAB file.  The inputs u are taken
+ * from channels and the outputs y are written to channels: blocks
+ * that have been started with ss_start() are updated at the end of
+ * every chn_read(), after the channel filters, so the outputs are
+ * ready for the servo routine and for chn_write().
+ *
+ * All of the memory for a block is allocated in one piece when it is
+ * created.  The matrices are stored as the single matrix [A B; C D]
+ * and the state and inputs as z = [x; u], so each update is one
+ * matrix-vector product that streams through the matrix once, using
+ * the vectorized column kernel from matmult.c.
+ *
+ * Blocks are usually started and stopped from the display thread
+ * while the servo thread is running them.  The list of running blocks
+ * is only changed with atomic stores, so ss_run() always sees a whole
+ * list, and ss_stop() waits for an update that is in progress to
+ * finish before it returns, so a stopped block can be freed at once.
+ *
+ * \ingroup servo
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "channel.h"
+#include "hook.h"
+#include "ssblock.h"
+#include "matkern.h"
+
+extern HOOK_LIST *chn_read_hooks;
+static SS_BLOCK *ss_list = NULL;	/* running blocks */
+static int ss_hooked = 0;		/* ss_run() is on chn_read_hooks */
+static unsigned long ss_runs = 0;	/* odd while ss_run() is going */
+static __thread int ss_in_run = 0;	/* this thread is in ss_run() */
+
+/* Look up a matrix and check its size (0 = any) */
+static MATRIX *ss_find(MATRIX *list, char *name, int nrows, int ncols)
+{
+  MATRIX *mp;
+
+  if (name == NULL) return NULL;
+  if ((mp = mat_find(list, name)) == NULL) {
+    fprintf(stderr, "ss_create: can't find matrix %s\n", name);
+    return NULL;
+  }
+  if ((nrows && mp->nrows != nrows) || (ncols && mp->ncols != ncols)) {
+    fprintf(stderr, "ss_create: %s is %d x %d, should be %d x %d\n",
+	    name, mp->nrows, mp->ncols, nrows ? nrows : mp->nrows,
+	    ncols ? ncols : mp->ncols);
+    return NULL;
+  }
+  return mp;
+}
+
+/* Copy a matrix into [A B; C D] at (row, col) */
+static void ss_place(SS_BLOCK *sp, MATRIX *mp, int row, int col)
+{
+  int j, ld = sp->n + sp->p;
+
+  for (j = 0; j < mp->ncols; j++)
+    memcpy(sp->M + row + (col + j) * ld, mp->real + j * mp->nrows,
+	   mp->nrows * sizeof(double));
+}
+
+/*!
+ * \fn SS_BLOCK *ss_create(MATRIX *list, char *a, char *b, char *c,
+ *			  char *d, char *x0)
+ * \brief create a block from the named matrices in a list
+ * \ingroup servo
+ *
+ * a, b and c are required; d and x0 may be NULL, in which case they
+ * are zero.  The block starts with x = x0 and its channels unbound.
+ * Returns NULL if a matrix is missing or has the wrong size.
+ */
+SS_BLOCK *ss_create(MATRIX *list, char *a, char *b, char *c, char *d,
+		    char *x0)
+{
+  MATRIX *A, *B, *C, *D = NULL, *X0 = NULL;
+  SS_BLOCK *sp;
+  size_t size;
+  int n, m, p, i;
+  char *mem;
+
+  if ((A = ss_find(list, a, 0, 0)) == NULL) return NULL;
+  n = A->nrows;
+  if (A->ncols != n) {
+    fprintf(stderr, "ss_create: %s is not square\n", a);
+    return NULL;
+  }
+  if ((B = ss_find(list, b, n, 0)) == NULL) return NULL;
+  if ((C = ss_find(list, c, 0, n)) == NULL) return NULL;
+  m = B->ncols;
+  p = C->nrows;
+  if ((d != NULL && (D = ss_find(list, d, p, m)) == NULL) ||
+      (x0 != NULL && (X0 = ss_find(list, x0, n, 1)) == NULL))
+    return NULL;
+
+  /* One allocation for everything; the matrix first, for alignment */
+  size = ((n + p) * (n + m) + (n + m) + (n + p) + n) * sizeof(double) +
+    (m + p) * sizeof(int) + sizeof(SS_BLOCK);
+  if (posix_memalign((void **) &mem, 64, size) != 0) {
+    fprintf(stderr, "ss_create: out of memory\n");
+    return NULL;
+  }
+  memset(mem, 0, size);
+  sp = (SS_BLOCK *) (mem + size - sizeof(SS_BLOCK));
+  sp->n = n;
+  sp->m = m;
+  sp->p = p;
+  sp->M = (double *) mem;
+  sp->z = sp->M + (n + p) * (n + m);
+  sp->w = sp->z + (n + m);
+  sp->x0 = sp->w + (n + p);
+  sp->in = (int *) (sp->x0 + n);
+  sp->out = sp->in + m;
+
+  ss_place(sp, A, 0, 0);
+  ss_place(sp, B, 0, n);
+  ss_place(sp, C, n, 0);
+  if (D != NULL) ss_place(sp, D, n, n);
+  if (X0 != NULL) memcpy(sp->x0, X0->real, n * sizeof(double));
+  for (i = 0; i < m; i++) sp->in[i] = -1;
+  for (i = 0; i < p; i++) sp->out[i] = -1;
+  ss_reset(sp);
+  return sp;
+}
+
+/*!
+ * \fn SS_BLOCK *ss_load(char *file)
+ * \brief create a block from the matrices A, B, C, D and x0 in a file
+ * \ingroup servo
+ *
+ * D and x0 are optional.
+ */
+SS_BLOCK *ss_load(char *file)
+{
+  MATRIX *list;
+  SS_BLOCK *sp;
+
+  if ((list = mat_load(file)) == NULL) {
+    fprintf(stderr, "ss_load: can't load %s\n", file);
+    return NULL;
+  }
+  sp = ss_create(list, "A", "B", "C",
+		 mat_find(list, "D") != NULL ? "D" : NULL,
+		 mat_find(list, "x0") != NULL ? "x0" : NULL);
+  mat_list_free(list);
+  return sp;
+}
+
+/*! Stop a block if it is running and free it */
+void ss_free(SS_BLOCK *sp)
+{
+  if (sp == NULL) return;
+  ss_stop(sp);
+  free(sp->M);				/* start of the allocation */
+}
+
+/*!
+ * \fn int ss_bind(SS_BLOCK *sp, int *in, int *out)
+ * \brief set the input and output channels
+ * \ingroup servo
+ *
+ * in has m entries and out has p entries; -1 leaves an input at zero
+ * or an output unused.  Either list can be NULL to leave it unchanged.
+ */
+int ss_bind(SS_BLOCK *sp, int *in, int *out)
+{
+  int i;
+
+  if (sp == NULL) return -1;
+  for (i = 0; in != NULL && i < sp->m; i++)
+    if (in[i] < -1 || in[i] >= CHN_MAXCHN) return -1;
+  for (i = 0; out != NULL && i < sp->p; i++)
+    if (out[i] < -1 || out[i] >= CHN_MAXCHN) return -1;
+  if (in != NULL) memcpy(sp->in, in, sp->m * sizeof(int));
+  if (out != NULL) memcpy(sp->out, out, sp->p * sizeof(int));
+  return 0;
+}
+
+/*! Set the state back to x0 */
+void ss_reset(SS_BLOCK *sp)
+{
+  memcpy(sp->z, sp->x0, sp->n * sizeof(double));
+}
+
+/*!
+ * \fn void ss_step(SS_BLOCK *sp, double *u, double *y)
+ * \brief update the block once with inputs u, storing outputs in y
+ * \ingroup servo
+ *
+ * u and y can be NULL if the inputs are already in sp->z + n or the
+ * outputs aren't needed (they are left in sp->w + n).
+ */
+void ss_step(SS_BLOCK *sp, double *u, double *y)
+{
+  int n = sp->n, ld = sp->n + sp->p;
+
+  if (u != NULL) memcpy(sp->z + n, u, sp->m * sizeof(double));
+  memset(sp->w, 0, ld * sizeof(double));
+  mat_tile_edge(ld, 1, n + sp->m, 1.0, sp->M, ld, sp->z, n + sp->m,
+		sp->w, ld);
+  memcpy(sp->z, sp->w, n * sizeof(double));
+  if (y != NULL) memcpy(y, sp->w + n, sp->p * sizeof(double));
+}
+
+/* Update the running blocks from their channels (chn_read hook) */
+static int ss_run(void)
+{
+  SS_BLOCK *sp;
+  double *u, *y;
+  int i;
+
+  __atomic_add_fetch(&ss_runs, 1, __ATOMIC_SEQ_CST);
+  ss_in_run = 1;
+  for (sp = __atomic_load_n(&ss_list, __ATOMIC_ACQUIRE); sp != NULL;
+       sp = __atomic_load_n(&sp->next, __ATOMIC_ACQUIRE)) {
+    u = sp->z + sp->n;
+    for (i = 0; i < sp->m; i++)
+      u[i] = sp->in[i] >= 0 ? chn_data(sp->in[i]) : 0;
+    ss_step(sp, NULL, NULL);
+    y = sp->w + sp->n;
+    for (i = 0; i < sp->p; i++)
+      if (sp->out[i] >= 0) chn_data(sp->out[i]) = y[i];
+  }
+  ss_in_run = 0;
+  __atomic_add_fetch(&ss_runs, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*!
+ * \fn int ss_start(SS_BLOCK *sp)
+ * \brief update the block at the end of every chn_read()
+ * \ingroup servo
+ */
+int ss_start(SS_BLOCK *sp)
+{
+  SS_BLOCK **spp;
+  int nhooks;
+
+  if (sp == NULL || sp->running) return -1;
+  if (!ss_hooked) {
+    /* Left in place by ss_stop(): the servo may be running the hooks */
+    nhooks = chn_read_hooks->nhooks;
+    if (hook_add(chn_read_hooks, ss_run) <= nhooks) {
+      fprintf(stderr, "ss_start: no room on the chn_read hook list\n");
+      return -1;
+    }
+    ss_hooked = 1;
+  }
+
+  /* Append, so blocks run in the order they were started */
+  for (spp = &ss_list; *spp != NULL; spp = &(*spp)->next);
+  sp->next = NULL;
+  sp->running = 1;
+  __atomic_store_n(spp, sp, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/*!
+ * \fn int ss_stop(SS_BLOCK *sp)
+ * \brief stop updating a block
+ * \ingroup servo
+ *
+ * If another thread is in the middle of updating the blocks, waits
+ * for it to finish, so the block is no longer in use on return.
+ */
+int ss_stop(SS_BLOCK *sp)
+{
+  SS_BLOCK **spp;
+  unsigned long runs;
+
+  if (sp == NULL || !sp->running) return -1;
+  for (spp = &ss_list; *spp != sp; spp = &(*spp)->next);
+  __atomic_store_n(spp, sp->next, __ATOMIC_SEQ_CST);
+  sp->running = 0;
+
+  /* An update that started before the unlink may still have sp */
+  runs = __atomic_load_n(&ss_runs, __ATOMIC_SEQ_CST);
+  if ((runs & 1) && !ss_in_run)
+    while (__atomic_load_n(&ss_runs, __ATOMIC_ACQUIRE) == runs)
+      sched_yield();
+  return 0;
+}
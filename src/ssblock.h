@@ -0,0 +1,82 @@
+/*!
+ * \file ssblock.h
+ * \brief discrete-time state-space controller blocks
+ *
+ * \date 19 Oct 26
+ *
+ * \ingroup servo
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#ifndef __SSBLOCK_INCLUDED__
+#define __SSBLOCK_INCLUDED__
+
+#include "matrix.h"
+
+/*!
+ * \struct ss_block
+ * \brief state-space system x+ = A x + B u, y = C x + D u
+ *
+ * The matrices are stored together as [A B; C D] (column-major) and
+ * the state and input together as z = [x; u], so that one update is
+ * a single matrix-vector product.
+ */
+struct ss_block {
+  int n, m, p;				/* states, inputs, outputs */
+  double *M;				/* [A B; C D], (n+p) x (n+m) */
+  double *z;				/* [x; u] */
+  double *w;				/* [x+; y] */
+  double *x0;				/* initial state */
+  int *in, *out;			/* input and output channels */
+  int running;				/* updated by chn_read */
+  struct ss_block *next;
+};
+typedef struct ss_block SS_BLOCK;
+
+SS_BLOCK *ss_create(MATRIX *list, char *a, char *b, char *c, char *d,
+		    char *x0);
+SS_BLOCK *ss_load(char *file);
+void ss_free(SS_BLOCK *sp);
+int ss_bind(SS_BLOCK *sp, int *in, int *out);
+int ss_start(SS_BLOCK *sp);
+int ss_stop(SS_BLOCK *sp);
+void ss_reset(SS_BLOCK *sp);
+void ss_step(SS_BLOCK *sp, double *u, double *y);
+
+/* Current state */
+#define ss_state(sp)	((sp)->z)
+
+#endif /* __SSBLOCK_INCLUDED__ */
@@ -0,0 +1,185 @@
+/*!
+ * \file sstst.c
+ * \brief test state-space blocks
+ *
+ * \date 19 Oct 26
+ *
+ * Writes a MATLAB file with a 3 state, 2 input, 1 output system,
+ * loads it with ss_load(), runs it from chn_read() on virtual
+ * channels and compares the outputs with the same system simulated
+ * with mat_statespace().  Also checks that a matrix of the wrong size
+ * is rejected and that a stopped block is no longer updated, including
+ * when it is stopped while another thread is running the blocks, and
+ * that ss_start() fails if the chn_read hook list is full.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include "channel.h"
+#include "ssblock.h"
+#include "hook.h"
+
+#define TST_NAME "sstst"
+#include "tstutil.h"
+
+extern HOOK_LIST *chn_read_hooks;
+
+static char devfile[] = "/tmp/sststXXXXXX.dev";
+static char matfile[] = "/tmp/sststXXXXXX.mat";
+static volatile int running;
+
+/* Append a matrix (given row by row) to a MATLAB v4 file */
+static void write_matrix(FILE *fp, char *name, int m, int n, double *rows)
+{
+  int32_t hdr[5] = {0, 0, 0, 0, 0};
+  int i, j;
+
+  hdr[1] = m;
+  hdr[2] = n;
+  hdr[4] = strlen(name) + 1;
+  fwrite(hdr, sizeof(hdr), 1, fp);
+  fwrite(name, hdr[4], 1, fp);
+  for (j = 0; j < n; ++j)
+    for (i = 0; i < m; ++i) fwrite(rows + i * n + j, sizeof(double), 1, fp);
+}
+
+static MATRIX *matrix(int m, int n, double *rows)
+{
+  MATRIX *a = mat_init(m, n);
+  int i, j;
+
+  for (i = 0; i < m; ++i)
+    for (j = 0; j < n; ++j) mat_element_set(a, i, j, rows[i * n + j]);
+  return a;
+}
+
+static int nop(void) { return 0; }
+
+/* Servo: read the channels as fast as possible */
+static void *servo(void *arg)
+{
+  long k = 0;
+
+  while (running) {
+    chn_data(0) = ++k % 7;
+    chn_read();
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  static double A[] = {0.9, 0.1, 0, -0.1, 0.8, 0.2, 0, 0, 0.5};
+  static double B[] = {1, 0, 0, 1, 0.5, 0.5};
+  static double C[] = {1, -1, 2};
+  static double D[] = {0.1, 0};
+  static double x0[] = {1, 2, 3};
+  static int in[] = {0, 1}, out[] = {2};
+  MATRIX *Am = matrix(3, 3, A), *Bm = matrix(3, 2, B), *Cm = matrix(1, 3, C);
+  MATRIX *Dm = matrix(1, 2, D), *x = matrix(3, 1, x0), *u = mat_init(2, 1);
+  MATRIX *y = mat_create();
+  SS_BLOCK *sp;
+  pthread_t thread;
+  FILE *fp;
+  double last, state[3];
+  int k, bad;
+
+  tst_tmpfile(devfile, 4);
+  tst_tmpfile(matfile, 4);
+
+  fp = fopen(matfile, "wb");
+  write_matrix(fp, "A", 3, 3, A);
+  write_matrix(fp, "B", 3, 2, B);
+  write_matrix(fp, "C", 1, 3, C);
+  write_matrix(fp, "D", 1, 2, D);
+  write_matrix(fp, "x0", 3, 1, x0);
+  write_matrix(fp, "Dbad", 2, 2, A);
+  fclose(fp);
+
+  fp = fopen(devfile, "w");
+  fprintf(fp, "device: virtual 4 0x00;\n");
+  fclose(fp);
+  chn_cache_enable = 0;
+  if (chn_config(devfile) < 0) {
+    fprintf(stderr, "sstst: configuration failed\n");
+    return 1;
+  }
+  unlink(devfile);
+
+  if ((sp = ss_load(matfile)) == NULL) {
+    fprintf(stderr, "sstst: ss_load failed\n");
+    return 1;
+  }
+  check(sp->n == 3 && sp->m == 2 && sp->p == 1, "block size");
+  check(ss_bind(sp, in, out) == 0, "ss_bind failed");
+
+  /* No room for the update on the chn_read hook list */
+  while (hook_add(chn_read_hooks, nop) < chn_read_hooks->length);
+  fprintf(stderr, "sstst: expect 1 error message:\n");
+  check(ss_start(sp) < 0 && !sp->running, "ss_start with a full hook list");
+  hook_remove(chn_read_hooks, nop);
+  check(ss_start(sp) == 0, "ss_start failed");
+
+  for (k = 0; k < 50; ++k) {
+    chn_data(0) = sin(0.3 * k);
+    chn_data(1) = k % 3;
+    mat_element_set(u, 0, 0, chn_data(0));
+    mat_element_set(u, 1, 0, chn_data(1));
+    chn_read();
+
+    mat_statespace(y, Cm, x, Dm, u);
+    mat_statespace(x, Am, x, Bm, u);
+    if (fabs(chn_data(2) - mat_element_get(y, 0, 0)) > 1e-12) {
+      fprintf(stderr, "sstst: step %d: output %g, expected %g\n", k,
+	      chn_data(2), mat_element_get(y, 0, 0));
+      status = 1;
+      break;
+    }
+  }
+  check(fabs(ss_state(sp)[2] - mat_element_get(x, 2, 0)) < 1e-12, "state");
+
+  /* Stopped blocks aren't updated; reset goes back to x0 */
+  check(ss_stop(sp) == 0, "ss_stop failed");
+  last = chn_data(2);
+  chn_data(0) = 100;
+  chn_read();
+  check(chn_data(2) == last, "stopped block was updated");
+  ss_reset(sp);
+  check(ss_state(sp)[0] == 1 && ss_state(sp)[2] == 3, "ss_reset");
+
+  /* Stopped while another thread is running it: no update afterwards */
+  running = 1;
+  pthread_create(&thread, NULL, servo, NULL);
+  for (k = 0, bad = 0; k < 2000; ++k) {
+    ss_start(sp);
+    usleep(k % 50);
+    ss_stop(sp);
+    memcpy(state, ss_state(sp), sizeof(state));
+    usleep(20);
+    if (memcmp(state, ss_state(sp), sizeof(state)) != 0) ++bad;
+  }
+  running = 0;
+  pthread_join(thread, NULL);
+  check(bad == 0, "block updated after ss_stop returned");
+  ss_free(sp);
+
+  /* D of the wrong size */
+  fprintf(stderr, "sstst: expect an error message:\n");
+  {
+    MATRIX *list = mat_load(matfile);
+    check(ss_create(list, "A", "B", "C", "Dbad", NULL) == NULL,
+	  "wrong size not detected");
+    mat_list_free(list);
+  }
+  unlink(matfile);
+  chn_close();
+
+  return status;
+}
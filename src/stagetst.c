@@ -0,0 +1,118 @@
+/*!
+ * \file stagetst.c
+ * \brief test channel processing stages
+ *
+ * \date 19 Oct 26
+ *
+ * Puts clamp, deadband, rate limit and derivative stages on virtual
+ * channels, in chn_read() and in chn_write(), and compares the
+ * channel data over a run of inputs with the same stages computed
+ * directly.  The configuration is checked both as parsed and as
+ * replayed from the cache.  Also checks that bad stage flags are
+ * rejected.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "channel.h"
+
+#define TST_NAME "stagetst"
+#include "tstutil.h"
+
+static char devfile[] = "/tmp/stagetstXXXXXX.dev";
+static char cachefile[sizeof(devfile) + 6];
+
+static double clamp(double x, double lo, double hi)
+{
+  return x < lo ? lo : x > hi ? hi : x;
+}
+
+static double deadband(double x, double lo, double hi)
+{
+  return x < lo ? x - lo : x > hi ? x - hi : 0;
+}
+
+/* Run the channels and compare with the stages computed directly */
+static void check_channels(char *when)
+{
+  double rate = 0, last = 0, in, ref[8];
+  int k, i, bad = 0;
+
+  for (k = 0; k < 60; ++k) {
+    in = 3 * sin(0.2 * k) + (k % 7 == 0 ? 1 : 0);
+    for (i = 0; i < 8; ++i) chn_data(i) = in + i * 0.1;
+
+    ref[0] = clamp(chn_data(0), -1, 1);
+    ref[1] = clamp(deadband(chn_data(1), -0.5, 0.5), -2, 2);
+    ref[2] = clamp(chn_data(2), -3, 0.5);
+    ref[3] = chn_data(3);
+    if (k == 0) rate = chn_data(3);
+    rate += clamp(chn_data(3) - rate, -0.1, 0.2);
+    ref[5] = rate;
+    ref[4] = chn_data(4);
+    ref[6] = k == 0 ? 0 : 100 * (chn_data(4) - last);
+    last = chn_data(4);
+
+    chn_read();
+    for (i = 0; i < 7; ++i)
+      if (fabs(chn_data(i) - ref[i]) > 1e-12) ++bad;
+    if (chn_data(7) != in + 7 * 0.1) ++bad;	/* not until chn_write */
+
+    chn_data(7) = 2 * in;
+    chn_write();
+    if (chn_data(7) != clamp(2 * in, 0, 1)) ++bad;
+  }
+  if (bad) {
+    fprintf(stderr, "stagetst: channels (%s): %d values wrong\n", when, bad);
+    status = 1;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  CHANNEL *cp = chn_chantbl + CHN_MAXCHN - 1;
+  FILE *fp;
+
+  tst_tmpfile(devfile, 4);
+  sprintf(cachefile, "%s.cache", devfile);
+  fp = fopen(devfile, "w");
+  fprintf(fp, "device: virtual 8 0x00;\n");
+  fprintf(fp, "channel: 0 -clamp=-1:1;\n");
+  fprintf(fp, "channel: 1 -deadband=0.5 -clamp=-2:2;\n");
+  fprintf(fp, "channel: 2 -clamp=-3:0.5;\n");
+  fprintf(fp, "channel: 3 -ratelimit=0.1:0.2 -stageout=5;\n");
+  fprintf(fp, "channel: 4 -deriv=100 -stageout=6;\n");
+  fprintf(fp, "channel: 7 -clamp=0:1 -onwrite;\n");
+  fclose(fp);
+  unlink(cachefile);
+
+  chn_cache_enable = 0;
+  check(chn_config(devfile) >= 0, "configuration failed");
+  check_channels("parsed");
+
+  chn_cache_enable = 1;
+  check(chn_config(devfile) >= 0, "configuration failed (writing cache)");
+  check(access(cachefile, R_OK) == 0, "cache not written");
+  check(chn_config(devfile) >= 0, "configuration failed (from cache)");
+  check_channels("cached");
+
+  /* Bad flags */
+  fprintf(stderr, "stagetst: expect 5 error messages:\n");
+  check(chn_stage_add(cp, "clamp", "1") < 0, "clamp with one value");
+  check(chn_stage_add(cp, "clamp", "2:1") < 0, "empty clamp");
+  check(chn_stage_add(cp, "deadband", "-1") < 0, "negative deadband");
+  check(chn_stage_add(cp, "ratelimit", "") < 0, "rate limit without rate");
+  check(chn_stage_add(cp, "stageout", "x") < 0, "bad output channel");
+  chn_stage_clear(CHN_MAXCHN - 1);
+
+  unlink(cachefile);
+  unlink(devfile);
+  chn_close();
+
+  return status;
+}
@@ -0,0 +1,287 @@
+/*!
+ * \file trace.c
+ * \brief timeline trace of servo, driver, display and serial activity
+ *
+ * \date 19 Oct 26
+ *
+ * While tracing is on, every profiler stage (see profile.c) that ends
+ * is also logged as an event with its start time and duration.  Each
+ * thread logs to its own ring buffer, which is created the first time
+ * the thread logs something, so logging never takes a lock.  A
+ * background thread empties the buffers every 100 ms and writes the
+ * events to a file in the Chrome trace event format, which can be
+ * loaded into chrome://tracing or the Perfetto UI
+ * (https://ui.perfetto.dev).  Events are dropped (and counted) if a
+ * buffer fills up between flushes.
+ *
+ * Threads can be given a name for the trace with prof_trace_thread().
+ *
+ * \ingroup servo
+ *
+ * Copyright (c) 2008 by California Institute of Technology
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the California Institute of Technology nor
+ *    the names of its contributors may be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL CALTECH
+ * OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "profile.h"
+#include "display.h"
+
+#define TRC_SIZE 8192			/* events per thread (power of 2) */
+#define TRC_NAMELEN 32
+
+struct trc_event {
+  uint64_t start;			/* start time (ns) */
+  uint32_t dur;				/* duration (ns) */
+  uint32_t id;				/* profiler stage */
+};
+
+struct trc_buffer {
+  struct trc_event ev[TRC_SIZE];
+  unsigned long head;			/* next event to write (thread) */
+  unsigned long tail;			/* next event to flush */
+  unsigned long dropped;		/* events lost to a full buffer */
+  int tid;				/* thread number in the trace */
+  char name[TRC_NAMELEN];
+  int named;				/* name written to the file */
+  struct trc_buffer *link;
+};
+
+int prof_tracing = 0;			/* log events */
+static struct trc_buffer *trc_list = NULL;
+static int trc_nthreads = 0;
+static pthread_mutex_t trc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trc_buffer *trc_buf = NULL;
+static __thread char *trc_thread_name = NULL;
+
+static FILE *trc_fp = NULL;
+static uint64_t trc_t0;			/* time at start of trace */
+static int trc_nevents;			/* events written to the file */
+static pthread_t trc_thread;
+static volatile int trc_running = 0;
+
+/*!
+ * \fn void prof_trace_thread(char *name)
+ * \brief set the name used for the calling thread in traces
+ * \ingroup servo
+ *
+ * The name should be a string constant; it is used when the thread
+ * first logs an event.
+ */
+void prof_trace_thread(char *name)
+{
+  trc_thread_name = name;
+  if (trc_buf != NULL) {
+    strncpy(trc_buf->name, name, TRC_NAMELEN - 1);
+    trc_buf->named = 0;
+  }
+}
+
+/* Create the buffer for this thread */
+static struct trc_buffer *trc_register(void)
+{
+  struct trc_buffer *bp;
+
+  if ((bp = calloc(1, sizeof(struct trc_buffer))) == NULL) return NULL;
+  pthread_mutex_lock(&trc_mutex);
+  bp->tid = ++trc_nthreads;
+  if (trc_thread_name != NULL)
+    strncpy(bp->name, trc_thread_name, TRC_NAMELEN - 1);
+  else
+    snprintf(bp->name, TRC_NAMELEN, "thread %d", bp->tid);
+  bp->link = trc_list;
+  trc_list = bp;
+  pthread_mutex_unlock(&trc_mutex);
+  return trc_buf = bp;
+}
+
+/*!
+ * \fn void prof_trace_event(int id, uint64_t start, uint64_t end)
+ * \brief log a stage for the calling thread (called by prof_record)
+ * \ingroup servo
+ */
+void prof_trace_event(int id, uint64_t start, uint64_t end)
+{
+  struct trc_buffer *bp = trc_buf;
+  struct trc_event *ep;
+  unsigned long head;
+
+  if (bp == NULL && (bp = trc_register()) == NULL) return;
+  head = bp->head;
+  if (head - __atomic_load_n(&bp->tail, __ATOMIC_ACQUIRE) >= TRC_SIZE) {
+    ++bp->dropped;
+    return;
+  }
+  ep = bp->ev + (head & (TRC_SIZE - 1));
+  ep->start = start;
+  ep->dur = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t) (end - start);
+  ep->id = id;
+  __atomic_store_n(&bp->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Write a string to the trace file, leaving out JSON special characters */
+static void trc_puts(char *s)
+{
+  for (; *s != '\0'; ++s)
+    if (*s != '"' && *s != '\\' && (unsigned char) *s >= ' ') putc(*s, trc_fp);
+}
+
+/* Write out everything that has been logged so far */
+static void trc_flush(void)
+{
+  struct trc_buffer *bp;
+  struct trc_event *ep;
+  unsigned long head, tail;
+
+  pthread_mutex_lock(&trc_mutex);
+  for (bp = trc_list; bp != NULL; bp = bp->link) {
+    head = __atomic_load_n(&bp->head, __ATOMIC_ACQUIRE);
+    tail = bp->tail;
+    if (!bp->named) {
+      fprintf(trc_fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+	      "\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",
+	      trc_nevents++ ? "," : "", bp->tid);
+      trc_puts(bp->name);
+      fprintf(trc_fp, "\"}}");
+      bp->named = 1;
+    }
+    for (; tail != head; ++tail) {
+      ep = bp->ev + (tail & (TRC_SIZE - 1));
+      if (ep->start < trc_t0) continue;	/* logged before the start */
+      fprintf(trc_fp, "%s\n{\"name\":\"", trc_nevents++ ? "," : "");
+      trc_puts(ep->id < PROF_MAXSTAGE ? prof_stages[ep->id].name : "?");
+      fprintf(trc_fp, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+	      "\"ts\":%.3f,\"dur\":%.3f}", bp->tid,
+	      (ep->start - trc_t0) * 1e-3, ep->dur * 1e-3);
+    }
+    __atomic_store_n(&bp->tail, tail, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&trc_mutex);
+}
+
+/* Background thread: flush the buffers ten times a second */
+static void *trc_writer(void *arg)
+{
+  while (trc_running) {
+    usleep(100000);
+    trc_flush();
+  }
+  return NULL;
+}
+
+/*!
+ * \fn int prof_trace_start(char *filename)
+ * \brief start logging events to a trace file
+ * \ingroup servo
+ *
+ * Returns 0 on success or -1 if the file can't be opened or a trace
+ * is already running.
+ */
+int prof_trace_start(char *filename)
+{
+  struct trc_buffer *bp;
+
+  if (trc_fp != NULL) {
+    fprintf(stderr, "prof_trace_start: trace already running\n");
+    return -1;
+  }
+  if ((trc_fp = fopen(filename, "w")) == NULL) {
+    fprintf(stderr, "prof_trace_start: can't open %s\n", filename);
+    return -1;
+  }
+  fprintf(trc_fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  /* Skip anything left over from an earlier trace */
+  pthread_mutex_lock(&trc_mutex);
+  for (bp = trc_list; bp != NULL; bp = bp->link) {
+    __atomic_store_n(&bp->tail, bp->head, __ATOMIC_RELEASE);
+    bp->named = 0;
+    bp->dropped = 0;
+  }
+  pthread_mutex_unlock(&trc_mutex);
+  trc_t0 = prof_clock();
+  trc_nevents = 0;
+
+  trc_running = 1;
+  if (pthread_create(&trc_thread, NULL, trc_writer, NULL) != 0) {
+    fprintf(stderr, "prof_trace_start: can't start writer thread\n");
+    fclose(trc_fp);
+    trc_fp = NULL;
+    return -1;
+  }
+  prof_tracing = 1;
+  return 0;
+}
+
+/*!
+ * \fn int prof_trace_stop(void)
+ * \brief stop logging and close the trace file
+ * \ingroup servo
+ *
+ * Returns the number of events that were dropped because a buffer was
+ * full, or -1 if no trace was running.
+ */
+int prof_trace_stop(void)
+{
+  struct trc_buffer *bp;
+  int dropped = 0;
+
+  if (trc_fp == NULL) return -1;
+  prof_tracing = 0;
+  trc_running = 0;
+  pthread_join(trc_thread, NULL);
+  trc_flush();
+
+  for (bp = trc_list; bp != NULL; bp = bp->link) dropped += bp->dropped;
+  fprintf(trc_fp, "\n]}\n");
+  fclose(trc_fp);
+  trc_fp = NULL;
+  return dropped;
+}
+
+/*! Start or stop a trace to trace.json (display callback) */
+int prof_trace_cb(long arg)
+{
+  if (!prof_tracing) {
+    if (prof_trace_start("trace.json") == 0)
+      DD_PROMPT("tracing to trace.json");
+  } else if (prof_trace_stop() > 0)
+    DD_PROMPT("trace.json written (some events dropped)");
+  else
+    DD_PROMPT("trace.json written");
+  return 0;
+}
@@ -0,0 +1,48 @@
+/*!
+ * \file tstutil.h
+ * \brief helpers shared by the check programs
+ *
+ * \date 19 Oct 26
+ *
+ * A check program defines TST_NAME (the name to put in front of its
+ * messages) before including this file, reports each condition with
+ * check() and returns status from main().  tst_tmpfile() creates a
+ * unique temporary file from a mkstemps() template.
+ *
+ * $Id$
+ */
+
+#ifndef __TSTUTIL_INCLUDED__
+#define __TSTUTIL_INCLUDED__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int status = 0;			/* exit status of the program */
+
+/* Report a condition that doesn't hold and note the failure */
+static void check(int ok, char *msg)
+{
+  if (!ok) {
+    fprintf(stderr, "%s: %s\n", TST_NAME, msg);
+    status = 1;
+  }
+}
+
+/*
+ * Create an empty file from a template that ends in XXXXXX followed by
+ * a suffix of suffixlen characters; the name is filled in.  Exits if
+ * the file can't be created.
+ */
+static inline void tst_tmpfile(char *file, int suffixlen)
+{
+  int fd;
+
+  if ((fd = mkstemps(file, suffixlen)) < 0 || close(fd) < 0) {
+    perror(TST_NAME);
+    exit(1);
+  }
+}
+
+#endif /* __TSTUTIL_INCLUDED__ */